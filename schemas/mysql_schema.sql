@@ -7,7 +7,8 @@ CREATE TABLE IF NOT EXISTS `buddies` (
   `groups` varchar(255) collate utf8_bin NOT NULL,
   `flags` smallint(4) NOT NULL DEFAULT '0',
   PRIMARY KEY (`id`),
-  UNIQUE KEY `user_id` (`user_id`,`uin`)
+  UNIQUE KEY `user_id` (`user_id`,`uin`),
+  KEY `user_id_id` (`user_id`,`id`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;
  
 CREATE TABLE IF NOT EXISTS `buddies_settings` (
@@ -16,8 +17,7 @@ CREATE TABLE IF NOT EXISTS `buddies_settings` (
   `var` varchar(50) collate utf8_bin NOT NULL,
   `type` smallint(4) unsigned NOT NULL,
   `value` varchar(255) collate utf8_bin NOT NULL,
-  PRIMARY KEY (`buddy_id`,`var`),
-  KEY `user_id` (`user_id`)
+  PRIMARY KEY (`user_id`,`buddy_id`,`var`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;
  
 CREATE TABLE IF NOT EXISTS `users` (
@@ -31,7 +31,16 @@ CREATE TABLE IF NOT EXISTS `users` (
   `vip` tinyint(1) NOT NULL  default '0',
   `online` tinyint(1) NOT NULL  default '0',
   PRIMARY KEY (`id`),
-  UNIQUE KEY `jid` (`jid`)
+  UNIQUE KEY `jid` (`jid`),
+  KEY `online_jid` (`online`,`jid`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;
+
+CREATE TABLE IF NOT EXISTS `users_servers` (
+  `user_id` int(10) unsigned NOT NULL,
+  `jid` varchar(255) collate utf8_bin NOT NULL,
+  `server` varchar(255) collate utf8_bin NOT NULL,
+  PRIMARY KEY (`user_id`),
+  KEY `jid` (`jid`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;
 
 CREATE TABLE IF NOT EXISTS `users_settings` (
@@ -48,5 +57,5 @@ CREATE TABLE IF NOT EXISTS `db_version` (
   UNIQUE KEY `ver` (`ver`)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;
 
-INSERT INTO db_version (ver) VALUES ('2');
+INSERT INTO db_version (ver) VALUES ('4');
 
@@ -4,6 +4,44 @@ is designed to ease access to it and abstract common behaviour.
 """
 
 
+class _response_parser:
+	"""
+	Incremental parser telling when a response read in chunks forms a
+	complete XML document. Every chunk is parsed only once.
+	"""
+	def __init__( self ):
+		from xml.parsers.expat import ParserCreate
+
+		self.complete = False
+		self.depth = 0
+		self.failed = False
+		self.parser = ParserCreate()
+		self.parser.StartElementHandler = self._start
+		self.parser.EndElementHandler = self._end
+
+	def _start( self, name, attrs ):
+		self.depth += 1
+
+	def _end( self, name ):
+		self.depth -= 1
+		if self.depth == 0:
+			self.complete = True
+
+	def feed( self, chunk ):
+		"""
+		Parse next chunk of the response. Malformed responses are never
+		complete, so they are read until the socket is closed.
+		"""
+		from xml.parsers.expat import ExpatError
+
+		if self.failed or self.complete:
+			return
+		try:
+			self.parser.Parse( chunk, False )
+		except ExpatError:
+			self.failed = True
+
+
 class config_interface:
 	"""
 	An instance of this class represents the config_interface opened by a
@@ -39,7 +77,15 @@ class config_interface:
 			s = socket.socket( socket.AF_UNIX )
 			s.connect( self.path )
 			s.send( str(data) )
-			response = s.recv( 10240 )
+			# big responses (like flight recorder dumps) come in more chunks
+			parser = _response_parser()
+			response = ''
+			while not parser.complete:
+				chunk = s.recv( 10240 )
+				if not chunk:
+					break
+				response += chunk
+				parser.feed( chunk )
 			s.close()
 			return response
 		except socket.error, e:
@@ -48,6 +48,9 @@ cmds = [
 	action( 'restart' ),
 	action( 'reload' ),
 	action( 'stats' ),
+	action( 'memory', args=[ arg('count', True) ] ),
+	action( 'flight-recorder',
+		args=[ arg('action'), arg('jid'), arg('size', True) ] ),
 	action( 'upgrade-db' ),
 	action( 'message-all', args=[ arg('path', True) ] ),
 	action( 'register',
@@ -648,6 +648,67 @@ class spectrum:
 		except RuntimeError, e:
 			raise RuntimeError( "%s"%(e.message ) )
 
+	def get_memory( self, count=10 ):
+		"""
+		Get estimated memory usage of subsystems and of the users who use
+		the most memory. Note that this method requires the xmpp library
+		to be installed.
+
+		@param count: How many users should be returned (0 means all).
+		@type  count: int
+		@return: The IQ packet send back by the client
+		@rtype:
+			U{xmpp.protocol.Iq<http://xmpppy.sourceforge.net/apidocs/xmpp.protocol.Iq-class.html>}
+		"""
+		import xmpp
+
+		interface = config_interface.config_interface( self )
+		ns = 'http://spectrum.im/protocol/memory'
+		nodes = [ xmpp.simplexml.Node( 'top', attrs={'limit': str( count )} ) ]
+		try:
+			return interface.query( nodes, ns )
+		except RuntimeError, e:
+			raise RuntimeError( "%s"%(e.message ) )
+
+	def flight_recorder( self, action, jid, size=None ):
+		"""
+		Control the flight recorder of a user. Note that this method
+		requires the xmpp library to be installed.
+
+		@param action: One of "enable", "disable" or "dump".
+		@type  action: str
+		@param jid: The bare JID of the user.
+		@type  jid: str
+		@param size: How many events should be kept (only for "enable").
+		@type  size: str
+		@return: The recorded events if action is "dump", None otherwise.
+		@rtype: str
+		@raise RuntimeError: In case the command fails.
+		"""
+		import xmpp
+
+		if action not in [ 'enable', 'disable', 'dump' ]:
+			raise RuntimeError( "Unknown action: %s"%(action) )
+
+		attrs = { 'jid': jid }
+		if size:
+			attrs['size'] = str( size )
+
+		interface = config_interface.config_interface( self )
+		ns = 'http://spectrum.im/protocol/flight-recorder'
+		nodes = [ xmpp.simplexml.Node( action, attrs=attrs ) ]
+		try:
+			iq = interface.query( nodes, ns )
+		except RuntimeError, e:
+			raise RuntimeError( "%s"%(e.message ) )
+
+		node = iq.getQueryChildren()[0]
+		error = node.getTag( 'error' )
+		if error:
+			raise RuntimeError( error.getData() )
+		if action == 'dump':
+			return node.getData()
+
 	def _get_output_file( self, directory, name, suffix ):
 		first = '%s/%s.%s'%(directory, name, suffix)
 		if not os.path.exists( first ):
@@ -196,6 +196,57 @@ class spectrum_group:
 			env.log( "\n\n".join( output ) )
 		return 0
 	
+	def memory( self, count=None ):
+		"""
+		Print estimated memory usage of subsystems (rosters, conversations,
+		MUCs, filetransfers, caps, vCards and stanza queue) and of the
+		I{count} users who use the most memory (default: 10).
+
+		@return: 0
+		@rtype: int
+		"""
+		if count is None:
+			count = 10
+		output = []
+		for instance in self.instances:
+			if not instance.running():
+				continue
+
+			try:
+				iq = instance.get_memory( int( count ) )
+				o = [ instance.get_jid() + ':' ]
+				for node in iq.getQueryChildren():
+					if node.getName() == 'subsystem':
+						o.append( '%s: %d KB'%(node.getAttr( 'name' ),
+							int( node.getAttr( 'value' ) ) / 1024) )
+				for node in iq.getQueryChildren():
+					if node.getName() == 'user':
+						o.append( '%s: %d KB'%(node.getAttr( 'jid' ),
+							int( node.getAttr( 'total' ) ) / 1024) )
+				output.append( "\n".join( o ) )
+			except RuntimeError, e:
+				env.error( "%s: %s"%(instance.get_jid(), e.message) )
+		if output:
+			env.log( "\n\n".join( output ) )
+		return 0
+
+	def flight_recorder( self, action, jid, size=None ):
+		"""
+		Control the flight recorder of the user with JID I{jid}. The
+		I{action} "enable" starts recording the last I{size} (default:
+		256) stanzas, libpurple callbacks and storage calls of the user,
+		"dump" prints them and "disable" stops recording.
+
+		@return: 0
+		@rtype: int
+		"""
+		for instance in self.instances:
+			events = self._single_action( instance, 'flight_recorder',
+				[ action, jid, size ] )
+			if events:
+				env.log( events )
+		return 0
+
 	def upgrade_db( self ):
 		"""
 		Try to upgrade the database schema.
@@ -27,6 +27,7 @@
 #include "account.h"
 #include "value.h"
 #include <vector>
+#include <map>
 
 struct UserRow {
 	long id;
@@ -38,6 +39,12 @@ struct UserRow {
 	bool vip;
 };
 
+// One value exposed by backend in http://jabber.org/protocol/stats.
+struct BackendStat {
+	std::string units;
+	long value;
+};
+
 // Abstract storage backend.
 class AbstractBackend {
 	public:
@@ -55,12 +62,19 @@ class AbstractBackend {
 		virtual void removeUser(long userId) = 0;
 		virtual void updateUser(const UserRow &user) = 0;
 		virtual std::map<std::string, UserRow> getUsersByJid(const std::string &jid) = 0;
+		// Stores that user with userId is `jid` connected to `server` (used by IRC,
+		// where one JID has one user per server).
+		virtual void addUserServer(long userId, const std::string &jid, const std::string &server) {}
 		virtual void updateSetting(long userId, const std::string &key, const std::string &value) = 0;
 		virtual bool reconnect() { return false; }
 		virtual void beginTransaction() { }
 		virtual void commitTransaction() { }
 		virtual void addSetting(long userId, const std::string &key, const std::string &value, PurpleType type) {}
 		virtual GHashTable * getSettings(long userId) = 0;
+		virtual bool loaded() { return true; }
+		virtual long getRegisteredUsersCount() { return 0; }
+		virtual long getRegisteredUsersRosterCount() { return 0; }
+		virtual void getStats(std::map <std::string, BackendStat> &stats) {}
 
 };
 
@@ -23,6 +23,9 @@
 #include "transport.h"
 #include "usermanager.h"
 #include "capabilityhandler.h"
+#include "stanzawriter.h"
+#include "spectrum_util.h"
+#include "memoryaccounting.h"
 
 AbstractSpectrumBuddy::AbstractSpectrumBuddy(long id) : m_id(id), m_online(false), m_subscription("ask"), m_flags(0) {
 }
@@ -148,39 +151,45 @@ Tag *AbstractSpectrumBuddy::generateXStatusStanza(int user_features) {
 	return tag;
 }
 
-Tag *AbstractSpectrumBuddy::generatePresenceStanza(int features, bool only_new) {
-	std::string alias = getAlias();
-	std::string name = getSafeName();
-
+bool AbstractSpectrumBuddy::writePresenceStanza(StanzaWriter &writer, const std::string &to, int features, bool only_new) {
 	PurpleStatusPrimitive s;
 	std::string statusMessage;
 	if (!getStatus(s, statusMessage))
-		return NULL;
+		return false;
+
+	bool avatars = s != PURPLE_STATUS_OFFLINE && (features & TRANSPORT_FEATURE_AVATARS);
+	std::string iconHash;
+	if (avatars)
+		iconHash = getIconHash();
+
+	if (only_new) {
+		// Everything the stanza is generated from except "to".
+		std::string presence = stringOf((int) s) + "\n" + statusMessage + "\n" + (avatars ? "1" : "0") + iconHash;
+		if (m_lastPresence == presence)
+			return false;
+		m_lastPresence = presence;
+	}
 
-	Tag *tag = new Tag("presence");
-	tag->addAttribute("from", getJid());
+	writer.start("presence");
+	writer.addAttribute("from", getJid());
+	if (s == PURPLE_STATUS_OFFLINE)
+		writer.addAttribute("type", "unavailable");
+	writer.addAttribute("to", to);
 
 	if (!statusMessage.empty())
-		tag->addChild( new Tag("status", statusMessage) );
+		writer.addChild("status", statusMessage);
 
 	switch(s) {
-		case PURPLE_STATUS_AVAILABLE: {
-			break;
-		}
 		case PURPLE_STATUS_AWAY: {
-			tag->addChild( new Tag("show", "away" ) );
+			writer.addChild("show", "away");
 			break;
 		}
 		case PURPLE_STATUS_UNAVAILABLE: {
-			tag->addChild( new Tag("show", "dnd" ) );
+			writer.addChild("show", "dnd");
 			break;
 		}
 		case PURPLE_STATUS_EXTENDED_AWAY: {
-			tag->addChild( new Tag("show", "xa" ) );
-			break;
-		}
-		case PURPLE_STATUS_OFFLINE: {
-			tag->addAttribute( "type", "unavailable" );
+			writer.addChild("show", "xa");
 			break;
 		}
 		default:
@@ -189,29 +198,25 @@ Tag *AbstractSpectrumBuddy::generatePresenceStanza(int features, bool only_new)
 
 	if (s != PURPLE_STATUS_OFFLINE) {
 		// caps
-		Tag *c = new Tag("c");
-		c->addAttribute("xmlns", "http://jabber.org/protocol/caps");
-		c->addAttribute("hash", "sha-1");
-		c->addAttribute("node", "http://spectrum.im/transport");
-		c->addAttribute("ver", Transport::instance()->hash());
-		tag->addChild(c);
-
-		if (features & TRANSPORT_FEATURE_AVATARS) {
+		writer.startChild("c");
+		writer.addAttribute("xmlns", "http://jabber.org/protocol/caps");
+		writer.addAttribute("hash", "sha-1");
+		writer.addAttribute("node", "http://spectrum.im/transport");
+		writer.addAttribute("ver", Transport::instance()->hash());
+		writer.endChild();
+
+		if (avatars) {
 			// vcard-temp:x:update
-			Tag *x = new Tag("x");
-			x->addAttribute("xmlns","vcard-temp:x:update");
-			x->addChild( new Tag("photo", getIconHash()) );
-			tag->addChild(x);
+			writer.startChild("x");
+			writer.addAttribute("xmlns", "vcard-temp:x:update");
+			writer.addChild("photo", iconHash);
+			writer.endChild();
 		}
 	}
 
-	if (only_new) {
-		if (m_lastPresence == tag->xml()) {
-			delete tag;
-			return NULL;
-		}
-		m_lastPresence = tag->xml();
-	}
+	return true;
+}
 
-	return tag;
+void AbstractSpectrumBuddy::getMemoryUsage(unsigned long *usage) {
+	usage[MEMORY_ROSTER] += sizeof(AbstractSpectrumBuddy) + m_subscription.capacity() + m_lastPresence.capacity();
 }
@@ -31,6 +31,8 @@
 
 using namespace gloox;
 
+class StanzaWriter;
+
 typedef enum { 	SUBSCRIPTION_NONE = 0,
 				SUBSCRIPTION_TO,
 				SUBSCRIPTION_FROM,
@@ -61,10 +63,10 @@ class AbstractSpectrumBuddy {
 
 		Tag *generateXStatusStanza(int user_features);
 
-		// Generates whole <presence> stanza without "to" attribute. That attribute
-		// has to be added manually.
-		// only_new - if the stanza is the same as previous generated one, returns NULL.
-		Tag *generatePresenceStanza(int features, bool only_new = false);
+		// Writes whole <presence> stanza to `writer`. Returns false if there is
+		// nothing to send.
+		// only_new - if the presence is the same as previous generated one, returns false.
+		bool writePresenceStanza(StanzaWriter &writer, const std::string &to, int features, bool only_new = false);
 
 		// Sets online/offline state information.
 		void setOnline();
@@ -120,6 +122,10 @@ class AbstractSpectrumBuddy {
 
 		virtual void handleBuddyRemoved(PurpleBuddy *buddy) = 0;
 
+		// Adds approximate memory used by this buddy to `usage` (indexed
+		// by MemorySubsystem).
+		virtual void getMemoryUsage(unsigned long *usage);
+
 	private:
 		long m_id;
 		bool m_online;
@@ -29,6 +29,7 @@
 #include "Poco/Format.h"
 #include "registerhandler.h"
 #include "adhochandler.h"
+#include "../flightrecorder.h"
 
 static bool compareSDataASC(SortData &a, SortData &b) {
 	return strcmp(a.sKey.c_str(), b.sKey.c_str()) < 0;
@@ -67,6 +68,7 @@ AdhocAdmin::AdhocAdmin(AbstractUser *user, const std::string &from, const std::s
 	values[tr(m_language.c_str(), _("List online users"))] = "List online users";
 	values[tr(m_language.c_str(), _("Register new user"))] = "Register new user";
 	values[tr(m_language.c_str(), _("Unregister user"))] = "Unregister user";
+	values[tr(m_language.c_str(), _("Flight recorder"))] = "Flight recorder";
 	adhocTag->addListSingle(tr(m_language.c_str(), _("Command")), "config_area", values);
 
 	GlooxAdhocHandler::sendAdhocResult(from, id, adhocTag);
@@ -352,6 +354,55 @@ AdhocTag *AdhocAdmin::handleListUsersForm(Tag *tag, const DataForm &form) {
 	return adhocTag;
 }
 
+AdhocTag *AdhocAdmin::generateFlightRecorderForm(const std::string &sessionId) {
+	AdhocTag *adhocTag = new AdhocTag(sessionId, "transport_admin", "executing");
+	adhocTag->setAction("complete");
+	adhocTag->setTitle(tr(m_language.c_str(), _("Flight recorder")));
+	adhocTag->setInstructions(tr(m_language.c_str(), _("Records the last stanzas, libpurple callbacks and storage calls of the user.")));
+	adhocTag->addTextSingle(tr(m_language.c_str(), _("Bare JID")), "user_jid");
+
+	std::map <std::string, std::string> values;
+	values[tr(m_language.c_str(), _("Start recording"))] = "enable";
+	values[tr(m_language.c_str(), _("Stop recording"))] = "disable";
+	values[tr(m_language.c_str(), _("Show recorded events"))] = "dump";
+	adhocTag->addListSingle(tr(m_language.c_str(), _("Action")), "recorder_action", values);
+	adhocTag->addTextSingle(tr(m_language.c_str(), _("Number of recorded events")), "recorder_size", stringOf(FLIGHT_RECORDER_SIZE));
+
+	return adhocTag;
+}
+
+AdhocTag *AdhocAdmin::handleFlightRecorderForm(Tag *tag, const DataForm &form) {
+	if (!form.hasField("user_jid") || !form.hasField("recorder_action"))
+		return NULL;
+	const std::string &user_jid = form.field("user_jid")->value();
+	const std::string &action = form.field("recorder_action")->value();
+
+	AdhocTag *adhocTag = new AdhocTag(tag->findAttribute("sessionid"), "transport_admin", "completed");
+	FlightRecorderManager *manager = FlightRecorderManager::instance();
+	if (manager == NULL || user_jid.empty())
+		return adhocTag;
+
+	if (action == "enable") {
+		unsigned int size = FLIGHT_RECORDER_SIZE;
+		if (form.hasField("recorder_size") && !form.field("recorder_size")->value().empty())
+			size = fromString<unsigned int>(form.field("recorder_size")->value());
+		manager->enable(user_jid, size ? size : FLIGHT_RECORDER_SIZE);
+	}
+	else if (action == "disable") {
+		if (!manager->disable(user_jid))
+			adhocTag->addNote("error", tr(m_language.c_str(), _("Flight recorder is not enabled for this user.")));
+	}
+	else if (action == "dump") {
+		FlightRecorder *recorder = manager->getRecorder(user_jid);
+		if (recorder)
+			adhocTag->addTextMulti(tr(m_language.c_str(), _("Recorded events")), "events", recorder->dump());
+		else
+			adhocTag->addNote("error", tr(m_language.c_str(), _("Flight recorder is not enabled for this user.")));
+	}
+
+	return adhocTag;
+}
+
 AdhocTag *AdhocAdmin::handleExecutionInit(Tag *tag, const DataForm &form) {
 	if (!form.hasField("config_area"))
 		return NULL;
@@ -377,6 +428,10 @@ AdhocTag *AdhocAdmin::handleExecutionInit(Tag *tag, const DataForm &form) {
 		m_state = ADHOC_ADMIN_LIST_USERS;
 		return generateListUsersForm(tag->findAttribute("sessionid"));
 	}
+	else if (result == "Flight recorder") {
+		m_state = ADHOC_ADMIN_FLIGHT_RECORDER;
+		return generateFlightRecorderForm(tag->findAttribute("sessionid"));
+	}
 	return NULL;
 }
 
@@ -407,6 +462,8 @@ AdhocTag *AdhocAdmin::handleAdhocTag(Tag *stanzaTag) {
 			m_state = ADHOC_ADMIN_REGISTER_USER;
 		else if (data == "ADHOC_ADMIN_UNREGISTER_USER")
 			m_state = ADHOC_ADMIN_UNREGISTER_USER;
+		else if (data == "ADHOC_ADMIN_FLIGHT_RECORDER")
+			m_state = ADHOC_ADMIN_FLIGHT_RECORDER;
 	}
 
 	if (m_state == ADHOC_ADMIN_INIT) {
@@ -430,6 +487,9 @@ AdhocTag *AdhocAdmin::handleAdhocTag(Tag *stanzaTag) {
 	else if (m_state == ADHOC_ADMIN_UNREGISTER_USER) {
 		return handleUnregisterUserForm(tag, form);
 	}
+	else if (m_state == ADHOC_ADMIN_FLIGHT_RECORDER) {
+		return handleFlightRecorderForm(tag, form);
+	}
 	return NULL;
 }
 
@@ -44,6 +44,7 @@ typedef enum {	ADHOC_ADMIN_INIT = 0,
 				ADHOC_ADMIN_REGISTER_USER,
 				ADHOC_ADMIN_UNREGISTER_USER,
 				ADHOC_ADMIN_LIST_USERS,
+				ADHOC_ADMIN_FLIGHT_RECORDER,
 				} AdhocAdminState;
 
 enum {
@@ -99,6 +100,9 @@ class AdhocAdmin : public AdhocCommandHandler, public AbstractConfigInterfaceHan
 
 		AdhocTag *generateListUsersForm(const std::string &sessionId);
 		AdhocTag *handleListUsersForm(Tag *tag, const DataForm &form);
+
+		AdhocTag *generateFlightRecorderForm(const std::string &sessionId);
+		AdhocTag *handleFlightRecorderForm(Tag *tag, const DataForm &form);
 		
 		AdhocTag *handleExecutionInit(Tag *tag, const DataForm &form);
 
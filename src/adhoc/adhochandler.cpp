@@ -113,7 +113,7 @@ Disco::ItemList GlooxAdhocHandler::handleDiscoNodeItems( const JID &_from, const
 							continue;
 						}
 						// we are using "transport_" prefix here to identify command in disco#info handler
-						lst.push_back( new Disco::Item( Transport::instance()->jid(), "transport_" + (std::string) action->label, tr(user->getLang(), action->label) ) );
+						lst.push_back( new Disco::Item( Transport::instance()->jid(), "transport_" + (std::string) action->label, tr(user->getTranslation(), action->label) ) );
 
 						if (m_nodes.find("transport_" + (std::string) action->label) == m_nodes.end()) {
 							m_nodes["transport_" + (std::string) action->label] = 1;
@@ -145,7 +145,7 @@ Disco::ItemList GlooxAdhocHandler::handleDiscoNodeItems( const JID &_from, const
 						purple_menu_action_free(action);
 						continue;
 					}
-					lst.push_back( new Disco::Item( _to.bare(), "transport_" + (std::string) action->label, (std::string) tr(user->getLang(), action->label) ) );
+					lst.push_back( new Disco::Item( _to.bare(), "transport_" + (std::string) action->label, (std::string) tr(user->getTranslation(), action->label) ) );
 					if (m_nodes.find("transport_" + (std::string) action->label) == m_nodes.end()) {
 						m_nodes["transport_" + (std::string) action->label] = 1;
 						GlooxMessageHandler::instance()->j->disco()->registerNodeHandler(this, "transport_" + (std::string) action->label);
@@ -230,7 +230,7 @@ bool AdhocRepeater::handleIq(const IQ &stanza) {
 		s->addChild(c);
 		Transport::instance()->send(s);
 
-		g_timeout_add(0,&removeRepeater,this);
+		purple_timeout_add(0,&removeRepeater,this);
 
 	}
 
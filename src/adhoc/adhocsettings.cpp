@@ -43,22 +43,22 @@ AdhocSettings::AdhocSettings(User *user, const std::string &from, const std::str
 	if (user) {
 		adhocTag->setInstructions(tr(m_language, _("Change your transport settings here.")));
 		
-		bool value = m_user->getSetting<bool>("enable_transport");
+		bool value = m_user->getSetting<bool>(SETTING_ENABLE_TRANSPORT);
 		adhocTag->addBoolean(tr(m_language, _("Enable transport")), "enable_transport", value);
 
-		value = m_user->getSetting<bool>("enable_notify_email");
+		value = m_user->getSetting<bool>(SETTING_ENABLE_NOTIFY_EMAIL);
 		adhocTag->addBoolean(tr(m_language, _("Enable notification of new email (if the legacy network supports it)")), "enable_notify_email", value);
 
-		value = m_user->getSetting<bool>("enable_avatars");
+		value = m_user->getSetting<bool>(SETTING_ENABLE_AVATARS);
 		adhocTag->addBoolean(tr(m_language, _("Enable avatars")), "enable_avatars", value);
 
-		value = m_user->getSetting<bool>("enable_chatstate");
+		value = m_user->getSetting<bool>(SETTING_ENABLE_CHATSTATE);
 		adhocTag->addBoolean(tr(m_language, _("Enable \"is typing\" notifications")), "enable_chatstate", value);
 
-		value = m_user->getSetting<bool>("save_files_on_server");
+		value = m_user->getSetting<bool>(SETTING_SAVE_FILES_ON_SERVER);
 		adhocTag->addBoolean(tr(m_language, _("Save incoming file transfers on server")), "save_files_on_server", value);
 
-		value = m_user->getSetting<bool>("reject_authorizations");
+		value = m_user->getSetting<bool>(SETTING_REJECT_AUTHORIZATIONS);
 		adhocTag->addBoolean(tr(m_language, _("Reject all incoming authorizations")), "reject_authorizations", value);
 	}
 	else {
@@ -89,22 +89,15 @@ bool AdhocSettings::handleIq(const IQ &stanza) {
 			std::string key = (*it)->findAttribute("var");
 			if (key.empty()) continue;
 
-			PurpleValue * savedValue = m_user->getSettingValue(key);
-			if (!savedValue) continue;
+			UserSetting setting = SettingsManager::findSetting(key);
+			if (setting == SETTING_UNKNOWN) continue;
 
 			Tag *v =(*it)->findChild("value");
 			if (!v) continue;
 
-			PurpleValue *value;
-			if (purple_value_get_type(savedValue) == PURPLE_TYPE_BOOLEAN) {
-				value = purple_value_new(PURPLE_TYPE_BOOLEAN);
-				purple_value_set_boolean(value, atoi(v->cdata().c_str()));
-				if (purple_value_get_boolean(savedValue) == purple_value_get_boolean(value)) {
-					purple_value_destroy(value);
-					continue;
-				}
-				m_user->updateSetting<bool>(key, purple_value_get_boolean(value));
-			}
+			// updateSetting does nothing when value hasn't changed.
+			if (SettingsManager::settingType(setting) == PURPLE_TYPE_BOOLEAN)
+				m_user->updateSetting<bool>(setting, atoi(v->cdata().c_str()));
 		}
 
 		AdhocTag *payload = new AdhocTag(tag->findAttribute("sessionid"), "transport_settings", "completed");
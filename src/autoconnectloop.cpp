@@ -23,6 +23,7 @@
 #include "log.h"
 #include "usermanager.h"
 #include "transport.h"
+#include "sessionsnapshot.h"
 
 /*
  * Callback which is called periodically and restoring connections.
@@ -32,12 +33,18 @@ static gboolean iter(gpointer data){
 	return loop->restoreNextConnection();
 }
 
-AutoConnectLoop::AutoConnectLoop() {
+AutoConnectLoop::AutoConnectLoop(SessionSnapshot *snapshot) : m_snapshot(snapshot) {
 	m_users = Transport::instance()->sql()->getOnlineUsers();
 
 	// This code blocks and it's alright, because transport should not handle anything before it gets to consistent
 	// state.
 	for (std::vector <std::string>::iterator it = m_users.begin(); it != m_users.end(); it++) {
+		// XMPP user still sees presences from snapshot, they will be fixed after restore.
+		if (m_snapshot && m_snapshot->hasUser(*it)) {
+			Log("connection restorer", "Skipping unavailable presences for " << *it << ", it's in session snapshot");
+			continue;
+		}
+
 		Log("connection restorer", "Sending unavailable presences to " << *it);
 		Tag *stanza = new Tag("presence");
 		stanza->addAttribute( "to", *it);
@@ -74,6 +81,8 @@ AutoConnectLoop::AutoConnectLoop() {
 
 AutoConnectLoop::~AutoConnectLoop() {
 	Log("connection restorer", "Restorer deleted");
+	if (m_snapshot)
+		m_snapshot->clear();
 	m_timer->deleteLater();
 }
 
@@ -89,6 +98,10 @@ bool AutoConnectLoop::restoreNextConnection() {
 	Log("connection restorer", "Checking next jid " << jid);
 	User *user = Transport::instance()->userManager()->getUserByJID(jid);
 	if (user == NULL) {
+		// Users from session snapshot are created directly, but we probe them anyway,
+		// so we get unavailable presence if they went offline while we were down.
+		if (m_snapshot)
+			m_snapshot->restoreUser(jid);
 		Log("connection restorer", "Sending probe presence to " << jid);
 		Tag *stanza = new Tag("presence");
 		stanza->addAttribute( "to", jid);
@@ -30,11 +30,15 @@
 #include "configfile.h"
 #include "spectrumtimer.h"
 
+class SessionSnapshot;
+
 // Connects accounts automatically after Spectrum start.
-// Accounts are connected one by one by timer.
+// Accounts are connected one by one by timer. Users stored in SessionSnapshot
+// are restored directly from it, so we don't have to send unavailable presences
+// for their whole rosters.
 class AutoConnectLoop {
 	public:
-		AutoConnectLoop();
+		AutoConnectLoop(SessionSnapshot *snapshot = NULL);
 		~AutoConnectLoop();
 
 		// Restore next account connection.
@@ -44,6 +48,7 @@ class AutoConnectLoop {
 	private:
 		std::vector <std::string> m_users;
 		SpectrumTimer *m_timer;
+		SessionSnapshot *m_snapshot;
 };
 
 #endif
@@ -90,14 +90,7 @@ void CapabilityHandler::handleDiscoInfo(const JID &jid, Tag *query, int context)
 	Transport::instance()->setClientCapabilities(m_versions[context].version, capabilities);
 
 	JID j(m_versions[context].jid);
-	AbstractUser *user;
-	if (Transport::instance()->protocol()->tempAccountsAllowed()) {
-		std::string server = j.username().substr(j.username().find("%") + 1, j.username().length() - j.username().find("%"));
-		user = (AbstractUser *) Transport::instance()->userManager()->getUserByJID(jid.bare() + server);
-	}
-	else {
-		user = (AbstractUser *) Transport::instance()->userManager()->getUserByJID(jid.bare());
-	}
+	AbstractUser *user = (AbstractUser *) Transport::instance()->userManager()->getUserByJID(Transport::instance()->protocol()->userKey(jid, j));
 	if (user && user->hasResource(jid.resource())) {
 		if (user->getResource(jid.resource()).caps == 0) {
 			user->setResource(jid.resource(), -256, capabilities);
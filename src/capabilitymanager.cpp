@@ -20,6 +20,7 @@
 
 #include "capabilitymanager.h"
 #include "transport.h"
+#include "memoryaccounting.h"
 
 CapabilityManager::CapabilityManager() {
 	m_caps["_default"] = 0;
@@ -39,3 +40,10 @@ bool CapabilityManager::hasClientCapabilities(const std::string &client) {
 int CapabilityManager::getCapabilities(const std::string &client) {
 	return m_caps[client];
 }
+
+unsigned long CapabilityManager::getMemoryUsage() {
+	unsigned long size = 0;
+	for (std::map <std::string, int>::iterator it = m_caps.begin(); it != m_caps.end(); it++)
+		size += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(int);
+	return size;
+}
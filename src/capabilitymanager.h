@@ -38,6 +38,9 @@ class CapabilityManager {
 		void setClientCapabilities(const std::string &client, int capabilities);
 		bool hasClientCapabilities(const std::string &client);
 		int getCapabilities(const std::string &client);
+
+		// Returns approximate memory used by capabilities cache.
+		unsigned long getMemoryUsage();
 		
 	private:
 		std::map <std::string, int> m_caps;
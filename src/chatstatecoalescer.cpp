@@ -0,0 +1,144 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "chatstatecoalescer.h"
+#include "glib.h"
+
+// Conversations without activity for this time (in ms) are forgotten.
+#define CHATSTATE_FORGET_TIME 600000
+
+ChatStateCoalescer::ChatStateCoalescer(int interval, int window, long *counter) : m_interval(interval), m_window(window),
+	m_pending(0), m_suppressed(0), m_counter(counter), m_time(0) {
+}
+
+ChatStateCoalescer::~ChatStateCoalescer() {
+}
+
+long long ChatStateCoalescer::now() {
+	if (m_time != 0)
+		return m_time;
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void ChatStateCoalescer::suppress() {
+	m_suppressed++;
+	if (m_counter)
+		(*m_counter)++;
+}
+
+void ChatStateCoalescer::dropPending(State &s) {
+	if (s.pending.empty())
+		return;
+	s.pending = "";
+	m_pending--;
+	suppress();
+}
+
+bool ChatStateCoalescer::handleChatState(const std::string &key, const std::string &state) {
+	long long t = now();
+	std::map <std::string, State>::iterator it = m_states.find(key);
+	if (it == m_states.end()) {
+		State &s = m_states[key];
+		s.activity = t;
+		s.due = 0;
+		if (state == "composing") {
+			s.last = state;
+			s.lastSent = t;
+			return true;
+		}
+		// Nothing has been forwarded yet, so there's nothing to finish.
+		s.last = "active";
+		s.lastSent = 0;
+		if (state == "active") {
+			suppress();
+			return false;
+		}
+		s.pending = state;
+		s.due = t + m_window;
+		m_pending++;
+		return false;
+	}
+
+	State &s = it->second;
+	s.activity = t;
+
+	// Newer state replaces the deferred one.
+	dropPending(s);
+
+	if (state == s.last) {
+		suppress();
+		return false;
+	}
+
+	long long due = s.lastSent + m_interval;
+	if (state != "composing" && t + m_window > due)
+		due = t + m_window;
+
+	if (due <= t) {
+		s.last = state;
+		s.lastSent = t;
+		return true;
+	}
+
+	s.pending = state;
+	s.due = due;
+	m_pending++;
+	return false;
+}
+
+void ChatStateCoalescer::handleMessage(const std::string &key) {
+	std::map <std::string, State>::iterator it = m_states.find(key);
+	if (it == m_states.end())
+		return;
+	State &s = it->second;
+	s.activity = now();
+	dropPending(s);
+	// Message implies the contact is not typing anymore.
+	s.last = "active";
+}
+
+void ChatStateCoalescer::flush(std::list <std::pair<std::string, std::string> > &states) {
+	long long t = now();
+	for (std::map <std::string, State>::iterator it = m_states.begin(); it != m_states.end(); ) {
+		State &s = it->second;
+		if (!s.pending.empty() && s.due <= t) {
+			states.push_back(std::make_pair(it->first, s.pending));
+			s.last = s.pending;
+			s.lastSent = t;
+			s.pending = "";
+			m_pending--;
+		}
+		if (s.pending.empty() && s.activity + CHATSTATE_FORGET_TIME <= t)
+			m_states.erase(it++);
+		else
+			++it;
+	}
+}
+
+void ChatStateCoalescer::remove(const std::string &key) {
+	std::map <std::string, State>::iterator it = m_states.find(key);
+	if (it == m_states.end())
+		return;
+	if (!it->second.pending.empty())
+		m_pending--;
+	m_states.erase(it);
+}
@@ -0,0 +1,96 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_CHATSTATE_COALESCER_H
+#define SPECTRUM_CHATSTATE_COALESCER_H
+
+#include <string>
+#include <map>
+#include <list>
+
+// Reduces number of XEP-0085 chat states (typing notifications) forwarded
+// between XMPP and legacy network. One instance handles one direction for all
+// conversations of one user, conversations are identified by `key`.
+//
+// - repeated states are suppressed,
+// - state is not forwarded more often than once per `interval` ms; newer
+//   state replaces the deferred one,
+// - states other than "composing" are deferred for `window` ms and dropped
+//   if the message itself is forwarded in the meantime, because the message
+//   already tells the other side that the contact stopped typing.
+//
+// Deferred states have to be collected by flush().
+class ChatStateCoalescer {
+	public:
+		// `interval` - minimal time between two forwarded states in ms.
+		// `window` - time in ms for which the state can be superseded by message.
+		// `counter` - optional global counter increased with every suppressed state.
+		ChatStateCoalescer(int interval = 1000, int window = 500, long *counter = NULL);
+		~ChatStateCoalescer();
+
+		// Returns true if the state should be forwarded now. If it returns false,
+		// the state is either dropped or deferred until flush().
+		bool handleChatState(const std::string &key, const std::string &state);
+
+		// Has to be called when message is forwarded in conversation `key`.
+		void handleMessage(const std::string &key);
+
+		// Stores deferred states which should be forwarded now into `states`
+		// (key, state) and forgets conversations without recent activity.
+		void flush(std::list <std::pair<std::string, std::string> > &states);
+
+		// Returns true if there are deferred states waiting for flush().
+		bool hasPending() { return m_pending != 0; }
+
+		// Forgets the conversation.
+		void remove(const std::string &key);
+
+		// Returns number of tracked conversations.
+		unsigned int size() { return m_states.size(); }
+
+		// Returns count of states which have not been forwarded.
+		long getSuppressed() { return m_suppressed; }
+
+		// Sets current time in ms. Used only by tests, if it's 0, real time is used.
+		void setTime(long long t) { m_time = t; }
+
+	private:
+		struct State {
+			std::string last;		// Last forwarded state.
+			std::string pending;	// Deferred state, empty if there is no such state.
+			long long lastSent;		// Time when the last state was forwarded.
+			long long due;			// Time when the deferred state should be forwarded.
+			long long activity;		// Time of last state or message.
+		};
+
+		long long now();
+		void suppress();
+		void dropPending(State &s);
+
+		std::map <std::string, State> m_states;
+		int m_interval;
+		int m_window;
+		int m_pending;
+		long m_suppressed;
+		long *m_counter;
+		long long m_time;
+};
+
+#endif
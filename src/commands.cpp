@@ -71,19 +71,19 @@ static PurpleCmdRet resend_presences_command_cb(PurpleConversation *conv, const
 // 						purple_value_set_boolean(value, atoi(args[2]));
 // 						user->updateSetting(args[1], value);
 // 						if (purple_value_get_boolean(value))
-// 							g_string_append_printf(s, tr(user->getLang(),_("%s is now True\n")), args[1]);
+// 							g_string_append_printf(s, tr(user->getTranslation(),_("%s is now True\n")), args[1]);
 // 						else
-// 							g_string_append_printf(s, tr(user->getLang(),_("%s is now False\n")), args[1]);
+// 							g_string_append_printf(s, tr(user->getTranslation(),_("%s is now False\n")), args[1]);
 // 					}
 // 					else if (purple_value_get_type(value) == PURPLE_TYPE_STRING) {
 // 						value = purple_value_new(PURPLE_TYPE_STRING);
 // 						purple_value_set_string(value, args[2]);
 // 						user->updateSetting(args[1], value);
-// 						g_string_append_printf(s, tr(user->getLang(),_("%s is now \"%s\"\n")), args[1], args[2]);
+// 						g_string_append_printf(s, tr(user->getTranslation(),_("%s is now \"%s\"\n")), args[1], args[2]);
 // 					}
 // 				}
 // 				else {
-// 					g_string_append_printf(s, tr(user->getLang(), _("The setting \"%s\" does not exist.  Try \"/transport settings list\" to get a list of available settings.\n")), args[1]);
+// 					g_string_append_printf(s, tr(user->getTranslation(), _("The setting \"%s\" does not exist.  Try \"/transport settings list\" to get a list of available settings.\n")), args[1]);
 // 				}
 // 			}
 // 		}
@@ -115,22 +115,22 @@ static PurpleCmdRet help_command_cb(PurpleConversation *conv, const char *cmd, c
 		if (text) {
 			for (l = text; l; l = l->next)
 				if (l->next)
-					g_string_append_printf(s, "%s\n", tr(user->getLang(),(char *)l->data));
+					g_string_append_printf(s, "%s\n", tr(user->getTranslation(),(char *)l->data));
 				else
-					g_string_append_printf(s, "%s", tr(user->getLang(),(char *)l->data));
+					g_string_append_printf(s, "%s", tr(user->getTranslation(),(char *)l->data));
 		} else {
-			g_string_append(s, tr(user->getLang(),_("No such command (in this context).")));
+			g_string_append(s, tr(user->getTranslation(),_("No such command (in this context).")));
 		}
 	} else {
-		s = g_string_new(tr(user->getLang(),_("Use \"/transport help &lt;command&gt;\" for help on a specific command.\n"
+		s = g_string_new(tr(user->getTranslation(),_("Use \"/transport help &lt;command&gt;\" for help on a specific command.\n"
 											 "The following commands are available in this context:\n")));
 
 		text = purple_cmd_list(conv);
 		for (l = text; l; l = l->next)
 			if (l->next)
-				g_string_append_printf(s, "%s, ", tr(user->getLang(),(char *)l->data));
+				g_string_append_printf(s, "%s, ", tr(user->getTranslation(),(char *)l->data));
 			else
-				g_string_append_printf(s, "%s.", tr(user->getLang(),(char *)l->data));
+				g_string_append_printf(s, "%s.", tr(user->getTranslation(),(char *)l->data));
 		g_list_free(text);
 	}
 
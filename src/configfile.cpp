@@ -258,7 +258,7 @@ void ConfigFile::loadPurpleAccountSettings(Configuration &configuration) {
 	char **keys = g_key_file_get_keys(keyfile, "purple", NULL, NULL);
 	for (int i = 0; keys[i]; i++) {
 		bool found = false;
-		PurplePlugin *plugin = purple_find_prpl(Transport::instance()->protocol()->protocol().c_str());
+		PurplePlugin *plugin = Transport::instance()->prpl();
 		PurplePluginProtocolInfo *prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(plugin);
 		for (GList *l = prpl_info->protocol_options; l != NULL; l = l->next) {
 			PurpleAccountOption *option = (PurpleAccountOption *) l->data;
@@ -356,6 +356,24 @@ Configuration ConfigFile::getConfiguration() {
 	loadString(configuration.language, "service", "language", "en");
 	loadString(configuration.encoding, "service", "encoding", "");
 	loadString(configuration.eventloop, "service", "eventloop", "glib");
+	loadInteger(configuration.unregisteredCacheTTL, "service", "unregistered_cache_ttl", 300);
+	loadInteger(configuration.unregisteredCacheSize, "service", "unregistered_cache_size", 10000);
+	loadInteger(configuration.probeBurst, "service", "probe_burst", 3);
+	loadInteger(configuration.probeInterval, "service", "probe_interval", 60);
+	loadInteger(configuration.conversationIdleTimeout, "service", "conversation_idle_timeout", 3600);
+	loadInteger(configuration.maxConversations, "service", "max_conversations", 200);
+	loadInteger(configuration.chatstateInterval, "service", "chatstate_interval", 1000);
+	loadInteger(configuration.chatstateWindow, "service", "chatstate_window", 500);
+	loadInteger(configuration.queueBudget, "service", "queue_budget", 100);
+	loadInteger(configuration.queueHighLimit, "service", "queue_high_limit", 16384);
+	loadInteger(configuration.queuePresenceLimit, "service", "queue_presence_limit", 8192);
+	loadInteger(configuration.queueBulkLimit, "service", "queue_bulk_limit", 4096);
+	loadInteger(configuration.jobsBudget, "service", "jobs_budget", 20);
+	loadInteger(configuration.settingsFlushInterval, "service", "settings_flush_interval", 5);
+	loadInteger(configuration.settingsFlushMaxDelay, "service", "settings_flush_max_delay", 30);
+	loadInteger(configuration.rosterPushWindow, "service", "roster_push_window", 50);
+	loadInteger(configuration.rosterPushBatch, "service", "roster_push_batch", 1);
+	loadBoolean(configuration.prunePlugins, "service", "prune_plugins", false);
 	loadBoolean(configuration.enable_commands, "service", "enable_commands", true);
 	loadBoolean(configuration.jid_escaping, "service", "jid_escaping", true);
 	loadBoolean(configuration.onlyForVIP, "service", "only_for_vip", false);
@@ -411,13 +429,23 @@ Configuration ConfigFile::getConfiguration() {
 	// Database section
 	LOAD_REQUIRED_STRING(configuration.sqlType, "database", "type");
 	LOAD_REQUIRED_STRING(configuration.sqlDb, "database", "database");
-	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlHost, "database", "host", configuration.sqlType == "sqlite" ? "optional" : "");
-	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlPassword, "database", "password", configuration.sqlType == "sqlite" ? "optional" : "");
-	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlUser, "database", "user", configuration.sqlType == "sqlite" ? "optional" : "");
-	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlPrefix, "database", "prefix", configuration.sqlType == "sqlite" ? "" : "required");
+	// SQLite and key-value storage are just local files, so they don't need connection settings.
+	bool localDb = configuration.sqlType == "sqlite" || configuration.sqlType == "kv";
+	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlHost, "database", "host", localDb ? "optional" : "");
+	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlPassword, "database", "password", localDb ? "optional" : "");
+	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlUser, "database", "user", localDb ? "optional" : "");
+	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlPrefix, "database", "prefix", localDb ? "" : "required");
 	LOAD_REQUIRED_STRING_DEFAULT(configuration.sqlCryptKey, "database", "useless_encryption_key", "");
 	loadString(configuration.sqlVIP, "database", "vip_statement", "");
+	loadString(configuration.sqliteProfile, "database", "sqlite_profile", "default");
+	loadInteger(configuration.sqliteMmapSize, "database", "sqlite_mmap_size", 64);
+	loadInteger(configuration.sqliteCacheSize, "database", "sqlite_cache_size", 16);
+	loadInteger(configuration.sqliteCheckpointInterval, "database", "sqlite_checkpoint_interval", 30);
+	loadInteger(configuration.sqliteMaintenanceInterval, "database", "sqlite_maintenance_interval", 21600);
 	LOAD_REQUIRED_STRING(configuration.userDir, "purple", "userdir");
+	loadString(configuration.sessionSnapshot, "service", "session_snapshot", configuration.userDir + "/session.snapshot");
+	loadInteger(configuration.sessionSnapshotInterval, "service", "session_snapshot_interval", 60);
+	loadInteger(configuration.sessionSnapshotMaxAge, "service", "session_snapshot_max_age", 600);
 
 	// Logging section
 	loadString(configuration.logfile, "logging", "log_file", "");
@@ -448,7 +476,7 @@ Configuration ConfigFile::getConfiguration() {
 		configuration.reg_extra_fields.push_back("encoding");
 	}
 
-	if (configuration.sqlType == "sqlite")
+	if (localDb)
 		create_dir(configuration.sqlDb, 0750);
 	create_dir(configuration.filetransferCache, 0750);
 	create_dir(configuration.config_interface, 0750);
@@ -81,6 +81,28 @@ struct Configuration {
 	std::string filetransferWeb;
 	std::string eventloop;
 
+	int unregisteredCacheTTL;		// Seconds an unregistered JID is remembered.
+	int unregisteredCacheSize;		// Maximum number of remembered unregistered JIDs.
+	int probeBurst;					// Probes which can be sent to one JID at once.
+	int probeInterval;				// Seconds needed to allow one more probe.
+	std::string sessionSnapshot;	// File used to store session snapshot.
+	int sessionSnapshotInterval;	// How often is session snapshot stored (in seconds).
+	int sessionSnapshotMaxAge;		// Older session snapshot is not restored (in seconds).
+	int conversationIdleTimeout;	// Seconds after which idle conversation is closed.
+	int maxConversations;			// Maximum number of opened conversations per user.
+	int chatstateInterval;			// Minimal time between two forwarded chatstates (in ms).
+	int chatstateWindow;			// Time for which chatstate can be superseded by message (in ms).
+	int queueBudget;				// Stanzas sent in one main loop iteration before queueing.
+	int queueHighLimit;				// Memory limit of queued messages and IQs (in KB).
+	int queuePresenceLimit;			// Memory limit of queued presences (in KB).
+	int queueBulkLimit;				// Memory limit of queued MUC presences and vCards (in KB).
+	int jobsBudget;					// Time used by per-user jobs in one main loop iteration (in ms).
+	int settingsFlushInterval;		// Changed user settings are written to storage when they don't change for this time (in seconds)...
+	int settingsFlushMaxDelay;		// ...or when this time passed since the first change (in seconds).
+	int rosterPushWindow;			// Roster pushes sent to user's server without result at once.
+	int rosterPushBatch;			// Buddies sent in one roster push.
+	bool prunePlugins;				// Unused libpurple plugins are destroyed after libpurple initialization.
+
 	std::string sqlHost;			// Database host.
 	std::string sqlPassword;		// Database password.
 	std::string sqlUser;			// Database user.
@@ -88,6 +110,11 @@ struct Configuration {
 	std::string sqlPrefix;			// Prefix for database tables.
 	std::string sqlType;			// Type of database.
 	std::string sqlCryptKey;
+	std::string sqliteProfile;		// "default" or "performance" (WAL journal and tuned pragmas).
+	int sqliteMmapSize;				// SQLite mmap_size in MB (performance profile).
+	int sqliteCacheSize;			// SQLite page cache size in MB (performance profile).
+	int sqliteCheckpointInterval;	// How often is WAL checkpointed (in seconds).
+	int sqliteMaintenanceInterval;	// How often are ANALYZE and incremental vacuum run (in seconds).
 	
 	std::string hash; 				// Version hash used for caps.
 	
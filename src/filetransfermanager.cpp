@@ -28,7 +28,7 @@
 #include "spectrum_util.h"
 #include "abstractuser.h"
 #include "abstractspectrumbuddy.h"
-#include "utf8.h"
+#include "textsanitizer.h"
 #include "capabilityhandler.h"
 #include "Poco/Format.h"
 
@@ -258,11 +258,10 @@ void FileTransferManager::handleXferFileReceiveRequest(PurpleXfer *xfer) {
 	std::string tempname(purple_xfer_get_filename(xfer));
 	std::string remote_user(purple_xfer_get_remote_user(xfer));
 
-	std::string filename;
-	filename.resize(tempname.size());
+	std::string filename(tempname);
 
 	// replace invalid characters
-	utf8::replace_invalid(tempname.begin(), tempname.end(), filename.begin(), '_');
+	sanitizeXMLText(filename, "_");
 	for (std::string::iterator it = filename.begin(); it != filename.end(); ++it) {
 		if (*it == '\\' || *it == '&' || *it == '/' || *it == '?' || *it == '*' || *it == ':') {
 			*it = '_';
@@ -273,7 +272,7 @@ void FileTransferManager::handleXferFileReceiveRequest(PurpleXfer *xfer) {
 	if (user != NULL) {
 		FiletransferRepeater *repeater = (FiletransferRepeater *) xfer->ui_data;
 		if (user->hasFeature(GLOOX_FEATURE_FILETRANSFER) && 
-			!user->getSetting<bool>("save_files_on_server") &&
+			!user->getSetting<bool>(SETTING_SAVE_FILES_ON_SERVER) &&
 			!Transport::instance()->getConfiguration().filetransferForceDir) {
 			// TODO: CHECK IF requestFT could be part of this class...
 			std::string sid = repeater->requestFT();
@@ -312,7 +311,7 @@ void FileTransferManager::handleXferFileReceiveComplete(PurpleXfer *xfer) {
 				url += dirs.back() + "/";
 				url += basename;
 				std::string message  = Poco::format(_("Received file '%s'.  You can download it at: %s"), basename, url );
-				Message s(Message::Chat, user->jid(), tr(user->getLang(), message));
+				Message s(Message::Chat, user->jid(), tr(user->getTranslation(), message));
 				s.setFrom(remote_user + "@" + Transport::instance()->jid() + "/bot");
 				Transport::instance()->send(s.tag());
 			}
@@ -193,6 +193,9 @@ class FiletransferRepeater {
 		// Returns filetransfer SID.
 		const std::string &getSID() { return m_sid; }
 
+		// Returns size of allocated data buffer.
+		size_t getBufferSize() { return m_max_buffer_size; }
+
 		// Callback which tells libpurple that UI is ready.
 		// MUST be called only by timer.
 		void ui_ready_callback();
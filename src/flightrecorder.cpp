@@ -0,0 +1,355 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "flightrecorder.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "glib.h"
+#include "gloox/jid.h"
+#include "gloox/iq.h"
+#include "transport.h"
+#include "usermanager.h"
+#include "user.h"
+#include "stanzawriter.h"
+
+FlightRecorderManager* FlightRecorderManager::m_pInstance = NULL;
+
+// Returns value of attribute `name` of the top-level element of serialized
+// stanza or empty string if there's no such attribute.
+static std::string getAttribute(const std::string &head, const char *name) {
+	std::string pattern = std::string(" ") + name + "=";
+	size_t pos = head.find(pattern);
+	if (pos == std::string::npos || pos + pattern.size() >= head.size())
+		return "";
+	pos += pattern.size();
+	char quote = head[pos];
+	size_t end = head.find(quote, pos + 1);
+	if ((quote != '\'' && quote != '"') || end == std::string::npos)
+		return "";
+	return head.substr(pos + 1, end - pos - 1);
+}
+
+// Returns description of stanza used as event detail.
+static std::string stanzaDetail(const std::string &name, const std::string &type, const std::string &peer, const std::string &id) {
+	std::string detail = type.empty() ? "-" : type;
+	if (!peer.empty())
+		detail += " " + peer;
+	if (name == "iq" && !id.empty())
+		detail += " id=" + id;
+	return detail;
+}
+
+static std::string bareJid(const std::string &jid) {
+	return JID(jid).bare();
+}
+
+FlightRecorder::FlightRecorder(unsigned int capacity) {
+	m_events.resize(capacity == 0 ? 1 : capacity);
+	m_next = 0;
+	m_count = 0;
+	m_recorded = 0;
+}
+
+FlightRecorder::~FlightRecorder() {
+}
+
+long long FlightRecorder::now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+const char *FlightRecorder::typeName(FlightEventType type) {
+	switch (type) {
+		case FLIGHT_STANZA_IN: return "in";
+		case FLIGHT_STANZA_SEND: return "send";
+		case FLIGHT_STANZA_OUT: return "out";
+		case FLIGHT_CALLBACK: return "callback";
+		case FLIGHT_SQL: return "sql";
+	}
+	return "unknown";
+}
+
+void FlightRecorder::record(FlightEventType type, const std::string &name, const std::string &detail, long long time) {
+	Event &e = m_events[m_next];
+	e.time = time ? time : now();
+	e.type = type;
+	e.name = name;
+	e.detail = detail;
+	m_next = (m_next + 1) % m_events.size();
+	if (m_count < m_events.size())
+		m_count++;
+	m_recorded++;
+}
+
+void FlightRecorder::clear() {
+	m_next = 0;
+	m_count = 0;
+}
+
+std::string FlightRecorder::dump() {
+	std::string out;
+	unsigned int first = (m_next + m_events.size() - m_count) % m_events.size();
+	long long previous = 0;
+	for (unsigned int i = 0; i < m_count; i++) {
+		Event &e = m_events[(first + i) % m_events.size()];
+		time_t seconds = (time_t) (e.time / 1000000);
+		struct tm tm;
+		localtime_r(&seconds, &tm);
+
+		char line[96];
+		long long delta = previous ? e.time - previous : 0;
+		snprintf(line, sizeof(line), "%02d:%02d:%02d.%06ld %+9.3f ms %-8s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+				 (long) (e.time % 1000000), delta / 1000.0, typeName(e.type));
+		out += line + e.name;
+		if (!e.detail.empty())
+			out += " " + e.detail;
+		out += "\n";
+		previous = e.time;
+	}
+	return out;
+}
+
+FlightRecorderManager::FlightRecorderManager() {
+	m_pInstance = this;
+}
+
+FlightRecorderManager::~FlightRecorderManager() {
+	for (std::map <std::string, FlightRecorder *>::iterator it = m_recorders.begin(); it != m_recorders.end(); it++)
+		delete (*it).second;
+	m_pInstance = NULL;
+}
+
+void FlightRecorderManager::enable(const std::string &jid, unsigned int size) {
+	std::string bare = bareJid(jid);
+	disable(bare);
+
+	if (size > FLIGHT_RECORDER_MAX_SIZE)
+		size = FLIGHT_RECORDER_MAX_SIZE;
+	m_recorders[bare] = new FlightRecorder(size);
+
+	// Storage backend knows only user's ID. Users without storage row yet
+	// (not registered) are mapped by setStorageId() when they log in.
+	UserManager *manager = Transport::instance()->userManager();
+	User *user = manager ? manager->getUserByJID(bare) : NULL;
+	if (user)
+		setStorageId(bare, user->storageId());
+	else {
+		UserRow row = Transport::instance()->sql()->getUserByJid(bare);
+		if (row.id != -1)
+			setStorageId(bare, row.id);
+	}
+	Log("FlightRecorder", "Recording events of " << bare);
+}
+
+bool FlightRecorderManager::disable(const std::string &jid) {
+	std::string bare = bareJid(jid);
+	std::map <std::string, FlightRecorder *>::iterator it = m_recorders.find(bare);
+	if (it == m_recorders.end())
+		return false;
+
+	removeStorageId(bare);
+	delete (*it).second;
+	m_recorders.erase(it);
+	Log("FlightRecorder", "Stopped recording events of " << bare);
+	return true;
+}
+
+void FlightRecorderManager::removeStorageId(const std::string &bare) {
+	for (std::map <long, std::string>::iterator s = m_storageIds.begin(); s != m_storageIds.end(); s++) {
+		if ((*s).second == bare) {
+			m_storageIds.erase(s);
+			break;
+		}
+	}
+}
+
+void FlightRecorderManager::setStorageId(const std::string &jid, long storageId) {
+	if (m_recorders.empty() || storageId == -1)
+		return;
+	std::string bare = bareJid(jid);
+	if (m_recorders.find(bare) == m_recorders.end())
+		return;
+	// User could have been unregistered and registered again with new ID.
+	removeStorageId(bare);
+	m_storageIds[storageId] = bare;
+}
+
+FlightRecorder *FlightRecorderManager::getRecorder(const std::string &jid) {
+	std::map <std::string, FlightRecorder *>::iterator it = m_recorders.find(bareJid(jid));
+	return it == m_recorders.end() ? NULL : (*it).second;
+}
+
+std::list <std::string> FlightRecorderManager::getJids() {
+	std::list <std::string> jids;
+	for (std::map <std::string, FlightRecorder *>::iterator it = m_recorders.begin(); it != m_recorders.end(); it++)
+		jids.push_back((*it).first);
+	return jids;
+}
+
+void FlightRecorderManager::record(const std::string &jid, FlightEventType type, const std::string &name, const std::string &detail) {
+	if (m_recorders.empty() || jid.empty())
+		return;
+	FlightRecorder *recorder = getRecorder(jid);
+	if (recorder)
+		recorder->record(type, name, detail);
+}
+
+void FlightRecorderManager::record(long storageId, FlightEventType type, const std::string &name, const std::string &detail) {
+	std::map <long, std::string>::iterator it = m_storageIds.find(storageId);
+	if (it != m_storageIds.end())
+		record((*it).second, type, name, detail);
+}
+
+void FlightRecorderManager::record(PurpleAccount *account, const std::string &name, const char *detail) {
+	UserManager *manager = Transport::instance()->userManager();
+	if (m_recorders.empty() || account == NULL || manager == NULL)
+		return;
+	User *user = (User *) manager->getUserByAccount(account);
+	if (user)
+		record(user->jid(), FLIGHT_CALLBACK, name, detail ? detail : "");
+}
+
+void FlightRecorderManager::recordSend(Tag *tag) {
+	const std::string &to = tag->findAttribute("to");
+	if (m_recorders.empty() || getRecorder(to) == NULL)
+		return;
+	std::string detail = stanzaDetail(tag->name(), tag->findAttribute("type"), tag->findAttribute("from"), tag->findAttribute("id"));
+	record(to, FLIGHT_STANZA_SEND, tag->name(), detail);
+}
+
+void FlightRecorderManager::recordSend(StanzaWriter &writer) {
+	if (m_recorders.empty() || getRecorder(writer.to()) == NULL)
+		return;
+	record(writer.to(), FLIGHT_STANZA_SEND, writer.name(), stanzaDetail(writer.name(), writer.type(), writer.from(), ""));
+}
+
+void FlightRecorderManager::handleLog(LogLevel level, LogArea area, const std::string &message) {
+	if (m_recorders.empty() || message.size() < 2 || message[0] != '<')
+		return;
+
+	// We need only the top-level element.
+	std::string head = message.substr(0, message.find('>'));
+	std::string name = head.substr(1, head.find_first_of(" /") - 1);
+	std::string from = getAttribute(head, "from");
+	std::string to = getAttribute(head, "to");
+
+	if (area == LogAreaXmlIncoming)
+		record(from, FLIGHT_STANZA_IN, name, stanzaDetail(name, getAttribute(head, "type"), to, getAttribute(head, "id")));
+	else if (area == LogAreaXmlOutgoing)
+		record(to, FLIGHT_STANZA_OUT, name, stanzaDetail(name, getAttribute(head, "type"), from, getAttribute(head, "id")));
+}
+
+bool FlightRecorderManager::handleCondition(Tag *stanzaTag) {
+	return stanzaTag->findChild("query", "xmlns", "http://spectrum.im/protocol/flight-recorder") != NULL;
+}
+
+Tag *FlightRecorderManager::handleTag(Tag *stanzaTag) {
+// 	recv:	<iq type='result'>
+// 				<query xmlns='http://spectrum.im/protocol/flight-recorder'>
+// 					<dump jid='user@example.com' events='2' recorded='2'>12:00:00.000100    +0.000 ms callback conv_write_im ...</dump>
+// 				</query>
+// 			</iq>
+// Query without children returns <recorder jid='...' events='...'/> for every enabled recorder.
+	Tag *query = stanzaTag->findChild("query");
+	if (query == NULL)
+		return NULL;
+
+	IQ _s(IQ::Result, stanzaTag->findAttribute("from"), stanzaTag->findAttribute("id"));
+	_s.setFrom(Transport::instance()->jid());
+	Tag *s = _s.tag();
+
+	Tag *response = new Tag("query");
+	response->setXmlns("http://spectrum.im/protocol/flight-recorder");
+	s->addChild(response);
+
+	if (query->children().empty()) {
+		for (std::map <std::string, FlightRecorder *>::iterator it = m_recorders.begin(); it != m_recorders.end(); it++) {
+			Tag *t = new Tag("recorder");
+			t->addAttribute("jid", (*it).first);
+			t->addAttribute("events", (long) (*it).second->size());
+			response->addChild(t);
+		}
+		return s;
+	}
+
+	Tag *command = query->children().front();
+	const std::string &jid = command->findAttribute("jid");
+	Tag *t = new Tag(command->name());
+	t->addAttribute("jid", jid);
+	response->addChild(t);
+
+	if (jid.empty()) {
+		Tag *error = new Tag("error", "Bad Request");
+		error->addAttribute("code", "400");
+		t->addChild(error);
+	}
+	else if (command->name() == "enable") {
+		int size = atoi(command->findAttribute("size").c_str());
+		enable(jid, size > 0 ? size : FLIGHT_RECORDER_SIZE);
+	}
+	else if (command->name() == "disable" && !disable(jid)) {
+		Tag *error = new Tag("error", "Not Found");
+		error->addAttribute("code", "404");
+		t->addChild(error);
+	}
+	else if (command->name() == "dump") {
+		FlightRecorder *recorder = getRecorder(jid);
+		if (recorder) {
+			t->addAttribute("events", (long) recorder->size());
+			t->addAttribute("recorded", (long) recorder->recorded());
+			t->setCData(recorder->dump());
+		}
+		else {
+			Tag *error = new Tag("error", "Not Found");
+			error->addAttribute("code", "404");
+			t->addChild(error);
+		}
+	}
+	return s;
+}
+
+FlightRecorderSQL::FlightRecorderSQL(long storageId, const char *name) {
+	m_storageId = storageId;
+	m_name = name;
+	m_start = FlightRecorderManager::active() ? FlightRecorder::now() : 0;
+}
+
+FlightRecorderSQL::FlightRecorderSQL(const std::string &jid, const char *name) {
+	m_storageId = -1;
+	m_name = name;
+	m_start = 0;
+	if (FlightRecorderManager::active()) {
+		m_jid = jid;
+		m_start = FlightRecorder::now();
+	}
+}
+
+FlightRecorderSQL::~FlightRecorderSQL() {
+	if (m_start == 0 || !FlightRecorderManager::active())
+		return;
+	char duration[32];
+	snprintf(duration, sizeof(duration), "%.3f ms", (FlightRecorder::now() - m_start) / 1000.0);
+	if (m_jid.empty())
+		FlightRecorderManager::instance()->record(m_storageId, FLIGHT_SQL, m_name, duration);
+	else
+		FlightRecorderManager::instance()->record(m_jid, FLIGHT_SQL, m_name, duration);
+}
@@ -0,0 +1,182 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_FLIGHT_RECORDER_H
+#define SPECTRUM_FLIGHT_RECORDER_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include "purple.h"
+#include "gloox/loghandler.h"
+#include "abstractconfiginterfacehandler.h"
+#include "log.h"
+
+using namespace gloox;
+
+extern LogClass Log_;
+
+class StanzaWriter;
+
+// Default and maximum number of events kept for one user.
+#define FLIGHT_RECORDER_SIZE 256
+#define FLIGHT_RECORDER_MAX_SIZE 65536
+
+typedef enum {	FLIGHT_STANZA_IN = 0,		// stanza received from XMPP server
+				FLIGHT_STANZA_SEND,			// stanza passed to Transport::send
+				FLIGHT_STANZA_OUT,			// stanza written to XMPP server
+				FLIGHT_CALLBACK,			// libpurple callback
+				FLIGHT_SQL,					// storage backend call
+				} FlightEventType;
+
+// Ring buffer of the last timestamped events of one user. When it's full,
+// the oldest event is overwritten.
+class FlightRecorder {
+	public:
+		FlightRecorder(unsigned int capacity = FLIGHT_RECORDER_SIZE);
+		~FlightRecorder();
+
+		// Records new event. `time` is in microseconds, if it's 0, current
+		// time is used.
+		void record(FlightEventType type, const std::string &name, const std::string &detail = "", long long time = 0);
+
+		// Returns number of events in buffer.
+		unsigned int size() { return m_count; }
+
+		// Returns number of events recorded since the recorder was created.
+		unsigned long recorded() { return m_recorded; }
+
+		// Returns recorded events, the oldest first, one per line. Every line
+		// contains time since the previous event, so it's visible where the
+		// time was spent.
+		std::string dump();
+
+		// Removes all events.
+		void clear();
+
+		static const char *typeName(FlightEventType type);
+
+		// Returns current time in microseconds.
+		static long long now();
+
+	private:
+		struct Event {
+			long long time;
+			FlightEventType type;
+			std::string name;
+			std::string detail;
+		};
+
+		std::vector <Event> m_events;
+		unsigned int m_next;			// where the next event will be stored
+		unsigned int m_count;
+		unsigned long m_recorded;
+};
+
+// Keeps flight recorders of users selected by admin and feeds them with
+// events. Recording is cheap when no recorder is enabled, so hooks can stay
+// in hot paths; use FlightRecorderManager::active() before building event
+// data.
+//
+// Stanzas are recorded as gloox logs them, so the manager has to be
+// registered as gloox LogHandler for LogAreaXmlIncoming | LogAreaXmlOutgoing.
+//
+// Recorders can be controlled through ConfigInterface:
+//
+//   <iq type='get'><query xmlns='http://spectrum.im/protocol/flight-recorder'><enable jid='user@example.com' size='256'/></query></iq>
+//   <iq type='get'><query xmlns='http://spectrum.im/protocol/flight-recorder'><dump jid='user@example.com'/></query></iq>
+//   <iq type='get'><query xmlns='http://spectrum.im/protocol/flight-recorder'><disable jid='user@example.com'/></query></iq>
+class FlightRecorderManager : public LogHandler, public AbstractConfigInterfaceHandler {
+	public:
+		FlightRecorderManager();
+		~FlightRecorderManager();
+
+		static FlightRecorderManager *instance() { return m_pInstance; }
+
+		// Returns true if there is at least one enabled recorder.
+		static bool active() { return m_pInstance && !m_pInstance->m_recorders.empty(); }
+
+		// Starts recording events of user with bare JID `jid`. If the recorder
+		// already exists, it's cleared.
+		void enable(const std::string &jid, unsigned int size = FLIGHT_RECORDER_SIZE);
+
+		// Stops recording and removes recorded events. Returns false if there
+		// was no recorder for this JID.
+		bool disable(const std::string &jid);
+
+		// Maps storage backend ID to user with bare JID `jid`, so storage
+		// calls with this ID are recorded. Called when user logs in; does
+		// nothing if the user has no enabled recorder.
+		void setStorageId(const std::string &jid, long storageId);
+
+		// Returns recorder of user or NULL if it's not enabled.
+		FlightRecorder *getRecorder(const std::string &jid);
+
+		// Returns list of JIDs with enabled recorder.
+		std::list <std::string> getJids();
+
+		// Records event of user with bare or full JID `jid`.
+		void record(const std::string &jid, FlightEventType type, const std::string &name, const std::string &detail = "");
+
+		// Records event of user with given storage backend ID.
+		void record(long storageId, FlightEventType type, const std::string &name, const std::string &detail = "");
+
+		// Records libpurple callback of account's user.
+		void record(PurpleAccount *account, const std::string &name, const char *detail = NULL);
+
+		// Records stanza passed to Transport::send.
+		void recordSend(Tag *tag);
+		void recordSend(StanzaWriter &writer);
+
+		// LogHandler
+		void handleLog(LogLevel level, LogArea area, const std::string &message);
+
+		// AbstractConfigInterfaceHandler
+		bool handleCondition(Tag *tag);
+		Tag *handleTag(Tag *tag);
+
+	private:
+		void removeStorageId(const std::string &bare);
+
+		std::map <std::string, FlightRecorder *> m_recorders;	// bare JID -> recorder
+		std::map <long, std::string> m_storageIds;				// storage ID -> bare JID
+		static FlightRecorderManager *m_pInstance;
+};
+
+// Records storage backend call with its duration into flight recorder of
+// the user with given storage ID or JID. Create it on stack at the beginning
+// of the call:
+//
+//   FlightRecorderSQL rec(userId, "addBuddy");
+class FlightRecorderSQL {
+	public:
+		FlightRecorderSQL(long storageId, const char *name);
+		FlightRecorderSQL(const std::string &jid, const char *name);
+		~FlightRecorderSQL();
+
+	private:
+		long m_storageId;
+		std::string m_jid;
+		const char *m_name;
+		long long m_start;
+};
+
+#endif
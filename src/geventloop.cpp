@@ -19,29 +19,17 @@
  */
 
 #include "geventloop.h"
-#include "transport_config.h"
-#include "transport.h"
 #ifdef _WIN32
 #include "win32/win32dep.h"
 #endif
 #ifdef WITH_LIBEVENT
-#include "ev.h"
+#include <math.h>
 #endif
 
-static struct ev_loop *loop;
-
 typedef struct _PurpleIOClosure {
-	// This has to be first member of this struct because of casting
-#ifdef WITH_LIBEVENT
-	struct ev_io io;
-#endif
 	PurpleInputFunction function;
 	guint result;
 	gpointer data;
-#ifdef WITH_LIBEVENT
-	GSourceFunc function2;
-	struct ev_timer timer;
-#endif
 } PurpleIOClosure;
 
 static gboolean io_invoke(GIOChannel *source,
@@ -128,26 +116,128 @@ static PurpleEventLoopUiOps eventLoopOps =
 
 #ifdef WITH_LIBEVENT
 
+// Closure of libev watcher. Only one of the watchers is used.
+typedef struct _EventClosure {
+	// This has to be first member of this struct because of casting
+	struct ev_io io;
+	struct ev_timer timer;
+	guint id;
+	PurpleInputFunction function;
+	GSourceFunc function2;
+	gpointer data;
+	bool pending;			// Added from other thread, not started yet.
+} EventClosure;
+
+static struct ev_loop *loop = NULL;
+static GThread *mainThread = NULL;
+static struct ev_async wakeup;
+
+// All watchers by ID. IDs are never reused, so callback can find out
+// if its watcher has been removed in the meantime.
 static GHashTable *events = NULL;
-static unsigned long id = 0;
+static guint lastId = 0;
+
+// Timers added from other threads, started by wakeup watcher in main thread.
+static GSList *pendingTimers = NULL;
+// Watchers removed from other threads. libev watchers can be stopped only in
+// main thread and the closure can be just dispatched there, so both stopping
+// and freeing is done by wakeup watcher.
+static GSList *pendingRemovals = NULL;
+static GStaticMutex eventsMutex = G_STATIC_MUTEX_INIT;
+
+static guint event_register(EventClosure *closure) {
+	if (++lastId == 0)
+		lastId = 1;
+	closure->id = lastId;
+	g_hash_table_insert(events, GUINT_TO_POINTER(closure->id), closure);
+	return closure->id;
+}
 
-static void event_io_destroy(gpointer data)
-{
-	PurpleIOClosure *closure = (PurpleIOClosure* )data;
+static EventClosure *event_lookup(guint handle) {
+	g_static_mutex_lock(&eventsMutex);
+	EventClosure *closure = (EventClosure *) g_hash_table_lookup(events, GUINT_TO_POINTER(handle));
+	g_static_mutex_unlock(&eventsMutex);
+	return closure;
+}
+
+static gboolean event_remove(guint handle) {
+	g_static_mutex_lock(&eventsMutex);
+	EventClosure *closure = (EventClosure *) g_hash_table_lookup(events, GUINT_TO_POINTER(handle));
+	if (closure == NULL) {
+		g_static_mutex_unlock(&eventsMutex);
+		return FALSE;
+	}
+	g_hash_table_remove(events, GUINT_TO_POINTER(handle));
+	if (closure->pending) {
+		// Not started yet, so nobody else can use it.
+		pendingTimers = g_slist_remove(pendingTimers, closure);
+		g_static_mutex_unlock(&eventsMutex);
+		g_free(closure);
+		return TRUE;
+	}
+	if (g_thread_self() != mainThread) {
+		pendingRemovals = g_slist_prepend(pendingRemovals, closure);
+		ev_async_send(loop, &wakeup);
+		g_static_mutex_unlock(&eventsMutex);
+		return TRUE;
+	}
+	g_static_mutex_unlock(&eventsMutex);
+
+	// Stopping watcher which hasn't been started is no-op.
 	ev_io_stop(loop, &closure->io);
 	ev_timer_stop(loop, &closure->timer);
-	g_free(data);
+	g_free(closure);
+	return TRUE;
+}
+
+static void event_wakeup_invoke(struct ev_loop *l, struct ev_async *w, int event) {
+	g_static_mutex_lock(&eventsMutex);
+	for (GSList *it = pendingTimers; it != NULL; it = it->next) {
+		EventClosure *closure = (EventClosure *) it->data;
+		closure->pending = false;
+		ev_timer_start(l, &closure->timer);
+	}
+	g_slist_free(pendingTimers);
+	pendingTimers = NULL;
+
+	for (GSList *it = pendingRemovals; it != NULL; it = it->next) {
+		EventClosure *closure = (EventClosure *) it->data;
+		ev_io_stop(l, &closure->io);
+		ev_timer_stop(l, &closure->timer);
+		g_free(closure);
+	}
+	g_slist_free(pendingRemovals);
+	pendingRemovals = NULL;
+	g_static_mutex_unlock(&eventsMutex);
 }
 
 static void event_timer_invoke(struct ev_loop *l, struct ev_timer *w, int event) {
-	PurpleIOClosure *closure = (PurpleIOClosure *) (((char *)w) - offsetof (PurpleIOClosure, timer));
-	if (!closure->function2(closure->data)) {
-		ev_timer_stop(l, w);
+	EventClosure *closure = (EventClosure *) (((char *)w) - offsetof (EventClosure, timer));
+	guint id = closure->id;
+	// Removed from other thread, but not stopped by wakeup watcher yet.
+	if (event_lookup(id) == NULL)
+		return;
+	gboolean again = closure->function2(closure->data);
+
+	// Callback could remove its own timer.
+	if (event_lookup(id) == NULL)
+		return;
+
+	if (!again) {
+		event_remove(id);
+	}
+	else if (!ev_is_active(w)) {
+		// timers with zero interval are not repeated by libev
+		ev_timer_set(w, 0., 0.);
+		ev_timer_start(l, w);
 	}
 }
 
 static void event_io_invoke(struct ev_loop *l, struct ev_io *w, int event) {
-	PurpleIOClosure *closure = (PurpleIOClosure* )w;
+	EventClosure *closure = (EventClosure* )w;
+	// Removed from other thread, but not stopped by wakeup watcher yet.
+	if (event_lookup(closure->id) == NULL)
+		return;
 	PurpleInputCondition purple_cond = (PurpleInputCondition)0;
 	int tmp = 0;
 	if (event & EV_READ)
@@ -164,21 +254,13 @@ static void event_io_invoke(struct ev_loop *l, struct ev_io *w, int event) {
 	closure->function(closure->data, w->fd, purple_cond);
 }
 
-static gboolean event_input_remove(guint handle)
-{
-	PurpleIOClosure *closure = (PurpleIOClosure *) g_hash_table_lookup(events, &handle);
-	if (closure) {
-		event_io_destroy(closure);
-	}
-	return TRUE;
-}
-
+// Inputs can be added only from main thread.
 static guint event_input_add(gint fd,
 								PurpleInputCondition condition,
 								PurpleInputFunction function,
 								gpointer data)
 {
-	PurpleIOClosure *closure = g_new0(PurpleIOClosure, 1);
+	EventClosure *closure = g_new0(EventClosure, 1);
 	closure->function = function;
 	closure->data = data;
 
@@ -193,59 +275,113 @@ static guint event_input_add(gint fd,
 	}
 
 	ev_io_init(&closure->io, event_io_invoke, fd, tmp);
-	ev_io_start(loop, &closure->io);
 
-	int *f = (int *) g_malloc(sizeof(int));
-	*f = id++;
-	g_hash_table_replace(events, f, closure);
-	
-	return *f;
+	g_static_mutex_lock(&eventsMutex);
+	guint id = event_register(closure);
+	g_static_mutex_unlock(&eventsMutex);
+
+	ev_io_start(loop, &closure->io);
+	return id;
 }
 
-static guint event_timeout_add (guint interval, GSourceFunc function, gpointer data) {
-	struct timeval timeout;
-	PurpleIOClosure *closure = g_new0(PurpleIOClosure, 1);
+// Timeouts can be added also from other threads (DNS resolver, file transfers).
+static guint event_timer_add(ev_tstamp after, ev_tstamp repeat, GSourceFunc function, gpointer data) {
+	EventClosure *closure = g_new0(EventClosure, 1);
 	closure->function2 = function;
 	closure->data = data;
+	ev_timer_init(&closure->timer, event_timer_invoke, after, repeat);
+
+	g_static_mutex_lock(&eventsMutex);
+	guint id = event_register(closure);
+	if (g_thread_self() == mainThread) {
+		ev_timer_start(loop, &closure->timer);
+	}
+	else {
+		closure->pending = true;
+		pendingTimers = g_slist_prepend(pendingTimers, closure);
+		ev_async_send(loop, &wakeup);
+	}
+	g_static_mutex_unlock(&eventsMutex);
+	return id;
+}
 
-	ev_timer_init (&closure->timer, event_timer_invoke, (double)(interval) / 1000, (double)(interval) / 1000);
-	ev_timer_start (loop, &closure->timer);
-	
-	guint *f = (guint *) g_malloc(sizeof(guint));
-	*f = id++;
-	g_hash_table_replace(events, f, closure);
-	return *f;
+static guint event_timeout_add(guint interval, GSourceFunc function, gpointer data) {
+	return event_timer_add((ev_tstamp) interval / 1000, (ev_tstamp) interval / 1000, function, data);
+}
+
+static guint event_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data) {
+	// Like g_timeout_add_seconds, fire on whole seconds, so all these timers
+	// are handled in one loop iteration. It can be up to 1 second late.
+	ev_tstamp after = interval + 1. - fmod(ev_now(loop), 1.);
+	return event_timer_add(after, interval, function, data);
 }
 
 static PurpleEventLoopUiOps libEventLoopOps =
 {
 	event_timeout_add,
-	event_input_remove,
+	event_remove,
 	event_input_add,
-	event_input_remove,
-	NULL,
-// #if GLIB_CHECK_VERSION(2,14,0)
-// 	g_timeout_add_seconds,
-// #else
+	event_remove,
 	NULL,
-// #endif
+	event_timeout_add_seconds,
 
 	NULL,
 	NULL,
 	NULL
 };
 
-#endif /* WITH_LIBEVENT*/
-
-PurpleEventLoopUiOps * getEventLoopUiOps(){
-	if (CONFIG().eventloop == "glib")
-		return &eventLoopOps;
-#ifdef WITH_LIBEVENT
-	events = g_hash_table_new_full(g_int_hash, g_int_equal, g_free, NULL);
-	return &libEventLoopOps;
-#endif
+struct ev_loop *createEventLoop(const std::string &eventloop) {
+	unsigned int flags = EVFLAG_AUTO;
+	if (eventloop == "epoll")
+		flags = EVBACKEND_EPOLL;
+	else if (eventloop == "kqueue")
+		flags = EVBACKEND_KQUEUE;
+
+	struct ev_loop *l = ev_default_loop(flags);
+	if (l == NULL && flags != EVFLAG_AUTO)
+		l = ev_default_loop(EVFLAG_AUTO);
+	return l;
 }
 
 void setLoop(struct ev_loop *l) {
 	loop = l;
+	if (loop == NULL)
+		return;
+	mainThread = g_thread_self();
+	if (events == NULL)
+		events = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	ev_async_init(&wakeup, event_wakeup_invoke);
+	ev_async_start(loop, &wakeup);
+	// wakeup watcher alone shouldn't keep loop running
+	ev_unref(loop);
+}
+
+std::string getEventLoopBackend(struct ev_loop *l) {
+	switch (ev_backend(l)) {
+		case EVBACKEND_SELECT:
+			return "select";
+		case EVBACKEND_POLL:
+			return "poll";
+		case EVBACKEND_EPOLL:
+			return "epoll";
+		case EVBACKEND_KQUEUE:
+			return "kqueue";
+		case EVBACKEND_DEVPOLL:
+			return "devpoll";
+		case EVBACKEND_PORT:
+			return "port";
+		default:
+			return "unknown";
+	}
+}
+
+#endif /* WITH_LIBEVENT*/
+
+PurpleEventLoopUiOps * getEventLoopUiOps(const std::string &eventloop){
+#ifdef WITH_LIBEVENT
+	if (eventloop != "glib" && loop != NULL)
+		return &libEventLoopOps;
+#endif
+	return &eventLoopOps;
 }
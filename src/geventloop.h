@@ -21,15 +21,32 @@
 #ifndef _HI_EVENTLOOP_H
 #define _HI_EVENTLOOP_H
 
+#include <string>
 #include <glib.h>
 #include "purple.h"
 #include "eventloop.h"
+#include "transport_config.h"
+#ifdef WITH_LIBEVENT
 #include "ev.h"
+#endif
 
 #define READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
 #define WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
 
-PurpleEventLoopUiOps * getEventLoopUiOps();
+// Returns libpurple eventloop ops for `eventloop` ("glib" or libev backend).
+// Libev ops can be used only after setLoop() has been called.
+PurpleEventLoopUiOps * getEventLoopUiOps(const std::string &eventloop = "glib");
+
+#ifdef WITH_LIBEVENT
+// Creates default libev loop. `eventloop` is name of preferred backend ("epoll",
+// "kqueue"); if it's not available, the best available backend is used.
+struct ev_loop *createEventLoop(const std::string &eventloop);
+
+// Sets libev loop used by libev ops. Has to be called from main thread.
 void setLoop(struct ev_loop *loop = NULL);
 
+// Returns name of backend used by libev loop.
+std::string getEventLoopBackend(struct ev_loop *loop);
+#endif
+
 #endif
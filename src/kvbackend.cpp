@@ -0,0 +1,570 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "kvbackend.h"
+#include "main.h"
+#include "log.h"
+#include "spectrumbuddy.h"
+#include "spectrumtimer.h"
+#include "spectrum_util.h"
+#include "transport.h"
+#include "flightrecorder.h"
+#include "probelimiter.h"
+#include "protocols/abstractprotocol.h"
+#include <algorithm>
+#include <set>
+
+static gboolean compactStore(gpointer data) {
+	KVBackend *backend = (KVBackend *) data;
+	backend->compact();
+	return TRUE;
+}
+
+static gboolean flushRecords(gpointer data) {
+	KVBackend *backend = (KVBackend *) data;
+	backend->flush();
+	return FALSE;
+}
+
+static PurpleValue *createValue(const KVSetting &setting) {
+	PurpleValue *value = NULL;
+	switch ((PurpleType) setting.type) {
+		case PURPLE_TYPE_BOOLEAN:
+			value = purple_value_new(PURPLE_TYPE_BOOLEAN);
+			purple_value_set_boolean(value, atoi(setting.value.c_str()));
+		break;
+		case PURPLE_TYPE_STRING:
+			value = purple_value_new(PURPLE_TYPE_STRING);
+			purple_value_set_string(value, setting.value.c_str());
+		break;
+		default:
+			break;
+	}
+	return value;
+}
+
+KVBackend::KVBackend(GlooxMessageHandler *parent) {
+	p = parent;
+	m_loaded = false;
+	m_transaction = 0;
+	m_buddies = 0;
+	m_compactTimer = new SpectrumTimer(600000, compactStore, this);
+	m_flushTimer = new SpectrumTimer(KV_FLUSH_INTERVAL, flushRecords, this);
+	m_store = new KVStore(p->configuration().sqlDb);
+
+	if (!m_store->open()) {
+		Log("KV ERROR", m_store->getLastError());
+		return;
+	}
+	if (!m_store->getLastError().empty())
+		Log("KV", m_store->getLastError());
+
+	std::vector <std::string> ids = m_store->keys(KV_ID_PREFIX);
+	for (std::vector <std::string>::iterator it = ids.begin(); it != ids.end(); it++) {
+		std::string jid;
+		if (m_store->get(*it, jid))
+			m_ids[atol(it->substr(strlen(KV_ID_PREFIX)).c_str())] = jid;
+	}
+
+	std::string buddies;
+	if (m_store->get(KV_BUDDIES_COUNT, buddies))
+		m_buddies = atol(buddies.c_str());
+
+	Log("KV", "Loaded " << m_ids.size() << " users from " << m_store->getPath());
+	m_loaded = true;
+	m_compactTimer->start();
+}
+
+KVBackend::~KVBackend() {
+	flush();
+	delete m_compactTimer;
+	delete m_flushTimer;
+	delete m_store;
+}
+
+long KVBackend::nextId(const std::string &key) {
+	std::string value;
+	long id = 1;
+	if (m_store->get(key, value))
+		id = atol(value.c_str());
+	m_store->put(key, stringOf(id + 1));
+	return id;
+}
+
+bool KVBackend::read(long userId, KVUserRecord &r) {
+	std::map <long, KVUserRecord>::iterator it = m_dirty.find(userId);
+	if (it != m_dirty.end()) {
+		r = it->second;
+		return true;
+	}
+
+	std::map <long, std::string>::iterator id = m_ids.find(userId);
+	if (id == m_ids.end())
+		return false;
+
+	std::string data;
+	if (!m_store->get(KV_USER_PREFIX + id->second, data))
+		return false;
+	if (!r.parse(data)) {
+		Log("KV ERROR", "Broken record of user " << id->second);
+		return false;
+	}
+	return true;
+}
+
+KVUserRecord *KVBackend::record(long userId) {
+	std::map <long, KVUserRecord>::iterator it = m_dirty.find(userId);
+	if (it != m_dirty.end())
+		return &it->second;
+
+	KVUserRecord r;
+	if (!read(userId, r))
+		return NULL;
+
+	m_buddiesCount[userId] = r.buddies.size();
+	return &(m_dirty[userId] = r);
+}
+
+void KVBackend::changed() {
+	// Every write rewrites whole user record, so changes done outside of
+	// transaction are collected and written together.
+	if (m_transaction == 0)
+		m_flushTimer->start();
+}
+
+void KVBackend::flush() {
+	m_flushTimer->stop();
+	if (m_dirty.empty() && m_online.empty())
+		return;
+
+	m_store->beginBatch();
+	for (std::map <std::string, bool>::iterator it = m_online.begin(); it != m_online.end(); it++) {
+		if (it->second)
+			m_store->put(KV_ONLINE_PREFIX + it->first, "");
+		else
+			m_store->remove(KV_ONLINE_PREFIX + it->first);
+	}
+	for (std::map <long, KVUserRecord>::iterator it = m_dirty.begin(); it != m_dirty.end(); it++) {
+		m_store->put(KV_USER_PREFIX + it->second.jid, it->second.serialize());
+		m_buddies += (long) it->second.buddies.size() - (long) m_buddiesCount[it->first];
+	}
+	m_store->put(KV_BUDDIES_COUNT, stringOf(m_buddies));
+	if (!m_store->commitBatch())
+		Log("KV ERROR", m_store->getLastError());
+
+	m_dirty.clear();
+	m_buddiesCount.clear();
+	m_online.clear();
+}
+
+UserRow KVBackend::toUserRow(const KVUserRecord &record) {
+	UserRow user;
+	user.id = record.id;
+	user.jid = record.jid;
+	user.uin = record.uin;
+	user.password = record.password;
+	user.language = record.language;
+	user.encoding = record.encoding;
+	user.vip = record.vip;
+	return user;
+}
+
+void KVBackend::addUser(const UserRow &user) {
+	if (m_store->contains(KV_USER_PREFIX + user.jid)) {
+		Log("KV ERROR", "User " << user.jid << " already exists");
+		return;
+	}
+
+	KVUserRecord r;
+	r.jid = user.jid;
+	r.uin = user.uin;
+	r.password = user.password;
+	r.language = user.language;
+	r.encoding = user.encoding;
+	r.vip = user.vip;
+
+	m_store->beginBatch();
+	r.id = nextId(KV_NEXT_USER_ID);
+	m_store->put(KV_USER_PREFIX + r.jid, r.serialize());
+	m_store->put(KV_ID_PREFIX + stringOf(r.id), r.jid);
+	if (!m_store->commitBatch()) {
+		Log("KV ERROR", m_store->getLastError());
+		return;
+	}
+	m_ids[r.id] = r.jid;
+
+	// This JID could be cached as unregistered, so forget it.
+	if (p->probeLimiter())
+		p->probeLimiter()->forget(r.jid);
+}
+
+void KVBackend::removeUser(long userId) {
+	FlightRecorderSQL rec(userId, "removeUser");
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+
+	std::string jid = r->jid;
+	m_buddies -= m_buddiesCount[userId];
+	m_dirty.erase(userId);
+	m_buddiesCount.erase(userId);
+	m_online.erase(jid);
+
+	m_store->beginBatch();
+	m_store->remove(KV_USER_PREFIX + jid);
+	m_store->remove(KV_ID_PREFIX + stringOf(userId));
+	m_store->remove(KV_ONLINE_PREFIX + jid);
+	m_store->put(KV_BUDDIES_COUNT, stringOf(m_buddies));
+	if (!m_store->commitBatch())
+		Log("KV ERROR", m_store->getLastError());
+	m_ids.erase(userId);
+}
+
+void KVBackend::updateUser(const UserRow &user) {
+	FlightRecorderSQL rec(user.id, "updateUser");
+	UserRow res = getUserByJid(user.jid);
+	if (res.id == -1)
+		return;
+	KVUserRecord *r = record(res.id);
+	if (!r)
+		return;
+	r->password = user.password;
+	r->language = user.language;
+	r->encoding = user.encoding;
+	r->vip = user.vip;
+	changed();
+}
+
+UserRow KVBackend::getUserByJid(const std::string &jid) {
+	FlightRecorderSQL rec(jid, "getUserByJid");
+	UserRow user;
+	user.id = -1;
+	user.vip = 0;
+
+	std::string data;
+	KVUserRecord r;
+	if (!m_store->get(KV_USER_PREFIX + jid, data) || !r.parse(data))
+		return user;
+
+	// Record can be changed in current transaction.
+	std::map <long, KVUserRecord>::iterator it = m_dirty.find(r.id);
+	if (it != m_dirty.end())
+		return toUserRow(it->second);
+	return toUserRow(r);
+}
+
+std::map<std::string, UserRow> KVBackend::getUsersByJid(const std::string &jid) {
+	std::map<std::string, UserRow> users;
+	// Users with server routing have "jid%server" key, see AbstractProtocol::userKey.
+	std::vector <std::string> keys = m_store->keys(KV_USER_PREFIX + jid + "%");
+	for (std::vector <std::string>::iterator it = keys.begin(); it != keys.end(); it++) {
+		UserRow user = getUserByJid(it->substr(strlen(KV_USER_PREFIX)));
+		if (user.id != -1)
+			users[user.jid] = user;
+	}
+	return users;
+}
+
+void KVBackend::addUserServer(long userId, const std::string &jid, const std::string &server) {
+	// Users are found by "jid%" prefix, the row is kept only so it survives
+	// migration back to SQL.
+	KVUserRecord *r = record(userId);
+	if (!r || !r->serverJid.empty())
+		return;
+	r->serverJid = jid;
+	r->server = server;
+	changed();
+}
+
+long KVBackend::addBuddy(long userId, const std::string &uin, const std::string &subscription, const std::string &group, const std::string &nickname, int flags) {
+	FlightRecorderSQL rec(userId, "addBuddy");
+	std::string u(uin);
+	p->protocol()->prepareUsername(u);
+
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return -1;
+
+	m_store->beginBatch();
+	std::map <std::string, KVBuddy>::iterator it = r->buddies.find(u);
+	if (it == r->buddies.end()) {
+		it = r->buddies.insert(std::make_pair(u, KVBuddy())).first;
+		it->second.id = nextId(KV_NEXT_BUDDY_ID);
+		it->second.uin = u;
+	}
+	KVBuddy &buddy = it->second;
+	buddy.subscription = subscription;
+	buddy.group = group;
+	buddy.nickname = nickname;
+	buddy.flags = flags;
+	long id = buddy.id;
+	changed();
+	if (!m_store->commitBatch())
+		Log("KV ERROR", m_store->getLastError());
+	return id;
+}
+
+void KVBackend::updateBuddySubscription(long userId, const std::string &uin, const std::string &subscription) {
+	FlightRecorderSQL rec(userId, "updateBuddySubscription");
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+	std::map <std::string, KVBuddy>::iterator it = r->buddies.find(uin);
+	if (it != r->buddies.end()) {
+		it->second.subscription = subscription;
+		changed();
+	}
+}
+
+void KVBackend::removeBuddy(long userId, const std::string &uin, long buddy_id) {
+	FlightRecorderSQL rec(userId, "removeBuddy");
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+	if (r->buddies.erase(uin) == 0 && buddy_id != 0) {
+		KVBuddy *buddy = r->findBuddy(buddy_id);
+		if (buddy)
+			r->buddies.erase(buddy->uin);
+	}
+	changed();
+}
+
+void KVBackend::addBuddySetting(long userId, long buddyId, const std::string &key, const std::string &value, PurpleType type) {
+	FlightRecorderSQL rec(userId, "addBuddySetting");
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+	KVBuddy *buddy = r->findBuddy(buddyId);
+	if (!buddy)
+		return;
+	KVSetting &setting = buddy->settings[key];
+	setting.type = type;
+	setting.value = value;
+	changed();
+}
+
+GHashTable *KVBackend::getBuddies(long userId, PurpleAccount *account) {
+	FlightRecorderSQL rec(userId, "getBuddies");
+	GHashTable *roster = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	KVUserRecord r;
+	if (!read(userId, r))
+		return roster;
+
+	// Sort buddies by id, so they are added in the same order as with SQL backend.
+	std::map <long, KVBuddy *> buddies;
+	for (std::map <std::string, KVBuddy>::iterator it = r.buddies.begin(); it != r.buddies.end(); it++)
+		buddies[it->second.id] = &it->second;
+
+	for (std::map <long, KVBuddy *>::iterator it = buddies.begin(); it != buddies.end(); it++) {
+		KVBuddy &b = *it->second;
+		std::string preparedUin(b.uin);
+		Transport::instance()->protocol()->prepareUsername(preparedUin, account);
+
+		if (b.uin.empty() || std::count(b.uin.begin(), b.uin.end(), '@') > 1 || g_hash_table_lookup(roster, preparedUin.c_str()) != NULL
+			|| !g_utf8_validate(b.uin.c_str(), -1, NULL))
+			continue;
+
+		std::string subscription = b.subscription.empty() ? "ask" : b.subscription;
+		std::string group = b.group.empty() ? "Buddies" : b.group;
+		PurpleGroup *g = purple_find_group(group.c_str());
+		if (!g) {
+			g = purple_group_new(group.c_str());
+			purple_blist_add_group(g, NULL);
+		}
+
+		PurpleBuddy *buddy = purple_find_buddy_in_group(account, b.uin.c_str(), g);
+		if (!buddy) {
+			PurpleContact *contact = purple_contact_new();
+			purple_blist_add_contact(contact, g, NULL);
+
+			buddy = purple_buddy_new(account, b.uin.c_str(), b.nickname.c_str());
+			purple_blist_add_buddy(buddy, contact, g, NULL);
+			purple_blist_server_alias_buddy(buddy, b.nickname.c_str());
+			Log("ADDING BUDDY", b.id << " " << b.uin << " " << b.nickname << " subscription: " << subscription << " " << buddy);
+
+			GHashTable *settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) purple_value_destroy);
+			for (std::map <std::string, KVSetting>::iterator s = b.settings.begin(); s != b.settings.end(); s++) {
+				PurpleValue *value = createValue(s->second);
+				if (value)
+					g_hash_table_replace(settings, g_strdup(s->first.c_str()), value);
+			}
+			g_hash_table_destroy(buddy->node.settings);
+			buddy->node.settings = settings;
+		}
+
+		if (!buddy->node.ui_data) {
+			buddy->node.ui_data = (void *) new SpectrumBuddy(b.id, buddy);
+			SpectrumBuddy *s_buddy = (SpectrumBuddy *) buddy->node.ui_data;
+			s_buddy->setSubscription(subscription);
+			s_buddy->setFlags(b.flags);
+		}
+		g_hash_table_replace(roster, g_strdup(preparedUin.c_str()), buddy->node.ui_data);
+
+		GSList *list;
+		for (list = purple_find_buddies(account, b.uin.c_str()); list; list = g_slist_delete_link(list, list)) {
+			PurpleBuddy *buddy = (PurpleBuddy *) list->data;
+			if (!buddy->node.ui_data) {
+				buddy->node.ui_data = (void *) new SpectrumBuddy(b.id, buddy);
+				SpectrumBuddy *s_buddy = (SpectrumBuddy *) buddy->node.ui_data;
+				s_buddy->setSubscription(subscription);
+				s_buddy->setFlags(b.flags);
+			}
+		}
+	}
+
+	return roster;
+}
+
+std::list <std::string> KVBackend::getBuddies(long userId) {
+	FlightRecorderSQL rec(userId, "getBuddies");
+	std::list <std::string> list;
+	KVUserRecord r;
+	if (!read(userId, r))
+		return list;
+
+	for (std::map <std::string, KVBuddy>::iterator it = r.buddies.begin(); it != r.buddies.end(); it++) {
+		std::string uin = it->second.uin;
+		if (it->second.flags & SPECTRUM_BUDDY_JID_ESCAPING) {
+			list.push_back(JID::escapeNode(uin));
+		}
+		else {
+			std::for_each( uin.begin(), uin.end(), replaceBadJidCharacters() );
+			list.push_back(uin);
+		}
+	}
+	return list;
+}
+
+void KVBackend::addSetting(long userId, const std::string &key, const std::string &value, PurpleType type) {
+	FlightRecorderSQL rec(userId, "addSetting");
+	if (userId == 0) {
+		Log("KV ERROR", "Trying to add user setting with user_id = 0: " << key);
+		return;
+	}
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+	KVSetting &setting = r->settings[key];
+	setting.type = type;
+	setting.value = value;
+	changed();
+}
+
+void KVBackend::updateSetting(long userId, const std::string &key, const std::string &value) {
+	FlightRecorderSQL rec(userId, "updateSetting");
+	KVUserRecord *r = record(userId);
+	if (!r)
+		return;
+	std::map <std::string, KVSetting>::iterator it = r->settings.find(key);
+	if (it != r->settings.end()) {
+		it->second.value = value;
+		changed();
+	}
+}
+
+GHashTable *KVBackend::getSettings(long userId) {
+	FlightRecorderSQL rec(userId, "getSettings");
+	GHashTable *settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) purple_value_destroy);
+	KVUserRecord r;
+	if (!read(userId, r))
+		return settings;
+
+	for (std::map <std::string, KVSetting>::iterator it = r.settings.begin(); it != r.settings.end(); it++) {
+		PurpleValue *value = createValue(it->second);
+		if (value)
+			g_hash_table_replace(settings, g_strdup(it->first.c_str()), value);
+	}
+	return settings;
+}
+
+std::vector<std::string> KVBackend::getOnlineUsers() {
+	std::vector<std::string> keys = m_store->keys(KV_ONLINE_PREFIX);
+	std::set<std::string> users;
+	for (std::vector<std::string>::iterator it = keys.begin(); it != keys.end(); it++)
+		users.insert(it->substr(strlen(KV_ONLINE_PREFIX)));
+	// changes which are not written yet
+	for (std::map <std::string, bool>::iterator it = m_online.begin(); it != m_online.end(); it++) {
+		if (it->second)
+			users.insert(it->first);
+		else
+			users.erase(it->first);
+	}
+	return std::vector<std::string>(users.begin(), users.end());
+}
+
+void KVBackend::setUserOnline(long userId, bool online) {
+	FlightRecorderSQL rec(userId, "setUserOnline");
+	std::map <long, std::string>::iterator it = m_ids.find(userId);
+	if (it == m_ids.end())
+		return;
+	// Online flag is written with other changes, so users connecting at once
+	// don't mean one synced write for each of them.
+	m_online[it->second] = online;
+	changed();
+}
+
+void KVBackend::beginTransaction() {
+	if (m_transaction++ == 0)
+		m_store->beginBatch();
+}
+
+void KVBackend::commitTransaction() {
+	if (m_transaction == 0)
+		return;
+	if (--m_transaction == 0) {
+		flush();
+		if (!m_store->commitBatch())
+			Log("KV ERROR", m_store->getLastError());
+	}
+}
+
+long KVBackend::getRegisteredUsersCount() {
+	return m_ids.size();
+}
+
+long KVBackend::getRegisteredUsersRosterCount() {
+	return m_buddies;
+}
+
+void KVBackend::getStats(std::map <std::string, BackendStat> &stats) {
+	stats["kv/records"].units = "records";
+	stats["kv/records"].value = m_store->size();
+	stats["kv/live-bytes"].units = "bytes";
+	stats["kv/live-bytes"].value = m_store->getLiveBytes();
+	stats["kv/dead-bytes"].units = "bytes";
+	stats["kv/dead-bytes"].value = m_store->getDeadBytes();
+	stats["kv/batches"].units = "batches";
+	stats["kv/batches"].value = m_store->getBatches();
+}
+
+bool KVBackend::compact() {
+	if (m_transaction != 0 || !m_store->needsCompaction())
+		return false;
+
+	Log("KV", "Compacting " << m_store->getPath() << ", " << m_store->getDeadBytes() << " bytes of old data");
+	if (!m_store->compact()) {
+		Log("KV ERROR", "Compaction failed: " << m_store->getLastError());
+		if (!m_store->isOpen())
+			m_store->open();
+		return false;
+	}
+	Log("KV", "Compaction done, store has " << m_store->getLiveBytes() << " bytes");
+	return true;
+}
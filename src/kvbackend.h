@@ -0,0 +1,111 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_KVBACKEND_H
+#define SPECTRUM_KVBACKEND_H
+
+#include <string>
+#include <map>
+#include "abstractbackend.h"
+#include "kvstore.h"
+
+class GlooxMessageHandler;
+class SpectrumTimer;
+
+// Changed records are written at most this often (in ms) outside of transaction.
+#define KV_FLUSH_INTERVAL 1000
+
+// Storage backend which uses embedded KVStore instead of SQL database. It's
+// used when "type=kv" is set in [database] section, "database" option is then
+// path to the store file. Whole user (roster, buddies settings and user
+// settings) is stored in one record, so user is loaded by one read.
+//
+// Changes done between beginTransaction() and commitTransaction() are kept in
+// decoded records and written as one atomic batch. Changes done outside of
+// transaction are written together after KV_FLUSH_INTERVAL.
+class KVBackend : public AbstractBackend {
+	public:
+		KVBackend(GlooxMessageHandler *parent);
+		~KVBackend();
+
+		bool loaded() { return m_loaded; }
+
+		void addUser(const UserRow &user);
+		void removeUser(long userId);
+		void updateUser(const UserRow &user);
+		UserRow getUserByJid(const std::string &jid);
+		std::map<std::string, UserRow> getUsersByJid(const std::string &jid);
+		void addUserServer(long userId, const std::string &jid, const std::string &server);
+
+		long addBuddy(long userId, const std::string &uin, const std::string &subscription, const std::string &group = "Buddies", const std::string &nickname = "", int flags = 0);
+		void updateBuddySubscription(long userId, const std::string &uin, const std::string &subscription);
+		void removeBuddy(long userId, const std::string &uin, long buddy_id);
+		void addBuddySetting(long userId, long buddyId, const std::string &key, const std::string &value, PurpleType type);
+		GHashTable *getBuddies(long userId, PurpleAccount *account);
+		std::list <std::string> getBuddies(long userId);
+
+		void addSetting(long userId, const std::string &key, const std::string &value, PurpleType type);
+		void updateSetting(long userId, const std::string &key, const std::string &value);
+		GHashTable *getSettings(long userId);
+
+		std::vector<std::string> getOnlineUsers();
+		void setUserOnline(long userId, bool online);
+
+		void beginTransaction();
+		void commitTransaction();
+
+		long getRegisteredUsersCount();
+		long getRegisteredUsersRosterCount();
+		void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Compacts the store if there are too many old values. Called by timer.
+		bool compact();
+
+		// Writes changed records. Called by timer.
+		void flush();
+
+	private:
+		// Reads record of the user. Returns false if there's no such user.
+		bool read(long userId, KVUserRecord &record);
+
+		// Returns record of the user which is going to be changed or NULL if
+		// there's no such user. Records are kept in m_dirty until flush().
+		KVUserRecord *record(long userId);
+
+		// Schedules writing of changed records if there's no transaction.
+		void changed();
+
+		long nextId(const std::string &key);
+		UserRow toUserRow(const KVUserRecord &record);
+
+		GlooxMessageHandler *p;
+		KVStore *m_store;
+		bool m_loaded;
+		int m_transaction;
+		std::map <long, std::string> m_ids;				// user id -> jid
+		std::map <long, KVUserRecord> m_dirty;			// changed records which are not written yet
+		std::map <long, unsigned int> m_buddiesCount;	// buddies count of records in m_dirty when loaded
+		std::map <std::string, bool> m_online;			// online flags (by jid) which are not written yet
+		long m_buddies;
+		SpectrumTimer *m_compactTimer;
+		SpectrumTimer *m_flushTimer;
+};
+
+#endif
@@ -0,0 +1,600 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "kvstore.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define KV_OP_PUT 1
+#define KV_OP_REMOVE 2
+#define KV_HEADER_SIZE 8
+#define KV_BATCH_HEADER_SIZE 16
+#define KV_COMPACT_CHUNK (4 * 1024 * 1024)
+
+// Calls fsync() on directory containing `path`, so renaming of the file
+// in it survives crash.
+static bool syncDirectory(const std::string &path) {
+	size_t slash = path.find_last_of('/');
+	std::string dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+	int fd = ::open(dir.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	bool ret = fsync(fd) == 0;
+	::close(fd);
+	return ret;
+}
+
+// FNV-1a, we just need to detect batch which was not fully written.
+static uint32_t checksum(const char *data, size_t size) {
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void writeInt(std::string &out, int32_t value) {
+	out.append((const char *) &value, sizeof(int32_t));
+}
+
+static void writeInt64(std::string &out, int64_t value) {
+	out.append((const char *) &value, sizeof(int64_t));
+}
+
+static void writeString(std::string &out, const std::string &value) {
+	writeInt(out, value.size());
+	out.append(value);
+}
+
+static bool readInt(const char *&data, const char *end, int32_t &value) {
+	if (end - data < (int) sizeof(int32_t))
+		return false;
+	memcpy(&value, data, sizeof(int32_t));
+	data += sizeof(int32_t);
+	return true;
+}
+
+static bool readInt64(const char *&data, const char *end, int64_t &value) {
+	if (end - data < (int) sizeof(int64_t))
+		return false;
+	memcpy(&value, data, sizeof(int64_t));
+	data += sizeof(int64_t);
+	return true;
+}
+
+static bool readString(const char *&data, const char *end, std::string &value) {
+	int32_t len;
+	if (!readInt(data, end, len) || len < 0 || end - data < len)
+		return false;
+	value.assign(data, len);
+	data += len;
+	return true;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+	const char *ptr = data.c_str();
+	size_t left = data.size();
+	while (left > 0) {
+		ssize_t written = write(fd, ptr, left);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		ptr += written;
+		left -= written;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char *buffer, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t r = pread(fd, buffer, size, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		buffer += r;
+		size -= r;
+		offset += r;
+	}
+	return true;
+}
+
+static void writeSettings(std::string &out, const std::map <std::string, KVSetting> &settings) {
+	writeInt(out, settings.size());
+	for (std::map <std::string, KVSetting>::const_iterator it = settings.begin(); it != settings.end(); it++) {
+		writeString(out, it->first);
+		writeInt(out, it->second.type);
+		writeString(out, it->second.value);
+	}
+}
+
+static bool readSettings(const char *&data, const char *end, std::map <std::string, KVSetting> &settings) {
+	int32_t count;
+	if (!readInt(data, end, count) || count < 0)
+		return false;
+	for (int32_t i = 0; i < count; i++) {
+		std::string key;
+		KVSetting setting;
+		int32_t type;
+		if (!readString(data, end, key) || !readInt(data, end, type) || !readString(data, end, setting.value))
+			return false;
+		setting.type = type;
+		settings[key] = setting;
+	}
+	return true;
+}
+
+KVBuddy *KVUserRecord::findBuddy(long buddyId) {
+	for (std::map <std::string, KVBuddy>::iterator it = buddies.begin(); it != buddies.end(); it++) {
+		if (it->second.id == buddyId)
+			return &it->second;
+	}
+	return NULL;
+}
+
+std::string KVUserRecord::serialize() const {
+	std::string out;
+	writeInt(out, KV_RECORD_V2);
+	writeInt64(out, id);
+	writeString(out, jid);
+	writeString(out, uin);
+	writeString(out, password);
+	writeString(out, language);
+	writeString(out, encoding);
+	writeInt(out, vip);
+	writeString(out, serverJid);
+	writeString(out, server);
+	writeSettings(out, settings);
+
+	writeInt(out, buddies.size());
+	for (std::map <std::string, KVBuddy>::const_iterator it = buddies.begin(); it != buddies.end(); it++) {
+		const KVBuddy &buddy = it->second;
+		writeInt64(out, buddy.id);
+		writeString(out, buddy.uin);
+		writeString(out, buddy.subscription);
+		writeString(out, buddy.nickname);
+		writeString(out, buddy.group);
+		writeInt(out, buddy.flags);
+		writeSettings(out, buddy.settings);
+	}
+	return out;
+}
+
+bool KVUserRecord::parse(const std::string &data) {
+	const char *ptr = data.c_str();
+	const char *end = ptr + data.size();
+	int32_t value;
+	int64_t id64;
+
+	settings.clear();
+	buddies.clear();
+	serverJid.clear();
+	server.clear();
+
+	// Records of version 1 start directly with 32bit id.
+	if (!readInt(ptr, end, value))
+		return false;
+	bool v2 = value == KV_RECORD_V2;
+	if (v2) {
+		if (!readInt64(ptr, end, id64))
+			return false;
+		id = (long) id64;
+	}
+	else
+		id = value;
+	if (!readString(ptr, end, jid) || !readString(ptr, end, uin) || !readString(ptr, end, password)
+		|| !readString(ptr, end, language) || !readString(ptr, end, encoding) || !readInt(ptr, end, value))
+		return false;
+	vip = value;
+	if (v2 && (!readString(ptr, end, serverJid) || !readString(ptr, end, server)))
+		return false;
+	if (!readSettings(ptr, end, settings))
+		return false;
+
+	int32_t count;
+	if (!readInt(ptr, end, count) || count < 0)
+		return false;
+	for (int32_t i = 0; i < count; i++) {
+		KVBuddy buddy;
+		if (v2) {
+			if (!readInt64(ptr, end, id64))
+				return false;
+			buddy.id = (long) id64;
+		}
+		else {
+			if (!readInt(ptr, end, value))
+				return false;
+			buddy.id = value;
+		}
+		if (!readString(ptr, end, buddy.uin) || !readString(ptr, end, buddy.subscription) || !readString(ptr, end, buddy.nickname)
+			|| !readString(ptr, end, buddy.group) || !readInt(ptr, end, value))
+			return false;
+		buddy.flags = value;
+		if (!readSettings(ptr, end, buddy.settings))
+			return false;
+		buddies[buddy.uin] = buddy;
+	}
+	return ptr == end;
+}
+
+KVStore::KVStore(const std::string &path, bool sync) : m_path(path), m_sync(sync), m_fd(-1), m_end(0),
+	m_batchLevel(0), m_live(0), m_dead(0), m_batches(0) {
+}
+
+KVStore::~KVStore() {
+	close();
+}
+
+void KVStore::setError(const std::string &error) {
+	m_error = error;
+	if (errno != 0)
+		m_error += std::string(": ") + strerror(errno);
+}
+
+bool KVStore::open() {
+	close();
+	m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0640);
+	if (m_fd == -1) {
+		setError("Can't open " + m_path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		setError("Can't stat " + m_path);
+		close();
+		return false;
+	}
+
+	if (st.st_size == 0) {
+		std::string header("SPKV");
+		writeInt(header, KVSTORE_VERSION);
+		if (!writeAll(m_fd, header) || (m_sync && fsync(m_fd) != 0)) {
+			setError("Can't write " + m_path);
+			close();
+			return false;
+		}
+		m_end = KV_HEADER_SIZE;
+		return true;
+	}
+
+	if (!replay()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void KVStore::close() {
+	if (m_fd != -1)
+		::close(m_fd);
+	m_fd = -1;
+	m_end = 0;
+	m_index.clear();
+	m_pending.clear();
+	m_batchLevel = 0;
+	m_live = 0;
+	m_dead = 0;
+}
+
+bool KVStore::replay() {
+	char header[KV_BATCH_HEADER_SIZE];
+	if (!readAll(m_fd, header, KV_HEADER_SIZE, 0) || memcmp(header, "SPKV", 4) != 0) {
+		errno = 0;
+		setError(m_path + " is not Spectrum key-value store");
+		return false;
+	}
+	int32_t version;
+	memcpy(&version, header + 4, sizeof(int32_t));
+	if (version != KVSTORE_VERSION) {
+		errno = 0;
+		setError(m_path + " has unsupported version");
+		return false;
+	}
+
+	struct stat st;
+	fstat(m_fd, &st);
+	off_t offset = KV_HEADER_SIZE;
+	std::string data;
+	while (offset + KV_BATCH_HEADER_SIZE <= st.st_size) {
+		if (!readAll(m_fd, header, KV_BATCH_HEADER_SIZE, offset) || memcmp(header, "SPKB", 4) != 0)
+			break;
+
+		const char *ptr = header + 4;
+		const char *end = header + KV_BATCH_HEADER_SIZE;
+		int32_t count, length, sum;
+		readInt(ptr, end, count);
+		readInt(ptr, end, length);
+		readInt(ptr, end, sum);
+		if (length < 0 || offset + KV_BATCH_HEADER_SIZE + length > st.st_size)
+			break;
+
+		data.resize(length);
+		if (length > 0 && !readAll(m_fd, &data[0], length, offset + KV_BATCH_HEADER_SIZE))
+			break;
+		if ((uint32_t) sum != checksum(data.c_str(), data.size()))
+			break;
+
+		// Check all records before the batch is applied, so malformed batch
+		// is thrown away as a whole like the incomplete one.
+		std::vector <Record> records;
+		if (!parseBatch(data, count, records))
+			break;
+
+		off_t base = offset + KV_BATCH_HEADER_SIZE;
+		for (std::vector <Record>::iterator r = records.begin(); r != records.end(); r++) {
+			std::string key(data, r->keyOffset, r->keyLength);
+			std::map <std::string, Entry>::iterator it = m_index.find(key);
+			if (it != m_index.end()) {
+				m_dead += it->second.size + it->first.size();
+				m_live -= it->second.size + it->first.size();
+				m_index.erase(it);
+			}
+			if (r->op == KV_OP_PUT) {
+				Entry &entry = m_index[key];
+				entry.offset = base + r->keyOffset + r->keyLength;
+				entry.size = r->valueLength;
+				m_live += r->valueLength + r->keyLength;
+			}
+		}
+		offset += KV_BATCH_HEADER_SIZE + length;
+	}
+
+	// Remove batch which wasn't fully written when we crashed and everything
+	// after it.
+	if (offset != st.st_size) {
+		if (ftruncate(m_fd, offset) != 0) {
+			setError("Can't truncate " + m_path);
+			return false;
+		}
+		errno = 0;
+		setError("Removed incomplete or malformed batch from " + m_path);
+	}
+	m_end = offset;
+	return true;
+}
+
+bool KVStore::parseBatch(const std::string &data, int32_t count, std::vector <Record> &records) {
+	if (count < 0)
+		return false;
+	const char *start = data.c_str();
+	const char *ptr = start;
+	const char *end = ptr + data.size();
+	for (int32_t i = 0; i < count; i++) {
+		int32_t op, keyLength, valueLength;
+		if (!readInt(ptr, end, op) || !readInt(ptr, end, keyLength) || !readInt(ptr, end, valueLength)
+			|| (op != KV_OP_PUT && op != KV_OP_REMOVE) || keyLength < 0 || valueLength < 0
+			|| end - ptr < (off_t) keyLength + valueLength)
+			return false;
+		Record record;
+		record.op = op;
+		record.keyOffset = ptr - start;
+		record.keyLength = keyLength;
+		record.valueLength = valueLength;
+		records.push_back(record);
+		ptr += keyLength + valueLength;
+	}
+	return ptr == end;
+}
+
+bool KVStore::get(const std::string &key, std::string &value) {
+	std::map <std::string, Change>::iterator change = m_pending.find(key);
+	if (change != m_pending.end()) {
+		if (change->second.removed)
+			return false;
+		value = change->second.value;
+		return true;
+	}
+
+	std::map <std::string, Entry>::iterator it = m_index.find(key);
+	if (it == m_index.end())
+		return false;
+
+	value.resize(it->second.size);
+	if (it->second.size != 0 && !readAll(m_fd, &value[0], it->second.size, it->second.offset)) {
+		setError("Can't read " + key);
+		value.clear();
+		return false;
+	}
+	return true;
+}
+
+bool KVStore::contains(const std::string &key) {
+	std::map <std::string, Change>::iterator change = m_pending.find(key);
+	if (change != m_pending.end())
+		return !change->second.removed;
+	return m_index.find(key) != m_index.end();
+}
+
+void KVStore::put(const std::string &key, const std::string &value) {
+	Change &change = m_pending[key];
+	change.removed = false;
+	change.value = value;
+	if (m_batchLevel == 0)
+		writeBatch(m_pending);
+}
+
+void KVStore::remove(const std::string &key) {
+	if (!contains(key))
+		return;
+	Change &change = m_pending[key];
+	change.removed = true;
+	change.value.clear();
+	if (m_batchLevel == 0)
+		writeBatch(m_pending);
+}
+
+std::vector <std::string> KVStore::keys(const std::string &prefix) {
+	std::vector <std::string> result;
+	for (std::map <std::string, Entry>::iterator it = m_index.lower_bound(prefix); it != m_index.end(); it++) {
+		if (it->first.compare(0, prefix.size(), prefix) != 0)
+			break;
+		if (m_pending.find(it->first) == m_pending.end())
+			result.push_back(it->first);
+	}
+	for (std::map <std::string, Change>::iterator it = m_pending.lower_bound(prefix); it != m_pending.end(); it++) {
+		if (it->first.compare(0, prefix.size(), prefix) != 0)
+			break;
+		if (!it->second.removed)
+			result.push_back(it->first);
+	}
+	return result;
+}
+
+void KVStore::beginBatch() {
+	m_batchLevel++;
+}
+
+bool KVStore::commitBatch() {
+	if (m_batchLevel == 0)
+		return false;
+	if (--m_batchLevel > 0)
+		return true;
+	return writeBatch(m_pending);
+}
+
+bool KVStore::writeBatch(const std::map <std::string, Change> &changes) {
+	if (changes.empty())
+		return true;
+	if (m_fd == -1) {
+		errno = 0;
+		setError("Store is not opened");
+		return false;
+	}
+
+	std::string data;
+	std::vector <std::pair <std::map <std::string, Change>::const_iterator, off_t> > offsets;
+	for (std::map <std::string, Change>::const_iterator it = changes.begin(); it != changes.end(); it++) {
+		writeInt(data, it->second.removed ? KV_OP_REMOVE : KV_OP_PUT);
+		writeInt(data, it->first.size());
+		writeInt(data, it->second.value.size());
+		data.append(it->first);
+		offsets.push_back(std::make_pair(it, (off_t) data.size()));
+		data.append(it->second.value);
+	}
+
+	std::string batch("SPKB");
+	writeInt(batch, changes.size());
+	writeInt(batch, data.size());
+	writeInt(batch, checksum(data.c_str(), data.size()));
+	batch.append(data);
+
+	if (lseek(m_fd, m_end, SEEK_SET) != m_end || !writeAll(m_fd, batch) || (m_sync && fsync(m_fd) != 0)) {
+		setError("Can't write batch to " + m_path);
+		// Don't leave partial batch in the file, so the next one is not lost after restart.
+		// Changes stay pending and are written again with the next batch.
+		if (ftruncate(m_fd, m_end) != 0) {}
+		return false;
+	}
+
+	off_t base = m_end + KV_BATCH_HEADER_SIZE;
+	for (unsigned int i = 0; i < offsets.size(); i++) {
+		const std::string &key = offsets[i].first->first;
+		const Change &change = offsets[i].first->second;
+		std::map <std::string, Entry>::iterator it = m_index.find(key);
+		if (it != m_index.end()) {
+			m_dead += it->second.size + key.size();
+			m_live -= it->second.size + key.size();
+			m_index.erase(it);
+		}
+		if (!change.removed) {
+			Entry &entry = m_index[key];
+			entry.offset = base + offsets[i].second;
+			entry.size = change.value.size();
+			m_live += entry.size + key.size();
+		}
+	}
+	m_end += batch.size();
+	m_batches++;
+	m_pending.clear();
+	return true;
+}
+
+bool KVStore::needsCompaction() {
+	return m_dead > 1024 * 1024 && m_dead > m_live;
+}
+
+bool KVStore::compact() {
+	if (m_fd == -1 || m_batchLevel != 0)
+		return false;
+
+	std::string tmp = m_path + ".compact";
+	KVStore target(tmp, false);
+	unlink(tmp.c_str());
+	if (!target.open()) {
+		m_error = target.getLastError();
+		return false;
+	}
+
+	// Copy live values in chunks, so we don't need the whole store in memory.
+	unsigned long chunk = 0;
+	std::string value;
+	target.beginBatch();
+	for (std::map <std::string, Entry>::iterator it = m_index.begin(); it != m_index.end(); it++) {
+		if (!get(it->first, value)) {
+			target.close();
+			unlink(tmp.c_str());
+			return false;
+		}
+		target.put(it->first, value);
+		chunk += value.size();
+		if (chunk > KV_COMPACT_CHUNK) {
+			target.commitBatch();
+			target.beginBatch();
+			chunk = 0;
+		}
+	}
+	if (!target.commitBatch() || fsync(target.m_fd) != 0) {
+		m_error = target.getLastError();
+		target.close();
+		unlink(tmp.c_str());
+		return false;
+	}
+	target.close();
+
+	if (rename(tmp.c_str(), m_path.c_str()) != 0) {
+		setError("Can't replace " + m_path);
+		unlink(tmp.c_str());
+		return false;
+	}
+	// The store is replaced anyway, so it has to be reopened even if this fails.
+	bool synced = syncDirectory(m_path);
+	int syncErrno = errno;
+
+	// Keep changes which failed to be written before, open() drops them.
+	std::map <std::string, Change> pending;
+	pending.swap(m_pending);
+	bool ret = open();
+	m_pending.swap(pending);
+	if (ret && !synced) {
+		errno = syncErrno;
+		setError("Can't sync directory of " + m_path);
+		return false;
+	}
+	return ret;
+}
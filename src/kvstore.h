@@ -0,0 +1,180 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_KVSTORE_H
+#define SPECTRUM_KVSTORE_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <sys/types.h>
+#include <stdint.h>
+
+#define KVSTORE_VERSION 1
+
+// Keys used by KVBackend. Every registered user has one record with whole
+// roster and settings stored under KV_USER_PREFIX + bare JID, so loading the
+// user is one read.
+#define KV_USER_PREFIX "user/"
+#define KV_ID_PREFIX "id/"
+#define KV_ONLINE_PREFIX "online/"
+#define KV_NEXT_USER_ID "meta/next_user_id"
+#define KV_NEXT_BUDDY_ID "meta/next_buddy_id"
+#define KV_BUDDIES_COUNT "meta/buddies"
+
+// First integer of user record with 64bit ids and users_servers row. Older
+// records start with 32bit user id, which is never negative.
+#define KV_RECORD_V2 -2
+
+struct KVSetting {
+	int type;				// PurpleType
+	std::string value;
+};
+
+struct KVBuddy {
+	long id;
+	std::string uin;
+	std::string subscription;
+	std::string nickname;
+	std::string group;
+	int flags;
+	std::map <std::string, KVSetting> settings;
+};
+
+// One user with his roster and settings. It's independent on libpurple, so
+// it can be used by tools/migrate-db too.
+struct KVUserRecord {
+	long id;
+	std::string jid;
+	std::string uin;
+	std::string password;
+	std::string language;
+	std::string encoding;
+	bool vip;
+	std::string serverJid;						// users_servers row, empty if there's none
+	std::string server;
+	std::map <std::string, KVSetting> settings;
+	std::map <std::string, KVBuddy> buddies;	// key is buddy's uin
+
+	KVUserRecord() : id(-1), vip(false) {}
+
+	// Returns buddy with the given id or NULL.
+	KVBuddy *findBuddy(long buddyId);
+
+	std::string serialize() const;
+	bool parse(const std::string &data);
+};
+
+// Simple embedded key-value store. All changes are appended to one log file
+// in batches. Batch is written by one write() call and has a checksum, so
+// batch which was not fully written before crash is thrown away when the
+// store is opened again and the store is always in consistent state. Keys are
+// kept in memory with offsets of their values, values are read from the file
+// when needed. Old values are removed by compact().
+//
+// File format (host byte order, all integers are 32bit):
+//   "SPKV" | version | batch | batch | ...
+//   batch: "SPKB" | records count | data length | checksum | data
+//   record: op (put = 1, remove = 2) | key length | value length | key | value
+class KVStore {
+	public:
+		// `sync` - if true, fsync() is called after every batch.
+		KVStore(const std::string &path, bool sync = true);
+		~KVStore();
+
+		// Opens the store and loads the index. Creates new store if there's no file.
+		bool open();
+		void close();
+		bool isOpen() { return m_fd != -1; }
+
+		// Reads value of the key. Returns false if the key doesn't exist.
+		bool get(const std::string &key, std::string &value);
+		bool contains(const std::string &key);
+
+		// Stores value. If there's no batch started, it's written immediately.
+		// Changes which can't be written stay pending and are written with
+		// the next batch.
+		void put(const std::string &key, const std::string &value);
+		void remove(const std::string &key);
+
+		// Returns all keys starting with prefix.
+		std::vector <std::string> keys(const std::string &prefix);
+
+		// Starts batch. All changes done until commitBatch() are written
+		// atomically. Batches can be nested, only the outer one is written.
+		void beginBatch();
+		bool commitBatch();
+
+		// Rewrites the file with only live values. The new file replaces the
+		// old one by rename() and the directory is synced, so the rename is
+		// not lost after crash.
+		bool compact();
+
+		// Returns true if there's more than 1MB of old values and they
+		// take more space than live values.
+		bool needsCompaction();
+
+		unsigned int size() { return m_index.size(); }
+		unsigned long getLiveBytes() { return m_live; }
+		unsigned long getDeadBytes() { return m_dead; }
+		unsigned long getBatches() { return m_batches; }
+		const std::string &getLastError() { return m_error; }
+		const std::string &getPath() { return m_path; }
+
+	private:
+		struct Entry {
+			off_t offset;
+			unsigned int size;
+		};
+
+		struct Change {
+			bool removed;
+			std::string value;
+		};
+
+		// Record of batch read from the file.
+		struct Record {
+			int32_t op;
+			size_t keyOffset;			// offset of the key in batch data
+			int32_t keyLength;
+			int32_t valueLength;
+		};
+
+		bool replay();
+		// Checks `count` records in batch data. Returns false if any of them
+		// is malformed or there's some data after them.
+		bool parseBatch(const std::string &data, int32_t count, std::vector <Record> &records);
+		bool writeBatch(const std::map <std::string, Change> &changes);
+		void setError(const std::string &error);
+
+		std::string m_path;
+		bool m_sync;
+		int m_fd;
+		off_t m_end;
+		std::map <std::string, Entry> m_index;
+		std::map <std::string, Change> m_pending;
+		int m_batchLevel;
+		unsigned long m_live;
+		unsigned long m_dead;
+		unsigned long m_batches;
+		std::string m_error;
+};
+
+#endif
@@ -46,119 +46,126 @@ inline unsigned long hashpjw(const char *str_param) {
 
 // Swap the endianness of a 4-byte word.
 // On some architectures you can replace my_swap4 with an inlined instruction.
-inline unsigned long my_swap4(unsigned long result) {
-	unsigned long c0 = (result >> 0) & 0xff;
-	unsigned long c1 = (result >> 8) & 0xff;
-	unsigned long c2 = (result >> 16) & 0xff;
-	unsigned long c3 = (result >> 24) & 0xff;
+inline guint32 my_swap4(guint32 result) {
+	guint32 c0 = (result >> 0) & 0xff;
+	guint32 c1 = (result >> 8) & 0xff;
+	guint32 c2 = (result >> 16) & 0xff;
+	guint32 c3 = (result >> 24) & 0xff;
 
 	return (c0 << 24) | (c1 << 16) | (c2 << 8) | c3;
 }
 
-inline int read4_from_offset(MoFile *mo_file, int offset) {
-	unsigned long *ptr = (unsigned long *)(((char *)mo_file->getData()) + offset);
-	
-	if (mo_file->isReversed()) {
-		return my_swap4(*ptr);
-	} else {
-		return *ptr;
-	}
-}
-
 MoFile::MoFile(const std::string &filename) {
+	m_file = NULL;
 	m_data = NULL;
 	m_size = 0;
-	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-	if (file.is_open()) {
-		m_size = file.tellg();
-		m_data = new char [m_size];
-		file.seekg (0, std::ios::beg);
-		file.read (m_data, m_size);
-		file.close();
+	m_reversed = false;
+	m_num_strings = 0;
+	m_hash_num_entries = 0;
+
+	if (!g_file_test(filename.c_str(), G_FILE_TEST_EXISTS))
+		return;
+
+	// Catalogs are mapped, so pages are shared between languages and
+	// processes and only used parts of pidgin.mo are read into memory.
+	m_file = g_mapped_file_new(filename.c_str(), FALSE, NULL);
+	if (!m_file)
+		return;
+	m_data = g_mapped_file_get_contents(m_file);
+	m_size = g_mapped_file_get_length(m_file);
+
+	const guint32 TARGET_MAGIC = 0x950412DE;
+	const guint32 TARGET_MAGIC_REVERSED = 0xDE120495;
+	guint32 magic = read4(0);
+
+	if (magic == TARGET_MAGIC) {
+		m_reversed = false;
+	} else if (magic == TARGET_MAGIC_REVERSED) {
+		m_reversed = true;
+	} else {
+		unload();
+		return;
 	}
-	
-	if (m_data) {
-		unsigned long *long_ptr = (unsigned long *) m_data;
-
-		const unsigned long TARGET_MAGIC = 0x950412DE;
-		const unsigned long TARGET_MAGIC_REVERSED = 0xDE120495;
-		unsigned long magic = long_ptr[0];
-
-		if (magic == TARGET_MAGIC) {
-			m_reversed = false;
-		} else if (magic == TARGET_MAGIC_REVERSED) {
-			m_reversed = true;
-		} else {
-			delete[] m_data;
-			m_data = NULL;
-			return;
-		}
 
-		m_num_strings = read4_from_offset(this, 8);
-		m_original_table_offset = read4_from_offset(this, 12);
-		m_translated_table_offset = read4_from_offset(this, 16);
-		m_hash_num_entries = read4_from_offset(this, 20);
-		m_hash_offset = read4_from_offset(this, 24);
-		
-		if (m_hash_num_entries == 0) {
-			delete[] m_data;
-			m_data = NULL;
-			return;
-		}
+	m_num_strings = read4(8);
+	m_original_table_offset = read4(12);
+	m_translated_table_offset = read4(16);
+	m_hash_num_entries = read4(20);
+	m_hash_offset = read4(24);
+
+	// Hash table is needed for lookups and its size has to be > 2, because
+	// double hashing increment is computed modulo size - 2.
+	if (m_hash_num_entries < 3 || m_hash_offset + (guint64) m_hash_num_entries * 4 > m_size) {
+		unload();
+		return;
 	}
 }
 
 MoFile::~MoFile() {
-	if (m_data)
-		delete[] m_data;
+	unload();
+}
+
+void MoFile::unload() {
+	if (m_file)
+		g_mapped_file_unref(m_file);
+	m_file = NULL;
+	m_data = NULL;
+	m_size = 0;
 }
 
 bool MoFile::isLoaded() {
 	return m_data != NULL;
 }
 
+guint32 MoFile::read4(guint32 offset) {
+	if ((guint64) offset + 4 > m_size)
+		return 0;
+	guint32 result;
+	memcpy(&result, m_data + offset, 4);
+	return m_reversed ? my_swap4(result) : result;
+}
+
+const char *MoFile::getString(guint32 table_offset, guint32 index) {
+	if (index >= m_num_strings)
+		return NULL;
+	guint64 addr_offset = table_offset + (guint64) index * 8;
+	if (addr_offset + 8 > m_size)
+		return NULL;
+	guint32 length = read4(addr_offset);
+	guint32 string_offset = read4(addr_offset + 4);
+	if ((guint64) string_offset + length >= m_size || m_data[string_offset + length] != '\0')
+		return NULL;
+	return m_data + string_offset;
+}
+
 const char *MoFile::lookup(const char *s) {
 	if (m_data == NULL)
-		return s;
+		return NULL;
 
-	unsigned long V = hashpjw(s);
-	int S = m_hash_num_entries;
+	guint32 V = hashpjw(s);
+	guint32 S = m_hash_num_entries;
+
+	guint32 hash_cursor = V % S;
+	guint32 orig_hash_cursor = hash_cursor;
+	guint32 increment = 1 + (V % (S - 2));
 
-	int hash_cursor = V % S;
-	int orig_hash_cursor = hash_cursor;
-	int increment = 1 + (V % (S - 2));
-	int target_index = -1;
-	
 	while (1) {
-		unsigned int index = read4_from_offset(this, m_hash_offset + 4 * hash_cursor);
+		guint32 index = read4(m_hash_offset + 4 * hash_cursor);
 		if (index == 0) break;
 
 		index--;  // Because entries in the table are stored +1 so that 0 means empty.
 
-		int addr_offset = m_original_table_offset + 8 * index + 4;
-		int string_offset = read4_from_offset(this, addr_offset);
-
-		char *t = ((char *)m_data) + string_offset;
-		
-		if (strcmp(s, t) == 0) {
-			target_index = index;
-			break;
-		}
+		const char *t = getString(m_original_table_offset, index);
+		if (t && strcmp(s, t) == 0)
+			return getString(m_translated_table_offset, index);
 
 		hash_cursor += increment;
 		hash_cursor %= S;
 
 		if (hash_cursor == orig_hash_cursor) break;
 	}
-	
-	if (target_index == -1) return s;  // Maybe we want to log an error?
-
-    int addr_offset = m_translated_table_offset + 8 * target_index + 4;
-    int string_offset = read4_from_offset(this, addr_offset);
 
-    char *t = ((char *)m_data) + string_offset;
-		
-	return t;
+	return NULL;
 }
 
 static void deleteTranslation(gpointer data) {
@@ -183,17 +190,29 @@ Translation::~Translation() {
 	delete m_spectrum;
 }
 
+const char *Translation::lookup(const char *key) {
+	const char *ret = m_spectrum->lookup(key);
+	if (ret == NULL)
+		ret = m_pidgin->lookup(key);
+	return ret;
+}
+
 const char * Translation::translate(const char *key) {
 	if (*key == '\0')
 		return "";
-	const char *ret = m_spectrum->lookup(key);
-	if (strcmp(ret, key) == 0)
-		return m_pidgin->lookup(key);
-	return ret;
+	const char *ret = lookup(key);
+	return ret ? ret : key;
+}
+
+void Translation::setCached(unsigned int id, const char *translation) {
+	if (id >= m_cache.size())
+		m_cache.resize(id + 1, NULL);
+	m_cache[id] = translation;
 }
 
 Localization::Localization() {
 	m_locales = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, deleteTranslation);
+	m_ids = g_hash_table_new(g_str_hash, g_str_equal);
 	// There is always English - source codes...
 	m_languages["en"] = "English";
 	char *l = g_build_filename(INSTALL_DIR, "share", "locale", NULL);
@@ -215,18 +234,51 @@ Localization::Localization() {
 
 Localization::~Localization() {
 	g_hash_table_destroy(m_locales);
+	g_hash_table_destroy(m_ids);
+	for (std::vector <char *>::iterator it = m_keys.begin(); it != m_keys.end(); it++)
+		g_free(*it);
 }
 
-const char * Localization::translate(const char *lang, const char *key) {
+Translation *Localization::getTranslation(const char *lang) {
 	Translation *trans;
 	if (!(trans = (Translation *) g_hash_table_lookup(m_locales, lang))) {
 		loadLocale(lang);
 		trans = (Translation *) g_hash_table_lookup(m_locales, lang);
 	}
-	if (trans) {
-		return trans->translate(key);
+	return trans;
+}
+
+const char * Localization::translate(Translation *trans, const char *key) {
+	if (*key == '\0')
+		return "";
+	if (!trans)
+		return key;
+
+	gpointer id_ptr = g_hash_table_lookup(m_ids, key);
+	if (id_ptr) {
+		unsigned int id = GPOINTER_TO_UINT(id_ptr) - 1;
+		const char *ret = trans->cached(id);
+		if (!ret) {
+			ret = trans->lookup(key);
+			if (!ret)
+				ret = m_keys[id];
+			trans->setCached(id, ret);
+		}
+		return ret;
 	}
-	return key;
+
+	// Only keys which have translation get an ID. Texts coming from legacy
+	// network are passed here too and we don't want to remember all of them.
+	const char *ret = trans->lookup(key);
+	if (!ret)
+		return key;
+
+	unsigned int id = m_keys.size();
+	char *k = g_strdup(key);
+	m_keys.push_back(k);
+	g_hash_table_insert(m_ids, k, GUINT_TO_POINTER(id + 1));
+	trans->setCached(id, ret);
+	return ret;
 }
 
 bool Localization::loadLocale(const std::string &lang) {
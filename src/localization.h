@@ -22,43 +22,66 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include "glib.h"
 #include "purple.h"
 #include <iostream>
 #include <fstream>
 
+// Memory mapped GNU .mo catalog.
 class MoFile {
 	public:
 		MoFile(const std::string &filename);
 		~MoFile();
 
+		// Returns translation of `s` or NULL if there's no translation.
 		const char *lookup(const char *s);
 
 		bool isLoaded();
 		bool isReversed() { return m_reversed; }
-		char *getData() { return m_data; }
 
 	private:
-		std::ifstream::pos_type m_size;
-		char *m_data;
+		void unload();
+		// Reads 4-byte word at `offset`, returns 0 when it's out of file.
+		guint32 read4(guint32 offset);
+		// Returns `index`-th string from table at `table_offset` or NULL if
+		// it's not valid NUL-terminated string inside the file.
+		const char *getString(guint32 table_offset, guint32 index);
+
+		GMappedFile *m_file;
+		const char *m_data;
+		gsize m_size;
 		bool m_reversed;
-		int m_num_strings;
-		int m_original_table_offset;
-		int m_translated_table_offset;
-		int m_hash_num_entries;
-		int m_hash_offset;
+		guint32 m_num_strings;
+		guint32 m_original_table_offset;
+		guint32 m_translated_table_offset;
+		guint32 m_hash_num_entries;
+		guint32 m_hash_offset;
 };
 
+// Catalogs for one language. Handle is owned by Localization and it's valid
+// for the whole lifetime of the transport, so users can keep it.
 class Translation {
 	public:
 		Translation(const std::string &lang);
 		~Translation();
 
+		// Returns translation from spectrum.mo or pidgin.mo or NULL if there's
+		// no translation.
+		const char *lookup(const char *key);
+
+		// Returns translation or `key` itself.
 		const char * translate(const char *key);
 
+		// Returns cached translation of message with given ID or NULL if it's
+		// not cached yet.
+		const char *cached(unsigned int id) { return id < m_cache.size() ? m_cache[id] : NULL; }
+		void setCached(unsigned int id, const char *translation);
+
 	private:
 		MoFile *m_spectrum;
 		MoFile *m_pidgin;
+		std::vector <const char *> m_cache;		// message ID -> translation
 };
 
 class Localization {
@@ -67,13 +90,26 @@ class Localization {
 		~Localization();
 
 		bool loadLocale(const std::string &lang);
-		const char * translate(const char *lang, const char *key);
+
+		// Returns handle for given language, loads it if needed. Returns NULL
+		// if translations are not supported.
+		Translation *getTranslation(const char *lang);
+
+		// Translates `key` using language handle. Keys with translation get
+		// message ID, so next lookups of the same key are only an index into
+		// per-language cache.
+		const char * translate(Translation *trans, const char *key);
+		const char * translate(Translation *trans, const std::string &key) { return translate(trans, key.c_str()); }
+
+		const char * translate(const char *lang, const char *key) { return translate(getTranslation(lang), key); }
 		const char * translate(const char *lang, const std::string &key) { return translate(lang, key.c_str()); }
 		const char * translate(const std::string &lang, const std::string &key) { return translate(lang.c_str(), key.c_str()); }
 		std::map <std::string, std::string> &getLanguages();
 
 	private:
 		GHashTable *m_locales;		// xml_lang, hash table with localizations
+		GHashTable *m_ids;			// key -> message ID + 1
+		std::vector <char *> m_keys;	// message ID -> key
 		std::map<std::string, std::string> m_languages;
 };
 
@@ -26,6 +26,13 @@
 #endif
 #include <fcntl.h>
 #include <signal.h>
+#ifndef WIN32
+#include <poll.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+#endif
 #include "utf8.h"
 #include "log.h"
 #include "geventloop.h"
@@ -50,6 +57,7 @@
 #include "configfile.h"
 #include "spectrum_util.h"
 #include "sql.h"
+#include "kvbackend.h"
 #include "user.h"
 #include "protocolmanager.h"
 #include "filetransfermanager.h"
@@ -59,6 +67,14 @@
 #include "transport.h"
 
 #include "parser.h"
+#include "probelimiter.h"
+#include "stanzaqueue.h"
+#include "workscheduler.h"
+#include "sessionsnapshot.h"
+#include "streamtrace.h"
+#include "flightrecorder.h"
+#include "memoryaccounting.h"
+#include "textsanitizer.h"
 #include "commands.h"
 #include "protocols/abstractprotocol.h"
 #include "cmds.h"
@@ -88,6 +104,8 @@ static gboolean ver = FALSE;
 static gboolean upgrade_db = FALSE;
 static gboolean check_db_version = FALSE;
 static gboolean list_purple_settings = FALSE;
+static gchar *trace_file = NULL;
+static StreamTrace *streamTrace = NULL;
 
 static GOptionEntry options_entries[] = {
 	{ "nodaemon", 'n', 0, G_OPTION_ARG_NONE, &nodaemon, "Disable background daemon mode", NULL },
@@ -97,6 +115,7 @@ static GOptionEntry options_entries[] = {
 	{ "list-purple-settings", 's', 0, G_OPTION_ARG_NONE, &list_purple_settings, "Lists purple settings which can be used in config file", NULL },
 	{ "upgrade-db", 'u', 0, G_OPTION_ARG_NONE, &upgrade_db, "Upgrades Spectrum database", NULL },
 	{ "check-db-version", 'c', 0, G_OPTION_ARG_NONE, &check_db_version, "Checks Spectrum database version", NULL },
+	{ "trace", 't', 0, G_OPTION_ARG_STRING, &trace_file, "Record component stream and libpurple callbacks to file for tools/trace-replay", NULL },
 	{ NULL, 0, 0, G_OPTION_ARG_NONE, NULL, "", NULL }
 };
 
@@ -202,9 +221,35 @@ namespace gloox {
 		public:
 			HiComponent(const std::string & ns, const std::string & server, const std::string & component, const std::string & password, int port = 5347) : Component(ns, server, component, password, port) {};
 			virtual ~HiComponent() {};
+
+			// Sends already serialized stanza.
+			void sendRaw(const std::string &xml) { send(xml); }
 	};
 }
 
+/*
+ * Returns true if libpurple callbacks are recorded, so their data have to be prepared
+ */
+static inline bool tracingCallbacks() {
+	return streamTrace || FlightRecorderManager::active();
+}
+
+/*
+ * Records libpurple callback into stream trace and into flight recorder of its user
+ */
+static void traceCallback(const char *name, PurpleAccount *account, PurpleConversation *conv, const char *who = NULL, const char *text = NULL, const char *extra = NULL) {
+	if (streamTrace)
+		streamTrace->callback(name, account, conv, who, text, extra);
+	if (FlightRecorderManager::active()) {
+		if (conv && !account)
+			account = purple_conversation_get_account(conv);
+		std::string detail = conv ? purple_conversation_get_name(conv) : "";
+		if (who)
+			detail += detail.empty() ? who : std::string(" ") + who;
+		FlightRecorderManager::instance()->record(account, name, detail.c_str());
+	}
+}
+
 /*
  * New message from legacy network received (we can create conversation here)
  */
@@ -216,6 +261,8 @@ static void newMessageReceived(PurpleAccount* account,char * name,char *msg,Purp
  * Called when libpurple wants to write some message to Chat
  */
 static void conv_write_im(PurpleConversation *conv, const char *who, const char *message, PurpleMessageFlags flags, time_t mtime) {
+	if (tracingCallbacks())
+		traceCallback("conv_write_im", NULL, conv, who, message, stringOf((int) flags).c_str());
 	GlooxMessageHandler::instance()->purpleConversationWriteIM(conv, who, message, flags, mtime);
 }
 
@@ -223,6 +270,8 @@ static void conv_write_im(PurpleConversation *conv, const char *who, const char
  * Called when libpurple wants to write some message to Groupchat
  */
 static void conv_write_chat(PurpleConversation *conv, const char *who, const char *message, PurpleMessageFlags flags, time_t mtime) {
+	if (tracingCallbacks())
+		traceCallback("conv_write_chat", NULL, conv, who, message, stringOf((int) flags).c_str());
 	GlooxMessageHandler::instance()->purpleConversationWriteChat(conv, who, message, flags, mtime);
 }
 
@@ -242,6 +291,8 @@ static void conv_write_conv(PurpleConversation *conv, const char *who, const cha
  * Called when chat topic was changed
  */
 static void conv_chat_topic_changed(PurpleConversation *chat, const char *who, const char *topic) {
+	if (tracingCallbacks())
+		traceCallback("conv_chat_topic_changed", NULL, chat, who, topic);
 	GlooxMessageHandler::instance()->purpleChatTopicChanged(chat, who, topic);
 }
 
@@ -249,6 +300,12 @@ static void conv_chat_topic_changed(PurpleConversation *chat, const char *who, c
  * Called when there are new users added
  */
 static void conv_chat_add_users(PurpleConversation *conv, GList *cbuddies, gboolean new_arrivals) {
+	if (tracingCallbacks()) {
+		for (GList *l = cbuddies; l != NULL; l = l->next) {
+			PurpleConvChatBuddy *cb = (PurpleConvChatBuddy *) l->data;
+			traceCallback("conv_chat_add_users", NULL, conv, cb->name, cb->alias, stringOf((int) cb->flags).c_str());
+		}
+	}
 	GlooxMessageHandler::instance()->purpleChatAddUsers(conv, cbuddies, new_arrivals);
 }
 
@@ -265,6 +322,8 @@ static void conv_chat_update_user(PurpleConversation *conv, const char *user) {
  * Called when user is renamed
  */
 static void conv_chat_rename_user(PurpleConversation *conv, const char *old_name, const char *new_name, const char *new_alias) {
+	if (tracingCallbacks())
+		traceCallback("conv_chat_rename_user", NULL, conv, old_name, new_name, new_alias);
 	GlooxMessageHandler::instance()->purpleChatRenameUser(conv, old_name, new_name, new_alias);
 }
 
@@ -276,6 +335,10 @@ static void conv_destroy(PurpleConversation *conv) {
  * Called when users are removed from chat
  */
 static void conv_chat_remove_users(PurpleConversation *conv, GList *users) {
+	if (tracingCallbacks()) {
+		for (GList *l = users; l != NULL; l = l->next)
+			traceCallback("conv_chat_remove_users", NULL, conv, (const char *) l->data);
+	}
 	GlooxMessageHandler::instance()->purpleChatRemoveUsers(conv, users);
 }
 
@@ -283,6 +346,8 @@ static void conv_chat_remove_users(PurpleConversation *conv, GList *users) {
  * Called when user is logged in...
  */
 static void signed_on(PurpleConnection *gc,gpointer unused) {
+	if (tracingCallbacks())
+		traceCallback("signed_on", purple_connection_get_account(gc), NULL);
 	GlooxMessageHandler::instance()->signedOn(gc, unused);
 #ifdef __linux__
 	// force returning of memory chunks allocated by libxml2 to kernel
@@ -294,6 +359,8 @@ static void signed_on(PurpleConnection *gc,gpointer unused) {
  * Called when somebody from legacy network start typing
  */
 static void buddyTyping(PurpleAccount *account, const char *who, gpointer null) {
+	if (tracingCallbacks())
+		traceCallback("buddyTyping", account, NULL, who);
 	GlooxMessageHandler::instance()->purpleBuddyTyping(account, who);
 }
 
@@ -301,6 +368,8 @@ static void buddyTyping(PurpleAccount *account, const char *who, gpointer null)
  * Called when somebody from legacy network paused typing.
  */
 static void buddyTyped(PurpleAccount *account, const char *who, gpointer null) {
+	if (tracingCallbacks())
+		traceCallback("buddyTyped", account, NULL, who);
 	GlooxMessageHandler::instance()->purpleBuddyTypingPaused(account, who);
 }
 
@@ -308,6 +377,8 @@ static void buddyTyped(PurpleAccount *account, const char *who, gpointer null) {
  * Called when somebody from legacy network stops typing
  */
 static void buddyTypingStopped(PurpleAccount *account, const char *who, gpointer null){
+	if (tracingCallbacks())
+		traceCallback("buddyTypingStopped", account, NULL, who);
 	GlooxMessageHandler::instance()->purpleBuddyTypingStopped(account, who);
 }
 
@@ -315,18 +386,26 @@ static void buddyTypingStopped(PurpleAccount *account, const char *who, gpointer
  * Called when PurpleBuddy is removed
  */
 static void buddyRemoved(PurpleBuddy *buddy, gpointer null) {
+	if (tracingCallbacks())
+		traceCallback("buddyRemoved", purple_buddy_get_account(buddy), NULL, purple_buddy_get_name(buddy));
 	GlooxMessageHandler::instance()->purpleBuddyRemoved(buddy);
 }
 
 static void buddyStatusChanged(PurpleBuddy *buddy, PurpleStatus *status, PurpleStatus *old_status) {
+	if (tracingCallbacks())
+		traceCallback("buddyStatusChanged", purple_buddy_get_account(buddy), NULL, purple_buddy_get_name(buddy), purple_status_get_attr_string(status, "message"), purple_primitive_get_id_from_type(purple_status_type_get_primitive(purple_status_get_type(status))));
 	GlooxMessageHandler::instance()->purpleBuddyStatusChanged(buddy, status, old_status);
 }
 
 static void buddySignedOn(PurpleBuddy *buddy) {
+	if (tracingCallbacks())
+		traceCallback("buddySignedOn", purple_buddy_get_account(buddy), NULL, purple_buddy_get_name(buddy));
 	GlooxMessageHandler::instance()->purpleBuddySignedOn(buddy);
 }
 
 static void buddySignedOff(PurpleBuddy *buddy) {
+	if (tracingCallbacks())
+		traceCallback("buddySignedOff", purple_buddy_get_account(buddy), NULL, purple_buddy_get_name(buddy));
 	GlooxMessageHandler::instance()->purpleBuddySignedOff(buddy);
 }
 
@@ -352,6 +431,8 @@ static void NodeRemoved(PurpleBlistNode *node, void *data) {
  * Called when purple disconnects from legacy network.
  */
 static void connection_report_disconnect(PurpleConnection *gc,PurpleConnectionError reason,const char *text){
+	if (tracingCallbacks())
+		traceCallback("connection_report_disconnect", purple_connection_get_account(gc), NULL, NULL, text, stringOf((int) reason).c_str());
 	GlooxMessageHandler::instance()->purpleConnectionError(gc, reason, text);
 }
 
@@ -589,8 +670,9 @@ static void * notifyEmails(PurpleConnection *gc, size_t count, gboolean detailed
 	else {
 		PurpleAccount *account = purple_connection_get_account(gc);
 		User *user = (User *) GlooxMessageHandler::instance()->userManager()->getUserByAccount(account);
-		std::string message = Poco::format(_("%s has %d new message."), std::string(*tos), (int) count );
-		Message s(Message::Chat, user->jid(), tr(user->getLang(), message));
+		std::string message = tr(user->getTranslation(), Poco::format(_("%s has %d new message."), std::string(*tos), (int) count));
+		sanitizeXMLText(message);
+		Message s(Message::Chat, user->jid(), message);
 		s.setFrom(Transport::instance()->jid());
 		Transport::instance()->send(s.tag());
 	}
@@ -928,6 +1010,50 @@ static gboolean transportReconnect(gpointer data) {
 	return FALSE;
 }
 
+/*
+ * Called by StanzaQueue to really send the stanza
+ */
+static void sendStanza(Tag *tag, void *data) {
+	GlooxMessageHandler *handler = (GlooxMessageHandler *) data;
+	handler->j->send(tag);
+}
+
+static void sendRawStanza(const std::string &xml, void *data) {
+	GlooxMessageHandler *handler = (GlooxMessageHandler *) data;
+	handler->sendRaw(xml);
+}
+
+// Unacknowledged bytes in socket above which StanzaQueue stops sending.
+#define MAX_UNSENT_BYTES (64 * 1024)
+
+/*
+ * Called by StanzaQueue to check if the connection can take more data.
+ * gloox writes to blocking socket, so without this check slow XMPP server
+ * would block the whole transport.
+ */
+static bool canWriteStanza(void *data) {
+#ifndef WIN32
+	GlooxMessageHandler *handler = (GlooxMessageHandler *) data;
+	ConnectionTCPClient *conn = dynamic_cast<ConnectionTCPClient*>(handler->j->connectionImpl());
+	if (conn == NULL || conn->socket() < 0)
+		return true;
+	int fd = conn->socket();
+#ifdef SIOCOUTQ
+	// Data not acknowledged by the server yet.
+	int unsent = 0;
+	if (ioctl(fd, SIOCOUTQ, &unsent) == 0 && unsent > MAX_UNSENT_BYTES)
+		return false;
+#endif
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLOUT);
+#else
+	return true;
+#endif
+}
+
 static gboolean sendPing(gpointer data) {
 	GlooxMessageHandler::instance()->j->xmppPing(GlooxMessageHandler::instance()->jid(), GlooxMessageHandler::instance());
 	return TRUE;
@@ -940,9 +1066,24 @@ static void transportDataReceived(gpointer data, gint source, PurpleInputConditi
 	GlooxMessageHandler::instance()->j->recv(1000);
 }
 
+static GTimeVal startupPhaseStart;
+
+/*
+ * Logs time spent in startup phase which has just finished and starts measuring the next one.
+ */
+static void startupPhase(const char *finished) {
+	GTimeVal now;
+	g_get_current_time(&now);
+	if (finished) {
+		long ms = (now.tv_sec - startupPhaseStart.tv_sec) * 1000 + (now.tv_usec - startupPhaseStart.tv_usec) / 1000;
+		Log("startup", finished << " took " << ms << " ms");
+	}
+	startupPhaseStart = now;
+}
+
 static void listPurpleSettings() {
 	std::cout << "You can use those variables in [purple] section in Spectrum config file.\n";
-	PurplePlugin *plugin = purple_find_prpl(Transport::instance()->protocol()->protocol().c_str());
+	PurplePlugin *plugin = Transport::instance()->prpl();
 	PurplePluginProtocolInfo *prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(plugin);
 	for (GList *l = prpl_info->protocol_options; l != NULL; l = l->next) {
 		PurpleAccountOption *option = (PurpleAccountOption *) l->data;
@@ -998,18 +1139,31 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 	gatewayHandler = NULL;
 	ftServer = NULL;
 	m_stats = NULL;
+	m_probeLimiter = NULL;
+	m_sessionSnapshot = NULL;
+	m_stanzaQueue = NULL;
+	m_workScheduler = NULL;
+	m_prpl = NULL;
 	connectIO = NULL;
 	m_socketId = 0;
 #ifndef WIN32
 	m_configInterface = NULL;
+	m_memoryAccounting = NULL;
 #endif
+	m_flightRecorder = NULL;
 
 	bool loaded = true;
 
+	startupPhase(NULL);
 	if (!loadConfigFile(config))
 		loaded = false;
+	startupPhase("loading config");
 
 	g_thread_init(NULL);
+	if ((check_db_version || upgrade_db) && m_configuration.sqlType == "kv") {
+		std::cout << "Key-value storage backend doesn't have DB schema, there's nothing to check or upgrade.\n";
+		exit(0);
+	}
 	if (check_db_version) {
 		m_sql = new SQLClass(this, upgrade_db, true);
 		if (!m_sql->loaded())
@@ -1051,20 +1205,41 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 
 	if (m_configuration.logAreas & LOG_AREA_PURPLE)
 		j->logInstance().registerLogHandler(LogLevelDebug, LogAreaXmlIncoming | LogAreaXmlOutgoing, &Log_);
+	if (trace_file) {
+		streamTrace = new StreamTrace();
+		if (streamTrace->open(trace_file))
+			j->logInstance().registerLogHandler(LogLevelDebug, LogAreaXmlIncoming | LogAreaXmlOutgoing, streamTrace);
+		else {
+			delete streamTrace;
+			streamTrace = NULL;
+		}
+	}
+	// Stanzas are recorded only for users selected by admin.
+	m_flightRecorder = new FlightRecorderManager();
+	j->logInstance().registerLogHandler(LogLevelDebug, LogAreaXmlIncoming | LogAreaXmlOutgoing, m_flightRecorder);
 	m_loop = NULL;
 #ifdef WITH_LIBEVENT
 	m_evLoop = NULL;
 #endif
 
+	if (CONFIG().eventloop != "glib") {
+#ifdef WITH_LIBEVENT
+		m_evLoop = createEventLoop(CONFIG().eventloop);
+		if (m_evLoop) {
+			setLoop(m_evLoop);
+			Log("eventloop", "Using libev eventloop with " << getEventLoopBackend(m_evLoop) << " backend");
+		}
+		else
+#endif
+		{
+			Log("eventloop", "Eventloop " << CONFIG().eventloop << " is not available, using glib");
+			m_configuration.eventloop = "glib";
+		}
+	}
+
 	if (CONFIG().eventloop == "glib") {
 		m_loop = g_main_loop_new(NULL, FALSE);
 	}
-#ifdef WITH_LIBEVENT
-	else {
-		m_evLoop = ev_default_loop (0);
-		setLoop(m_evLoop);
-	}
-#endif
 
 	m_userManager = new UserManager();
 	m_adhoc = new GlooxAdhocHandler();
@@ -1073,11 +1248,16 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 	if (list_purple_settings)
 		m_configuration.logAreas = 0;
 	
+	startupPhase("creating main loop");
 	if (loaded && !initPurple())
 		loaded = false;
+	startupPhase("libpurple initialization");
 	
 	if (loaded && !loadProtocol())
 		loaded = false;
+	if (loaded && m_configuration.prunePlugins)
+		pruneUnusedPlugins();
+	startupPhase("loading protocol");
 
 	if (list_purple_settings) {
 		listPurpleSettings();
@@ -1085,9 +1265,13 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 	}
 
 	if (loaded) {
-		m_sql = new SQLClass(this, upgrade_db);
+		if (m_configuration.sqlType == "kv")
+			m_sql = new KVBackend(this);
+		else
+			m_sql = new SQLClass(this, upgrade_db);
 		if (!m_sql->loaded())
 			loaded = false;
+		startupPhase("opening storage");
 	}
 
 	if (loaded) {
@@ -1115,6 +1299,19 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 
 		m_parser = new GlooxParser();
 		m_collector = new AccountCollector();
+		m_probeLimiter = new ProbeLimiter(m_configuration.unregisteredCacheTTL, m_configuration.unregisteredCacheSize,
+										  m_configuration.probeBurst, m_configuration.probeInterval);
+		m_stanzaQueue = new StanzaQueue(&sendStanza, this, m_configuration.queueBudget);
+		m_stanzaQueue->setRawSender(&sendRawStanza);
+		m_stanzaQueue->setWritable(&canWriteStanza);
+		m_stanzaQueue->setLimit(STANZA_PRIORITY_HIGH, m_configuration.queueHighLimit * 1024);
+		m_stanzaQueue->setLimit(STANZA_PRIORITY_PRESENCE, m_configuration.queuePresenceLimit * 1024);
+		m_stanzaQueue->setLimit(STANZA_PRIORITY_BULK, m_configuration.queueBulkLimit * 1024);
+		m_workScheduler = new WorkScheduler(m_configuration.jobsBudget);
+		if (!m_protocol->tempAccountsAllowed()) {
+			m_sessionSnapshot = new SessionSnapshot(m_configuration.sessionSnapshot, m_configuration.sessionSnapshotInterval, m_configuration.sessionSnapshotMaxAge);
+			m_sessionSnapshot->load();
+		}
 
 		ftManager = new FileTransferManager();
 		ft = new SIProfileFT(j, ftManager);
@@ -1137,28 +1334,38 @@ GlooxMessageHandler::GlooxMessageHandler(const std::string &config) : MessageHan
 		j->registerIqHandler(m_stats, ExtStats);
 		m_vcardManager = new VCardManager(j);
 #ifndef WIN32
-		if (m_configInterface)
+		if (m_configInterface) {
 			m_configInterface->registerHandler(m_stats);
+			m_memoryAccounting = new MemoryAccounting();
+			m_configInterface->registerHandler(m_memoryAccounting);
+			m_configInterface->registerHandler(m_flightRecorder);
+		}
 #endif
 		m_vcard = new GlooxVCardHandler(this);
 		j->registerIqHandler(m_vcard, ExtVCard);
 		j->registerPresenceHandler(this);
 		j->registerSubscriptionHandler(this);
 		Transport::instance()->registerStanzaExtension( new VCardUpdate );
+		startupPhase("creating handlers");
 
 		transportConnect();
 		if (m_loop) {
 			g_main_loop_run(m_loop);
 		}
 #ifdef WITH_LIBEVENT
-		else {
-			 ev_loop(m_evLoop, 0);
+		else if (m_evLoop) {
+			ev_loop(m_evLoop, 0);
 		}
 #endif
 	}
 }
 
 GlooxMessageHandler::~GlooxMessageHandler(){
+	// Store snapshot before users are removed, so we can restore them quickly.
+	if (m_sessionSnapshot) {
+		m_sessionSnapshot->save();
+		delete m_sessionSnapshot;
+	}
 	delete m_userManager;
 	purple_blist_uninit();
 	purple_core_quit();
@@ -1167,14 +1374,16 @@ GlooxMessageHandler::~GlooxMessageHandler(){
 		g_main_loop_unref(m_loop);
 	}
 #ifdef WITH_LIBEVENT
-	else {
-// 		stop m_evLoop somehow...
+	else if (m_evLoop) {
+		ev_unloop(m_evLoop, EVUNLOOP_ALL);
 	}
 #endif
 	
 #ifndef WIN32
 	if (m_configInterface)
 		delete m_configInterface;
+	if (m_memoryAccounting)
+		delete m_memoryAccounting;
 #endif
 	if (m_parser)
 		delete m_parser;
@@ -1188,6 +1397,12 @@ GlooxMessageHandler::~GlooxMessageHandler(){
 		delete gatewayHandler;
 	if (m_stats)
 		delete m_stats;
+	if (m_probeLimiter)
+		delete m_probeLimiter;
+	if (m_stanzaQueue)
+		delete m_stanzaQueue;
+	if (m_workScheduler)
+		delete m_workScheduler;
 	if (m_adhoc)
 		delete m_adhoc;
 	if (m_vcardManager)
@@ -1203,10 +1418,18 @@ GlooxMessageHandler::~GlooxMessageHandler(){
 		delete m_searchHandler;
 	delete m_transport;
 	delete j;
+	// Deleted after the component, so the end of the stream is recorded too.
+	if (streamTrace) {
+		delete streamTrace;
+		streamTrace = NULL;
+	}
+	if (m_flightRecorder)
+		delete m_flightRecorder;
 }
 
 bool GlooxMessageHandler::loadProtocol(){
 	m_protocol = NULL;
+	m_prpl = NULL;
 	for (GList *l = getSupportedProtocols(); l != NULL; l = l->next) {
 		_spectrum_protocol *protocol = (_spectrum_protocol *) l->data;
 		if (configuration().protocol == protocol->prpl_id) {
@@ -1227,7 +1450,8 @@ bool GlooxMessageHandler::loadProtocol(){
 		return false;
 	}
 
-	if (!purple_find_prpl(m_protocol->protocol().c_str())) {
+	m_prpl = purple_find_prpl(m_protocol->protocol().c_str());
+	if (!m_prpl) {
 		Log("loadProtocol", "There is no libpurple plugin installed for protocol \"" << configuration().protocol << "\"");
 		return false;
 	}
@@ -1246,6 +1470,10 @@ bool GlooxMessageHandler::loadProtocol(){
 	return true;
 }
 
+void GlooxMessageHandler::sendRaw(const std::string &xml) {
+	((HiComponent *) j)->sendRaw(xml);
+}
+
 void GlooxMessageHandler::handleLog(LogLevel level, LogArea area, const std::string &message) {
 // 	if (m_configuration.logAreas & LOG_AREA_XML) {
 // 		if (area == LogAreaXmlIncoming)
@@ -1266,22 +1494,24 @@ void GlooxMessageHandler::purpleConnectionError(PurpleConnection *gc,PurpleConne
 		Log(user->jid(), "Disconnected from legacy network because of error " << int(reason) << " " << std::string(text ? text : ""));
 		if (text)
 			Log(user->jid(), std::string(text));
+		std::string message = tr(user->getTranslation(), _(text ? text : ""));
+		sanitizeXMLText(message);
 		// fatal error => account will be disconnected, so we have to remove it
 		if (reason != 0) {
 // 			if (text){
-// 				Message s(Message::Chat, user->jid(), tr(user->getLang(), text));
+// 				Message s(Message::Chat, user->jid(), tr(user->getTranslation(), text));
 // 				std::string from;
 // 				s.setFrom(jid());
 // 				Transport::instance()->send(s);
 // 			}
-			Presence tag(Presence::Unavailable, user->jid(), tr(user->getLang(), _(text ? text : "")));
+			Presence tag(Presence::Unavailable, user->jid(), message);
 			tag.setFrom(Transport::instance()->jid());
 			Transport::instance()->send(tag.tag());
 			m_userManager->removeUserTimer(user);
 		}
 		else {
 			if (user->reconnectCount() > 0) {
-				Presence tag(Presence::Unavailable, user->jid(), tr(user->getLang(), _(text ? text : "")));
+				Presence tag(Presence::Unavailable, user->jid(), message);
 				tag.setFrom(Transport::instance()->jid());
 				Transport::instance()->send(tag.tag());
 				m_userManager->removeUserTimer(user);
@@ -1507,7 +1737,7 @@ void GlooxMessageHandler::notifyEmail(PurpleConnection *gc,const char *subject,
 	PurpleAccount *account = purple_connection_get_account(gc);
 	User *user = (User *) userManager()->getUserByAccount(account);
 	if (user!=NULL) {
-		if (user->getSetting<bool>("enable_notify_email")) {
+		if (user->getSetting<bool>(SETTING_ENABLE_NOTIFY_EMAIL)) {
 			std::string text("New email, ");
 			if (from)
 				text += "From: " + std::string(from);
@@ -1519,6 +1749,7 @@ void GlooxMessageHandler::notifyEmail(PurpleConnection *gc,const char *subject,
 				text += "Subject: " + std::string(subject) + "\n";
 			if (url)
 				text += "URL: " + std::string(url);
+			sanitizeXMLText(text);
 			Message s(Message::Chat, user->jid(), text);
 			s.setFrom(jid());
 			Transport::instance()->send(s.tag());
@@ -1605,18 +1836,11 @@ void GlooxMessageHandler::handleSubscription(const Subscription &stanza) {
 		return;
 	}
 
-	if (CONFIG().protocol == "irc") {
+	if (protocol()->tempAccountsAllowed()) {
 		return;
 	}
 
-	User *user;
-	if (protocol()->tempAccountsAllowed()) {
-		std::string server = stanza.to().username().substr(stanza.to().username().find("%") + 1, stanza.to().username().length() - stanza.to().username().find("%"));
-		user = (User *) userManager()->getUserByJID(stanza.from().bare() + server);
-	}
-	else {
-		user = (User *) userManager()->getUserByJID(stanza.from().bare());
-	}
+	User *user = (User *) userManager()->getUserByJID(stanza.from().bare());
 	if (user)
 		user->handleSubscription(stanza);
 	else if (stanza.subtype() == Subscription::Unsubscribe) {
@@ -1657,6 +1881,14 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 		return;
 	}
 	
+	// Presence for transport from JID we already know is unregistered => drop it
+	// without asking database and disco#info again.
+	if (stanza.to().username() == "" && !protocol()->tempAccountsAllowed() && m_probeLimiter->isUnregistered(stanza.from().bare())) {
+		Log(stanza.from().full(), "This user is not registered (cached), dropping presence");
+		m_probeLimiter->countDropped();
+		return;
+	}
+
 	// get entity capabilities
 	Tag *c = NULL;
 	bool isMUC = stanza.findExtension(ExtMUC) != NULL;
@@ -1681,17 +1913,8 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 		delete stanzaTag;
 	}
 	
-	User *user;
-	std::string userkey;
-	if (protocol()->tempAccountsAllowed()) {
-		std::string server = stanza.to().username().substr(stanza.to().username().find("%") + 1, stanza.to().username().length() - stanza.to().username().find("%"));
-		userkey = stanza.from().bare() + server;
-		user = (User *) userManager()->getUserByJID(stanza.from().bare() + server);
-	}
-	else {
-		user = (User *) userManager()->getUserByJID(stanza.from().bare());
-		userkey = stanza.from().bare();
-	}
+	std::string userkey = protocol()->userKey(stanza.from(), stanza.to());
+	User *user = (User *) userManager()->getUserByJID(userkey);
 	if (user == NULL) {
 		// we are not connected and probe arrived => answer with unavailable
 		if (stanza.subtype() == Presence::Probe) {
@@ -1701,7 +1924,7 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 			tag->addAttribute("from", stanza.to().bare());
 			tag->addAttribute("type", "unavailable");
 			Transport::instance()->send(tag);
-			if (stanza.to().username() == "") {
+			if (stanza.to().username() == "" && m_probeLimiter->canSendProbe(userkey)) {
 				Tag *s = new Tag("presence");
 				s->addAttribute( "to", stanza.from().bare());
 				s->addAttribute( "type", "probe");
@@ -1714,6 +1937,7 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 			if(res.id==-1 && !protocol()->tempAccountsAllowed()) {
 				// presence from unregistered user
 				Log(stanza.from().full(), "This user is not registered");
+				m_probeLimiter->setUnregistered(userkey);
 				return;
 			}
 			else {
@@ -1726,6 +1950,7 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 					res.vip = 0;
 					sql()->addUser(res);
 					res = sql()->getUserByJid(userkey);
+					sql()->addUserServer(res.id, stanza.from().bare(), userkey.substr(stanza.from().bare().size() + 1));
 				}
 				bool isVip = res.vip;
 				std::list<std::string> const &x = configuration().allowedServers;
@@ -1735,8 +1960,8 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 				}
 				Log(stanza.from().full(), "Creating new User instance");
 				if (protocol()->tempAccountsAllowed()) {
-					std::string server = stanza.to().username().substr(stanza.to().username().find("%") + 1, stanza.to().username().length() - stanza.to().username().find("%"));
-					user = new User(stanza.from(), stanza.to().resource() + "@" + server, "", stanza.from().bare() + server, res.id, res.encoding, res.language, res.vip);
+					std::string server = AbstractProtocol::legacyServer(stanza.to().username());
+					user = new User(stanza.from(), stanza.to().resource() + "@" + server, "", userkey, res.id, res.encoding, res.language, res.vip);
 				}
 				else {
 					if (purple_accounts_find(res.uin.c_str(), protocol()->protocol().c_str()) != NULL) {
@@ -1756,13 +1981,7 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 
 				m_userManager->addUser(user);
 				user->receivedPresence(stanza);
-				if (protocol()->tempAccountsAllowed()) {
-					std::string server = stanza.to().username().substr(stanza.to().username().find("%") + 1, stanza.to().username().length() - stanza.to().username().find("%"));
-					server = stanza.from().bare() + server;
-					purple_timeout_add_seconds(15, &connectUser, g_strdup(server.c_str()));
-				}
-				else
-					purple_timeout_add_seconds(15, &connectUser, g_strdup(stanza.from().bare().c_str()));
+				purple_timeout_add_seconds(15, &connectUser, g_strdup(userkey.c_str()));
 			}
 		}
 		if (stanza.presence() == Presence::Unavailable && stanza.to().username() == ""){
@@ -1798,6 +2017,9 @@ void GlooxMessageHandler::handlePresence(const Presence &stanza){
 		if (res.id != -1) {
 			sql()->setUserOnline(res.id, false);
 		}
+		else if (!protocol()->tempAccountsAllowed()) {
+			m_probeLimiter->setUnregistered(userkey);
+		}
 	}
 }
 
@@ -1810,14 +2032,6 @@ void GlooxMessageHandler::onConnect() {
 		m_discoHandler->setIdentity("client", "pc", "Spectrum");
 		j->disco()->setVersion(configuration().discoName, VERSION, "");
 
-		std::string id = "client";
-		id += '/';
-		id += "pc";
-		id += '/';
-		id += '/';
-		id += "Spectrum";
-		id += '<';
-		
 		std::list<std::string> features = protocol()->transportFeatures();
 		features.sort();
 		for (std::list<std::string>::iterator it = features.begin(); it != features.end(); it++) {
@@ -1836,19 +2050,15 @@ void GlooxMessageHandler::onConnect() {
 			f.push_back("http://jabber.org/protocol/disco#info");
 		f.sort();
 		for (std::list<std::string>::iterator it = f.begin(); it != f.end(); it++) {
-			id += (*it);
-			id += '<';
 			m_discoHandler->addFeature(*it);
 		}
 
-		SHA sha;
-		sha.feed( id );
-		m_configuration.hash = Base64::encode64( sha.binary() );
+		m_configuration.hash = m_discoHandler->capsHash();
 		j->disco()->registerNodeHandler( m_spectrumNodeHandler, "http://spectrum.im/transport#" + m_configuration.hash );
 		m_discoHandler->registerNodeHandler( m_spectrumNodeHandler, "http://spectrum.im/transport#" + m_configuration.hash );
 
-		if (m_configuration.protocol != "irc")
-			new AutoConnectLoop();
+		if (!m_protocol->tempAccountsAllowed())
+			new AutoConnectLoop(m_sessionSnapshot);
 		m_firstConnection = false;
 		purple_timeout_add_seconds(60, &sendPing, this);
 	}
@@ -1856,6 +2066,9 @@ void GlooxMessageHandler::onConnect() {
 
 void GlooxMessageHandler::onDisconnect(ConnectionError e) {
 	Log("gloox", "Disconnected from Jabber server !");
+	// Queued stanzas would be sent to the new stream with outdated state.
+	if (m_stanzaQueue)
+		m_stanzaQueue->clear();
 	switch (e) {
 		case ConnNoError: Log("gloox", "Reason: No error"); break;
 		case ConnStreamError: Log("gloox", "Reason: Stream error"); break;
@@ -1969,15 +2182,7 @@ void GlooxMessageHandler::handleMessage (const Message &msg, MessageSession *ses
 	if (msg.subtype() == Message::Error || msg.subtype() == Message::Invalid)
 		return;
 	
-	User *user;
-	// TODO; move it to IRCProtocol
-	if (m_configuration.protocol == "irc") {
-		std::string server = msg.to().username().substr(msg.to().username().find("%") + 1, msg.to().username().length() - msg.to().username().find("%"));
-		user = (User *) userManager()->getUserByJID(msg.from().bare() + server);
-	}
-	else {
-		user = (User *) userManager()->getUserByJID(msg.from().bare());
-	}
+	User *user = (User *) userManager()->getUserByJID(m_protocol->userKey(msg.from(), msg.to()));
 	if (user!=NULL) {
 		if (user->isConnected()) {
 			Tag *msgTag = msg.tag();
@@ -2014,11 +2219,14 @@ void GlooxMessageHandler::handleMessage (const Message &msg, MessageSession *ses
 			s.addExtension(c);
 			Transport::instance()->send(s.tag());
 
-			Tag *stanza = new Tag("presence");
-			stanza->addAttribute( "to", msg.from().bare());
-			stanza->addAttribute( "type", "probe");
-			stanza->addAttribute( "from", jid());
-			Transport::instance()->send(stanza);
+			// Don't probe unregistered users and don't flood the others with probes.
+			if (!m_probeLimiter->isUnregistered(msg.from().bare()) && m_probeLimiter->canSendProbe(msg.from().bare())) {
+				Tag *stanza = new Tag("presence");
+				stanza->addAttribute( "to", msg.from().bare());
+				stanza->addAttribute( "type", "probe");
+				stanza->addAttribute( "from", jid());
+				Transport::instance()->send(stanza);
+			}
 		}
 		delete msgTag;
 	}
@@ -2038,6 +2246,28 @@ void GlooxMessageHandler::handleVCardResult(VCardContext context, const JID& jid
 	
 }
 
+void GlooxMessageHandler::pruneUnusedPlugins() {
+	// libpurple probes every plugin in its plugin directory during purple_core_init
+	// and keeps their modules opened. We need only loaded plugins (our prpl and helpers
+	// loaded by protocol class), plugin loaders and SSL plugins, which are loaded on demand.
+	// libpurple has no API to restrict the search path before probing, so this only
+	// frees memory of the other plugins, it doesn't save the probing time.
+	int pruned = 0;
+	GList *plugins = g_list_copy(purple_plugins_get_all());
+	for (GList *l = plugins; l != NULL; l = l->next) {
+		PurplePlugin *plugin = (PurplePlugin *) l->data;
+		if (purple_plugin_is_loaded(plugin) || !plugin->info || plugin->info->type != PURPLE_PLUGIN_STANDARD)
+			continue;
+		std::string id(plugin->info->id ? plugin->info->id : "");
+		if (id.find("ssl") != std::string::npos)
+			continue;
+		purple_plugin_destroy(plugin);
+		pruned++;
+	}
+	g_list_free(plugins);
+	Log("startup", "Destroyed " << pruned << " unused plugins");
+}
+
 bool GlooxMessageHandler::initPurple(){
 	bool ret;
 
@@ -2048,7 +2278,7 @@ bool GlooxMessageHandler::initPurple(){
 
 	purple_core_set_ui_ops(&coreUiOps);
 	
-	purple_eventloop_set_ui_ops(getEventLoopUiOps());
+	purple_eventloop_set_ui_ops(getEventLoopUiOps(CONFIG().eventloop));
 
 	ret = purple_core_init(PURPLE_UI);
 	if (ret) {
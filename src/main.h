@@ -94,7 +94,7 @@ class GlooxStatsHandler;
 class GlooxVCardHandler;
 class GlooxGatewayHandler;
 class GlooxAdhocHandler;
-class SQLClass;
+class AbstractBackend;
 class FileTransferManager;
 class UserManager;
 class AbstractProtocol;
@@ -104,9 +104,15 @@ class GlooxParser;
 class AccountCollector;
 class Transport;
 class SpectrumNodeHandler;
+class ProbeLimiter;
+class StanzaQueue;
+class WorkScheduler;
+class SessionSnapshot;
 #ifndef WIN32
 class ConfigInterface;
+class MemoryAccounting;
 #endif
+class FlightRecorderManager;
 
 struct User;
 struct UserRow;
@@ -190,13 +196,20 @@ public:
 	GlooxStatsHandler *stats() { return m_stats; }
 	Configuration & configuration() { return m_configuration; }
 	const std::string & jid() { return m_configuration.jid; } // just to create shortcut and because of historical reasons
-	SQLClass *sql() { return m_sql; }
+	AbstractBackend *sql() { return m_sql; }
 	GlooxVCardHandler *vcard() { return m_vcard; }
 	AbstractProtocol *protocol() { return m_protocol; }
+	PurplePlugin *prpl() { return m_prpl; }
 	GlooxAdhocHandler *adhoc() { return m_adhoc; }
 	GlooxSearchHandler *searchHandler() { return m_searchHandler; }
 	GlooxParser *parser() { return m_parser; }
 	AccountCollector *collector() { return m_collector; }
+	ProbeLimiter *probeLimiter() { return m_probeLimiter; }
+	StanzaQueue *stanzaQueue() { return m_stanzaQueue; }
+	WorkScheduler *workScheduler() { return m_workScheduler; }
+
+	// Sends stanza serialized by StanzaWriter, bypassing StanzaQueue.
+	void sendRaw(const std::string &xml);
 
 	// TODO: Make me private!
 	FileTransferManager* ftManager;
@@ -218,9 +231,15 @@ private:
 	 */
 	bool loadProtocol();
 
+	/*
+	 * Destroys probed plugins which are not used by loaded protocol to free their memory.
+	 */
+	void pruneUnusedPlugins();
+
 	Configuration m_configuration;				// configuration struct
 	AbstractProtocol *m_protocol;				// currently used protocol
-	SQLClass *m_sql;							// storage class
+	PurplePlugin *m_prpl;						// libpurple plugin of currently used protocol
+	AbstractBackend *m_sql;					// storage class
 	AccountCollector *m_collector;
 
 	CapabilityHandler *m_capabilityHandler;
@@ -233,9 +252,15 @@ private:
 	GlooxParser *m_parser;						// Gloox parser - makes Tag* from std::string
 	VCardManager* m_vcardManager;
 	SpectrumNodeHandler *m_spectrumNodeHandler;
+	ProbeLimiter *m_probeLimiter;				// negative cache and probes rate limiter
+	SessionSnapshot *m_sessionSnapshot;			// snapshot of online users used for fast restart
+	StanzaQueue *m_stanzaQueue;					// prioritized queue of outgoing stanzas
+	WorkScheduler *m_workScheduler;				// runs long per-user jobs in small steps
 #ifndef WIN32
 	ConfigInterface *m_configInterface;
+	MemoryAccounting *m_memoryAccounting;		// memory usage of subsystems and users
 #endif
+	FlightRecorderManager *m_flightRecorder;	// per-user event recorders enabled by admin
 	GIOChannel *connectIO;						// GIOChannel for Gloox socket
 	guint connectID;
 
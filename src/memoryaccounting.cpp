@@ -0,0 +1,206 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "memoryaccounting.h"
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gloox/iq.h"
+#include "main.h"
+#include "transport.h"
+#include "usermanager.h"
+#include "user.h"
+#include "stanzaqueue.h"
+#include "vcardhandler.h"
+#include "filetransferrepeater.h"
+
+// Computed usage is cached for getStats, so frequent statistics polling
+// doesn't walk all rosters every time.
+#define MEMORY_STATS_CACHE_TIME 10
+
+static const char *subsystemNames[] = {"roster", "conversations", "muc", "filetransfers", "caps", "vcards", "stanza-queue"};
+
+static bool compareUsage(const MemoryAccounting::UserUsage &a, const MemoryAccounting::UserUsage &b) {
+	return a.total > b.total;
+}
+
+MemoryAccounting::MemoryAccounting() {
+}
+
+MemoryAccounting::~MemoryAccounting() {
+}
+
+unsigned long MemoryAccounting::stringSize(const char *str) {
+	return str ? strlen(str) + 1 : 0;
+}
+
+const char *MemoryAccounting::subsystemName(int subsystem) {
+	if (subsystem < 0 || subsystem >= MEMORY_SUBSYSTEM_COUNT)
+		return "unknown";
+	return subsystemNames[subsystem];
+}
+
+void MemoryAccounting::sortUsers(std::vector <UserUsage> &users, unsigned int limit) {
+	if (limit != 0 && limit < users.size()) {
+		std::partial_sort(users.begin(), users.begin() + limit, users.end(), compareUsage);
+		users.resize(limit);
+	}
+	else
+		std::sort(users.begin(), users.end(), compareUsage);
+}
+
+void MemoryAccounting::addUser(unsigned long *totals, std::vector <UserUsage> &users, const std::string &jid, const unsigned long *usage) {
+	UserUsage u;
+	u.jid = jid;
+	u.total = 0;
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+		u.usage[i] = usage[i];
+		u.total += usage[i];
+		totals[i] += usage[i];
+	}
+	users.push_back(u);
+}
+
+void MemoryAccounting::collect(unsigned long *totals, std::vector <UserUsage> &users) {
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+		totals[i] = 0;
+
+	// Filetransfer buffers are bucketed by account in one pass, so we don't
+	// walk all transfers for every online user.
+	std::map <PurpleAccount *, unsigned long> xfers;
+	for (GList *l = purple_xfers_get_all(); l != NULL; l = l->next) {
+		PurpleXfer *xfer = (PurpleXfer *) l->data;
+		if (xfer->ui_data == NULL)
+			continue;
+		FiletransferRepeater *repeater = (FiletransferRepeater *) xfer->ui_data;
+		xfers[purple_xfer_get_account(xfer)] += sizeof(FiletransferRepeater) + repeater->getBufferSize();
+	}
+
+	UserManager *manager = Transport::instance()->userManager();
+	if (manager) {
+		GHashTableIter iter;
+		gpointer key, value;
+		g_hash_table_iter_init(&iter, manager->getUsersTable());
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			User *user = (User *) value;
+			unsigned long usage[MEMORY_SUBSYSTEM_COUNT];
+			for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+				usage[i] = 0;
+			user->getMemoryUsage(usage);
+
+			std::map <PurpleAccount *, unsigned long>::iterator it = xfers.find(user->account());
+			if (it != xfers.end())
+				usage[MEMORY_FILETRANSFERS] += (*it).second;
+
+			addUser(totals, users, user->jid(), usage);
+		}
+	}
+
+	// Caches shared by all users.
+	totals[MEMORY_CAPS] += Transport::instance()->getMemoryUsage();
+
+	GlooxVCardHandler *vcard = GlooxMessageHandler::instance()->vcard();
+	if (vcard)
+		totals[MEMORY_VCARDS] += vcard->getMemoryUsage();
+
+	// Queue can contain also stanzas for users who are not online anymore.
+	StanzaQueue *queue = GlooxMessageHandler::instance()->stanzaQueue();
+	if (queue)
+		totals[MEMORY_STANZA_QUEUE] = queue->bytes();
+}
+
+void MemoryAccounting::getStats(std::map <std::string, BackendStat> &stats) {
+	static unsigned long totals[MEMORY_SUBSYSTEM_COUNT];
+	static time_t lastCollect = 0;
+
+	time_t now = time(NULL);
+	if (lastCollect == 0 || now - lastCollect >= MEMORY_STATS_CACHE_TIME) {
+		std::vector <UserUsage> users;
+		collect(totals, users);
+		lastCollect = now;
+	}
+
+	unsigned long total = 0;
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+		std::string name = std::string("memory/") + subsystemName(i);
+		stats[name].units = "KB";
+		stats[name].value = totals[i] / 1024;
+		total += totals[i];
+	}
+	stats["memory/total"].units = "KB";
+	stats["memory/total"].value = total / 1024;
+}
+
+bool MemoryAccounting::handleCondition(Tag *stanzaTag) {
+	return stanzaTag->findChild("query", "xmlns", "http://spectrum.im/protocol/memory") != NULL;
+}
+
+Tag *MemoryAccounting::handleTag(Tag *stanzaTag) {
+// 	recv:	<iq type='result'>
+// 				<query xmlns='http://spectrum.im/protocol/memory'>
+// 					<subsystem name='roster' value='123456'/>
+// 					...
+// 					<user jid='user@example.com' total='4567' roster='4000' conversations='567' .../>
+// 					...
+// 				</query>
+// 			</iq>
+// All values are in bytes. Users are sorted by total, the biggest first. Limit 0
+// returns all online users.
+	Tag *query = stanzaTag->findChild("query");
+	if (query == NULL)
+		return NULL;
+
+	unsigned int limit = 10;
+	Tag *top = query->findChild("top");
+	if (top && !top->findAttribute("limit").empty())
+		limit = atoi(top->findAttribute("limit").c_str());
+
+	unsigned long totals[MEMORY_SUBSYSTEM_COUNT];
+	std::vector <UserUsage> users;
+	collect(totals, users);
+	sortUsers(users, limit);
+
+	IQ _s(IQ::Result, stanzaTag->findAttribute("from"), stanzaTag->findAttribute("id"));
+	_s.setFrom(Transport::instance()->jid());
+	Tag *s = _s.tag();
+
+	Tag *response = new Tag("query");
+	response->setXmlns("http://spectrum.im/protocol/memory");
+
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+		Tag *t = new Tag("subsystem");
+		t->addAttribute("name", subsystemName(i));
+		t->addAttribute("value", (long) totals[i]);
+		response->addChild(t);
+	}
+
+	for (std::vector <UserUsage>::iterator it = users.begin(); it != users.end(); it++) {
+		Tag *t = new Tag("user");
+		t->addAttribute("jid", (*it).jid);
+		t->addAttribute("total", (long) (*it).total);
+		for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+			t->addAttribute(subsystemName(i), (long) (*it).usage[i]);
+		response->addChild(t);
+	}
+
+	s->addChild(response);
+	return s;
+}
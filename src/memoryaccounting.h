@@ -0,0 +1,102 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_MEMORY_ACCOUNTING_H
+#define SPECTRUM_MEMORY_ACCOUNTING_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include "abstractconfiginterfacehandler.h"
+#include "abstractbackend.h"
+
+using namespace gloox;
+
+typedef enum {	MEMORY_ROSTER = 0,			// buddies and roster synchronization state
+				MEMORY_CONVERSATIONS,		// 1:1 conversations and their history
+				MEMORY_MUC,					// MUC conversations and occupants
+				MEMORY_FILETRANSFERS,		// filetransfer buffers
+				MEMORY_CAPS,				// resources and capabilities cache
+				MEMORY_VCARDS,				// buddy icons and pending vCard requests
+				MEMORY_STANZA_QUEUE,		// stanzas waiting in StanzaQueue
+				MEMORY_SUBSYSTEM_COUNT
+				} MemorySubsystem;
+
+// Approximate memory used by one node of std::map and std::list and by one
+// GHashTable entry (without the key and value themselves).
+#define MEMORY_MAP_NODE (4 * sizeof(void *) + sizeof(int))
+#define MEMORY_LIST_NODE (2 * sizeof(void *))
+#define MEMORY_HASH_NODE (3 * sizeof(void *))
+
+// Approximate size of PurplePresence with its statuses. The structure is
+// opaque, so we can't use sizeof().
+#define MEMORY_PURPLE_PRESENCE 256
+
+// Estimates memory held by transport subsystems and by every online user.
+//
+// Numbers are estimations computed from sizes of structures and strings we
+// know about, they don't include allocator overhead and memory used inside
+// libpurple prpls, so their sum is always lower than RSS. They are good enough
+// to tell which users or subsystems are responsible when RSS grows.
+//
+// Subsystems are exported as "memory/<subsystem>" statistics. Top users can be
+// queried through ConfigInterface:
+//
+//   <iq type='get'><query xmlns='http://spectrum.im/protocol/memory'><top limit='10'/></query></iq>
+class MemoryAccounting : public AbstractConfigInterfaceHandler {
+	public:
+		struct UserUsage {
+			std::string jid;
+			unsigned long usage[MEMORY_SUBSYSTEM_COUNT];
+			unsigned long total;
+		};
+
+		MemoryAccounting();
+		virtual ~MemoryAccounting();
+
+		// Computes memory used by every subsystem into `totals` and by every
+		// online user into `users`. `users` are not sorted, use sortUsers().
+		static void collect(unsigned long *totals, std::vector <UserUsage> &users);
+
+		// Appends user with per-subsystem `usage` to `users` and adds the usage
+		// to `totals`.
+		static void addUser(unsigned long *totals, std::vector <UserUsage> &users, const std::string &jid, const unsigned long *usage);
+
+		// Sorts users by total usage and keeps only first `limit` of them
+		// (0 means no limit).
+		static void sortUsers(std::vector <UserUsage> &users, unsigned int limit);
+
+		// Returns name of subsystem used in statistics.
+		static const char *subsystemName(int subsystem);
+
+		// Returns statistics for http://jabber.org/protocol/stats.
+		static void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Returns approximate memory used by string.
+		static unsigned long stringSize(const std::string &str) { return sizeof(std::string) + str.capacity(); }
+		static unsigned long stringSize(const char *str);
+
+		// AbstractConfigInterfaceHandler
+		bool handleCondition(Tag *tag);
+		Tag *handleTag(Tag *tag);
+};
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "probelimiter.h"
+#include "log.h"
+
+ProbeLimiter::ProbeLimiter(int ttl, unsigned int maxEntries, int burst, int interval) : m_ttl(ttl), m_maxEntries(maxEntries),
+	m_burst(burst), m_interval(interval), m_dropped(0), m_suppressed(0), m_time(0) {
+	if (m_maxEntries == 0)
+		m_maxEntries = 1;
+	if (m_interval <= 0)
+		m_interval = 1;
+}
+
+ProbeLimiter::~ProbeLimiter() {
+}
+
+time_t ProbeLimiter::now() {
+	return m_time == 0 ? time(NULL) : m_time;
+}
+
+void ProbeLimiter::expire(time_t t) {
+	// m_order is sorted by expiration time, so we can stop at first valid entry.
+	while (!m_order.empty() && (m_order.front().second <= t || m_cache.size() > m_maxEntries)) {
+		std::map <std::string, time_t>::iterator it = m_cache.find(m_order.front().first);
+		// Entry could be removed or added again since it's been inserted into m_order.
+		if (it != m_cache.end() && it->second == m_order.front().second)
+			m_cache.erase(it);
+		m_order.pop_front();
+	}
+}
+
+bool ProbeLimiter::isUnregistered(const std::string &jid) {
+	if (m_ttl <= 0)
+		return false;
+	time_t t = now();
+	std::map <std::string, time_t>::iterator it = m_cache.find(jid);
+	if (it == m_cache.end())
+		return false;
+	if (it->second <= t) {
+		m_cache.erase(it);
+		return false;
+	}
+	return true;
+}
+
+void ProbeLimiter::setUnregistered(const std::string &jid) {
+	if (m_ttl <= 0)
+		return;
+	time_t t = now();
+	m_cache[jid] = t + m_ttl;
+	m_order.push_back(std::make_pair(jid, t + m_ttl));
+	expire(t);
+}
+
+void ProbeLimiter::forget(const std::string &jid) {
+	m_cache.erase(jid);
+	m_buckets.erase(jid);
+}
+
+void ProbeLimiter::pruneBuckets(time_t t) {
+	// Bucket which has been refilled completely is the same as no bucket at all.
+	for (std::map <std::string, Bucket>::iterator it = m_buckets.begin(); it != m_buckets.end(); ) {
+		if (it->second.tokens + (double) (t - it->second.last) / m_interval >= m_burst)
+			m_buckets.erase(it++);
+		else
+			++it;
+	}
+}
+
+bool ProbeLimiter::canSendProbe(const std::string &jid) {
+	if (m_burst <= 0)
+		return true;
+	time_t t = now();
+	std::map <std::string, Bucket>::iterator it = m_buckets.find(jid);
+	if (it == m_buckets.end()) {
+		if (m_buckets.size() >= m_maxEntries) {
+			pruneBuckets(t);
+			// Table is still full of active senders, so be conservative.
+			if (m_buckets.size() >= m_maxEntries) {
+				m_suppressed++;
+				return false;
+			}
+		}
+		Bucket &b = m_buckets[jid];
+		b.tokens = m_burst - 1;
+		b.last = t;
+		return true;
+	}
+
+	Bucket &b = it->second;
+	b.tokens += (double) (t - b.last) / m_interval;
+	if (b.tokens > m_burst)
+		b.tokens = m_burst;
+	b.last = t;
+
+	if (b.tokens < 1) {
+		m_suppressed++;
+		Log(jid, "Probe presence suppressed by rate limiter");
+		return false;
+	}
+	b.tokens -= 1;
+	return true;
+}
@@ -0,0 +1,96 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_PROBE_LIMITER_H
+#define SPECTRUM_PROBE_LIMITER_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <time.h>
+
+// Protects the database and the XMPP server against misbehaving clients and
+// spam bots which keep sending stanzas to transport although they are not
+// registered or not connected.
+//
+// It keeps bounded negative cache of JIDs which are known to be unregistered
+// (every entry expires after `ttl` seconds) and per-JID token buckets used to
+// throttle probe presences sent as reaction to incoming stanzas.
+class ProbeLimiter {
+	public:
+		// `ttl` - number of seconds negative cache entry is valid.
+		// `maxEntries` - maximum number of JIDs in negative cache and in buckets table.
+		// `burst` - maximum number of probes which can be sent to one JID at once.
+		// `interval` - number of seconds needed to get one new probe token.
+		ProbeLimiter(int ttl = 300, unsigned int maxEntries = 10000, int burst = 3, int interval = 60);
+		~ProbeLimiter();
+
+		// Returns true if the JID is cached as unregistered.
+		bool isUnregistered(const std::string &jid);
+
+		// Counts stanza dropped because its sender is cached as unregistered.
+		void countDropped() { m_dropped++; }
+
+		// Marks JID as unregistered.
+		void setUnregistered(const std::string &jid);
+
+		// Removes JID from negative cache. Has to be called whenever user row
+		// is created (backends do it in addUser).
+		void forget(const std::string &jid);
+
+		// Returns true if the probe presence can be sent to JID. If it returns
+		// false, the probe should not be sent and it's counted as suppressed.
+		bool canSendProbe(const std::string &jid);
+
+		// Returns number of JIDs in negative cache.
+		unsigned int size() { return m_cache.size(); }
+
+		// Returns count of stanzas dropped because of negative cache.
+		long getDropped() { return m_dropped; }
+
+		// Returns count of probes suppressed by rate limiter.
+		long getSuppressed() { return m_suppressed; }
+
+		// Sets current time. Used only by tests, if it's 0, time(NULL) is used.
+		void setTime(time_t t) { m_time = t; }
+
+	private:
+		struct Bucket {
+			double tokens;
+			time_t last;
+		};
+
+		time_t now();
+		void expire(time_t t);
+		void pruneBuckets(time_t t);
+
+		std::map <std::string, time_t> m_cache;					// JID -> expiration time.
+		std::list <std::pair <std::string, time_t> > m_order;	// JIDs in insertion order.
+		std::map <std::string, Bucket> m_buckets;				// JID -> token bucket.
+		int m_ttl;
+		unsigned int m_maxEntries;
+		int m_burst;
+		int m_interval;
+		long m_dropped;
+		long m_suppressed;
+		time_t m_time;
+};
+
+#endif
@@ -40,6 +40,31 @@ extern Localization localization;
 
 using namespace gloox;
 
+// How incoming stanzas are routed to User instances.
+typedef enum {
+	PROTOCOL_ROUTING_BARE_JID = 0,	// One User per bare JID, buddies are "name@transport".
+	PROTOCOL_ROUTING_SERVER = 1,	// One User per bare JID and legacy server, buddies are "name%server@transport".
+} ProtocolRouting;
+
+// Describes protocol behaviour the core has to know about. Protocols fill it
+// in their constructors, so hot paths check these flags instead of comparing
+// configured protocol name.
+struct ProtocolCapabilities {
+	ProtocolCapabilities() : routing(PROTOCOL_ROUTING_BARE_JID), jidUsernames(false), mucPrivateMessages(false),
+		registration(true), passwordRequired(true), avatarWidth(0), avatarHeight(0), avatarExactSize(false),
+		rosterSyncQuietPeriod(500), rosterSyncMaxDelay(5000) {}
+
+	ProtocolRouting routing;
+	bool jidUsernames;			// Legacy usernames are JIDs, so resource is stripped from buddy names.
+	bool mucPrivateMessages;	// IM conversations can be private messages from MUC occupants.
+	bool registration;			// Users can register using jabber:iq:register.
+	bool passwordRequired;		// Registration form contains password field.
+	int avatarWidth;			// Size avatars are scaled to; 0 means prpl's icon_spec is used.
+	int avatarHeight;
+	bool avatarExactSize;		// Avatars are scaled to exactly avatarWidth x avatarHeight ignoring aspect ratio.
+	int rosterSyncQuietPeriod;	// Roster is synchronized when no new buddy came for this many milliseconds...
+	int rosterSyncMaxDelay;		// ...or when this many milliseconds passed since the first unsynchronized buddy.
+};
 
 // Abstract class for wrapping libpurple protocols
 class AbstractProtocol
@@ -47,6 +72,24 @@ class AbstractProtocol
 	public:
 		virtual ~AbstractProtocol() {}
 
+		// Returns protocol capabilities.
+		const ProtocolCapabilities &capabilities() { return m_capabilities; }
+
+		// Returns legacy server from "name%server" username or whole username if it doesn't contain '%'.
+		static std::string legacyServer(const std::string &username) {
+			size_t pos = username.find('%');
+			return pos == std::string::npos ? username : username.substr(pos + 1);
+		}
+
+		// Returns key of User instance which handles stanzas sent from `from` to `to`.
+		// With server routing it's "bare%server". '%' can't be in JID domain nor
+		// in server name, so the key can't be prefix of another user's key.
+		std::string userKey(const JID &from, const JID &to) {
+			if (m_capabilities.routing == PROTOCOL_ROUTING_SERVER)
+				return from.bare() + "%" + legacyServer(to.username());
+			return from.bare();
+		}
+
 		// Returns gateway identity (http://xmpp.org/registrar/disco-categories.html).
 		virtual const std::string gatewayIdentity() = 0;
 
@@ -143,7 +186,7 @@ class AbstractProtocol
 		/*
 		 * Returns true if temporary accounts for MUC are allows (this is useful for IRC, if you want to connect more network from one account)
 		 */
-		virtual bool tempAccountsAllowed() { return false; }
+		bool tempAccountsAllowed() { return m_capabilities.routing == PROTOCOL_ROUTING_SERVER; }
 		/*
 		 * Change nickname in room. Returns true if the nickname has to be changed in all rooms user is in.
 		 */
@@ -178,6 +221,9 @@ class AbstractProtocol
 		virtual void onRequestClose(void *handle) { }
 		virtual void onXMPPMessageReceived(User *user, const Message &msg) {}
 		virtual void onXMPPMessageSent(User *user, const char *msg) {}
+
+	protected:
+		ProtocolCapabilities m_capabilities;
 };
 
 #endif
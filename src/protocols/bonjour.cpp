@@ -21,6 +21,8 @@
 #include "bonjour.h"
 
 BonjourProtocol::BonjourProtocol() {
+	m_capabilities.passwordRequired = false;
+
 	m_transportFeatures.push_back("jabber:iq:register");
 	m_transportFeatures.push_back("jabber:iq:gateway");
 	m_transportFeatures.push_back("http://jabber.org/protocol/disco#info");
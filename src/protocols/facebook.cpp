@@ -76,16 +76,16 @@ Tag *FacebookProtocol::getVCardTag(User *user, GList *vcardEntries) {
 		if (purple_notify_user_info_entry_get_label(vcardEntry) && purple_notify_user_info_entry_get_value(vcardEntry)){
 			label = (std::string) purple_notify_user_info_entry_get_label(vcardEntry);
 			Log("vcard label", label << " => " << (std::string)purple_notify_user_info_entry_get_value(vcardEntry));
-			if (label==tr(user->getLang(),"Gender")){
+			if (label==tr(user->getTranslation(),"Gender")){
 				vcard->addChild( new Tag("GENDER", (std::string)purple_notify_user_info_entry_get_value(vcardEntry)));
 			}
-			else if (label==tr(user->getLang(),"Name")){
+			else if (label==tr(user->getTranslation(),"Name")){
 				vcard->addChild( new Tag("FN", (std::string)purple_notify_user_info_entry_get_value(vcardEntry)));
 			}
-			else if (label==tr(user->getLang(),"Birthday")){
+			else if (label==tr(user->getTranslation(),"Birthday")){
 				vcard->addChild( new Tag("BDAY", (std::string)purple_notify_user_info_entry_get_value(vcardEntry)));
 			}
-			else if (label==tr(user->getLang(),"Mobile")) {
+			else if (label==tr(user->getTranslation(),"Mobile")) {
 				Tag *tel = new Tag("TEL");
 				tel->addChild ( new Tag("CELL") );
 				tel->addChild ( new Tag("NUMBER", (std::string)purple_notify_user_info_entry_get_value(vcardEntry)) );
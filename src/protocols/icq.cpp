@@ -21,6 +21,12 @@
 #include "icq.h"
 
 ICQProtocol::ICQProtocol() {
+	m_capabilities.avatarWidth = 48;
+	m_capabilities.avatarHeight = 48;
+	m_capabilities.avatarExactSize = true;
+	m_capabilities.rosterSyncQuietPeriod = 3000;
+	m_capabilities.rosterSyncMaxDelay = 12000;
+
 	m_transportFeatures.push_back("jabber:iq:register");
 	m_transportFeatures.push_back("jabber:iq:gateway");
 	m_transportFeatures.push_back("http://jabber.org/protocol/disco#info");
@@ -238,11 +244,11 @@ bool ICQProtocol::onPurpleRequestInput(void *handle, User *user, const char *tit
 	if (primary){
 		std::string primaryString(primary);
 		if (primaryString == "Authorization Request Message:") {
-			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getLang(),_("Please authorize me.")));
+			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getTranslation(),_("Please authorize me.")));
 			return true;
 		}
 		else if (primaryString == "Authorization Denied Message:") {
-			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getLang(),_("Authorization denied.")));
+			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getTranslation(),_("Authorization denied.")));
 			return true;
 		}
 	}
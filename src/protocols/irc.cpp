@@ -47,7 +47,7 @@ ConfigHandler::ConfigHandler(User *user, const std::string &from, const std::str
 	std::map <std::string, std::string> values;
 	std::map<std::string, UserRow> users = Transport::instance()->sql()->getUsersByJid(bare);
 	for (std::map<std::string, UserRow>::iterator it = users.begin(); it != users.end(); it++) {
-		std::string server = (*it).second.jid.substr(bare.size());
+		std::string server = (*it).second.jid.substr(bare.size() + 1);
 		values[server] = stringOf((*it).second.id);
 		m_userId.push_back(stringOf((*it).second.id));
 	}
@@ -86,6 +86,9 @@ static AdhocCommandHandler * createConfigHandler(User *user, const std::string &
 }
 
 IRCProtocol::IRCProtocol() {
+	m_capabilities.routing = PROTOCOL_ROUTING_SERVER;
+	m_capabilities.registration = false;
+
 // 	m_transportFeatures.push_back("jabber:iq:register");
 	m_transportFeatures.push_back("http://jabber.org/protocol/disco#info");
 	m_transportFeatures.push_back("http://jabber.org/protocol/caps");
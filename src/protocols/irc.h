@@ -63,7 +63,6 @@ class IRCProtocol : AbstractProtocol
 		std::string text(const std::string &key);
 		Tag *getVCardTag(User *user, GList *vcardEntries);
 		bool isMUC(User *user, const std::string &jid) { return jid.find("%") != std::string::npos && jid.find("#") == 0; }
-		bool tempAccountsAllowed() { return true; }
 		bool changeNickname(const std::string &nick, PurpleConversation *conv);
 		void makeRoomJID(User *user, std::string &name);
 		void makePurpleUsernameRoom(User *user, const JID &jid, std::string &name);
@@ -154,7 +154,7 @@ bool MSNProtocol::onPurpleRequestInput(void *handle, User *user, const char *tit
 	if (primary){
 		std::string primaryString(primary);
 		if (primaryString == "Authorization Request Message:") {
-			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getLang(),_("Please authorize me.")));
+			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getTranslation(),_("Please authorize me.")));
 			return true;
 		}
 	}
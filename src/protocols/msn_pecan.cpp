@@ -153,7 +153,7 @@ bool MSNPecanProtocol::onPurpleRequestInput(void *handle, User *user, const char
 	if (primary){
 		std::string primaryString(primary);
 		if (primaryString == "Authorization Request Message:") {
-			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getLang(),_("Please authorize me.")));
+			((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getTranslation(),_("Please authorize me.")));
 			return true;
 		}
 	}
@@ -48,7 +48,7 @@ void QQProtocol::onPurpleAccountCreated(PurpleAccount *account) {
 
 bool QQProtocol::onPurpleRequestInput(void *handle, User *user, const char *title, const char *primary,const char *secondary, const char *default_value,gboolean multiline, gboolean masked, gchar *hint,const char *ok_text, GCallback ok_cb,const char *cancel_text, GCallback cancel_cb, PurpleAccount *account, const char *who,PurpleConversation *conv, void *user_data) {
 	if (primary){
-		((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getLang(),_("Please authorize me.")));
+		((PurpleRequestInputCb) ok_cb)(user_data,tr(user->getTranslation(),_("Please authorize me.")));
 		return true;
 	}
 	return false;
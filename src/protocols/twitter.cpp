@@ -23,6 +23,8 @@
 #include "Poco/Format.h"
 
 TwitterProtocol::TwitterProtocol() {
+	m_capabilities.passwordRequired = false;
+
 	m_transportFeatures.push_back("jabber:iq:register");
 	m_transportFeatures.push_back("jabber:iq:gateway");
 	m_transportFeatures.push_back("http://jabber.org/protocol/disco#info");
@@ -108,7 +110,7 @@ bool TwitterProtocol::onPurpleRequestInput(void *handle, User *user, const char
 	std::string t(title);
 	if (t == "Input your PIN") {
 		std::string text = Poco::format(_("To allow %s access to your Twitter account. Double click the following url, copy the PIN number from the web page and paste it back to Twitter through this chat window.\n%s"), CONFIG().discoName, m_lastUri);
-		Message s(Message::Chat, user->jid(), tr(user->getLang(), text));
+		Message s(Message::Chat, user->jid(), tr(user->getTranslation(), text));
 		s.setFrom(Transport::instance()->jid());
 		Transport::instance()->send(s.tag());
 		m_callbacks[handle].ok_cb = ok_cb;
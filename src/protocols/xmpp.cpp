@@ -22,6 +22,9 @@
 #include "transport.h"
 
 XMPPProtocol::XMPPProtocol() {
+	m_capabilities.jidUsernames = true;
+	m_capabilities.mucPrivateMessages = true;
+
 	m_transportFeatures.push_back("jabber:iq:register");
 	m_transportFeatures.push_back("jabber:iq:gateway");
 	m_transportFeatures.push_back("http://jabber.org/protocol/disco#info");
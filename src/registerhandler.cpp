@@ -124,7 +124,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 
 	JID from(iqTag->findAttribute("from"));
 
-	if (CONFIG().protocol == "irc") {
+	if (!PROTOCOL()->capabilities().registration) {
 		sendError(400, "bad-request", iqTag);
 		return false;
 	}
@@ -159,7 +159,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 			Log("GlooxRegisterHandler", "* sending registration form; user is not registered");
 			query->addChild( new Tag("instructions", tr(_language, instructions)) );
 			query->addChild( new Tag("username") );
-			if (CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour")
+			if (PROTOCOL()->capabilities().passwordRequired)
 				query->addChild( new Tag("password") );
 		}
 		else {
@@ -167,7 +167,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 			query->addChild( new Tag("instructions", tr(_language, instructions)) );
 			query->addChild( new Tag("registered") );
 			query->addChild( new Tag("username", res.uin));
-			if (CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour")
+			if (PROTOCOL()->capabilities().passwordRequired)
 				query->addChild( new Tag("password"));
 		}
 
@@ -192,7 +192,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 			field->addChild( new Tag("value", res.uin) );
 		x->addChild(field);
 
-		if (CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour") {
+		if (PROTOCOL()->capabilities().passwordRequired) {
 			field = new Tag("field");
 			field->addAttribute("type", "text-private");
 			field->addAttribute("var", "password");
@@ -303,7 +303,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 				else
 					encoding = Transport::instance()->getConfiguration().encoding;
 
-				if (usernametag==NULL || (passwordtag==NULL && CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour")) {
+				if (usernametag==NULL || (passwordtag==NULL && PROTOCOL()->capabilities().passwordRequired)) {
 					sendError(406, "not-acceptable", iqTag);
 					return false;
 				}
@@ -311,7 +311,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 					username = usernametag->cdata();
 					if (passwordtag)
 						password = passwordtag->cdata();
-					if (username.empty() || (password.empty() && CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour")) {
+					if (username.empty() || (password.empty() && PROTOCOL()->capabilities().passwordRequired)) {
 						sendError(406, "not-acceptable", iqTag);
 						return false;
 					}
@@ -319,7 +319,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 			}
 		}
 
-		if (Transport::instance()->getConfiguration().protocol == "xmpp") {
+		if (PROTOCOL()->capabilities().jidUsernames) {
 			// User tries to register himself.
 			if ((JID(username).bare() == from.bare())) {
 				sendError(406, "not-acceptable", iqTag);
@@ -351,7 +351,7 @@ bool GlooxRegisterHandler::handleIq(const Tag *iqTag) {
 
 		std::string jid = from.bare();
 
-		if (username.empty() || (password.empty() && CONFIG().protocol != "twitter" && CONFIG().protocol != "bonjour") || localization.getLanguages().find(language) == localization.getLanguages().end()) {
+		if (username.empty() || (password.empty() && PROTOCOL()->capabilities().passwordRequired) || localization.getLanguages().find(language) == localization.getLanguages().end()) {
 			sendError(406, "not-acceptable", iqTag);
 			return false;
 		}
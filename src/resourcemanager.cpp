@@ -20,6 +20,7 @@
 
 #include "resourcemanager.h"
 #include "transport.h"
+#include "memoryaccounting.h"
 
 Resource DummyResource;
 
@@ -132,3 +133,12 @@ bool ResourceManager::hasSamePriorities() {
 	}
 	return true;
 }
+
+unsigned long ResourceManager::getMemoryUsage() {
+	unsigned long size = MemoryAccounting::stringSize(m_resource);
+	for (std::map <std::string, Resource>::iterator it = m_resources.begin(); it != m_resources.end(); it++) {
+		size += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(Resource);
+		size += (*it).second.name.capacity() + (*it).second.status.capacity();
+	}
+	return size;
+}
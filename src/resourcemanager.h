@@ -81,6 +81,9 @@ class ResourceManager {
 		// Returns true if all resources have the same priority. If there's just one
 		// resource, it returns false everytime.
 		bool hasSamePriorities();
+
+		// Returns approximate memory used by resources.
+		unsigned long getMemoryUsage();
 		
 	private:
 		std::map <std::string, Resource> m_resources;
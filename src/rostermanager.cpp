@@ -19,19 +19,48 @@
  */
 
 #include "rostermanager.h"
+#include <set>
 #include "abstractspectrumbuddy.h"
 #include "main.h"
 #include "log.h"
 #include "usermanager.h"
 #include "capabilityhandler.h"
 #include "spectrumtimer.h"
+#include "stanzawriter.h"
+#include "textsanitizer.h"
 #include "transport.h"
 #include "user.h"
+#include "abstractbackend.h"
+#include "gloox/sha.h"
+#include "gloox/error.h"
+#include "memoryaccounting.h"
+#include "stanzaqueue.h"
 
 #ifndef TESTS
 #include "spectrumbuddy.h"
 #endif
 
+#define MERGE_STEP_SIZE 200
+#define SUBSCRIBE_STEP_SIZE 50
+#define ROSTER_ITEMS_STEP_SIZE 500
+#define PRESENCE_STEP_SIZE 200
+// Failed roster push is resent at most this number of times.
+#define ROSTER_PUSH_RETRIES 3
+// Roster push which isn't answered in this time (in ms) is resent.
+#define ROSTER_PUSH_TIMEOUT 30000
+// Failed roster push is resent after this time (in ms), doubled with each retry.
+#define ROSTER_PUSH_BACKOFF 1000
+
+static long pushesSent = 0;
+static long pushesFailed = 0;
+static long pushesRetried = 0;
+static long pushesTimedOut = 0;
+static long pushesInFlight = 0;
+static long pushesMaxInFlight = 0;
+static long long pushesLatency = 0;
+static long pushesMaxLatency = 0;
+static long pushesAcked = 0;
+
 struct SendPresenceToAllData {
 	int features;
 	int user_feature;
@@ -39,11 +68,44 @@ struct SendPresenceToAllData {
 	bool markOffline;
 };
 
-static void merge_buddy(gpointer key, gpointer v, gpointer data) {
-	AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) v;
+// Returns hash of roster item with given name and group.
+static std::string rosterItemHash(const std::string &alias, const std::string &group) {
+	SHA sha;
+	sha.feed(alias);
+	sha.feed("\n");
+	sha.feed(group);
+	return sha.hex();
+}
+
+static long long now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void collect_key(gpointer key, gpointer v, gpointer data) {
+	std::list <std::string> *keys = (std::list <std::string> *) data;
+	keys->push_back((char *) key);
+}
+
+static bool mergeRosterStep(void *data) {
+	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->mergeBuddies(MERGE_STEP_SIZE);
+}
+
+static bool sendNewBuddiesStep(void *data) {
+	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->sendNewBuddies(SUBSCRIBE_STEP_SIZE);
+}
+
+static bool parseRosterStep(void *data) {
 	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->parseRosterItems(ROSTER_ITEMS_STEP_SIZE);
+}
 
-	manager->mergeBuddy(s_buddy);
+static bool sendPresencesStep(void *data) {
+	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->sendQueuedPresences(PRESENCE_STEP_SIZE);
 }
 
 static void handleAskSubscriptionBuddies(gpointer key, gpointer v, gpointer data) {
@@ -76,14 +138,11 @@ static void sendCurrentPresence(gpointer key, gpointer v, gpointer data) {
 	std::string &to = d->to;
 	std::cout << "online: " << s_buddy->isOnline() << "\n";
 	if (s_buddy->isOnline()) {
-		Tag *tag = s_buddy->generatePresenceStanza(features);
-		std::cout << "online: " << tag << "\n";
-		if (tag) {
-			tag->addAttribute("to", to);
-			Transport::instance()->send( tag );
-		}
+		StanzaWriter &writer = StanzaWriter::instance();
+		if (s_buddy->writePresenceStanza(writer, to, features))
+			Transport::instance()->send(writer);
 		if (features & TRANSPORT_FEATURE_XSTATUS) {
-			tag = s_buddy->generateXStatusStanza(user_feature);
+			Tag *tag = s_buddy->generateXStatusStanza(user_feature);
 			if (tag) {
 				tag->addAttribute("to", JID(to).bare());
 				Transport::instance()->send(tag);
@@ -92,32 +151,60 @@ static void sendCurrentPresence(gpointer key, gpointer v, gpointer data) {
 	}
 }
 
-static gboolean sync_cb(gpointer data) {
+static void collectOnlineBuddy(gpointer key, gpointer v, gpointer data) {
+	AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) v;
+	std::set <std::string> *online = (std::set <std::string> *) data;
+	if (s_buddy->isOnline())
+		online->insert(s_buddy->getBareJid());
+}
+
+static gboolean restoredPresencesTimeout(gpointer data) {
 	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
-	return manager->syncBuddiesCallback();
+	return manager->sendRestoredPresences();
+}
+
+static gboolean retryRosterPushesTimeout(gpointer data) {
+	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->retryRosterPushes();
 }
 
-static gboolean sendRosterPresences(gpointer data) {
+static gboolean rosterPushesTimeout(gpointer data) {
 	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
-	return manager->_sendRosterPresences();
+	return manager->expireRosterPushes();
+}
+
+static gboolean sync_cb(gpointer data) {
+	SpectrumRosterManager *manager = (SpectrumRosterManager *) data;
+	return manager->syncBuddiesCallback();
 }
 
 SpectrumRosterManager::SpectrumRosterManager(User *user) : RosterStorage(user) {
 	m_user = user;
-	m_syncTimer = new SpectrumTimer(CONFIG().protocol == "icq" ? 12000 : 1000, &sync_cb, this);
-	m_presenceTimer = new SpectrumTimer(5000, &sendRosterPresences, this);
-	m_subscribeLastCount = -1;
+	m_syncTimer = new SpectrumTimer(PROTOCOL()->capabilities().rosterSyncQuietPeriod, &sync_cb, this);
+	m_restoredTimer = new SpectrumTimer(30000, &restoredPresencesTimeout, this);
+	m_retryTimer = new SpectrumTimer(ROSTER_PUSH_BACKOFF / 2, &retryRosterPushesTimeout, this);
+	m_pushTimer = new SpectrumTimer(ROSTER_PUSH_TIMEOUT / 6, &rosterPushesTimeout, this);
+	m_syncFirstEvent = 0;
 	m_roster = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	m_loadingFromDB = false;
 	m_rosterPushesContext = 0;
+	m_batchPushes = true;
 	m_supportRosterIQ = CONFIG().forceRemoteRoster;
+	m_rosterQuery = NULL;
+	m_rosterUnchanged = false;
 }
 
 SpectrumRosterManager::~SpectrumRosterManager() {
 	Transport::instance()->removeIDHandler(this);
+	Transport::instance()->removeJobs(this);
 	g_hash_table_destroy(m_roster);
+	if (m_rosterQuery)
+		delete m_rosterQuery;
 	delete m_syncTimer;
-	delete m_presenceTimer;
+	pushesInFlight -= m_rosterPushes.size();
+	delete m_restoredTimer;
+	delete m_retryTimer;
+	delete m_pushTimer;
 }
 
 bool SpectrumRosterManager::isInRoster(const std::string &name, const std::string &subscription) {
@@ -134,6 +221,15 @@ bool SpectrumRosterManager::isInRoster(const std::string &name, const std::strin
 }
 
 void SpectrumRosterManager::sendUnavailablePresenceToAll(const std::string &resource) {
+	// Presences queued by sendPresenceToAll would be sent after unavailable ones.
+	std::list <std::pair<std::string, std::string> >::iterator it = m_presenceQueue.begin();
+	while (it != m_presenceQueue.end()) {
+		if (resource.empty() || (*it).second == m_user->jid() + "/" + resource)
+			it = m_presenceQueue.erase(it);
+		else
+			it++;
+	}
+
 	SendPresenceToAllData *data = new SendPresenceToAllData;
 	data->features = m_user->getFeatures();
 	data->user_feature = m_user->getMergedFeatures();
@@ -147,14 +243,55 @@ void SpectrumRosterManager::sendUnavailablePresenceToAll(const std::string &reso
 	}
 	g_hash_table_foreach(m_roster, sendUnavailablePresence, data);
 	delete data;
+
+	if (resource.empty())
+		sendRestoredPresences();
 }
 
 void SpectrumRosterManager::sendPresenceToAll(const std::string &to) {
-	SendPresenceToAllData *data = new SendPresenceToAllData;
-	data->features = m_user->getFeatures();
-	data->to = to;
-	g_hash_table_foreach(m_roster, sendCurrentPresence, data);
-	delete data;
+	std::list <std::string> keys;
+	g_hash_table_foreach(m_roster, collect_key, &keys);
+	for (std::list <std::string>::iterator it = keys.begin(); it != keys.end(); it++)
+		m_presenceQueue.push_back(std::make_pair(*it, to));
+	Transport::instance()->addJob(m_user->jid(), "send-presences", &sendPresencesStep, this);
+}
+
+bool SpectrumRosterManager::sendQueuedPresences(int count) {
+	SendPresenceToAllData data;
+	data.features = m_user->getFeatures();
+	data.user_feature = m_user->getMergedFeatures();
+	data.markOffline = false;
+	while (count-- > 0 && !m_presenceQueue.empty()) {
+		std::pair<std::string, std::string> item = m_presenceQueue.front();
+		m_presenceQueue.pop_front();
+		// buddy could be removed in the meantime
+		AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) g_hash_table_lookup(m_roster, item.first.c_str());
+		if (!s_buddy)
+			continue;
+		data.to = item.second;
+		sendCurrentPresence((gpointer) item.first.c_str(), s_buddy, &data);
+	}
+	return !m_presenceQueue.empty();
+}
+
+void SpectrumRosterManager::setRestoredPresences(const std::list <std::string> &jids) {
+	m_restoredPresences = jids;
+}
+
+bool SpectrumRosterManager::sendRestoredPresences() {
+	if (m_restoredPresences.empty())
+		return false;
+
+	std::set <std::string> online;
+	g_hash_table_foreach(m_roster, collectOnlineBuddy, &online);
+	for (std::list <std::string>::iterator it = m_restoredPresences.begin(); it != m_restoredPresences.end(); it++) {
+		if (online.find(*it) == online.end())
+			SpectrumRosterManager::sendPresence(*it + "/bot", m_user->jid(), "unavailable");
+	}
+	Log(m_user->jid(), "Restored presences checked, " << m_restoredPresences.size() << " buddies were online before restart");
+	m_restoredPresences.clear();
+	m_restoredTimer->stop();
+	return false;
 }
 
 void SpectrumRosterManager::removeFromLocalRoster(const std::string &uin) {
@@ -197,18 +334,18 @@ void SpectrumRosterManager::setRoster(GHashTable *roster) {
 void SpectrumRosterManager::loadRoster() {
 	m_loadingFromDB = true;
 	setRoster(Transport::instance()->sql()->getBuddies(m_user->storageId(), m_user->account()));
+	setStoredSettings(m_roster);
 	m_loadingFromDB = false;
 }
 
 void SpectrumRosterManager::sendPresence(AbstractSpectrumBuddy *s_buddy, const std::string &resource, bool only_new) {
-	Tag *tag = s_buddy->generatePresenceStanza(m_user->getFeatures(), only_new);
-	if (tag) {
-		tag->addAttribute("to", m_user->jid() + std::string(resource.empty() ? "" : "/" + resource));
-		Transport::instance()->send(tag);
-	}
+	StanzaWriter &writer = StanzaWriter::instance();
+	std::string to = m_user->jid() + std::string(resource.empty() ? "" : "/" + resource);
+	if (s_buddy->writePresenceStanza(writer, to, m_user->getFeatures(), only_new))
+		Transport::instance()->send(writer);
 
 	if (m_user->getFeatures() & TRANSPORT_FEATURE_XSTATUS) {
-		tag = s_buddy->generateXStatusStanza(m_user->getMergedFeatures());
+		Tag *tag = s_buddy->generateXStatusStanza(m_user->getMergedFeatures());
 		if (tag) {
 			tag->addAttribute("to", m_user->jid());
 			Transport::instance()->send(tag);
@@ -297,20 +434,20 @@ void SpectrumRosterManager::handleBuddyCreated(AbstractSpectrumBuddy *s_buddy) {
 	Log(m_user->jid(), "handleBuddyCreated: " << name << " ("<< alias <<")");
 
 	if (!isInRoster(name, "both")) {
-		m_syncTimer->start();
+		scheduleSync();
 		Log(m_user->jid(), "Not in roster => adding to subscribe cache");
 		m_subscribeCache[name] = s_buddy;
 	}
 	else {
 		if (m_supportRosterIQ && m_xmppRoster.find(name) != m_xmppRoster.end()) {
 			// first synchronization = From XMPP to legacy network and we don't care what's on legacy network
-			if (m_user->getSetting<bool>("first_synchronization_done") == false) {
+			if (m_user->getSetting<bool>(SETTING_FIRST_SYNCHRONIZATION_DONE) == false) {
 				s_buddy->changeAlias(m_xmppRoster[name].nickname);
 				s_buddy->changeGroup(m_xmppRoster[name].groups);
 			}
 			// other synchronizations are done from ICQ to XMPP here
 			else {
-				m_syncTimer->start();
+				scheduleSync();
 				m_subscribeCache[name] = s_buddy;
 			}
 		}
@@ -341,56 +478,39 @@ void SpectrumRosterManager::handleBuddyCreated(PurpleBuddy *buddy) {
 
 
 bool SpectrumRosterManager::syncBuddiesCallback() {
-	Log(m_user->jid(), "sync_cb lastCount: " << m_subscribeLastCount << "cacheSize: " << int(m_subscribeCache.size()));
-	if (m_subscribeLastCount == int(m_subscribeCache.size())) {
-		sendNewBuddies();
-		return false;
+	Log(m_user->jid(), "sync_cb cacheSize: " << int(m_subscribeCache.size()));
+	m_syncFirstEvent = 0;
+	sendNewBuddies();
+	return false;
+}
+
+void SpectrumRosterManager::scheduleSync() {
+	scheduleSync(now());
+}
+
+bool SpectrumRosterManager::scheduleSync(long long t) {
+	if (m_syncFirstEvent == 0) {
+		m_syncFirstEvent = t;
+		m_syncTimer->start();
+		return true;
 	}
-	else {
-		m_subscribeLastCount = int(m_subscribeCache.size());
+	if (t - m_syncFirstEvent < PROTOCOL()->capabilities().rosterSyncMaxDelay) {
+		// Another buddy came in the quiet period, so wait for more of them,
+		// but do not postpone synchronization forever when buddies keep coming.
+		m_syncTimer->restart();
 		return true;
 	}
+	return false;
 }
 
 void SpectrumRosterManager::sendNewBuddies() {
 	if (int(m_subscribeCache.size()) == 0)
 		return;
 
-	Log(m_user->jid(), "Sending rosterX");
-
-	if (m_supportRosterIQ) {
-		std::map<std::string, AbstractSpectrumBuddy *>::iterator it = m_subscribeCache.begin();
-		while (it != m_subscribeCache.end()) {
-			AbstractSpectrumBuddy *s_buddy = (*it).second;
-			std::string jid = s_buddy->getBareJid();
-			std::string alias = s_buddy->getAlias();
-			std::string name = s_buddy->getName();
-
-			// check if buddy in jabber roster differs from buddy in legacy network contact list.
-			bool differs = true;
-			if (m_xmppRoster.find(name) != m_xmppRoster.end()) {
-				std::string group = m_xmppRoster[name].groups.size() == 0 ? "Buddies" : m_xmppRoster[name].groups.front();
-				differs = m_xmppRoster[name].nickname != alias ||  s_buddy->getGroup() != group;
-			}
-
-			// send roster push if buddies are different or subscription is not both
-			if (differs || s_buddy->getSubscription() != "both") {
-// 				std::string group = m_xmppRoster[name].groups.size() == 0 ? "Buddies" : m_xmppRoster[name].groups.front();
-// 				std::cout << s_buddy->getSubscription() << " " << group << " " << s_buddy->getGroup() << " " << m_xmppRoster[name].nickname <<  " " << alias << "\n";
-				m_rosterPushes[m_rosterPushesContext++] = s_buddy;
-				SpectrumRosterManager::sendRosterPush(m_user->jid(), jid, "both", alias, s_buddy->getGroup(), this, m_rosterPushesContext);
-
-				// Set subscription to both and store buddy
-				s_buddy->setSubscription("both");
-				storeBuddy(s_buddy);
-				addRosterItem(s_buddy);
-			}
-			it++;
-		}
-	}
-	else {
+	if (!m_supportRosterIQ) {
 		Resource res = m_user->findResourceWithFeature(GLOOX_FEATURE_ROSTERX);
 		if (res) {
+			Log(m_user->jid(), "Sending rosterX");
 			Tag *tag = new Tag("iq");
 			tag->addAttribute("to", m_user->jid() + "/" + res.name);
 			tag->addAttribute("type", "set");
@@ -421,25 +541,60 @@ void SpectrumRosterManager::sendNewBuddies() {
 			}
 			tag->addChild(x);
 			Transport::instance()->send(tag);
+
+			m_subscribeCache.clear();
+			return;
 		}
-		else {
-			std::map<std::string, AbstractSpectrumBuddy *>::iterator it = m_subscribeCache.begin();
-			while (it != m_subscribeCache.end()) {
-				AbstractSpectrumBuddy *s_buddy = (*it).second;
-				if (s_buddy->getSubscription() != "both") {
-					std::string alias = s_buddy->getAlias();
-					SpectrumRosterManager::sendSubscribePresence(s_buddy->getBareJid(), m_user->jid(), alias);
+	}
 
-					s_buddy->setSubscription("ask");
-					addRosterItem(s_buddy);
-				}
-				it++;
+	// Roster pushes and subscribe presences are sent one per buddy, so they
+	// are sent in chunks.
+	Log(m_user->jid(), "Sending " << m_subscribeCache.size() << " new buddies");
+	Transport::instance()->addJob(m_user->jid(), "send-new-buddies", &sendNewBuddiesStep, this);
+}
+
+bool SpectrumRosterManager::sendNewBuddies(int count) {
+	while (count-- > 0 && !m_subscribeCache.empty()) {
+		std::map<std::string, AbstractSpectrumBuddy *>::iterator it = m_subscribeCache.begin();
+		AbstractSpectrumBuddy *s_buddy = (*it).second;
+		m_subscribeCache.erase(it);
+
+		if (m_supportRosterIQ) {
+			std::string jid = s_buddy->getBareJid();
+			std::string alias = s_buddy->getAlias();
+			std::string name = s_buddy->getName();
+
+			// check if buddy in jabber roster differs from buddy in legacy network contact list.
+			bool differs = true;
+			if (m_xmppRoster.find(name) != m_xmppRoster.end()) {
+				std::string group = m_xmppRoster[name].groups.size() == 0 ? "Buddies" : m_xmppRoster[name].groups.front();
+				differs = m_xmppRoster[name].nickname != alias ||  s_buddy->getGroup() != group;
+			}
+
+			// send roster push if buddies are different or subscription is not both
+			if (differs || s_buddy->getSubscription() != "both") {
+				queueRosterPush(name);
+
+				// Set subscription to both and store buddy
+				s_buddy->setSubscription("both");
+				storeBuddy(s_buddy);
+				setSynchronized(s_buddy);
+				addRosterItem(s_buddy);
+			}
+			else {
+				setSynchronized(s_buddy);
 			}
 		}
-	}
+		else if (s_buddy->getSubscription() != "both") {
+			std::string alias = s_buddy->getAlias();
+			SpectrumRosterManager::sendSubscribePresence(s_buddy->getBareJid(), m_user->jid(), alias);
 
-	m_subscribeCache.clear();
-	m_subscribeLastCount = -1;
+			s_buddy->setSubscription("ask");
+			addRosterItem(s_buddy);
+		}
+	}
+	sendRosterPushes();
+	return !m_subscribeCache.empty();
 }
 
 void SpectrumRosterManager::handlePresence(const Presence &stanza) {
@@ -459,7 +614,7 @@ void SpectrumRosterManager::handlePresence(const Presence &stanza) {
 authRequest *SpectrumRosterManager::handleAuthorizationRequest(PurpleAccount *account, const char *remote_user, const char *id, const char *alias, const char *message, gboolean on_list, PurpleAccountRequestAuthorizationCb authorize_cb, PurpleAccountRequestAuthorizationCb deny_cb, void *user_data) {
 	std::string name(remote_user);
 
-	if (m_user->getSetting<bool>("reject_authorizations") && getRosterItem(remote_user) == NULL) {
+	if (m_user->getSetting<bool>(SETTING_REJECT_AUTHORIZATIONS) && getRosterItem(remote_user) == NULL) {
 		Log(m_user->jid(), "purpleAuthorization rejected: " << name << " on_list:" << on_list);
 		deny_cb(user_data);
 		return NULL;
@@ -485,6 +640,7 @@ authRequest *SpectrumRosterManager::handleAuthorizationRequest(PurpleAccount *ac
 	}
 	// send subscribe presence to user
 	std::string nickname = alias ? alias : "";
+	sanitizeXMLText(nickname);
 	SpectrumRosterManager::sendSubscribePresence(name + "@" + Transport::instance()->jid(), m_user->jid(), nickname);
 	return req;
 }
@@ -683,72 +839,357 @@ void SpectrumRosterManager::handleRosterResponse(Tag *iq) {
 		}
 		s_buddy->changeGroup(groups);
 		storeBuddy(s_buddy);
+		setSynchronized(s_buddy);
+
+		// While received roster is not merged yet, the push's version is stored
+		// only after the merge, otherwise crash in the middle of the merge would
+		// make next login skip it because of "unchanged" result.
+		const std::string &ver = query->findAttribute("ver");
+		if (!ver.empty()) {
+			if (!m_rosterVersion.empty())
+				m_rosterVersion = ver;
+			else
+				m_user->updateSetting<std::string>(SETTING_ROSTER_VERSION, ver);
+		}
 	}
 	else if (iq->findAttribute("type") == "result") {
 		Tag *query = iq->findChild("query");
 		if (query == NULL) {
-			std::cout << "query is null!\n";
+			// Empty result means roster hasn't changed since the version we sent
+			// (XEP-0237), changed items will come as roster pushes.
+			Log(m_user->jid(), "Roster hasn't changed since last synchronization");
+			m_rosterUnchanged = true;
 			return;
 		}
+		m_rosterUnchanged = false;
+		m_rosterVersion = query->findAttribute("ver");
+
+		// Large rosters are parsed in chunks, so we have to keep our own copy.
+		if (m_rosterQuery)
+			delete m_rosterQuery;
+		m_rosterQuery = query->clone();
+		m_rosterItems = m_rosterQuery->findChildren("item");
+		Transport::instance()->addJob(m_user->jid(), "parse-roster", &parseRosterStep, this);
+	}
+}
 
-		std::list<Tag*> items = query->findChildren("item");
-		for (std::list<Tag*>::const_iterator it = items.begin(); it != items.end(); it++) {
-			Tag *item = *it;
-			std::string remote_user = purpleUsername(JID(item->findAttribute("jid")).username());
-			m_xmppRoster[remote_user].jid = item->findAttribute("jid");
-			m_xmppRoster[remote_user].nickname = item->findAttribute("name");
-			std::list<Tag*> tags = item->findChildren("group");
-			for (std::list<Tag*>::const_iterator it = tags.begin(); it != tags.end(); it++) {
-				m_xmppRoster[remote_user].groups.push_back((*it)->cdata());
-			}
+bool SpectrumRosterManager::parseRosterItems(int count) {
+	while (count-- > 0 && !m_rosterItems.empty()) {
+		Tag *item = m_rosterItems.front();
+		m_rosterItems.pop_front();
+		std::string remote_user = purpleUsername(JID(item->findAttribute("jid")).username());
+		m_xmppRoster[remote_user].jid = item->findAttribute("jid");
+		m_xmppRoster[remote_user].nickname = item->findAttribute("name");
+		std::list<Tag*> tags = item->findChildren("group");
+		for (std::list<Tag*>::const_iterator it = tags.begin(); it != tags.end(); it++) {
+			m_xmppRoster[remote_user].groups.push_back((*it)->cdata());
 		}
 	}
+
+	if (!m_rosterItems.empty())
+		return true;
+
+	if (m_rosterQuery) {
+		delete m_rosterQuery;
+		m_rosterQuery = NULL;
+	}
+	return false;
 }
 
 void SpectrumRosterManager::handleIqID(const IQ &iq, int id) {
-	std::cout << "rosterPush with id " << id << "\n";
-	// This buddy was added into roster by transport just now, so we have to
-	// send initial presence.
-	// We can send it from here, because ejabberd is not ready just after this
-	// result iq... :/ (therefore there's timer)
-	if (m_rosterPushes.find(id) != m_rosterPushes.end()) {
-		std::cout << "sending presence\n";
-		m_presenceTimer->start();
+	std::map <int, RosterPush>::iterator it = m_rosterPushes.find(id);
+	if (it == m_rosterPushes.end())
+		return;
+	RosterPush push = it->second;
+	m_rosterPushes.erase(it);
+	pushesInFlight--;
+
+	if (iq.subtype() == IQ::Error) {
+		pushesFailed++;
+		const Error *error = iq.error();
+		if (push.buddies.size() > 1) {
+			// Server doesn't accept more items in one push, so send them one by one.
+			Log(m_user->jid(), "Multi-item roster push rejected, sending items separately");
+			m_batchPushes = false;
+			m_pushQueue.insert(m_pushQueue.begin(), push.buddies.begin(), push.buddies.end());
+		}
+		// Only temporary errors make sense to retry.
+		else if (error && (error->type() == StanzaErrorTypeWait || error->error() == StanzaErrorResourceConstraint)) {
+			retryRosterPush(push);
+		}
+		else {
+			Log(m_user->jid(), "Roster push for " << push.buddies.front() << " rejected, giving up");
+		}
+	}
+	else {
+		long latency = (long) (now() - push.sent);
+		pushesAcked++;
+		pushesLatency += latency;
+		if (latency > pushesMaxLatency)
+			pushesMaxLatency = latency;
+
+		// These buddies were added into roster by transport just now and the
+		// result means the server has them, so send initial presences.
+		for (std::list <std::string>::iterator it = push.buddies.begin(); it != push.buddies.end(); it++) {
+			// buddy could be removed in the meantime
+			AbstractSpectrumBuddy *s_buddy = getRosterItem(*it);
+			if (s_buddy)
+				sendPresence(s_buddy);
+		}
 	}
+	sendRosterPushes();
 }
 
-bool SpectrumRosterManager::_sendRosterPresences() {
-	for (std::map<int, AbstractSpectrumBuddy *>::iterator it = m_rosterPushes.begin(); it != m_rosterPushes.end(); it++) {
-		sendPresence((*it).second);
+void SpectrumRosterManager::retryRosterPush(RosterPush &push) {
+	if (push.retries >= ROSTER_PUSH_RETRIES) {
+		Log(m_user->jid(), "Roster push for " << push.buddies.front() << " failed " << push.retries + 1 << " times, giving up");
+		return;
 	}
-	m_rosterPushes.clear();
-	return false;
+	push.retryAt = now() + ((long long) ROSTER_PUSH_BACKOFF << push.retries);
+	push.retries++;
+
+	std::list <RosterPush>::iterator it = m_retryQueue.begin();
+	while (it != m_retryQueue.end() && (*it).retryAt <= push.retryAt)
+		it++;
+	m_retryQueue.insert(it, push);
+	m_retryTimer->start();
+}
+
+bool SpectrumRosterManager::retryRosterPushes() {
+	sendRosterPushes();
+	return !m_retryQueue.empty();
+}
+
+bool SpectrumRosterManager::expireRosterPushes() {
+	long long t = now();
+	std::list <RosterPush> expired;
+	for (std::map <int, RosterPush>::iterator it = m_rosterPushes.begin(); it != m_rosterPushes.end(); ) {
+		if (t - (*it).second.sent < ROSTER_PUSH_TIMEOUT) {
+			it++;
+			continue;
+		}
+		// Late result for this context will be ignored by handleIqID.
+		expired.push_back((*it).second);
+		m_rosterPushes.erase(it++);
+		pushesInFlight--;
+		pushesTimedOut++;
+	}
+	if (!expired.empty())
+		Log(m_user->jid(), expired.size() << " roster pushes timed out");
+	for (std::list <RosterPush>::iterator it = expired.begin(); it != expired.end(); it++)
+		retryRosterPush(*it);
+	sendRosterPushes();
+	return !m_rosterPushes.empty();
+}
+
+void SpectrumRosterManager::sendRosterPushes() {
+	sendRosterPushes(now());
+}
+
+void SpectrumRosterManager::sendRosterPushes(long long t) {
+	int window = CONFIG().rosterPushWindow;
+	int batch = m_batchPushes ? std::max(CONFIG().rosterPushBatch, 1) : 1;
+	while (window == 0 || (int) m_rosterPushes.size() < window) {
+		// Retried pushes share the window with new ones.
+		if (!m_retryQueue.empty() && m_retryQueue.front().retryAt <= t) {
+			pushesRetried++;
+			m_rosterPushes[++m_rosterPushesContext] = m_retryQueue.front();
+			m_retryQueue.pop_front();
+			sendQueuedPush(m_rosterPushesContext);
+			continue;
+		}
+		if (m_pushQueue.empty())
+			break;
+		RosterPush push;
+		push.retries = 0;
+		push.retryAt = 0;
+		while (!m_pushQueue.empty() && (int) push.buddies.size() < batch) {
+			// buddy could be removed in the meantime
+			if (getRosterItem(m_pushQueue.front()))
+				push.buddies.push_back(m_pushQueue.front());
+			m_pushQueue.pop_front();
+		}
+		if (push.buddies.empty())
+			continue;
+		m_rosterPushes[++m_rosterPushesContext] = push;
+		sendQueuedPush(m_rosterPushesContext);
+	}
+}
+
+void SpectrumRosterManager::sendQueuedPush(int context) {
+	RosterPush &push = m_rosterPushes[context];
+	IQ iq(IQ::Set, m_user->jid());
+	iq.setFrom(Transport::instance()->jid());
+
+	Tag *x = new Tag("query");
+	x->addAttribute("xmlns", "jabber:iq:roster");
+	for (std::list <std::string>::iterator it = push.buddies.begin(); it != push.buddies.end(); it++) {
+		AbstractSpectrumBuddy *s_buddy = getRosterItem(*it);
+		if (!s_buddy)
+			continue;
+		Tag *item = new Tag("item");
+		item->addAttribute("jid", s_buddy->getBareJid());
+		item->addAttribute("subscription", "both");
+		if (!s_buddy->getAlias().empty())
+			item->addAttribute("name", s_buddy->getAlias());
+		if (!s_buddy->getGroup().empty())
+			item->addChild(new Tag("group", s_buddy->getGroup()));
+		x->addChild(item);
+	}
+
+	iq.addExtension(new RosterExtension(x));
+	delete x;
+	push.sent = now();
+	pushesSent++;
+	if (++pushesInFlight > pushesMaxInFlight)
+		pushesMaxInFlight = pushesInFlight;
+	m_pushTimer->start();
+	Transport::instance()->send(iq, this, context);
+}
+
+void SpectrumRosterManager::getStats(std::map <std::string, BackendStat> &stats) {
+	stats["roster-pushes/sent"].units = "iqs";
+	stats["roster-pushes/sent"].value = pushesSent;
+	stats["roster-pushes/failed"].units = "iqs";
+	stats["roster-pushes/failed"].value = pushesFailed;
+	stats["roster-pushes/retried"].units = "iqs";
+	stats["roster-pushes/retried"].value = pushesRetried;
+	stats["roster-pushes/timed-out"].units = "iqs";
+	stats["roster-pushes/timed-out"].value = pushesTimedOut;
+	stats["roster-pushes/in-flight"].units = "iqs";
+	stats["roster-pushes/in-flight"].value = pushesInFlight;
+	stats["roster-pushes/max-in-flight"].units = "iqs";
+	stats["roster-pushes/max-in-flight"].value = pushesMaxInFlight;
+	stats["roster-pushes/latency"].units = "ms";
+	stats["roster-pushes/latency"].value = pushesAcked ? (long) (pushesLatency / pushesAcked) : 0;
+	stats["roster-pushes/max-latency"].units = "ms";
+	stats["roster-pushes/max-latency"].value = pushesMaxLatency;
+}
+
+void SpectrumRosterManager::getMemoryUsage(unsigned long *usage) {
+	unsigned long size = 0;
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, m_roster);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		size += MEMORY_HASH_NODE + MemoryAccounting::stringSize((const char *) key);
+		((AbstractSpectrumBuddy *) value)->getMemoryUsage(usage);
+	}
+
+	size += m_subscribeCache.size() * MEMORY_MAP_NODE;
+	for (std::map <std::string, authRequest *>::iterator it = m_authRequests.begin(); it != m_authRequests.end(); it++)
+		size += MEMORY_MAP_NODE + sizeof(authRequest) + (*it).second->who.capacity() + (*it).second->mainJID.capacity();
+	for (std::list <std::string>::iterator it = m_pushQueue.begin(); it != m_pushQueue.end(); it++)
+		size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*it);
+	for (std::list <RosterPush>::iterator it = m_retryQueue.begin(); it != m_retryQueue.end(); it++) {
+		size += MEMORY_LIST_NODE + sizeof(RosterPush);
+		for (std::list <std::string>::iterator b = (*it).buddies.begin(); b != (*it).buddies.end(); b++)
+			size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*b);
+	}
+	for (std::map <int, RosterPush>::iterator it = m_rosterPushes.begin(); it != m_rosterPushes.end(); it++) {
+		size += MEMORY_MAP_NODE + sizeof(RosterPush);
+		for (std::list <std::string>::iterator b = (*it).second.buddies.begin(); b != (*it).second.buddies.end(); b++)
+			size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*b);
+	}
+	for (std::map <std::string, RosterItem>::iterator it = m_xmppRoster.begin(); it != m_xmppRoster.end(); it++) {
+		RosterItem &item = (*it).second;
+		size += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(RosterItem);
+		size += item.jid.capacity() + item.subscription.capacity() + item.nickname.capacity();
+		for (std::list <std::string>::iterator g = item.groups.begin(); g != item.groups.end(); g++)
+			size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*g);
+	}
+	for (std::list <std::string>::iterator it = m_mergeQueue.begin(); it != m_mergeQueue.end(); it++)
+		size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*it);
+	for (std::list <std::pair<std::string, std::string> >::iterator it = m_presenceQueue.begin(); it != m_presenceQueue.end(); it++)
+		size += MEMORY_LIST_NODE + MemoryAccounting::stringSize((*it).first) + MemoryAccounting::stringSize((*it).second);
+	for (std::list <std::string>::iterator it = m_restoredPresences.begin(); it != m_restoredPresences.end(); it++)
+		size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*it);
+
+	// m_rosterItems point to children of m_rosterQuery.
+	if (m_rosterQuery)
+		size += StanzaQueue::getSize(m_rosterQuery) + m_rosterItems.size() * MEMORY_LIST_NODE;
+
+	usage[MEMORY_ROSTER] += size;
 }
 
 void SpectrumRosterManager::mergeRoster() {
-	if (m_supportRosterIQ)
-		g_hash_table_foreach(m_roster, merge_buddy, this);
-	if (m_user->getSetting<bool>("first_synchronization_done", false) == false) {
-		m_user->updateSetting("first_synchronization_done", true);
+	// Give buddies restored from session snapshot some time to come online.
+	if (!m_restoredPresences.empty())
+		m_restoredTimer->start();
+	if (m_supportRosterIQ && m_mergeQueue.empty())
+		g_hash_table_foreach(m_roster, collect_key, &m_mergeQueue);
+	Transport::instance()->addJob(m_user->jid(), "merge-roster", &mergeRosterStep, this);
+}
+
+bool SpectrumRosterManager::mergeBuddies(int count) {
+	while (count-- > 0 && !m_mergeQueue.empty()) {
+		std::string key = m_mergeQueue.front();
+		m_mergeQueue.pop_front();
+		// buddy could be removed in the meantime
+		AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) g_hash_table_lookup(m_roster, key.c_str());
+		if (s_buddy)
+			mergeBuddy(s_buddy);
+	}
+
+	if (!m_mergeQueue.empty())
+		return true;
+
+	if (m_user->getSetting<bool>(SETTING_FIRST_SYNCHRONIZATION_DONE) == false) {
+		m_user->updateSetting(SETTING_FIRST_SYNCHRONIZATION_DONE, true);
 	}
+	if (!m_rosterVersion.empty()) {
+		m_user->updateSetting<std::string>(SETTING_ROSTER_VERSION, m_rosterVersion);
+		m_rosterVersion.clear();
+	}
+	return false;
 }
 
 void SpectrumRosterManager::mergeBuddy(AbstractSpectrumBuddy *s_buddy) {
 	std::string name = s_buddy->getName();
-	if (m_xmppRoster.find(name) != m_xmppRoster.end()) {
+	if (m_rosterUnchanged) {
+		// Jabber roster is the same as after last synchronization, so only buddies
+		// changed in legacy network since then are pushed.
+		if (!isSynchronized(s_buddy)) {
+			scheduleSync();
+			m_subscribeCache[name] = s_buddy;
+		}
+	}
+	else if (m_xmppRoster.find(name) != m_xmppRoster.end()) {
 		// first synchronization = From XMPP to legacy network and we don't care what's on legacy network
-		if (m_user->getSetting<bool>("first_synchronization_done") == false) {
+		if (m_user->getSetting<bool>(SETTING_FIRST_SYNCHRONIZATION_DONE) == false) {
 			s_buddy->changeAlias(m_xmppRoster[name].nickname);
 			s_buddy->changeGroup(m_xmppRoster[name].groups);
+			setSynchronized(s_buddy);
 		}
 		// other synchronizations are done from ICQ to XMPP here
 		else {
-			m_syncTimer->start();
+			scheduleSync();
 			m_subscribeCache[name] = s_buddy;
 		}
 	}
 }
 
+bool SpectrumRosterManager::isSynchronized(AbstractSpectrumBuddy *s_buddy) {
+	PurpleBuddy *buddy = s_buddy->getBuddy();
+	if (!buddy || s_buddy->getSubscription() != "both")
+		return false;
+	const char *hash = purple_blist_node_get_string(&buddy->node, "roster_hash");
+	return hash && rosterItemHash(s_buddy->getAlias(), s_buddy->getGroup()) == hash;
+}
+
+void SpectrumRosterManager::setSynchronized(AbstractSpectrumBuddy *s_buddy) {
+	PurpleBuddy *buddy = s_buddy->getBuddy();
+	if (!buddy)
+		return;
+	std::string hash = rosterItemHash(s_buddy->getAlias(), s_buddy->getGroup());
+	const char *stored = purple_blist_node_get_string(&buddy->node, "roster_hash");
+	if (stored && hash == stored)
+		return;
+	purple_blist_node_set_string(&buddy->node, "roster_hash", hash.c_str());
+	storeBuddy(s_buddy);
+}
+
 void SpectrumRosterManager::sendRosterPush(const std::string &to, const std::string &jid, const std::string &subscription, const std::string &alias, const std::string &group, IqHandler *ih, int context) {
 	IQ iq(IQ::Set, to);
 	iq.setFrom(Transport::instance()->jid());
@@ -774,13 +1215,14 @@ void SpectrumRosterManager::sendRosterPush(const std::string &to, const std::str
 }
 
 void SpectrumRosterManager::sendPresence(const std::string &from, const std::string &to, const std::string &type, const std::string &message) {
-	Tag *tag = new Tag("presence");
-	tag->addAttribute("to", to);
-	tag->addAttribute("type", type);
-	tag->addAttribute("from", from);
+	StanzaWriter &writer = StanzaWriter::instance();
+	writer.start("presence");
+	writer.addAttribute("to", to);
+	writer.addAttribute("type", type);
+	writer.addAttribute("from", from);
 	if (!message.empty())
-		tag->addChild( new Tag("status", message) );
-	Transport::instance()->send(tag);
+		writer.addChild("status", message);
+	Transport::instance()->send(writer);
 }
 
 void SpectrumRosterManager::sendPresence(const std::string &from, const std::string &to, const Presence::PresenceType &type, const std::string &message) {
@@ -790,19 +1232,21 @@ void SpectrumRosterManager::sendPresence(const std::string &from, const std::str
 }
 
 void SpectrumRosterManager::sendSubscribePresence(const std::string &from, const std::string &to, const std::string &nick) {
-	Tag *tag = new Tag("presence");
-	tag->addAttribute("type", "subscribe");
-	tag->addAttribute("from", from);
-	tag->addAttribute("to", to);
+	StanzaWriter &writer = StanzaWriter::instance();
+	writer.start("presence");
+	writer.addAttribute("type", "subscribe");
+	writer.addAttribute("from", from);
+	writer.addAttribute("to", to);
 	if (!nick.empty()) {
-		Tag *n = new Tag("nick", nick);
-		n->addAttribute("xmlns", "http://jabber.org/protocol/nick");
-		tag->addChild(n);
+		writer.startChild("nick");
+		writer.addAttribute("xmlns", "http://jabber.org/protocol/nick");
+		writer.addCData(nick);
+		writer.endChild();
 	}
-	Transport::instance()->send(tag);
+	Transport::instance()->send(writer);
 }
 
-void SpectrumRosterManager::sendRosterGet(const std::string &to) {
+void SpectrumRosterManager::sendRosterGet(const std::string &to, const std::string &ver) {
 	Tag *iq = new Tag("iq");
 	iq->addAttribute("from", Transport::instance()->jid());
 	iq->addAttribute("to", to);
@@ -810,6 +1254,8 @@ void SpectrumRosterManager::sendRosterGet(const std::string &to) {
 	iq->addAttribute("type", "get");
 	Tag *query = new Tag("query");
 	query->addAttribute("xmlns", "jabber:iq:roster");
+	if (!ver.empty())
+		query->addAttribute("ver", ver);
 	iq->addChild(query);
 	Transport::instance()->send(iq);
 }
@@ -54,6 +54,16 @@ struct RosterItem {
 	std::list<std::string> groups;
 };
 
+// Roster push sent to user's server and waiting for result.
+struct RosterPush {
+	std::list <std::string> buddies;	// Names of buddies in this push.
+	long long sent;						// Time when the push was sent (in ms).
+	int retries;						// How many times the push has been resent.
+	long long retryAt;					// Time when failed push can be resent (in ms).
+};
+
+struct BackendStat;
+
 class RosterExtension : public StanzaExtension {
 	public:
 		RosterExtension() : StanzaExtension( 1055 ) { m_tag = NULL; }
@@ -89,9 +99,14 @@ class SpectrumRosterManager : public RosterStorage, public IqHandler {
 		// Sends unavailable presence of all online buddies.
 		void sendUnavailablePresenceToAll(const std::string &resource = "");
 
-		// Sends current presence of all buddies.
+		// Sends current presence of all buddies. Presences are sent in chunks
+		// by "send-presences" job.
 		void sendPresenceToAll(const std::string &to);
 
+		// Sends at most `count` presences queued by sendPresenceToAll.
+		// Returns true if there are still some queued presences.
+		bool sendQueuedPresences(int count);
+
 		// Remove buddy from local roster.
 		void removeFromLocalRoster(const std::string &uin);
 
@@ -142,9 +157,22 @@ class SpectrumRosterManager : public RosterStorage, public IqHandler {
 		// Do not call this function by yourself.
 		bool syncBuddiesCallback();
 
+		// Called when buddy has to be synchronized. Roster is synchronized
+		// once buddies stop coming for a while (see ProtocolCapabilities).
+		void scheduleSync();
+
+		// Same as above, but `t` (in ms) is used as current time. Returns false
+		// if synchronization can't be postponed anymore, because rosterSyncMaxDelay
+		// passed since the first unsynchronized buddy.
+		bool scheduleSync(long long t);
+
 		// Sends buddies from subscribeCache to end user.
 		void sendNewBuddies();
 
+		// Sends at most `count` buddies from subscribeCache to end user.
+		// Returns true if there are still some buddies in subscribeCache.
+		bool sendNewBuddies(int count);
+
 		// Handles presence stanza.
 		void handlePresence(const Presence &presence);
 
@@ -160,6 +188,10 @@ class SpectrumRosterManager : public RosterStorage, public IqHandler {
 		// Handles user's roster sent by server (jabber:iq:roster result).
 		void handleRosterResponse(Tag *iq);
 
+		// Parses at most `count` items of roster received in handleRosterResponse.
+		// Returns true if there are still some items to parse.
+		bool parseRosterItems(int count);
+
 		// Removes authorization request from internal storage.
 		void removeAuthRequest(const std::string &remote_user);
 
@@ -171,17 +203,61 @@ class SpectrumRosterManager : public RosterStorage, public IqHandler {
 		void handleIqID (const IQ &iq, int context);
 
 		// Synchronizes legacy network roster with the one stored in Jabber server.
+		// Buddies are merged in chunks by "merge-roster" job.
 		void mergeRoster();
 
+		// Merges at most `count` buddies queued by mergeRoster.
+		// Returns true if there are still some buddies to merge.
+		bool mergeBuddies(int count);
+
 		// Synchronizes one AbstractSpectrumBuddy with Jabber/legacy network roster.
 		void mergeBuddy(AbstractSpectrumBuddy *s_buddy);
 
-		// Sends presences as answer to roster push result IQ sent by server as response
-		// to mergeBuddy/mergeRoster jabber:iq:roster stanzas
-		bool _sendRosterPresences();
+		// Returns true if buddy's item in Jabber roster is the same as it was
+		// when this buddy was synchronized last time.
+		bool isSynchronized(AbstractSpectrumBuddy *s_buddy);
+
+		// Stores hash of buddy's item in Jabber roster, so next time we know
+		// if it has to be synchronized.
+		void setSynchronized(AbstractSpectrumBuddy *s_buddy);
+
+		// Queues roster push for buddy. It's sent by sendRosterPushes.
+		void queueRosterPush(const std::string &name) { m_pushQueue.push_back(name); }
+
+		// Sends queued roster pushes while there's a free place in roster push window.
+		// Failed pushes whose backoff has elapsed go first.
+		void sendRosterPushes();
+
+		// Same as above, but `t` (in ms) is used as current time for backoff.
+		void sendRosterPushes(long long t);
+
+		// Resends or drops roster pushes which haven't been answered in time.
+		// Returns true if there are still some pushes waiting for result.
+		// Called by timer.
+		bool expireRosterPushes();
+
+		// Resends failed roster pushes whose backoff has elapsed.
+		// Returns true if there are still some pushes waiting for backoff.
+		// Called by timer.
+		bool retryRosterPushes();
+
+		// Returns number of roster pushes waiting for result.
+		int rosterPushesInFlight() { return (int) m_rosterPushes.size(); }
 
 		int buddiesCount() { return (int) g_hash_table_size(m_roster); }
 
+		// Returns GHashTable with all buddies. Key is prepared username.
+		GHashTable *getRoster() { return m_roster; }
+
+		// Sets bare JIDs of buddies which were online before restart according
+		// to session snapshot. Unavailable presences are sent only to those of them
+		// who don't come online after connection.
+		void setRestoredPresences(const std::list <std::string> &jids);
+
+		// Sends unavailable presences to restored buddies which are not online.
+		// Do not call this function by yourself.
+		bool sendRestoredPresences();
+
 //	static:
 		// Sends roster push.
 		static void sendRosterPush(const std::string &to, const std::string &jid, const std::string &subscription,
@@ -193,22 +269,49 @@ class SpectrumRosterManager : public RosterStorage, public IqHandler {
 		static void sendPresence(const std::string &from, const std::string &to, const Presence::PresenceType &type, const std::string &message = "");
 		static void sendSubscribePresence(const std::string &from, const std::string &to, const std::string &nick = "");
 
-		// Asks for user's roster using jabber:iq:roster (for remote-roster protoXEP)
-		static void sendRosterGet(const std::string &to);
+		// Adds approximate memory used by buddies and roster synchronization
+		// state to `usage` (indexed by MemorySubsystem).
+		void getMemoryUsage(unsigned long *usage);
+
+		// Returns statistics of roster pushes sent by all users.
+		static void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Asks for user's roster using jabber:iq:roster (for remote-roster protoXEP).
+		// If `ver` is not empty, server sends only changes since this roster version (XEP-0237).
+		static void sendRosterGet(const std::string &to, const std::string &ver = "");
 
 	private:
 		GHashTable *m_roster;
 		User *m_user;
 		SpectrumTimer *m_syncTimer;
-		SpectrumTimer *m_presenceTimer;
+		SpectrumTimer *m_restoredTimer;
+		std::list <std::string> m_restoredPresences;
 		std::map <std::string, AbstractSpectrumBuddy *> m_subscribeCache;
 		std::map <std::string, authRequest *> m_authRequests;
-		int m_subscribeLastCount;
+		long long m_syncFirstEvent;
 		bool m_loadingFromDB;
 		bool m_supportRosterIQ;
-		std::map<int, AbstractSpectrumBuddy *> m_rosterPushes;
+		// Sends roster push with given context again (or for the first time).
+		void sendQueuedPush(int context);
+
+		// Schedules failed or expired roster push to be sent again after
+		// exponential backoff or gives up when it has been resent too many times.
+		void retryRosterPush(RosterPush &push);
+
+		std::list <std::string> m_pushQueue;		// Buddies waiting for roster push.
+		std::map <int, RosterPush> m_rosterPushes;	// Roster pushes waiting for result.
 		int m_rosterPushesContext;
+		bool m_batchPushes;							// False if server rejected multi-item roster push.
+		SpectrumTimer *m_pushTimer;					// Checks deadlines of roster pushes.
+		std::list <RosterPush> m_retryQueue;		// Failed roster pushes waiting for backoff, sorted by retryAt.
+		SpectrumTimer *m_retryTimer;				// Resends failed roster pushes after backoff.
 		std::map<std::string, RosterItem> m_xmppRoster;
+		bool m_rosterUnchanged;				// Jabber roster hasn't changed since last synchronization.
+		std::string m_rosterVersion;		// Version of received roster (or of newer push), stored when it's merged.
+		std::list <std::string> m_mergeQueue;
+		std::list <std::pair<std::string, std::string> > m_presenceQueue;
+		Tag *m_rosterQuery;
+		std::list <Tag *> m_rosterItems;
 
 };
 
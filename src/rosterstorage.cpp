@@ -28,66 +28,104 @@
 
 extern LogClass Log_;
 
+// Number of buddies stored in one WorkScheduler step.
+#define STORAGE_STEP_SIZE 100
+// Buddies are stored when they don't change for this time (in ms)...
+#define STORAGE_DELAY 10000
+// ...or when this time passed since the first change (in seconds).
+#define STORAGE_MAX_DELAY 60
+
+static bool storeBuddiesStep(void *data) {
+	RosterStorage *storage = (RosterStorage *) data;
+	return storage->storeBuddies(STORAGE_STEP_SIZE);
+}
+
 static gboolean storageTimeout(gpointer data) {
 	RosterStorage *storage = (RosterStorage *) data;
-	return storage->storeBuddies();
+	storage->scheduleStoring();
+	return FALSE;
 }
 
-static void save_settings(gpointer k, gpointer v, gpointer data) {
-	PurpleValue *value = (PurpleValue *) v;
-	std::string key((char *) k);
-	SaveData *s = (SaveData *) data;
-	User *user = s->user;
-	long id = s->id;
+// Converts setting to the string stored in DB. Returns false if its type
+// can't be stored.
+static bool settingToString(PurpleValue *value, std::string &str) {
 	if (purple_value_get_type(value) == PURPLE_TYPE_BOOLEAN) {
-		if (purple_value_get_boolean(value))
-			Transport::instance()->sql()->addBuddySetting(user->storageId(), id, key, "1", purple_value_get_type(value));
-		else
-			Transport::instance()->sql()->addBuddySetting(user->storageId(), id, key, "0", purple_value_get_type(value));
+		str = purple_value_get_boolean(value) ? "1" : "0";
 	}
 	else if (purple_value_get_type(value) == PURPLE_TYPE_STRING) {
-		const char *str = purple_value_get_string(value);
-		Transport::instance()->sql()->addBuddySetting(user->storageId(), id, key, str ? str : "", purple_value_get_type(value));
+		const char *val = purple_value_get_string(value);
+		str = val ? val : "";
+	}
+	else {
+		return false;
 	}
+	return true;
 }
 
-static gboolean storeAbstractSpectrumBuddy(gpointer key, gpointer v, gpointer data) {
-	User *user = (User *) data;
-	AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) v;
-	if (s_buddy->getFlags() & SPECTRUM_BUDDY_IGNORE)
-		return TRUE;
-	
-	// save PurpleBuddy
-	std::string alias = s_buddy->getAlias();
-	std::string name = s_buddy->getName();
-	long id = s_buddy->getId();
-
-	// Buddy is not in DB
-	if (id != -1) {
-		Transport::instance()->sql()->addBuddy(user->storageId(), name, s_buddy->getSubscription(), s_buddy->getGroup(), alias, s_buddy->getFlags());
+// Returns FNV-1a hash of setting's key and value. Only these fingerprints are
+// kept in memory instead of copies of all stored settings.
+static guint64 settingFingerprint(const char *key, const std::string &value) {
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	for (const char *c = key; *c; c++) {
+		hash ^= (unsigned char) *c;
+		hash *= G_GUINT64_CONSTANT(1099511628211);
 	}
-	else {
-		id = Transport::instance()->sql()->addBuddy(user->storageId(), name, s_buddy->getSubscription(), s_buddy->getGroup(), alias, s_buddy->getFlags());
-		s_buddy->setId(id);
+	hash *= G_GUINT64_CONSTANT(1099511628211);
+	for (std::string::const_iterator it = value.begin(); it != value.end(); it++) {
+		hash ^= (unsigned char) *it;
+		hash *= G_GUINT64_CONSTANT(1099511628211);
 	}
-	Log("buddyListSaveNode", id << " " << name << " " << alias << " " << s_buddy->getSubscription());
-	if (s_buddy->getBuddy() && id != -1) {
-		PurpleBuddy *buddy = s_buddy->getBuddy();
-		SaveData *s = new SaveData;
-		s->user = user;
-		s->id = id;
-		g_hash_table_foreach(buddy->node.settings, save_settings, s);
-		delete s;
+	return hash;
+}
+
+static void remember_setting(gpointer k, gpointer v, gpointer data) {
+	std::vector <guint64> *stored = (std::vector <guint64> *) data;
+	std::string str;
+	if (settingToString((PurpleValue *) v, str))
+		stored->push_back(settingFingerprint((char *) k, str));
+}
+
+static void remember_settings(gpointer k, gpointer v, gpointer data) {
+	AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) v;
+	std::map <long, std::vector <guint64> > *stored = (std::map <long, std::vector <guint64> > *) data;
+	if (s_buddy->getBuddy() && s_buddy->getId() != -1) {
+		std::vector <guint64> &fingerprints = (*stored)[s_buddy->getId()];
+		g_hash_table_foreach(s_buddy->getBuddy()->node.settings, remember_setting, &fingerprints);
+		std::sort(fingerprints.begin(), fingerprints.end());
 	}
+}
+
+static void save_settings(gpointer k, gpointer v, gpointer data) {
+	PurpleValue *value = (PurpleValue *) v;
+	std::string key((char *) k);
+	SaveData *s = (SaveData *) data;
+	User *user = s->user;
+	long id = s->id;
+	std::string str;
+	if (!settingToString(value, str))
+		return;
+
+	guint64 fingerprint = settingFingerprint(key.c_str(), str);
+	s->current.push_back(fingerprint);
+	if (std::binary_search(s->stored->begin(), s->stored->end(), fingerprint))
+		return;
+	Transport::instance()->sql()->addBuddySetting(user->storageId(), id, key, str, purple_value_get_type(value));
+}
+
+static gboolean storeAbstractSpectrumBuddy(gpointer key, gpointer v, gpointer data) {
+	RosterStorage *storage = (RosterStorage *) data;
+	storage->saveBuddy((AbstractSpectrumBuddy *) v);
 	return TRUE;
 }
 
 RosterStorage::RosterStorage(User *user) : m_user(user) {
 	m_storageCache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-	m_storageTimer = new SpectrumTimer(10000, &storageTimeout, this);
+	m_storageTimer = new SpectrumTimer(STORAGE_DELAY, &storageTimeout, this);
+	m_storageFirstChange = 0;
 }
 
 RosterStorage::~RosterStorage() {
+	Transport::instance()->removeJobs(this);
 	delete m_storageTimer;
 	g_hash_table_destroy(m_storageCache);
 }
@@ -97,7 +135,15 @@ void RosterStorage::storeBuddy(AbstractSpectrumBuddy *s_buddy) {
 		return;
 	if (g_hash_table_lookup(m_storageCache, s_buddy->getSafeName().c_str()) == NULL)
 		g_hash_table_replace(m_storageCache, g_strdup(s_buddy->getSafeName().c_str()), s_buddy);
-	m_storageTimer->start();
+
+	time_t t = time(NULL);
+	if (m_storageFirstChange == 0) {
+		m_storageFirstChange = t;
+		m_storageTimer->start();
+	}
+	else if (t - m_storageFirstChange < STORAGE_MAX_DELAY) {
+		m_storageTimer->restart();
+	}
 }
 
 void RosterStorage::storeBuddy(PurpleBuddy *buddy) {
@@ -111,13 +157,75 @@ bool RosterStorage::storeBuddies() {
 	}
 	
 	Transport::instance()->sql()->beginTransaction();
-	g_hash_table_foreach_remove(m_storageCache, storeAbstractSpectrumBuddy, m_user);
+	g_hash_table_foreach_remove(m_storageCache, storeAbstractSpectrumBuddy, this);
 	Transport::instance()->sql()->commitTransaction();
 	
 	return true;
 }
 
+bool RosterStorage::storeBuddies(int count) {
+	if (g_hash_table_size(m_storageCache) == 0) {
+		return false;
+	}
+
+	GHashTableIter iter;
+	gpointer key, value;
+	Transport::instance()->sql()->beginTransaction();
+	g_hash_table_iter_init(&iter, m_storageCache);
+	while (count-- > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
+		saveBuddy((AbstractSpectrumBuddy *) value);
+		g_hash_table_iter_remove(&iter);
+	}
+	Transport::instance()->sql()->commitTransaction();
+
+	return g_hash_table_size(m_storageCache) != 0;
+}
+
+void RosterStorage::scheduleStoring() {
+	m_storageFirstChange = 0;
+	Transport::instance()->addJob(m_user->jid(), "store-buddies", &storeBuddiesStep, this);
+}
+
+void RosterStorage::saveBuddy(AbstractSpectrumBuddy *s_buddy) {
+	if (s_buddy->getFlags() & SPECTRUM_BUDDY_IGNORE)
+		return;
+	
+	// save PurpleBuddy
+	std::string alias = s_buddy->getAlias();
+	std::string name = s_buddy->getName();
+	long id = s_buddy->getId();
+
+	// Buddy is not in DB
+	if (id != -1) {
+		Transport::instance()->sql()->addBuddy(m_user->storageId(), name, s_buddy->getSubscription(), s_buddy->getGroup(), alias, s_buddy->getFlags());
+	}
+	else {
+		id = Transport::instance()->sql()->addBuddy(m_user->storageId(), name, s_buddy->getSubscription(), s_buddy->getGroup(), alias, s_buddy->getFlags());
+		s_buddy->setId(id);
+	}
+	Log("buddyListSaveNode", id << " " << name << " " << alias << " " << s_buddy->getSubscription());
+	if (s_buddy->getBuddy() && id != -1) {
+		PurpleBuddy *buddy = s_buddy->getBuddy();
+		std::vector <guint64> &stored = m_storedSettings[id];
+		SaveData *s = new SaveData;
+		s->user = m_user;
+		s->id = id;
+		s->stored = &stored;
+		g_hash_table_foreach(buddy->node.settings, save_settings, s);
+		std::sort(s->current.begin(), s->current.end());
+		stored.swap(s->current);
+		delete s;
+	}
+}
+
+void RosterStorage::setStoredSettings(GHashTable *roster) {
+	m_storedSettings.clear();
+	if (roster)
+		g_hash_table_foreach(roster, remember_settings, &m_storedSettings);
+}
+
 void RosterStorage::removeBuddy(AbstractSpectrumBuddy *s_buddy) {
+	m_storedSettings.erase(s_buddy->getId());
 	if (g_hash_table_lookup(m_storageCache, s_buddy->getSafeName().c_str()) != NULL)
 		g_hash_table_remove(m_storageCache, s_buddy->getSafeName().c_str());
 }
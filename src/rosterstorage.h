@@ -22,6 +22,8 @@
 #define SPECTRUM_ROSTERSTORAGE_H
 
 #include <string>
+#include <map>
+#include <vector>
 #include "purple.h"
 #include "account.h"
 #include "glib.h"
@@ -37,6 +39,8 @@ class User;
 struct SaveData {
 	User *user;
 	long id;
+	const std::vector <guint64> *stored;	// Fingerprints of settings stored last time (sorted).
+	std::vector <guint64> current;			// Fingerprints of current settings.
 };
 
 // Stores buddies into DB Backend.
@@ -46,7 +50,9 @@ class RosterStorage {
 		virtual ~RosterStorage();
 
 		// Add buddy to store queue and store it in future. Nothing
-		// will happen if buddy is already added.
+		// will happen if buddy is already added. Queue is stored once
+		// buddies stop changing for a while, but at latest after
+		// STORAGE_MAX_DELAY since the first change.
 		void storeBuddy(PurpleBuddy *buddy);
 		void storeBuddy(AbstractSpectrumBuddy *buddy);
 
@@ -54,14 +60,32 @@ class RosterStorage {
 		// if some buddies were stored.
 		bool storeBuddies();
 
+		// Stores at most `count` buddies from queue. Returns true if there are
+		// still some buddies in queue.
+		bool storeBuddies(int count);
+
+		// Adds job which stores buddies from queue in small batches to WorkScheduler.
+		void scheduleStoring();
+
 		// Remove buddy from storage queue.
 		void removeBuddy(PurpleBuddy *buddy);
 		void removeBuddy(AbstractSpectrumBuddy *buddy);
 
+		// Stores buddy and its settings immediately. Settings which haven't
+		// changed since they were stored last time are skipped. Only their
+		// fingerprints are kept in memory to find out the changed ones.
+		void saveBuddy(AbstractSpectrumBuddy *s_buddy);
+
+		// Remembers settings of buddies loaded from storage, so they are not
+		// written again until they change.
+		void setStoredSettings(GHashTable *roster);
+
 	private:
 		User *m_user;
 		GHashTable *m_storageCache;
 		SpectrumTimer *m_storageTimer;
+		time_t m_storageFirstChange;		// Time of the first change which is not stored yet.
+		std::map <long, std::vector <guint64> > m_storedSettings;	// Fingerprints of stored settings by buddy id.
 };
 
 #endif
@@ -0,0 +1,380 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "sessionsnapshot.h"
+#include "spectrumtimer.h"
+#include "log.h"
+#include "transport.h"
+#include "usermanager.h"
+#include "string.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#ifndef TESTS
+#include "abstractspectrumbuddy.h"
+#include "user.h"
+#include "sql.h"
+#endif
+
+#define SNAPSHOT_MAGIC "SPSS"
+#define SNAPSHOT_HEADER_SIZE 24
+
+static gboolean saveSnapshot(gpointer data) {
+	SessionSnapshot *snapshot = (SessionSnapshot *) data;
+	snapshot->save();
+	return TRUE;
+}
+
+// FNV-1a, we just need to detect truncated or damaged file.
+static guint32 checksum(const char *data, gsize size) {
+	guint32 hash = 2166136261U;
+	for (gsize i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void writeInt(std::string &out, gint32 value) {
+	out.append((const char *) &value, sizeof(gint32));
+}
+
+static void writeString(std::string &out, const std::string &value) {
+	writeInt(out, value.size());
+	out.append(value);
+}
+
+static bool readInt(const char *&data, const char *end, gint32 &value) {
+	if (end - data < (int) sizeof(gint32))
+		return false;
+	memcpy(&value, data, sizeof(gint32));
+	data += sizeof(gint32);
+	return true;
+}
+
+static bool readString(const char *&data, const char *end, std::string &value) {
+	gint32 len;
+	if (!readInt(data, end, len) || len < 0 || end - data < len)
+		return false;
+	value.assign(data, len);
+	data += len;
+	return true;
+}
+
+#ifndef TESTS
+static void collectBuddy(gpointer key, gpointer v, gpointer data) {
+	AbstractSpectrumBuddy *s_buddy = (AbstractSpectrumBuddy *) v;
+	SnapshotUser *u = (SnapshotUser *) data;
+	if (!s_buddy->isOnline())
+		return;
+	PurpleStatusPrimitive status;
+	std::string message;
+	SnapshotBuddy buddy;
+	buddy.jid = s_buddy->getBareJid();
+	buddy.status = s_buddy->getStatus(status, message) ? (int) status : (int) PURPLE_STATUS_AVAILABLE;
+	u->buddies.push_back(buddy);
+}
+
+static void collectUser(gpointer key, gpointer v, gpointer data) {
+	User *user = (User *) v;
+	std::map <std::string, SnapshotUser> *users = (std::map <std::string, SnapshotUser> *) data;
+	// Users which are still waiting for connection are restored by probe.
+	if (!user->isConnected())
+		return;
+	SnapshotUser &u = (*users)[user->userKey()];
+	u.jid = user->jid();
+	u.activeResource = user->getResource().name;
+
+	const std::map <std::string, Resource> &resources = user->getResources();
+	for (std::map <std::string, Resource>::const_iterator it = resources.begin(); it != resources.end(); it++) {
+		SnapshotResource r;
+		r.name = (*it).second.name;
+		r.priority = (*it).second.priority;
+		r.caps = (*it).second.caps;
+		r.show = (*it).second.show;
+		r.status = (*it).second.status;
+		u.resources.push_back(r);
+	}
+
+	g_hash_table_foreach(user->getRoster(), collectBuddy, &u);
+}
+#endif
+
+SessionSnapshot::SessionSnapshot(const std::string &file, int interval, int maxAge) : m_file(file), m_timer(NULL), m_restoring(false) {
+	m_maxAge = maxAge;
+	m_time = 0;
+	m_written = 0;
+	m_length = 0;
+	m_checksum = 0;
+	m_writes = 0;
+	if (!m_file.empty() && interval > 0) {
+		m_timer = new SpectrumTimer(interval * 1000, &saveSnapshot, this);
+		m_timer->start();
+	}
+}
+
+SessionSnapshot::~SessionSnapshot() {
+	if (m_timer)
+		delete m_timer;
+}
+
+time_t SessionSnapshot::now() {
+	return m_time != 0 ? m_time : time(NULL);
+}
+
+std::string SessionSnapshot::serialize(const std::map <std::string, SnapshotUser> &users, time_t timestamp) {
+	std::string data;
+	for (std::map <std::string, SnapshotUser>::const_iterator it = users.begin(); it != users.end(); it++) {
+		const SnapshotUser &u = (*it).second;
+		writeString(data, u.jid);
+		writeString(data, u.activeResource);
+		writeInt(data, u.resources.size());
+		for (std::list <SnapshotResource>::const_iterator r = u.resources.begin(); r != u.resources.end(); r++) {
+			writeString(data, (*r).name);
+			writeInt(data, (*r).priority);
+			writeInt(data, (*r).caps);
+			writeInt(data, (*r).show);
+			writeString(data, (*r).status);
+		}
+		writeInt(data, u.buddies.size());
+		for (std::list <SnapshotBuddy>::const_iterator b = u.buddies.begin(); b != u.buddies.end(); b++) {
+			writeString(data, (*b).jid);
+			writeInt(data, (*b).status);
+		}
+	}
+
+	std::string out(SNAPSHOT_MAGIC);
+	writeInt(out, SESSION_SNAPSHOT_VERSION);
+	writeInt(out, (gint32) timestamp);
+	writeInt(out, users.size());
+	writeInt(out, data.size());
+	writeInt(out, (gint32) checksum(data.c_str(), data.size()));
+	out.append(data);
+	return out;
+}
+
+bool SessionSnapshot::parse(const char *data, gsize size, std::map <std::string, SnapshotUser> &users, time_t &timestamp) {
+	const char *end = data + size;
+	gint32 version, t, count, length, sum;
+	if (size < SNAPSHOT_HEADER_SIZE || memcmp(data, SNAPSHOT_MAGIC, 4) != 0)
+		return false;
+	data += 4;
+	readInt(data, end, version);
+	readInt(data, end, t);
+	readInt(data, end, count);
+	readInt(data, end, length);
+	readInt(data, end, sum);
+	if (version != SESSION_SNAPSHOT_VERSION || count < 0 || length != end - data || (guint32) sum != checksum(data, length))
+		return false;
+
+	timestamp = (time_t) t;
+	for (gint32 i = 0; i < count; i++) {
+		SnapshotUser u;
+		gint32 n;
+		if (!readString(data, end, u.jid) || !readString(data, end, u.activeResource) || !readInt(data, end, n))
+			return false;
+		for (gint32 j = 0; j < n; j++) {
+			SnapshotResource r;
+			if (!readString(data, end, r.name) || !readInt(data, end, r.priority) || !readInt(data, end, r.caps) ||
+				!readInt(data, end, r.show) || !readString(data, end, r.status))
+				return false;
+			u.resources.push_back(r);
+		}
+		if (!readInt(data, end, n))
+			return false;
+		for (gint32 j = 0; j < n; j++) {
+			SnapshotBuddy b;
+			if (!readString(data, end, b.jid) || !readInt(data, end, b.status))
+				return false;
+			u.buddies.push_back(b);
+		}
+		users[u.jid] = u;
+	}
+	return data == end;
+}
+
+bool SessionSnapshot::load() {
+	m_users.clear();
+	if (m_file.empty())
+		return false;
+
+	GError *error = NULL;
+	GMappedFile *file = g_mapped_file_new(m_file.c_str(), FALSE, &error);
+	if (!file) {
+		Log("SessionSnapshot", "Can't open session snapshot " << m_file << ": " << error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	time_t timestamp;
+	bool ret = parse(g_mapped_file_get_contents(file), g_mapped_file_get_length(file), m_users, timestamp);
+	g_mapped_file_unref(file);
+
+	if (!ret) {
+		Log("SessionSnapshot", "Session snapshot " << m_file << " is not valid, ignoring it");
+		m_users.clear();
+		return false;
+	}
+
+	if (m_maxAge > 0 && now() - timestamp > m_maxAge) {
+		Log("SessionSnapshot", "Session snapshot " << m_file << " written at " << timestamp << " is too old, ignoring it");
+		m_users.clear();
+		return false;
+	}
+
+	Log("SessionSnapshot", "Loaded session snapshot " << m_file << " written at " << timestamp << " with " << m_users.size() << " users");
+	m_restoring = !m_users.empty();
+	return true;
+}
+
+bool SessionSnapshot::writeFile(const std::string &data) {
+	// Snapshot contains JIDs and statuses of users. Spectrum runs with umask 0
+	// when it's daemonized, so the temporary file is created with 0600 mode
+	// right away; O_EXCL makes sure we don't write into file somebody else
+	// prepared for us.
+	std::string tmp = m_file + ".tmp";
+	g_unlink(tmp.c_str());
+	int fd = open(tmp.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+	if (fd == -1)
+		return false;
+
+	const char *ptr = data.c_str();
+	size_t left = data.size();
+	while (left > 0) {
+		ssize_t written = write(fd, ptr, left);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		ptr += written;
+		left -= written;
+	}
+
+	// Data has to be on disk before rename, otherwise crash could leave
+	// empty snapshot.
+	if (left != 0 || fsync(fd) != 0) {
+		int err = errno;
+		close(fd);
+		g_unlink(tmp.c_str());
+		errno = err;
+		return false;
+	}
+	if (close(fd) != 0 || g_rename(tmp.c_str(), m_file.c_str()) != 0) {
+		int err = errno;
+		g_unlink(tmp.c_str());
+		errno = err;
+		return false;
+	}
+	return true;
+}
+
+bool SessionSnapshot::save() {
+	if (m_file.empty() || m_restoring)
+		return false;
+
+	std::map <std::string, SnapshotUser> users;
+#ifndef TESTS
+	g_hash_table_foreach(Transport::instance()->userManager()->getUsersTable(), collectUser, &users);
+#endif
+	time_t t = now();
+	std::string data = serialize(users, t);
+
+	// Data length and checksum from the header. Unchanged snapshot is written
+	// again only before it gets too old to be loaded.
+	gint32 length, sum;
+	memcpy(&length, data.c_str() + SNAPSHOT_HEADER_SIZE - 8, sizeof(gint32));
+	memcpy(&sum, data.c_str() + SNAPSHOT_HEADER_SIZE - 4, sizeof(gint32));
+	if (m_written != 0 && length == m_length && sum == m_checksum && (m_maxAge == 0 || t - m_written < m_maxAge / 2))
+		return true;
+
+	if (!writeFile(data)) {
+		Log("SessionSnapshot", "Can't write session snapshot " << m_file << ": " << g_strerror(errno));
+		return false;
+	}
+	m_written = t;
+	m_length = length;
+	m_checksum = sum;
+	m_writes++;
+	return true;
+}
+
+bool SessionSnapshot::hasUser(const std::string &jid) {
+	return m_users.find(jid) != m_users.end();
+}
+
+User *SessionSnapshot::restoreUser(const std::string &jid) {
+	if (!hasUser(jid))
+		return NULL;
+#ifdef TESTS
+	return NULL;
+#else
+	SnapshotUser &u = m_users[jid];
+	Configuration &config = Transport::instance()->getConfiguration();
+	UserRow res = Transport::instance()->sql()->getUserByJid(jid);
+	if (res.id == -1 || u.resources.empty() || Transport::instance()->userManager()->getUserByJID(jid)) {
+		removeUser(jid);
+		return NULL;
+	}
+
+	std::list<std::string> const &x = config.allowedServers;
+	if (config.onlyForVIP && !res.vip && std::find(x.begin(), x.end(), JID(jid).server()) == x.end()) {
+		removeUser(jid);
+		return NULL;
+	}
+
+	if (purple_accounts_find(res.uin.c_str(), Transport::instance()->protocol()->protocol().c_str()) != NULL) {
+		PurpleAccount *act = purple_accounts_find(res.uin.c_str(), Transport::instance()->protocol()->protocol().c_str());
+		if (Transport::instance()->userManager()->getUserByAccount(act)) {
+			removeUser(jid);
+			return NULL;
+		}
+	}
+
+	Log("SessionSnapshot", "Restoring user " << jid << " from session snapshot");
+	User *user = new User(JID(jid + "/" + u.activeResource), res.uin, res.password, jid, res.id, res.encoding, res.language, res.vip);
+	user->setFeatures(res.vip ? config.VIPFeatures : config.transportFeatures);
+	for (std::list <SnapshotResource>::iterator r = u.resources.begin(); r != u.resources.end(); r++) {
+		user->setResource((*r).name, (*r).priority, (*r).caps, (*r).show, (*r).status);
+	}
+	user->setActiveResource(u.activeResource);
+
+	std::list <std::string> buddies;
+	for (std::list <SnapshotBuddy>::iterator b = u.buddies.begin(); b != u.buddies.end(); b++) {
+		buddies.push_back((*b).jid);
+	}
+	user->setRestoredPresences(buddies);
+
+	Transport::instance()->userManager()->addUser(user);
+
+	// We know capabilities from snapshot, so we don't have to wait for disco#info.
+	if (user->getResource().caps != -1) {
+		user->setReadyForConnect(true);
+		user->forwardStatus(user->getResource().show, user->getResource().status);
+		user->connect();
+	}
+
+	removeUser(jid);
+	return user;
+#endif
+}
@@ -0,0 +1,128 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_SESSION_SNAPSHOT_H
+#define SPECTRUM_SESSION_SNAPSHOT_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <time.h>
+#include "glib.h"
+
+class SpectrumTimer;
+class User;
+
+#define SESSION_SNAPSHOT_VERSION 1
+
+struct SnapshotResource {
+	std::string name;
+	int priority;
+	int caps;
+	int show;
+	std::string status;
+};
+
+struct SnapshotBuddy {
+	std::string jid;		// Bare JID of the buddy as seen by XMPP user.
+	int status;				// PurpleStatusPrimitive of last-known presence.
+};
+
+struct SnapshotUser {
+	std::string jid;
+	std::string activeResource;
+	std::list <SnapshotResource> resources;
+	std::list <SnapshotBuddy> buddies;	// Only buddies which were online.
+};
+
+// Periodically stores state of online users (their resources, capabilities and
+// last-known presences of their buddies) into compact binary file. After restart
+// AutoConnectLoop uses this snapshot to restore users without waiting for
+// disco#info and without sending unavailable presences for whole rosters.
+//
+// File format (host byte order, all integers are 32bit):
+//   "SPSS" | version | timestamp | users count | data length | checksum | data
+// Strings are stored as length + bytes. The file is replaced atomically, so
+// crash during writing never leaves broken snapshot behind. It's readable only
+// by Spectrum's user and it's not rewritten when nothing has changed.
+class SessionSnapshot {
+	public:
+		// `file` - path to snapshot file, empty string disables the snapshot.
+		// `interval` - how often (in seconds) is snapshot written, 0 means only at exit.
+		// `maxAge` - older snapshot is not loaded (in seconds), 0 means no limit.
+		SessionSnapshot(const std::string &file, int interval = 60, int maxAge = 0);
+		~SessionSnapshot();
+
+		// Loads snapshot from the file. Returns false if there's no valid snapshot
+		// or if it's too old.
+		bool load();
+
+		// Collects the state of all online users and writes it into the file
+		// unless it's the same as the one written last time.
+		bool save();
+
+		// Returns number of snapshots written to file.
+		long getWrites() { return m_writes; }
+
+		// Sets current time, used in tests.
+		void setTime(time_t t) { m_time = t; }
+
+		// Returns true if there is loaded snapshot for user with this bare JID.
+		bool hasUser(const std::string &jid);
+
+		// Returns loaded snapshot for user with this bare JID.
+		SnapshotUser &getUser(const std::string &jid) { return m_users[jid]; }
+
+		// Removes loaded snapshot of the user. Called when user is restored.
+		void removeUser(const std::string &jid) { m_users.erase(jid); }
+
+		// Forgets loaded snapshot. Snapshot is not saved until this is called,
+		// so unrestored users are not lost when Spectrum crashes during restore.
+		void clear() { m_users.clear(); m_restoring = false; }
+
+		// Creates User according to the snapshot, sets its resources and starts
+		// connecting. Returns NULL if the user can't be restored.
+		User *restoreUser(const std::string &jid);
+
+		// Serializes users into snapshot data.
+		static std::string serialize(const std::map <std::string, SnapshotUser> &users, time_t timestamp);
+
+		// Parses snapshot data. Returns false if data are not valid snapshot.
+		static bool parse(const char *data, gsize size, std::map <std::string, SnapshotUser> &users, time_t &timestamp);
+
+	private:
+		time_t now();
+		// Writes data into temporary file with 0600 mode, syncs it and renames
+		// it to m_file. Sets errno on failure.
+		bool writeFile(const std::string &data);
+
+		std::string m_file;
+		std::map <std::string, SnapshotUser> m_users;
+		SpectrumTimer *m_timer;
+		bool m_restoring;
+		int m_maxAge;
+		time_t m_time;
+		time_t m_written;			// Time when snapshot was written last time.
+		gint32 m_length;			// Data length and checksum of last written snapshot.
+		gint32 m_checksum;
+		long m_writes;
+};
+
+#endif
@@ -22,18 +22,138 @@
 #include "log.h"
 #include "transport.h"
 #include "spectrum_util.h"
+#include "spectrumtimer.h"
+
+long SettingsManager::m_writes = 0;
+long SettingsManager::m_skipped = 0;
+
+// Known settings, indexed by UserSetting.
+static const struct {
+	const char *key;
+	PurpleType type;
+	const char *def;
+} knownSettings[SETTING_COUNT] = {
+	{"enable_transport", PURPLE_TYPE_BOOLEAN, "1"},
+	{"enable_notify_email", PURPLE_TYPE_BOOLEAN, "0"},
+	{"enable_avatars", PURPLE_TYPE_BOOLEAN, "1"},
+	{"enable_chatstate", PURPLE_TYPE_BOOLEAN, "1"},
+	{"save_files_on_server", PURPLE_TYPE_BOOLEAN, "0"},
+	{"reject_authorizations", PURPLE_TYPE_BOOLEAN, "0"},
+	{"first_synchronization_done", PURPLE_TYPE_BOOLEAN, "0"},
+	{"roster_version", PURPLE_TYPE_STRING, ""},
+};
+
+// Maps keys of known settings to their UserSetting + 1.
+static GHashTable *knownSettingsIndex = NULL;
+
+static gboolean flushTimeout(gpointer data) {
+	SettingsManager *manager = (SettingsManager *) data;
+	manager->flushSettings();
+	return FALSE;
+}
 
 SettingsManager::SettingsManager(AbstractUser *user) {
 	m_user = user;
 	m_settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) purple_value_destroy);
+	m_flags = 0;
+	m_stored = 0;
+	m_storageId = -1;
+	m_firstDirty = 0;
+	for (int i = 0; i < SETTING_COUNT; i++)
+		m_values[i] = NULL;
+	m_flushTimer = new SpectrumTimer(CONFIG().settingsFlushInterval * 1000, &flushTimeout, this);
 }
 
 SettingsManager::~SettingsManager() {
+	// User flushes settings in its destructor, but if something has changed
+	// them since then, write them with storage id remembered by markDirty(),
+	// because m_user is already destroyed here.
+	if (!m_dirty.empty())
+		Log("SettingsManager", "flushing " << m_dirty.size() << " settings changed during destruction");
+	flushSettings();
+	delete m_flushTimer;
+	for (int i = 0; i < SETTING_COUNT; i++) {
+		if (m_values[i])
+			purple_value_destroy(m_values[i]);
+	}
 	g_hash_table_destroy(m_settings);
 }
 
+void SettingsManager::markDirty(const std::string &key, const std::string &value) {
+	if (m_dirty.find(key) != m_dirty.end())
+		m_skipped++;
+	m_dirty[key] = value;
+	m_storageId = m_user->storageId();
+	if (CONFIG().settingsFlushInterval == 0) {
+		flushSettings();
+		return;
+	}
+
+	time_t t = time(NULL);
+	if (m_firstDirty == 0) {
+		m_firstDirty = t;
+		m_flushTimer->start();
+	}
+	else if (t - m_firstDirty < CONFIG().settingsFlushMaxDelay) {
+		// Settings are still changing, so wait for more changes, but do not
+		// postpone writing forever when they keep changing.
+		m_flushTimer->restart();
+	}
+}
+
+void SettingsManager::flushSettings() {
+	m_flushTimer->stop();
+	m_firstDirty = 0;
+	if (m_dirty.empty())
+		return;
+
+	AbstractBackend *sql = Transport::instance()->sql();
+	if (m_dirty.size() > 1)
+		sql->beginTransaction();
+	for (std::map <std::string, std::string>::iterator it = m_dirty.begin(); it != m_dirty.end(); it++) {
+		sql->updateSetting(m_storageId, it->first, it->second);
+	}
+	if (m_dirty.size() > 1)
+		sql->commitTransaction();
+	m_writes += m_dirty.size();
+	m_dirty.clear();
+}
+
+UserSetting SettingsManager::findSetting(const std::string &key) {
+	if (knownSettingsIndex == NULL) {
+		knownSettingsIndex = g_hash_table_new(g_str_hash, g_str_equal);
+		for (int i = 0; i < SETTING_COUNT; i++)
+			g_hash_table_insert(knownSettingsIndex, (gpointer) knownSettings[i].key, GINT_TO_POINTER(i + 1));
+	}
+	// Unknown key is 0, which is SETTING_UNKNOWN + 1.
+	return (UserSetting) (GPOINTER_TO_INT(g_hash_table_lookup(knownSettingsIndex, key.c_str())) - 1);
+}
+
+PurpleType SettingsManager::settingType(UserSetting setting) {
+	return knownSettings[setting].type;
+}
+
+void SettingsManager::addKnownSettings() {
+	for (int i = 0; i < SETTING_COUNT; i++) {
+		if (m_stored & (1 << i))
+			continue;
+		Transport::instance()->sql()->addSetting(m_user->storageId(), knownSettings[i].key, knownSettings[i].def, knownSettings[i].type);
+		if (knownSettings[i].type == PURPLE_TYPE_BOOLEAN) {
+			if (atoi(knownSettings[i].def))
+				m_flags |= 1 << i;
+			else
+				m_flags &= ~(1 << i);
+		}
+		else
+			m_strings[i] = knownSettings[i].def;
+		m_stored |= 1 << i;
+	}
+}
+
 template <>
 void SettingsManager::addSetting(const std::string &key, const bool &value) {
+	if (findSetting(key) != SETTING_UNKNOWN)
+		return;
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		Transport::instance()->sql()->addSetting(m_user->storageId(), key, value ? "1" : "0", PURPLE_TYPE_BOOLEAN);
@@ -45,6 +165,8 @@ void SettingsManager::addSetting(const std::string &key, const bool &value) {
 
 template <>
 void SettingsManager::addSetting(const std::string &key, const std::string &value) {
+	if (findSetting(key) != SETTING_UNKNOWN)
+		return;
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		Transport::instance()->sql()->addSetting(m_user->storageId(), key, value, PURPLE_TYPE_STRING);
@@ -56,6 +178,8 @@ void SettingsManager::addSetting(const std::string &key, const std::string &valu
 
 template <>
 void SettingsManager::addSetting(const std::string &key, const int &value) {
+	if (findSetting(key) != SETTING_UNKNOWN)
+		return;
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		Transport::instance()->sql()->addSetting(m_user->storageId(), key, stringOf(value), PURPLE_TYPE_INT);
@@ -65,8 +189,22 @@ void SettingsManager::addSetting(const std::string &key, const int &value) {
 	}
 }
 
+template<>
+bool SettingsManager::getSetting(UserSetting setting) {
+	return m_flags & (1 << setting);
+}
+
+template<>
+std::string SettingsManager::getSetting(UserSetting setting) {
+	return m_strings[setting];
+}
+
 template<>
 bool SettingsManager::getSetting(const std::string &key, const bool &def) {
+	UserSetting setting = findSetting(key);
+	if (setting != SETTING_UNKNOWN)
+		return (m_stored & (1 << setting)) ? getSetting<bool>(setting) : def;
+
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		return def;
@@ -76,6 +214,10 @@ bool SettingsManager::getSetting(const std::string &key, const bool &def) {
 
 template<>
 std::string SettingsManager::getSetting(const std::string &key, const std::string &def) {
+	UserSetting setting = findSetting(key);
+	if (setting != SETTING_UNKNOWN)
+		return (m_stored & (1 << setting)) ? getSetting<std::string>(setting) : def;
+
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		return def;
@@ -92,24 +234,72 @@ int SettingsManager::getSetting(const std::string &key, const int &def) {
 	return purple_value_get_int(v);
 }
 
+template <>
+void SettingsManager::updateSetting(UserSetting setting, const bool &value) {
+	if (!(m_stored & (1 << setting)))
+		return;
+	if (getSetting<bool>(setting) == value) {
+		m_skipped++;
+		return;
+	}
+	if (value)
+		m_flags |= 1 << setting;
+	else
+		m_flags &= ~(1 << setting);
+	markDirty(knownSettings[setting].key, value ? "1" : "0");
+}
+
+template <>
+void SettingsManager::updateSetting(UserSetting setting, const std::string &value) {
+	if (!(m_stored & (1 << setting)))
+		return;
+	if (m_strings[setting] == value) {
+		m_skipped++;
+		return;
+	}
+	m_strings[setting] = value;
+	markDirty(knownSettings[setting].key, value);
+}
+
 template <>
 void SettingsManager::updateSetting(const std::string &key, const bool &value) {
+	UserSetting setting = findSetting(key);
+	if (setting != SETTING_UNKNOWN) {
+		updateSetting<bool>(setting, value);
+		return;
+	}
+
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		return;
 	}
+	if ((bool) purple_value_get_boolean(v) == value) {
+		m_skipped++;
+		return;
+	}
 	purple_value_set_boolean(v, value);
-	Transport::instance()->sql()->updateSetting(m_user->storageId(), key, value ? "1" : "0");
+	markDirty(key, value ? "1" : "0");
 }
 
 template <>
 void SettingsManager::updateSetting(const std::string &key, const std::string &value) {
+	UserSetting setting = findSetting(key);
+	if (setting != SETTING_UNKNOWN) {
+		updateSetting<std::string>(setting, value);
+		return;
+	}
+
 	PurpleValue *v;
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		return;
 	}
+	const char *current = purple_value_get_string(v);
+	if (value == (current ? current : "")) {
+		m_skipped++;
+		return;
+	}
 	purple_value_set_string(v, value.c_str());
-	Transport::instance()->sql()->updateSetting(m_user->storageId(), key, value);
+	markDirty(key, value);
 }
 
 template <>
@@ -118,16 +308,50 @@ void SettingsManager::updateSetting(const std::string &key, const int &value) {
 	if ((v = (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str())) == NULL) {
 		return;
 	}
+	if (purple_value_get_int(v) == value) {
+		m_skipped++;
+		return;
+	}
 	purple_value_set_int(v, value);
-	Transport::instance()->sql()->updateSetting(m_user->storageId(), key, stringOf(value));
+	markDirty(key, stringOf(value));
 }
 
 void SettingsManager::setSettings(GHashTable *settings) {
 	if (m_settings)
 		g_hash_table_destroy(m_settings);
 	m_settings = settings;
+	m_flags = 0;
+	m_stored = 0;
+
+	for (int i = 0; i < SETTING_COUNT; i++) {
+		PurpleValue *v = (PurpleValue *) g_hash_table_lookup(m_settings, knownSettings[i].key);
+		if (v == NULL)
+			continue;
+		if (knownSettings[i].type == PURPLE_TYPE_BOOLEAN) {
+			if (purple_value_get_boolean(v))
+				m_flags |= 1 << i;
+		}
+		else {
+			const char *value = purple_value_get_string(v);
+			m_strings[i] = value ? value : "";
+		}
+		m_stored |= 1 << i;
+		g_hash_table_remove(m_settings, knownSettings[i].key);
+	}
 }
 
 PurpleValue *SettingsManager::getSettingValue(const std::string &key) {
-	return (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str());
+	UserSetting setting = findSetting(key);
+	if (setting == SETTING_UNKNOWN)
+		return (PurpleValue *) g_hash_table_lookup(m_settings, key.c_str());
+	if (!(m_stored & (1 << setting)))
+		return NULL;
+
+	if (m_values[setting] == NULL)
+		m_values[setting] = purple_value_new(knownSettings[setting].type);
+	if (knownSettings[setting].type == PURPLE_TYPE_BOOLEAN)
+		purple_value_set_boolean(m_values[setting], getSetting<bool>(setting));
+	else
+		purple_value_set_string(m_values[setting], m_strings[setting].c_str());
+	return m_values[setting];
 }
@@ -22,6 +22,7 @@
 #define SPECTRUM_SETTINGSMANAGER_H
 
 #include <string>
+#include <map>
 #include "purple.h"
 #include "account.h"
 #include "glib.h"
@@ -29,6 +30,23 @@
 
 using namespace gloox;
 
+class SpectrumTimer;
+
+// Settings every user has. Their keys, types and default values are declared
+// in settingsmanager.cpp. They are stored by index, so reading them doesn't
+// need hashing the key.
+typedef enum {
+	SETTING_UNKNOWN = -1,
+	SETTING_ENABLE_TRANSPORT = 0,
+	SETTING_ENABLE_NOTIFY_EMAIL,
+	SETTING_ENABLE_AVATARS,
+	SETTING_ENABLE_CHATSTATE,
+	SETTING_SAVE_FILES_ON_SERVER,
+	SETTING_REJECT_AUTHORIZATIONS,
+	SETTING_FIRST_SYNCHRONIZATION_DONE,
+	SETTING_ROSTER_VERSION,
+	SETTING_COUNT
+} UserSetting;
 
 // Stores and manages users' settings .
 class SettingsManager {
@@ -36,22 +54,69 @@ class SettingsManager {
 		SettingsManager(AbstractUser *user);
 		virtual ~SettingsManager();
 
+		// Adds all known settings which are not in storage yet with their
+		// default values.
+		void addKnownSettings();
+
 		// Adds new boolean setting. It does nothing if setting already exists.
+		// This is meant for protocol specific settings, known settings are
+		// added by addKnownSettings().
 		template <typename T> void addSetting(const std::string &key, const T &value);
 
 		// Returns setting. If if doesn't exist, return default value defined by 'def'.
 		template<typename T> T getSetting(const std::string& key, const T& def = T());
 
+		// Returns known setting. Only bool and std::string are supported.
+		template<typename T> T getSetting(UserSetting setting);
+
+		// Updates existing setting. Changed settings are not written to storage
+		// immediately, but in one transaction by flushSettings() once they
+		// don't change for settings_flush_interval (or settings_flush_max_delay
+		// after the first change). Unchanged values are not written at all.
 		template <typename T> void updateSetting(const std::string &key, const T &value);
+		template <typename T> void updateSetting(UserSetting setting, const T &value);
 
+		// Writes changed settings to storage. It's called also by destructor,
+		// so no change is lost.
+		void flushSettings();
+
+		// Returns setting as PurpleValue or NULL if it doesn't exist. Known
+		// settings are converted from their slots; the returned value is owned
+		// by SettingsManager and holds the value from the time of the call.
 		PurpleValue *getSettingValue(const std::string &key);
 
-		// Replaces all settings and sets the new ones.
+		// Replaces all settings and sets the new ones. Known settings are moved
+		// from the table to their slots.
 		void setSettings(GHashTable *settings);
 
+		// Returns known setting with given key or SETTING_UNKNOWN.
+		static UserSetting findSetting(const std::string &key);
+
+		// Returns type of known setting.
+		static PurpleType settingType(UserSetting setting);
+
+		// Returns number of settings written to storage by all users.
+		static long getSettingsWrites() { return m_writes; }
+
+		// Returns number of updates which haven't been written to storage,
+		// because value didn't change or it was changed again before flush.
+		static long getSettingsSkipped() { return m_skipped; }
+
 	private:
+		void markDirty(const std::string &key, const std::string &value);
+
 		AbstractUser *m_user;
-		GHashTable *m_settings;
+		GHashTable *m_settings;						// Protocol specific settings.
+		unsigned int m_flags;						// Values of known boolean settings, one bit per UserSetting.
+		unsigned int m_stored;						// Known settings which exist in storage.
+		std::string m_strings[SETTING_COUNT];		// Values of known string settings.
+		PurpleValue *m_values[SETTING_COUNT];		// Known settings returned by getSettingValue().
+		std::map <std::string, std::string> m_dirty;	// Changed settings not written yet.
+		long m_storageId;							// Storage id of m_user when settings were changed.
+		time_t m_firstDirty;						// Time of the first change which is not written yet.
+		SpectrumTimer *m_flushTimer;
+		static long m_writes;
+		static long m_skipped;
 };
 
 #endif
@@ -22,10 +22,12 @@
 #include "main.h"
 #include "user.h"
 #include "log.h"
+#include "textsanitizer.h"
 #include "sql.h"
 #include "usermanager.h"
 
 #include "transport.h"
+#include "memoryaccounting.h"
 
 SpectrumBuddy::SpectrumBuddy(long id, PurpleBuddy *buddy) : AbstractSpectrumBuddy(id), m_buddy(buddy) {
 }
@@ -40,6 +42,7 @@ std::string SpectrumBuddy::getAlias() {
 		alias = (std::string) purple_buddy_get_alias(m_buddy);
 	else
 		alias = (std::string) purple_buddy_get_server_alias(m_buddy);
+	sanitizeXMLText(alias);
 	return alias;
 }
 
@@ -65,6 +68,7 @@ bool SpectrumBuddy::getStatus(PurpleStatusPrimitive &status, std::string &status
 		char *stripped = purple_markup_strip_html(message);
 		statusMessage = std::string(stripped);
 		g_free(stripped);
+		sanitizeXMLText(statusMessage);
 	}
 	else
 		statusMessage = "";
@@ -83,6 +87,8 @@ bool SpectrumBuddy::getXStatus(std::string &mood, std::string &comment) {
 		const char *c = purple_status_get_attr_string(stat, PURPLE_MOOD_COMMENT);
 		mood = m ? m : "";
 		comment = c ? c : "";
+		sanitizeXMLText(mood);
+		sanitizeXMLText(comment);
 		return true;
 	}
 #endif
@@ -125,7 +131,9 @@ std::string SpectrumBuddy::getIconHash() {
 }
 
 std::string SpectrumBuddy::getGroup() {
-	return purple_group_get_name(purple_buddy_get_group(m_buddy)) ? std::string(purple_group_get_name(purple_buddy_get_group(m_buddy))) : std::string("Buddies");
+	std::string group = purple_group_get_name(purple_buddy_get_group(m_buddy)) ? std::string(purple_group_get_name(purple_buddy_get_group(m_buddy))) : std::string("Buddies");
+	sanitizeXMLText(group);
+	return group;
 }
 
 std::string SpectrumBuddy::getSafeName() {
@@ -250,3 +258,28 @@ void SpectrumBuddy::handleBuddyRemoved(PurpleBuddy *buddy) {
 		m_buddy = alive_buddy;
 	}
 }
+
+void SpectrumBuddy::getMemoryUsage(unsigned long *usage) {
+	AbstractSpectrumBuddy::getMemoryUsage(usage);
+	usage[MEMORY_ROSTER] += sizeof(SpectrumBuddy) - sizeof(AbstractSpectrumBuddy);
+	if (m_buddy == NULL)
+		return;
+
+	usage[MEMORY_ROSTER] += sizeof(PurpleBuddy) + MEMORY_PURPLE_PRESENCE;
+	usage[MEMORY_ROSTER] += MemoryAccounting::stringSize(m_buddy->name);
+	usage[MEMORY_ROSTER] += MemoryAccounting::stringSize(m_buddy->alias);
+	usage[MEMORY_ROSTER] += MemoryAccounting::stringSize(m_buddy->server_alias);
+
+	PurplePresence *pres = purple_buddy_get_presence(m_buddy);
+	PurpleStatus *stat = pres ? purple_presence_get_active_status(pres) : NULL;
+	if (stat)
+		usage[MEMORY_ROSTER] += MemoryAccounting::stringSize(purple_status_get_attr_string(stat, "message"));
+
+	// Icon data are kept in memory while the icon is referenced by buddy.
+	PurpleBuddyIcon *icon = purple_buddy_get_icon(m_buddy);
+	if (icon) {
+		size_t len = 0;
+		purple_buddy_icon_get_data(icon, &len);
+		usage[MEMORY_VCARDS] += len;
+	}
+}
@@ -73,6 +73,9 @@ class SpectrumBuddy : public AbstractSpectrumBuddy {
 
 		void handleBuddyRemoved(PurpleBuddy *buddy);
 
+		// Adds memory used by PurpleBuddy and its icon to `usage`.
+		void getMemoryUsage(unsigned long *usage);
+
 	private:
 		PurpleBuddy *m_buddy;
 };
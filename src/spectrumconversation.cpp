@@ -27,6 +27,7 @@
 #include "usermanager.h"
 #include "spectrumtimer.h"
 #include "abstractspectrumbuddy.h"
+#include "textsanitizer.h"
 #ifndef TESTS
 #include "user.h"
 #endif
@@ -56,7 +57,7 @@ SpectrumConversation::~SpectrumConversation() {
 void SpectrumConversation::handleMessage(User *user, const char *who, const char *msg, PurpleMessageFlags flags, time_t mtime, const std::string &currentBody) {
 	std::string name(who);
 	// Remove resource if it's XMPP JID
-	if (Transport::instance()->getConfiguration().protocol == "xmpp") {
+	if (Transport::instance()->protocol()->capabilities().jidUsernames) {
 		size_t pos = name.find("/");
 		if (pos != std::string::npos)
 			name.erase((int) pos, name.length() - (int) pos);
@@ -85,6 +86,8 @@ void SpectrumConversation::handleMessage(User *user, const char *who, const char
 	g_free(xhtml);
 	g_free(xhtml_linkified);
 	g_free(strip);
+	sanitizeXMLText(message);
+	sanitizeXMLText(m);
 
 	std::string to;
 	if (getResource().empty())
@@ -101,7 +104,7 @@ void SpectrumConversation::handleMessage(User *user, const char *who, const char
 			s.setFrom(name + std::string(getType() == SPECTRUM_CONV_CHAT ? "" : ("%" + JID(user->username()).server())) + "@" + Transport::instance()->jid() + "/bot");
 		}
 		Error *c = new Error(StanzaErrorTypeModify, StanzaErrorNotAcceptable);
-		c->setText(tr(user->getLang(), message));
+		c->setText(tr(user->getTranslation(), message));
 		s.addExtension(c);
 		Transport::instance()->send(s.tag());
 		return;
@@ -116,7 +119,7 @@ void SpectrumConversation::handleMessage(User *user, const char *who, const char
 	}
 
 	// chatstates
-	if (user->getSetting<bool>("enable_chatstate")) {
+	if (user->getSetting<bool>(SETTING_ENABLE_CHATSTATE)) {
 		if (user->hasFeature(GLOOX_FEATURE_CHATSTATES, getResource())) {
 			ChatState *c = new ChatState(ChatStateActive);
 			s.addExtension(c);
@@ -23,6 +23,8 @@
 #include <time.h>
 #include <gloox/clientbase.h>
 #include <gloox/tag.h>
+#include <gloox/sha.h>
+#include <gloox/base64.h>
 #include <glib.h>
 #include "usermanager.h"
 #include "log.h"
@@ -36,6 +38,9 @@ SpectrumDiscoHandler::SpectrumDiscoHandler(GlooxMessageHandler *parent) : IqHand
 }
 
 SpectrumDiscoHandler::~SpectrumDiscoHandler() {
+	invalidate();
+	for (Disco::IdentityList::iterator it = m_identities.begin(); it != m_identities.end(); it++)
+		delete (*it);
 }
 
 bool SpectrumDiscoHandler::handleIq (const IQ &stanza) {
@@ -64,45 +69,14 @@ bool SpectrumDiscoHandler::handleIq (const IQ &stanza) {
 		}
 	}
 	else {
-		Tag *re = NULL;
 		const Disco::Info *info = stanza.findExtension<Disco::Info>( ExtDiscoInfo );
 		if (info) {
-			if (!info->node().empty()) {
-				Disco::IdentityList identities;
-				StringList features;
-				std::map<std::string, std::list<DiscoNodeHandler*> >::const_iterator it = m_nodeHandlers.find( info->node() );
-				if (it == m_nodeHandlers.end()) {
-					return false;
-				}
-				else {
-					std::list<DiscoNodeHandler*>::const_iterator in = (*it).second.begin();
-					for( ; in != (*it).second.end(); ++in ) {
-						Disco::IdentityList il = (*in)->handleDiscoNodeIdentities( stanza.from(), info->node() );
-						il.sort(); // needed on win32
-						identities.merge( il );
-						StringList fl = (*in)->handleDiscoNodeFeatures( stanza.from(), info->node() );
-						fl.sort();  // needed on win32
-						features.merge( fl );
-						break;
-					}
-				}
-				re = generateDiscoInfoResponse(stanza, identities, features);
-			}
-			else {
-				Disco::IdentityList il;
-				Disco::IdentityList::const_iterator it = m_identities.begin();
-				for( ; it != m_identities.end(); ++it ) {
-					il.push_back( new Disco::Identity( *(*it) ) );
-				}
-				re = generateDiscoInfoResponse(stanza, il, m_features);
-			}
-			if (!re)
+			Tag *query = getDiscoInfoQuery(stanza.from(), info->node());
+			if (!query)
 				return false;
-			Transport::instance()->send(re);
+			Transport::instance()->send(generateDiscoInfoResponse(stanza, query));
 			return true;
 		}
-		
-		
 	}
 	return false;
 }
@@ -113,18 +87,84 @@ void SpectrumDiscoHandler::handleIqID (const IQ &iq, int context) {
 
 void SpectrumDiscoHandler::registerNodeHandler(DiscoNodeHandler* nh, const std::string& node) {
 	m_nodeHandlers[node].push_back(nh);
+	invalidate();
 }
 
-Tag *SpectrumDiscoHandler::generateDiscoInfoResponse(const IQ &stanza, const Disco::IdentityList &identities, const StringList &features) {
-	IQ re( IQ::Result, stanza.from(), stanza.id() );
-	re.setFrom( stanza.to() );
-	Tag *t = re.tag();
+void SpectrumDiscoHandler::setIdentity(const std::string& category, const std::string& type, const std::string& name) {
+	m_identities.push_back( new Disco::Identity( category, type, name ) );
+	invalidate();
+}
+
+void SpectrumDiscoHandler::addFeature(const std::string& feature) {
+	m_features.push_back( feature );
+	invalidate();
+}
+
+void SpectrumDiscoHandler::invalidate() {
+	for (std::map<std::string, Tag *>::iterator it = m_queries.begin(); it != m_queries.end(); it++)
+		delete (*it).second;
+	m_queries.clear();
+	m_capsHash.clear();
+}
+
+const std::string &SpectrumDiscoHandler::capsHash() {
+	if (!m_capsHash.empty())
+		return m_capsHash;
+
+	// S = category/type/lang/name< for every identity, then feature< for every feature
+	StringList identities;
+	for (Disco::IdentityList::const_iterator it = m_identities.begin(); it != m_identities.end(); ++it)
+		identities.push_back((*it)->category() + "/" + (*it)->type() + "//" + (*it)->name());
+	identities.sort();
+
+	StringList features = m_features;
+	features.sort();
+
+	std::string s;
+	for (StringList::const_iterator it = identities.begin(); it != identities.end(); ++it) {
+		s += *it;
+		s += '<';
+	}
+	for (StringList::const_iterator it = features.begin(); it != features.end(); ++it) {
+		s += *it;
+		s += '<';
+	}
+
+	SHA sha;
+	sha.feed(s);
+	m_capsHash = Base64::encode64(sha.binary());
+	return m_capsHash;
+}
+
+Tag *SpectrumDiscoHandler::getDiscoInfoQuery(const JID &from, const std::string &node) {
+	std::map<std::string, Tag *>::const_iterator cached = m_queries.find(node);
+	if (cached != m_queries.end())
+		return (*cached).second;
+
+	Disco::IdentityList identities;
+	StringList features;
+	if (!node.empty()) {
+		std::map<std::string, std::list<DiscoNodeHandler*> >::const_iterator it = m_nodeHandlers.find( node );
+		if (it == m_nodeHandlers.end() || (*it).second.empty())
+			return NULL;
+		DiscoNodeHandler *handler = (*it).second.front();
+		identities = handler->handleDiscoNodeIdentities( from, node );
+		identities.sort(); // needed on win32
+		features = handler->handleDiscoNodeFeatures( from, node );
+		features.sort();  // needed on win32
+	}
+	else {
+		for (Disco::IdentityList::const_iterator it = m_identities.begin(); it != m_identities.end(); ++it)
+			identities.push_back( new Disco::Identity( *(*it) ) );
+		features = m_features;
+	}
 
 	Tag *query = new Tag("query");
 	query->addAttribute("xmlns", "http://jabber.org/protocol/disco#info");
+	if (!node.empty())
+		query->addAttribute("node", node);
 	
-	Disco::IdentityList::const_iterator it = identities.begin();
-	for( ; it != identities.end(); ++it ) {
+	for (Disco::IdentityList::const_iterator it = identities.begin(); it != identities.end(); ++it ) {
 		query->addChild((*it)->tag());
 		delete (*it);
 	}
@@ -134,8 +174,15 @@ Tag *SpectrumDiscoHandler::generateDiscoInfoResponse(const IQ &stanza, const Dis
 		feature->addAttribute("var", *it);
 		query->addChild(feature);
 	}
-	
-	t->addChild(query);
-	
+
+	m_queries[node] = query;
+	return query;
+}
+
+Tag *SpectrumDiscoHandler::generateDiscoInfoResponse(const IQ &stanza, const Tag *query) {
+	IQ re( IQ::Result, stanza.from(), stanza.id() );
+	re.setFrom( stanza.to() );
+	Tag *t = re.tag();
+	t->addChild(query->clone());
 	return t;
 }
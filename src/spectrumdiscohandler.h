@@ -41,20 +41,31 @@ class SpectrumDiscoHandler : public IqHandler
 		bool handleIq (const IQ &iq);
 		void handleIqID (const IQ &iq, int context);
 
+		// Node handlers registered here have to return the same identities and
+		// features for all JIDs, because their responses are cached.
 		void registerNodeHandler( DiscoNodeHandler* nh, const std::string& node );
-		void setIdentity( const std::string& category, const std::string& type, const std::string& name = EmptyString ) {
-			m_identities.push_back( new Disco::Identity( category, type, name ) );
-		}
-		void addFeature( const std::string& feature )
-        { m_features.push_back( feature ); }
+		void setIdentity( const std::string& category, const std::string& type, const std::string& name = EmptyString );
+		void addFeature( const std::string& feature );
+
+		// Returns XEP-0115 verification string of buddies' identities and features.
+		const std::string &capsHash();
+
+		// Drops precomputed disco#info responses and caps hash. Called automatically
+		// when identities, features or node handlers change.
+		void invalidate();
 
 	private:
-		Tag *generateDiscoInfoResponse(const IQ &stanza, const Disco::IdentityList &identities, const StringList &features);
+		// Returns disco#info query for buddy JIDs, `node` can be empty.
+		// Queries are computed once and cached. Returns NULL for unknown node.
+		Tag *getDiscoInfoQuery(const JID &from, const std::string &node);
+		Tag *generateDiscoInfoResponse(const IQ &stanza, const Tag *query);
 		
 		GlooxMessageHandler *m_parent;
 		std::map<std::string, std::list<DiscoNodeHandler*> > m_nodeHandlers;
 		Disco::IdentityList m_identities;
 		StringList m_features;
+		std::map<std::string, Tag *> m_queries;		// Precomputed queries by node.
+		std::string m_capsHash;
 };
 
 #endif
@@ -33,15 +33,69 @@
 #include "spectrumconversation.h"
 #include "spectrummucconversation.h"
 #include "user.h"
+#include "memoryaccounting.h"
 #endif
 
-SpectrumMessageHandler::SpectrumMessageHandler(User *user) {
+// Resources of reaped conversations are remembered at most for this time
+// (in seconds) and for this number of conversations.
+#define REAPED_RESOURCE_TTL 86400
+#define MAX_REAPED_RESOURCES 1000
+
+long SpectrumMessageHandler::m_reapedConversations = 0;
+long SpectrumMessageHandler::m_reclaimedMemory = 0;
+long SpectrumMessageHandler::m_suppressedChatStatesIn = 0;
+long SpectrumMessageHandler::m_suppressedChatStatesOut = 0;
+
+static gboolean reapConversations(void *data) {
+	SpectrumMessageHandler *handler = (SpectrumMessageHandler *) data;
+	handler->reapIdleConversations();
+	// Timer is started again by touchConversation.
+	return handler->getReapableConversationsCount() != 0;
+}
+
+static gboolean flushChatStatesTimeout(void *data) {
+	SpectrumMessageHandler *handler = (SpectrumMessageHandler *) data;
+	return handler->flushChatStates();
+}
+
+// Returns estimated memory used by conversation and its message history.
+static long conversationMemory(AbstractConversation *s_conv) {
+	PurpleConversation *conv = s_conv->getConv();
+	long size = sizeof(AbstractConversation) + s_conv->getKey().size() + s_conv->getResource().size();
+	if (conv == NULL)
+		return size;
+	size += sizeof(PurpleConversation) + sizeof(PurpleConvIm);
+	for (GList *l = purple_conversation_get_message_history(conv); l != NULL; l = l->next) {
+		PurpleConvMessage *msg = (PurpleConvMessage *) l->data;
+		size += sizeof(GList) + sizeof(PurpleConvMessage);
+		if (msg->who)
+			size += strlen(msg->who);
+		if (msg->what)
+			size += strlen(msg->what);
+	}
+	return size;
+}
+
+SpectrumMessageHandler::SpectrumMessageHandler(User *user) :
+	m_incomingStates(CONFIG().chatstateInterval, CONFIG().chatstateWindow, &m_suppressedChatStatesIn),
+	m_outgoingStates(CONFIG().chatstateInterval, CONFIG().chatstateWindow, &m_suppressedChatStatesOut) {
 	m_user = user;
 	m_mucs = 0;
 	m_currentBody = "";
+	m_reaperTimer = NULL;
+	m_chatStateTimer = new SpectrumTimer(250, &flushChatStatesTimeout, this);
+
+	int timeout = CONFIG().conversationIdleTimeout;
+	if (timeout > 0 || CONFIG().maxConversations > 0) {
+		// Check idle conversations at least once per minute.
+		int interval = (timeout > 0 && timeout < 60) ? timeout : 60;
+		m_reaperTimer = new SpectrumTimer(interval * 1000, &reapConversations, this);
+	}
 }
 
 SpectrumMessageHandler::~SpectrumMessageHandler() {
+	delete m_reaperTimer;
+	delete m_chatStateTimer;
 	for (std::map<std::string, AbstractConversation *>::iterator i = m_conversations.begin(); i != m_conversations.end(); i++) {
 		AbstractConversation *s_conv = (*i).second;
 		if (s_conv->getType() == SPECTRUM_CONV_GROUPCHAT) {
@@ -64,17 +118,20 @@ void SpectrumMessageHandler::handlePurpleMessage(PurpleAccount* account, char *
 	if (conv == NULL) {
 		conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, account, name);
 #ifndef TESTS
-		if (Transport::instance()->getConfiguration().protocol == "irc") {
+		const ProtocolCapabilities &caps = Transport::instance()->protocol()->capabilities();
+		if (caps.routing == PROTOCOL_ROUTING_SERVER) {
 			m_conversations[getConversationName(conv)] = new SpectrumConversation(conv, SPECTRUM_CONV_GROUPCHAT);
 			m_conversations[getConversationName(conv)]->setKey(getConversationName(conv));
+			restoreConversationResource(getConversationName(conv));
 		}
-		else if (Transport::instance()->getConfiguration().protocol == "xmpp") {
+		else if (caps.mucPrivateMessages) {
 			std::string jid = purple_conversation_get_name(conv);
 			Transport::instance()->protocol()->makeRoomJID(m_user, jid);
 			if (m_mucs_names.find(jid) != m_mucs_names.end()) {
 				std::string key = jid + "/" + JID(std::string(name)).resource();
 				m_conversations[key] = new SpectrumConversation(conv, SPECTRUM_CONV_GROUPCHAT, jid);
 				m_conversations[key]->setKey(key);
+				restoreConversationResource(key);
 			}
 			else {
 				addConversation(conv, new SpectrumConversation(conv, SPECTRUM_CONV_CHAT));
@@ -95,6 +152,128 @@ void SpectrumMessageHandler::addConversation(PurpleConversation *conv, AbstractC
 		m_mucs_names[k] = 1;
 		m_mucs++;
 	}
+	else if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM) {
+		restoreConversationResource(k);
+
+		// New conversation is on the front of LRU, so this never removes it.
+		if (CONFIG().maxConversations > 0 && (int) m_lru.size() > CONFIG().maxConversations)
+			reapIdleConversations();
+	}
+}
+
+void SpectrumMessageHandler::restoreConversationResource(const std::string &key) {
+	// Conversation has been reaped before, so restore its resource.
+	std::map <std::string, std::pair<std::string, time_t> >::iterator it = m_reapedResources.find(key);
+	if (it != m_reapedResources.end()) {
+		if (it->second.second + REAPED_RESOURCE_TTL > time(NULL))
+			m_conversations[key]->setResource(it->second.first);
+		m_reapedResources.erase(it);
+	}
+	touchConversation(key);
+}
+
+void SpectrumMessageHandler::expireReapedResources(time_t now) {
+	// m_reapedOrder is sorted by time of reaping, so we can stop at first valid entry.
+	while (!m_reapedOrder.empty() && (m_reapedOrder.front().second + REAPED_RESOURCE_TTL <= now || m_reapedOrder.size() > MAX_REAPED_RESOURCES)) {
+		std::map <std::string, std::pair<std::string, time_t> >::iterator it = m_reapedResources.find(m_reapedOrder.front().first);
+		// Entry could be restored or reaped again since it's been inserted into m_reapedOrder.
+		if (it != m_reapedResources.end() && it->second.second == m_reapedOrder.front().second)
+			m_reapedResources.erase(it);
+		m_reapedOrder.pop_front();
+	}
+}
+
+void SpectrumMessageHandler::touchConversation(const std::string &key) {
+	if (m_reaperTimer == NULL || isMUC(key))
+		return;
+	untouchConversation(key);
+	m_lru.push_front(std::make_pair(key, time(NULL)));
+	m_lruIndex[key] = m_lru.begin();
+	m_reaperTimer->start();
+}
+
+void SpectrumMessageHandler::untouchConversation(const std::string &key) {
+	std::map <std::string, std::list <std::pair<std::string, time_t> >::iterator>::iterator it = m_lruIndex.find(key);
+	if (it == m_lruIndex.end())
+		return;
+	m_lru.erase(it->second);
+	m_lruIndex.erase(it);
+}
+
+void SpectrumMessageHandler::reapConversation(const std::string &key) {
+	untouchConversation(key);
+	if (!isOpenedConversation(key))
+		return;
+
+	AbstractConversation *s_conv = m_conversations[key];
+	if (!s_conv->getResource().empty()) {
+		time_t now = time(NULL);
+		m_reapedResources[key] = std::make_pair(s_conv->getResource(), now);
+		m_reapedOrder.push_back(std::make_pair(key, now));
+		expireReapedResources(now);
+	}
+	long size = conversationMemory(s_conv);
+
+	Log(m_user->jid(), "Closing idle conversation " << key);
+	removeConversation(key);
+
+	m_reapedConversations++;
+	m_reclaimedMemory += size;
+}
+
+void SpectrumMessageHandler::getMemoryUsage(unsigned long *usage) {
+	for (std::map<std::string, AbstractConversation *>::iterator it = m_conversations.begin(); it != m_conversations.end(); it++) {
+		AbstractConversation *s_conv = (*it).second;
+		unsigned long size = MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + conversationMemory(s_conv);
+		if (s_conv->getType() != SPECTRUM_CONV_GROUPCHAT) {
+			usage[MEMORY_CONVERSATIONS] += size;
+			continue;
+		}
+
+		PurpleConversation *conv = s_conv->getConv();
+		if (conv) {
+			for (GList *l = purple_conv_chat_get_users(PURPLE_CONV_CHAT(conv)); l != NULL; l = l->next) {
+				PurpleConvChatBuddy *cb = (PurpleConvChatBuddy *) l->data;
+				size += sizeof(GList) + sizeof(PurpleConvChatBuddy);
+				size += MemoryAccounting::stringSize(cb->name) + MemoryAccounting::stringSize(cb->alias);
+			}
+		}
+		usage[MEMORY_MUC] += size;
+	}
+
+	for (std::map <std::string, int>::iterator it = m_mucs_names.begin(); it != m_mucs_names.end(); it++)
+		usage[MEMORY_MUC] += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(int);
+
+	unsigned long size = 0;
+	for (std::list <std::pair<std::string, time_t> >::iterator it = m_lru.begin(); it != m_lru.end(); it++)
+		size += MEMORY_LIST_NODE + MEMORY_MAP_NODE + 2 * MemoryAccounting::stringSize((*it).first) + sizeof(time_t);
+	for (std::map <std::string, std::pair<std::string, time_t> >::iterator it = m_reapedResources.begin(); it != m_reapedResources.end(); it++)
+		size += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + MemoryAccounting::stringSize((*it).second.first) + sizeof(time_t);
+	for (std::list <std::pair<std::string, time_t> >::iterator it = m_reapedOrder.begin(); it != m_reapedOrder.end(); it++)
+		size += MEMORY_LIST_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(time_t);
+	usage[MEMORY_CONVERSATIONS] += size;
+}
+
+int SpectrumMessageHandler::reapIdleConversations() {
+	int timeout = CONFIG().conversationIdleTimeout;
+	int max = CONFIG().maxConversations;
+	time_t now = time(NULL);
+	int reaped = 0;
+
+	// m_lru is sorted by last activity, so the oldest conversations are at the end.
+	while (!m_lru.empty()) {
+		bool idle = timeout > 0 && m_lru.back().second + timeout <= now;
+		bool overLimit = max > 0 && (int) m_lru.size() > max;
+		if (!idle && !overLimit)
+			break;
+		std::string key = m_lru.back().first;
+		reapConversation(key);
+		reaped++;
+	}
+
+	if (reaped != 0)
+		Log(m_user->jid(), "Closed " << reaped << " idle conversations");
+	return reaped;
 }
 
 void SpectrumMessageHandler::removeConversation(const std::string &name, bool only_muc) {
@@ -109,7 +288,8 @@ void SpectrumMessageHandler::removeConversation(const std::string &name, bool on
 	if (!isOpenedConversation(name))
 		return;
 	Log("WARNING", "Conversation is not removed after purple_conversation_destroy (removing now): " << name);
-	if (m_conversations[name]->getType() == SPECTRUM_CONV_GROUPCHAT)
+	untouchConversation(name);
+	if (isMUC(name))
 		m_mucs--;
 	delete m_conversations[name];
 	m_conversations.erase(name);
@@ -132,6 +312,8 @@ void SpectrumMessageHandler::handleWriteIM(PurpleConversation *conv, const char
 		if (s_conv->getType() == SPECTRUM_CONV_GROUPCHAT) {
 			Transport::instance()->protocol()->makeUsernameRoom(m_user, name);
 		}
+		touchConversation(s_conv->getKey());
+		m_incomingStates.handleMessage(purple_conversation_get_name(conv));
 		s_conv->handleMessage(m_user, name.c_str(), msg, flags, mtime, m_currentBody);
 	}
 	else {
@@ -179,7 +361,9 @@ void SpectrumMessageHandler::purpleConversationDestroyed(PurpleConversation *con
 		return;
 	}
 	Log("purpleConversationDestroyed", "Removing conversation data: " << name);
-	if (m_conversations[name]->getType() == SPECTRUM_CONV_GROUPCHAT)
+	untouchConversation(name);
+	// PMs have SPECTRUM_CONV_GROUPCHAT type too, but they are not counted in m_mucs.
+	if (isMUC(name))
 		m_mucs--;
 	delete m_conversations[name];
 	m_conversations.erase(name);
@@ -226,8 +410,10 @@ void SpectrumMessageHandler::handleMessage(const Message& msg) {
 	}
 
 	m_conversations[key]->setResource(msg.from().resource());
+	touchConversation(key);
 
 	m_currentBody = msg.body();
+	m_outgoingStates.handleMessage(purpleUsername(msg.to().username()));
 	Log("SpectrumMessageHandler::handleMessage", "username " << username << ", key " << key << ", PurpleConversation: "
 			<< conv << ", SpectrumConversation: " << m_conversations[key] << ", resource was set to " << msg.from().resource());
 	
@@ -249,27 +435,27 @@ void SpectrumMessageHandler::handleMessage(const Message& msg) {
 				break;
 			case PURPLE_CMD_STATUS_NOT_FOUND:
 				{
-					purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),_("Transport: Unknown command.")), PURPLE_MESSAGE_RECV, time(NULL));
+					purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),_("Transport: Unknown command.")), PURPLE_MESSAGE_RECV, time(NULL));
 					break;
 				}
 			case PURPLE_CMD_STATUS_WRONG_ARGS:
-				purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),_("Syntax Error: Wrong number of arguments.")), PURPLE_MESSAGE_RECV, time(NULL));
+				purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),_("Syntax Error: Wrong number of arguments.")), PURPLE_MESSAGE_RECV, time(NULL));
 				break;
 			case PURPLE_CMD_STATUS_FAILED:
-				purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),error ? error : _("The command failed for an unknown reason.")), PURPLE_MESSAGE_RECV, time(NULL));
+				purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),error ? error : _("The command failed for an unknown reason.")), PURPLE_MESSAGE_RECV, time(NULL));
 				break;
 			case PURPLE_CMD_STATUS_WRONG_TYPE:
 				if(purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM)
-					purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),_("That command only works in group chats, not 1:1 conversations.")), PURPLE_MESSAGE_RECV, time(NULL));
+					purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),_("That command only works in group chats, not 1:1 conversations.")), PURPLE_MESSAGE_RECV, time(NULL));
 				else
-					purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),_("That command only works in 1:1 conversations, not group chats.")), PURPLE_MESSAGE_RECV, time(NULL));
+					purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),_("That command only works in 1:1 conversations, not group chats.")), PURPLE_MESSAGE_RECV, time(NULL));
 				break;
 			case PURPLE_CMD_STATUS_WRONG_PRPL:
 				if (m_currentBody.find("/me") == 0) {
 					handled = false;
 				}
 				else {
-					purple_conversation_write(conv, sender.c_str(), tr(m_user->getLang(),_("That command is not supported for this legacy network.")), PURPLE_MESSAGE_RECV, time(NULL));
+					purple_conversation_write(conv, sender.c_str(), tr(m_user->getTranslation(),_("That command is not supported for this legacy network.")), PURPLE_MESSAGE_RECV, time(NULL));
 				}
 				break;
 		}
@@ -296,6 +482,8 @@ void SpectrumMessageHandler::removeConversationResource(const std::string &resou
 		for (std::map<std::string, AbstractConversation *>::iterator u = m_conversations.begin(); u != m_conversations.end() ; u++) {
 			(*u).second->setResource("");
 		}
+		m_reapedResources.clear();
+		m_reapedOrder.clear();
 	}
 	else {
 		for (std::map<std::string, AbstractConversation *>::iterator u = m_conversations.begin(); u != m_conversations.end() ; u++) {
@@ -303,6 +491,12 @@ void SpectrumMessageHandler::removeConversationResource(const std::string &resou
 				(*u).second->setResource("");
 			}
 		}
+		for (std::map<std::string, std::pair<std::string, time_t> >::iterator u = m_reapedResources.begin(); u != m_reapedResources.end() ;) {
+			if ((*u).second.first == resource)
+				m_reapedResources.erase(u++);
+			else
+				u++;
+		}
 	}
 }
 
@@ -314,6 +508,15 @@ bool SpectrumMessageHandler::hasOpenedMUC() {
 void SpectrumMessageHandler::handleChatState(const std::string &uin, const std::string &state) {
 	if (!m_user->hasFeature(GLOOX_FEATURE_CHATSTATES) || !m_user->hasTransportFeature(TRANSPORT_FEATURE_TYPING_NOTIFY))
 		return;
+	if (!m_outgoingStates.handleChatState(uin, state)) {
+		if (m_outgoingStates.hasPending())
+			m_chatStateTimer->start();
+		return;
+	}
+	sendTyping(uin, state);
+}
+
+void SpectrumMessageHandler::sendTyping(const std::string &uin, const std::string &state) {
 	Log(m_user->jid(), "Sending " << state << " message to " << uin);
 	if (state == "composing")
 		serv_send_typing(purple_account_get_connection(m_user->account()),uin.c_str(),PURPLE_TYPING);
@@ -323,6 +526,53 @@ void SpectrumMessageHandler::handleChatState(const std::string &uin, const std::
 		serv_send_typing(purple_account_get_connection(m_user->account()),uin.c_str(),PURPLE_NOT_TYPING);
 }
 
+void SpectrumMessageHandler::handleBuddyChatState(const std::string &uin, const std::string &state) {
+	if (!m_incomingStates.handleChatState(uin, state)) {
+		if (m_incomingStates.hasPending())
+			m_chatStateTimer->start();
+		return;
+	}
+	sendChatstate(getBuddyJID(uin), m_user->jid(), state);
+}
+
+bool SpectrumMessageHandler::flushChatStates() {
+	std::list <std::pair<std::string, std::string> > states;
+	m_incomingStates.flush(states);
+	for (std::list <std::pair<std::string, std::string> >::iterator it = states.begin(); it != states.end(); it++) {
+		sendChatstate(getBuddyJID((*it).first), m_user->jid(), (*it).second);
+	}
+
+	states.clear();
+	m_outgoingStates.flush(states);
+	for (std::list <std::pair<std::string, std::string> >::iterator it = states.begin(); it != states.end(); it++) {
+		sendTyping((*it).first, (*it).second);
+	}
+
+	return m_incomingStates.hasPending() || m_outgoingStates.hasPending();
+}
+
+std::string SpectrumMessageHandler::getBuddyJID(const std::string &uin) {
+	std::string username(uin);
+	// Remove resource if it's XMPP JID
+	if (Transport::instance()->protocol()->capabilities().jidUsernames) {
+		size_t pos = username.find("/");
+		if (pos != std::string::npos)
+			username.erase((int) pos, username.length() - (int) pos);
+	}
+
+	AbstractSpectrumBuddy *s_buddy = NULL;
+#ifndef TESTS
+	User *u = (User *) m_user;
+	s_buddy = u->getRosterItem(uin);
+#endif
+	if (s_buddy && s_buddy->getFlags() & SPECTRUM_BUDDY_JID_ESCAPING)
+		username = JID::escapeNode(username);
+	else
+		std::for_each( username.begin(), username.end(), replaceBadJidCharacters() ); // OK
+
+	return username + "@" + Transport::instance()->jid() + "/bot";
+}
+
 // TODO: only used by IRC for handling PMs, remove it and move the code somewhere... 
 std::string SpectrumMessageHandler::getConversationName(PurpleConversation *conv) {
 	std::string name(purple_conversation_get_name(conv));
@@ -343,7 +593,7 @@ std::string SpectrumMessageHandler::getConversationName(PurpleConversation *conv
 		else
 			std::for_each( name.begin(), name.end(), replaceBadJidCharacters() );
 		std::transform(name.begin(), name.end(), name.begin(),(int(*)(int)) std::tolower);
-		if (Transport::instance()->getConfiguration().protocol == "irc") {
+		if (Transport::instance()->protocol()->capabilities().routing == PROTOCOL_ROUTING_SERVER) {
 			name += "%" + JID(m_user->username()).server() + "@" + Transport::instance()->jid() + "/bot";
 		}
 		else {
@@ -29,11 +29,16 @@
 #include "gloox/presence.h"
 #include "gloox/message.h"
 #include <algorithm>
+#include <list>
+#include <map>
 #include "abstractuser.h"
 #include "abstractconversation.h"
+#include "chatstatecoalescer.h"
 
 using namespace gloox;
 
+class SpectrumTimer;
+
 struct Conversation {
 	PurpleConversation *conv;
 	std::string resource;
@@ -70,6 +75,13 @@ class SpectrumMessageHandler {
 		// Handles chatstate notifications from Jabber side.
 		void handleChatState(const std::string &uin, const std::string &chatstate);
 
+		// Sends chatstate notification of legacy network user `uin` to XMPP user.
+		void handleBuddyChatState(const std::string &uin, const std::string &chatstate);
+
+		// Forwards chatstates deferred by coalescers. Returns true if there are
+		// still some deferred chatstates.
+		bool flushChatStates();
+
 		// Called by libpurple when there is new IM message to be written to Conversation.
 		void handleWriteIM(PurpleConversation *conv, const char *who, const char *msg, PurpleMessageFlags flags, time_t mtime);
 
@@ -91,19 +103,83 @@ class SpectrumMessageHandler {
 		// Called by libpurple when PurpleConversation is destroyed.
 		void purpleConversationDestroyed(PurpleConversation *conv);
 
+		// Closes 1:1 conversations which are idle for longer than conversation_idle_timeout
+		// and the least recently used ones above max_conversations. Group chats are
+		// never closed. Returns number of closed conversations.
+		int reapIdleConversations();
+
+		// Returns number of 1:1 conversations which can be closed by reapIdleConversations.
+		int getReapableConversationsCount() { return m_lru.size(); }
+
+		// Adds approximate memory used by 1:1 conversations and MUCs to `usage`
+		// (indexed by MemorySubsystem).
+		void getMemoryUsage(unsigned long *usage);
+
 //	static:
 		static void sendChatstate(const std::string &from, const std::string &to, const std::string &type);
 
+		// Returns number of conversations closed by reapIdleConversations since start.
+		static long getReapedConversations() { return m_reapedConversations; }
+
+		// Returns estimated number of bytes freed by closing idle conversations.
+		static long getReclaimedMemory() { return m_reclaimedMemory; }
+
+		// Returns number of chatstates from legacy network which have not been forwarded.
+		static long getSuppressedChatStatesIn() { return m_suppressedChatStatesIn; }
+
+		// Returns number of chatstates from XMPP which have not been forwarded.
+		static long getSuppressedChatStatesOut() { return m_suppressedChatStatesOut; }
+
 	private:
 		std::string getConversationName(PurpleConversation *conv);
 		AbstractConversation *getSpectrumMUCConversation(PurpleConversation *conv);
 		bool isMUC(const std::string &key);
 
+		// Moves conversation to the front of LRU list.
+		void touchConversation(const std::string &key);
+		void untouchConversation(const std::string &key);
+
+		// Restores resource remembered by reapConversation and adds conversation to LRU.
+		void restoreConversationResource(const std::string &key);
+
+		// Destroys conversation and remembers its resource.
+		void reapConversation(const std::string &key);
+
+		// Forgets resources of conversations reaped too long ago and the oldest
+		// ones above the limit.
+		void expireReapedResources(time_t now);
+
+		// Sends typing notification to legacy network.
+		void sendTyping(const std::string &uin, const std::string &chatstate);
+
+		// Returns JID of legacy network user used as "from" of chatstate notifications.
+		std::string getBuddyJID(const std::string &uin);
+
 		// Contains AbstractConversations. Key is full JID of legacy network user as received
 		// by Spectrum from XMPP, so for example:
 		// spectrum%conference.spectrum.im@xmpp.spectrum.im/HanzZ
 		std::map <std::string, AbstractConversation *> m_conversations;
 		std::map <std::string, int> m_mucs_names;
+
+		// LRU of 1:1 conversations, most recently used first. Value is time of last activity.
+		std::list <std::pair<std::string, time_t> > m_lru;
+		std::map <std::string, std::list <std::pair<std::string, time_t> >::iterator> m_lruIndex;
+
+		// Resources of reaped conversations (with time of reaping), restored when
+		// the conversation is opened again.
+		std::map <std::string, std::pair<std::string, time_t> > m_reapedResources;
+		std::list <std::pair<std::string, time_t> > m_reapedOrder;	// Keys of m_reapedResources in reaping order.
+		SpectrumTimer *m_reaperTimer;
+
+		static long m_reapedConversations;
+		static long m_reclaimedMemory;
+
+		ChatStateCoalescer m_incomingStates;	// Chatstates from legacy network.
+		ChatStateCoalescer m_outgoingStates;	// Chatstates from XMPP.
+		SpectrumTimer *m_chatStateTimer;
+
+		static long m_suppressedChatStatesIn;
+		static long m_suppressedChatStatesOut;
 		std::string m_currentBody;
 		User *m_user;
 		int m_mucs;
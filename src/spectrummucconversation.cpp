@@ -22,6 +22,7 @@
 #include "main.h" // just for replaceBadJidCharacters
 #include "transport.h"
 #include "usermanager.h"
+#include "textsanitizer.h"
 #include "user.h"
 
 SpectrumMUCConversation::SpectrumMUCConversation(PurpleConversation *conv, const std::string &jid, const RoomData &data) : AbstractConversation(SPECTRUM_CONV_GROUPCHAT) {
@@ -34,6 +35,7 @@ SpectrumMUCConversation::SpectrumMUCConversation(PurpleConversation *conv, const
 	m_conv->ui_data = this;
 	PurpleConvChat *chat = purple_conversation_get_chat_data(m_conv);
 	m_nickname = purple_conv_chat_get_nick(chat);
+	sanitizeXMLText(m_nickname);
 #endif
 	m_initialNickname = data.nickname;
 
@@ -51,6 +53,7 @@ SpectrumMUCConversation::~SpectrumMUCConversation() {
 
 void SpectrumMUCConversation::handleMessage(User *user, const char *who, const char *msg, PurpleMessageFlags flags, time_t mtime, const std::string &currentBody) {
 	std::string name(who);
+	sanitizeXMLText(name);
 // 
 // 	// send message to user
 // 	std::string message(purple_unescape_html(msg));
@@ -64,6 +67,7 @@ void SpectrumMUCConversation::handleMessage(User *user, const char *who, const c
 	char *strip, *xhtml;
 	purple_markup_html_to_xhtml(newline, &xhtml, &strip);
 	std::string message(strip);
+	sanitizeXMLText(message);
 
 	std::string to = user->jid() + m_res;
 	std::cout << user->jid() << " " << m_res << "\n";
@@ -104,6 +108,7 @@ void SpectrumMUCConversation::addUsers(User *user, GList *cbuddies) {
 		PurpleConvChatBuddy *cb = (PurpleConvChatBuddy *)l->data;
 // 		std::string alias(cb->alias ? cb->alias: "");
 		std::string name(cb->name);
+		sanitizeXMLText(name);
 		int flags = GPOINTER_TO_INT(cb->flags);
 // 		PURPLE_CBFLAGS_OP
 // 		<presence
@@ -182,6 +187,8 @@ void SpectrumMUCConversation::addUsers(User *user, GList *cbuddies) {
 void SpectrumMUCConversation::renameUser(User *user, const char *old_name, const char *new_name, const char *new_alias) {
 	std::string oldName(old_name);
 	std::string newName(new_name);
+	sanitizeXMLText(oldName);
+	sanitizeXMLText(newName);
 	Tag *tag = new Tag("presence");
 	tag->addAttribute("from", m_jid + "/" + oldName);
 	tag->addAttribute("to", user->jid() + m_res);
@@ -224,6 +231,7 @@ void SpectrumMUCConversation::removeUsers(User *_user, GList *users) {
 	GList *l;
 	for (l = users; l != NULL; l = l->next) {
 		std::string user((char *)l->data);
+		sanitizeXMLText(user);
 		Tag *tag = new Tag("presence");
 		tag->addAttribute("from", m_jid + "/" + user);
 		tag->addAttribute("to", _user->jid() + m_res);
@@ -244,7 +252,9 @@ void SpectrumMUCConversation::removeUsers(User *_user, GList *users) {
 
 void SpectrumMUCConversation::changeTopic(User *user, const char *who, const char *topic) {
 	m_topic = topic ? topic : "";
+	sanitizeXMLText(m_topic);
 	m_topicUser = who ? who : m_jid.substr(0,m_jid.find('%'));
+	sanitizeXMLText(m_topicUser);
 // 	if (user->connected())
 	sendTopic(user);
 }
@@ -21,64 +21,112 @@
 #include "spectrumtimer.h"
 #include "main.h"
 #include "log.h"
+#include "abstractbackend.h"
+
+#define ROOT_BITS 8
+#define ROOT_SIZE (1 << ROOT_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+#define LEVEL_BITS 6
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define LEVEL_INDEX(TICK, N) ((int) (((TICK) >> (ROOT_BITS + (N) * LEVEL_BITS)) & LEVEL_MASK))
+#define MAX_TICKS ((guint64) 1 << (ROOT_BITS + 3 * LEVEL_BITS))
+
+GStaticMutex SpectrumTimerWheel::mutex = G_STATIC_MUTEX_INIT;
+
+// Number of started timers which are shorter than one tick and therefore
+// are not in the wheel.
+static long nativeTimers = 0;
 
 #ifndef TESTS
 static gboolean _callback(gpointer data) {
 	SpectrumTimer *t = (SpectrumTimer*) data;
 	return t->timeout();
 }
+
+static gboolean _wheelCallback(gpointer data) {
+	SpectrumTimerWheel *wheel = (SpectrumTimerWheel *) data;
+	return wheel->process();
+}
 #endif
 
 SpectrumTimer::SpectrumTimer (int time, SpectrumTimerCallback callback, void *data) {
 	m_data = data;
 	m_callback = callback;
 	m_timeout = time;
-	m_mutex = g_mutex_new();
 	m_id = 0;
+	m_running = false;
 	m_deleteLater = false;
 	m_inCallback = false;
+	m_startAgain = false;
+	m_slot = NULL;
+	m_prev = NULL;
+	m_next = NULL;
+	m_expires = 0;
 }
 
 SpectrumTimer::~SpectrumTimer() {
 	Log("SpectrumTimer", "destructor id " << m_id);
 	stop();
-	g_mutex_free(m_mutex);
 }
 
 void SpectrumTimer::start() {
-	g_mutex_lock(m_mutex);
+	g_static_mutex_lock(&SpectrumTimerWheel::mutex);
 
 	if (m_inCallback) {
 		m_startAgain = true;
 	}
 
-	if (m_id == 0) {
+	if (!m_running) {
+		m_running = true;
+		if (m_timeout < SpectrumTimerWheel::TICK) {
+			nativeTimers++;
 #ifdef TESTS
-		m_id = 1;
+			m_id = 1;
 #else
-		m_id = 1;
-		int id;
-		if (m_timeout >= 1000)
-			id = purple_timeout_add_seconds(m_timeout / 1000, _callback, this);
-		else
-			id = purple_timeout_add(m_timeout, _callback, this);
-		if (m_id != 0)
-			m_id = id;
+			m_id = purple_timeout_add(m_timeout, _callback, this);
 #endif
+		}
+		else {
+			SpectrumTimerWheel::instance()->add(this, m_timeout);
+		}
 	}
-	g_mutex_unlock(m_mutex);
+	g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
+}
+
+void SpectrumTimer::restart() {
+	g_static_mutex_lock(&SpectrumTimerWheel::mutex);
+	// Timer waiting in the wheel is just moved to the new slot.
+	if (m_running && m_slot) {
+		SpectrumTimerWheel::instance()->remove(this);
+		SpectrumTimerWheel::instance()->add(this, m_timeout);
+		g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
+		return;
+	}
+	g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
+
+	if (m_timeout < SpectrumTimerWheel::TICK)
+		stop();
+	start();
 }
 
 void SpectrumTimer::stop() {
-	g_mutex_lock(m_mutex);
-	if (m_id != 0) {
+	g_static_mutex_lock(&SpectrumTimerWheel::mutex);
+	if (m_running) {
 		Log("SpectrumTimer", "stopping timer");
+		if (m_timeout < SpectrumTimerWheel::TICK) {
+			nativeTimers--;
 #ifndef TESTS
-		purple_timeout_remove(m_id);
+			purple_timeout_remove(m_id);
 #endif
-		m_id = 0;
+			m_id = 0;
+		}
+		else {
+			SpectrumTimerWheel::instance()->remove(this);
+		}
+		m_running = false;
 	}
-	g_mutex_unlock(m_mutex);
+	g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
 }
 
 void SpectrumTimer::deleteLater() {
@@ -100,14 +148,264 @@ gboolean SpectrumTimer::timeout() {
 	}
 	
 	if (m_deleteLater) {
-		m_id = 0;
+		// Native source is removed by GLib after returning FALSE. Timer started
+		// again in callback is removed from the wheel by destructor.
+		if (m_timeout < SpectrumTimerWheel::TICK) {
+			g_static_mutex_lock(&SpectrumTimerWheel::mutex);
+			if (m_running)
+				nativeTimers--;
+			m_running = false;
+			m_id = 0;
+			g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
+		}
 		delete this;
 		return FALSE;
 	}
-	
-	if (!ret)
-		m_id = 0;
+
+	g_static_mutex_lock(&SpectrumTimerWheel::mutex);
+	if (m_timeout < SpectrumTimerWheel::TICK) {
+		// Stopped in callback; if it has been started again, it has new source.
+		if (!m_running) {
+			ret = FALSE;
+		}
+		else if (!ret) {
+			nativeTimers--;
+			m_running = false;
+			m_id = 0;
+		}
+	}
+	else if (m_running && m_slot == NULL) {
+		if (ret)
+			SpectrumTimerWheel::instance()->add(this, m_timeout);
+		else
+			m_running = false;
+	}
+	g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
 	return ret;
 }
 
+void SpectrumTimer::getStats(std::map <std::string, BackendStat> &stats) {
+	g_static_mutex_lock(&SpectrumTimerWheel::mutex);
+	SpectrumTimerWheel *wheel = SpectrumTimerWheel::instance();
+	wheel->getStats(stats);
+	stats["timers/active"].units = "timers";
+	stats["timers/active"].value = wheel->size() + nativeTimers;
+	stats["timers/native"].units = "timers";
+	stats["timers/native"].value = nativeTimers;
+	g_static_mutex_unlock(&SpectrumTimerWheel::mutex);
+}
+
+SpectrumTimerWheel::SpectrumTimerWheel() {
+	for (int i = 0; i < ROOT_SIZE; i++)
+		m_root[i] = NULL;
+	for (int l = 0; l < 3; l++) {
+		for (int i = 0; i < LEVEL_SIZE; i++)
+			m_levels[l][i] = NULL;
+	}
+	m_expired = NULL;
+	m_tick = 0;
+	m_last = 0;
+	m_time = 0;
+	m_count = 0;
+	m_source = 0;
+	m_wake = 0;
+	m_inProcess = false;
+	m_expiredCount = 0;
+	m_maxBatch = 0;
+}
+
+SpectrumTimerWheel::~SpectrumTimerWheel() {
+#ifndef TESTS
+	if (m_source)
+		purple_timeout_remove(m_source);
+#endif
+}
+
+SpectrumTimerWheel *SpectrumTimerWheel::instance() {
+	static SpectrumTimerWheel *wheel = NULL;
+	if (wheel == NULL)
+		wheel = new SpectrumTimerWheel();
+	return wheel;
+}
+
+long long SpectrumTimerWheel::now() {
+	if (m_time != 0)
+		return m_time;
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void SpectrumTimerWheel::link(SpectrumTimer **slot, SpectrumTimer *timer) {
+	timer->m_slot = slot;
+	timer->m_prev = NULL;
+	timer->m_next = *slot;
+	if (*slot)
+		(*slot)->m_prev = timer;
+	*slot = timer;
+}
+
+void SpectrumTimerWheel::insert(SpectrumTimer *timer) {
+	guint64 expires = timer->m_expires;
+	if (expires < m_tick) {
+		link(&m_root[m_tick & ROOT_MASK], timer);
+		return;
+	}
+
+	guint64 idx = expires - m_tick;
+	if (idx < ROOT_SIZE) {
+		link(&m_root[expires & ROOT_MASK], timer);
+		return;
+	}
+
+	for (int l = 0; l < 3; l++) {
+		if (idx < ((guint64) 1 << (ROOT_BITS + (l + 1) * LEVEL_BITS))) {
+			link(&m_levels[l][LEVEL_INDEX(expires, l)], timer);
+			return;
+		}
+	}
+
+	// Longer than the wheel, it will be rescheduled when it comes to lower levels.
+	timer->m_expires = m_tick + MAX_TICKS - 1;
+	link(&m_levels[2][LEVEL_INDEX(timer->m_expires, 2)], timer);
+}
+
+void SpectrumTimerWheel::add(SpectrumTimer *timer, int timeout) {
+	if (m_count == 0 && !m_inProcess) {
+		// Wheel was not running, so there are no ticks to catch up.
+		m_last = now();
+	}
+
+	// Tick m_tick is run at m_last + TICK, so timer expires in the first tick
+	// which is run at least `timeout` ms from now.
+	long long delay = now() - m_last + timeout;
+	if (delay < TICK)
+		delay = TICK;
+	timer->m_expires = m_tick + (delay + TICK - 1) / TICK - 1;
+	insert(timer);
+	m_count++;
+
+	// Wake up earlier if this timer expires before the scheduled tick.
+	if (m_count == 1 || timer->m_expires < m_wake)
+		schedule();
+}
+
+void SpectrumTimerWheel::remove(SpectrumTimer *timer) {
+	if (timer->m_slot == NULL)
+		return;
+	if (timer->m_prev)
+		timer->m_prev->m_next = timer->m_next;
+	else
+		*timer->m_slot = timer->m_next;
+	if (timer->m_next)
+		timer->m_next->m_prev = timer->m_prev;
+	timer->m_slot = NULL;
+	timer->m_prev = NULL;
+	timer->m_next = NULL;
+	m_count--;
+
+	// Nothing is due, so don't wake up at all. Other removed timers can only
+	// cause one wake up for nothing.
+	if (m_count == 0)
+		schedule();
+}
+
+guint64 SpectrumTimerWheel::nextTick() {
+	// Timers from higher levels are cascaded to root when root index wraps,
+	// so we have to wake up there even if root slots are empty.
+	for (int k = 0; k < ROOT_SIZE; k++) {
+		int index = (int) ((m_tick + k) & ROOT_MASK);
+		if (index == 0 || m_root[index])
+			return m_tick + k;
+	}
+	return m_tick + ROOT_SIZE;
+}
+
+int SpectrumTimerWheel::nextTimeout() {
+	if (m_count == 0)
+		return -1;
+	long long delay = m_last + (long long) (nextTick() - m_tick + 1) * TICK - now();
+	return delay < 0 ? 0 : (int) delay;
+}
+
+void SpectrumTimerWheel::schedule() {
+	// process() schedules the source once all expired timers are called.
+	if (m_inProcess)
+		return;
+	int timeout = nextTimeout();
+	m_wake = timeout < 0 ? 0 : nextTick();
+#ifndef TESTS
+	if (m_source)
+		purple_timeout_remove(m_source);
+	m_source = timeout < 0 ? 0 : purple_timeout_add(timeout, _wheelCallback, this);
+#endif
+}
+
+int SpectrumTimerWheel::cascade(SpectrumTimer **level, int index) {
+	SpectrumTimer *timer = level[index];
+	level[index] = NULL;
+	while (timer) {
+		SpectrumTimer *next = timer->m_next;
+		insert(timer);
+		timer = next;
+	}
+	return index;
+}
+
+bool SpectrumTimerWheel::process() {
+	g_static_mutex_lock(&mutex);
+	// GLib removes the source which called us, because we return false.
+	m_source = 0;
+	m_inProcess = true;
+	long long t = now();
+	// Clock has been moved back or there's nothing to expire, just start
+	// counting again.
+	if (t < m_last || m_count == 0)
+		m_last = t;
 
+	while (t - m_last >= TICK) {
+		m_last += TICK;
+
+		int index = (int) (m_tick & ROOT_MASK);
+		if (index == 0 && cascade(m_levels[0], LEVEL_INDEX(m_tick, 0)) == 0 && cascade(m_levels[1], LEVEL_INDEX(m_tick, 1)) == 0)
+			cascade(m_levels[2], LEVEL_INDEX(m_tick, 2));
+		m_tick++;
+
+		// Move the whole slot to expired list, so timers can be stopped or
+		// deleted by callbacks of other timers expired in this tick.
+		long batch = 0;
+		SpectrumTimer *timer = m_root[index];
+		m_root[index] = NULL;
+		while (timer) {
+			SpectrumTimer *next = timer->m_next;
+			link(&m_expired, timer);
+			timer = next;
+			batch++;
+		}
+		if (batch > m_maxBatch)
+			m_maxBatch = batch;
+
+		while (m_expired) {
+			timer = m_expired;
+			remove(timer);
+			m_expiredCount++;
+			g_static_mutex_unlock(&mutex);
+			timer->timeout();
+			g_static_mutex_lock(&mutex);
+		}
+	}
+
+	m_inProcess = false;
+	schedule();
+	g_static_mutex_unlock(&mutex);
+	return false;
+}
+
+void SpectrumTimerWheel::getStats(std::map <std::string, BackendStat> &stats) {
+	stats["timers/wheel"].units = "timers";
+	stats["timers/wheel"].value = m_count;
+	stats["timers/expired"].units = "timers";
+	stats["timers/expired"].value = m_expiredCount;
+	stats["timers/max-batch"].units = "timers";
+	stats["timers/max-batch"].value = m_maxBatch;
+}
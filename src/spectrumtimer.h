@@ -17,20 +17,27 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
  */
-
 #ifndef SPECTRUM_TIMER_H
 #define SPECTRUM_TIMER_H
 
 #include <string>
+#include <map>
 #include "purple.h"
 #include "glib.h"
 
+struct BackendStat;
+class SpectrumTimerWheel;
+
 typedef gboolean (*SpectrumTimerCallback)(void *);
 
-// Wrapper of purple_timeout_*.
 // SpectrumTimer calls callback function after some time. If callback function
 // returns true, timer will start again automatically and function is called
 // repeatedly.
+//
+// Timers are kept in one SpectrumTimerWheel driven by single GLib source, so
+// thousands of timers don't mean thousands of GLib sources. The source is
+// scheduled only for ticks in which some timer expires. Only timers shorter
+// than one wheel tick have their own purple_timeout.
 class SpectrumTimer {
 	public:
 		// Creates new Timer.
@@ -46,6 +53,10 @@ class SpectrumTimer {
 		// Stops timer.  If it's already stopped, nothing whill happen.
 		void stop();
 
+		// Starts timer from the beginning, even if it's already started. Useful
+		// for postponing callback until there are no new events for `time` ms.
+		void restart();
+
 		// Deletes the timer later. Call this function if you want to delete this
 		// SpectrumTimer in its own callback.
 		void deleteLater();
@@ -55,17 +66,93 @@ class SpectrumTimer {
 		// SpectrumTimer::timeout().
 		gboolean timeout();
 		
-		bool isRunning() {return m_id != 0;}
+		bool isRunning() {return m_running;}
+
+		// Adds timer statistics (active timers, expired timers...) into `stats`.
+		static void getStats(std::map <std::string, BackendStat> &stats);
 
 	private:
+		friend class SpectrumTimerWheel;
+
 		void *m_data;						// Data to be passed to callback.
 		SpectrumTimerCallback m_callback;	// Callback which is called on timeout.
 		int m_timeout;						// Miliseconds.
-		guint m_id;							// Timer ID.
-		GMutex *m_mutex;					// Mutex.
+		guint m_id;							// Timer ID of timers which are not in wheel.
+		bool m_running;						// True if timer is started.
 		bool m_deleteLater;					// True if SpectrumTimer should be remove after callback.
 		bool m_inCallback;					// True if deleteLater has been called in callback.
 		bool m_startAgain;					// True if start has been called in callback
+
+		// Wheel slot this timer is linked in.
+		SpectrumTimer **m_slot;
+		SpectrumTimer *m_prev;
+		SpectrumTimer *m_next;
+		guint64 m_expires;					// Tick in which timer expires.
+};
+
+// Hierarchical timer wheel (four levels, 256 + 3 * 64 slots). Timer is added to
+// the slot of the level matching its expiration and moved to lower level when
+// that level wraps, so start/stop are O(1) and all timers expired in one tick
+// are handled in one batch.
+class SpectrumTimerWheel {
+	public:
+		// Length of one tick in ms.
+		static const int TICK = 50;
+
+		SpectrumTimerWheel();
+		~SpectrumTimerWheel();
+
+		static SpectrumTimerWheel *instance();
+
+		// Adds timer which expires after `timeout` ms. add() and remove() have to
+		// be called with `mutex` locked.
+		void add(SpectrumTimer *timer, int timeout);
+
+		// Removes timer from wheel. Does nothing if timer is not in the wheel.
+		void remove(SpectrumTimer *timer);
+
+		// Runs all ticks elapsed since last call and calls expired timers, then
+		// schedules new GLib source for the next tick with expiring timers.
+		// Always returns false, called by GLib source.
+		bool process();
+
+		// Returns number of ms until the wheel has to wake up or -1 if there
+		// are no timers in wheel.
+		int nextTimeout();
+
+		// Returns number of timers in wheel.
+		int size() { return m_count; }
+
+		void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Sets current time in ms, used in tests.
+		void setTime(long long t) { m_time = t; }
+
+		// Lock used by all timers.
+		static GStaticMutex mutex;
+
+	private:
+		long long now();
+		void link(SpectrumTimer **slot, SpectrumTimer *timer);
+		void insert(SpectrumTimer *timer);
+		int cascade(SpectrumTimer **level, int index);
+		// Returns next tick with expiring timers or cascade.
+		guint64 nextTick();
+		// Moves GLib source to nextTimeout() or removes it if wheel is empty.
+		void schedule();
+
+		SpectrumTimer *m_root[256];
+		SpectrumTimer *m_levels[3][64];
+		SpectrumTimer *m_expired;			// Timers expired in current tick.
+		guint64 m_tick;						// Next tick to run.
+		long long m_last;					// Time of last run tick in ms.
+		long long m_time;
+		int m_count;
+		guint m_source;
+		guint64 m_wake;						// Tick the source is scheduled for.
+		bool m_inProcess;					// True while process() runs ticks.
+		long m_expiredCount;
+		long m_maxBatch;
 };
 
 #endif
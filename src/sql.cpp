@@ -26,12 +26,15 @@
 #include "spectrum_util.h"
 #include "protocols/abstractprotocol.h"
 #include "transport.h"
+#include "flightrecorder.h"
+#include "probelimiter.h"
 #include "usermanager.h"
+#include "sqlitemaintenance.h"
 #include <sys/time.h>
 #include "gloox/base64.h"
 
-#define SQLITE_DB_VERSION 3
-#define MYSQL_DB_VERSION 2
+#define SQLITE_DB_VERSION 4
+#define MYSQL_DB_VERSION 4
 
 #if !defined(WITH_MYSQL) && !defined(WITH_SQLITE) && !defined(WITH_ODBC)
 #error There is no libPocoData storage backend installed. Spectrum will not work without one of them.
@@ -262,6 +265,7 @@ SQLClass::SQLClass(GlooxMessageHandler *parent, bool upgrade, bool check) {
 	m_check = check;
 	m_upgrade = upgrade;
 	m_sess = NULL;
+	m_maintenance = NULL;
 
 	m_stmt_addUser = NULL;
 	m_version_stmt = NULL;
@@ -282,6 +286,8 @@ SQLClass::SQLClass(GlooxMessageHandler *parent, bool upgrade, bool check) {
 	m_stmt_getSettings = NULL;
 	m_stmt_getOnlineUsers = NULL;
 	m_stmt_setUserOnline = NULL;
+	m_stmt_getUsersByServer = NULL;
+	m_stmt_addUserServer = NULL;
 	m_error = 0;
 	
 	m_reconnectTimer = new SpectrumTimer(1000, reconnectMe, this);
@@ -304,6 +310,10 @@ SQLClass::SQLClass(GlooxMessageHandler *parent, bool upgrade, bool check) {
 			SQLite::Connector::registerConnector(); 
 			m_sess = new Session("SQLite", p->configuration().sqlDb);
 			g_chmod(p->configuration().sqlDb.c_str(), 0640);
+			if (p->configuration().sqliteProfile == "performance")
+				applySQLiteProfile();
+			else if (p->configuration().sqliteProfile != "default")
+				Log("SQL ERROR", "Unknown sqlite_profile " << p->configuration().sqliteProfile << ", using default one");
 		}
 #endif
 	}
@@ -335,10 +345,24 @@ SQLClass::SQLClass(GlooxMessageHandler *parent, bool upgrade, bool check) {
 	
 	initDb();
 
+#ifdef WITH_SQLITE
+	if (m_loaded && !check && !upgrade && p->configuration().sqlType == "sqlite" && p->configuration().sqliteProfile == "performance") {
+		m_maintenance = new SQLiteMaintenance(p->configuration().sqlDb, p->configuration().sqliteCheckpointInterval,
+											  p->configuration().sqliteMaintenanceInterval);
+		m_maintenance->start();
+	}
+#endif
+
 // 	if (!vipSQL->connect("platby",p->configuration().sqlHost.c_str(),p->configuration().sqlUser.c_str(),p->configuration().sqlPassword.c_str()))
 }
 
 SQLClass::~SQLClass() {
+#ifdef WITH_SQLITE
+	if (m_maintenance) {
+		m_maintenance->finish();
+		delete m_maintenance;
+	}
+#endif
 	delete m_reconnectTimer;
 	delete m_pingTimer;
 	if (m_loaded) {
@@ -363,9 +387,46 @@ SQLClass::~SQLClass() {
 		delete m_stmt_getSettings;
 		delete m_stmt_getOnlineUsers;
 		delete m_stmt_setUserOnline;
+		delete m_stmt_getUsersByServer;
+		delete m_stmt_addUserServer;
+	}
+}
+
+void SQLClass::applySQLiteProfile() {
+	std::string value;
+	try {
+		// auto_vacuum can be changed only before the first table is created,
+		// so it has no effect for already existing databases.
+		*m_sess << "PRAGMA auto_vacuum=INCREMENTAL", now;
+		*m_sess << "PRAGMA journal_mode=WAL", into(value), now;
+		Log("SQL", "SQLite journal mode: " << value);
+		// With WAL, NORMAL synchronous mode is still safe against corruption, we
+		// can only lose last transactions after power loss.
+		*m_sess << "PRAGMA synchronous=NORMAL", now;
+		*m_sess << "PRAGMA temp_store=MEMORY", now;
+		// Negative value means KiB instead of pages.
+		*m_sess << "PRAGMA cache_size=-" + stringOf(p->configuration().sqliteCacheSize * 1024), now;
+		*m_sess << "PRAGMA mmap_size=" + stringOf((Poco::Int64) p->configuration().sqliteMmapSize * 1024 * 1024), into(value), now;
+		*m_sess << "PRAGMA journal_size_limit=" + stringOf(64 * 1024 * 1024), into(value), now;
+		// Checkpoints are done by SQLiteMaintenance thread, automatic checkpoint
+		// is there just to limit WAL size if the thread can't keep up.
+		*m_sess << "PRAGMA wal_autocheckpoint=10000", into(value), now;
+		// SQLiteMaintenance holds write lock while it analyzes one table or
+		// does one vacuum step, which takes few ms.
+		*m_sess << "PRAGMA busy_timeout=1000", into(value), now;
+	}
+	catch (Poco::Exception e) {
+		Log("SQL ERROR", "Can't set SQLite performance profile: " << e.displayText());
 	}
 }
 
+void SQLClass::getStats(std::map <std::string, BackendStat> &stats) {
+#ifdef WITH_SQLITE
+	if (m_maintenance)
+		m_maintenance->getStats(stats);
+#endif
+}
+
 void SQLClass::createStatement(SpectrumSQLStatement **statement, const std::string &format, const std::string &sql) {
 	if (*statement)
 		(*statement)->createStatement(m_sess);
@@ -419,7 +480,7 @@ void SQLClass::createStatements() {
 	else
 		createStatement(&m_stmt_addBuddySetting, "iisiss", "INSERT INTO " + p->configuration().sqlPrefix + "buddies_settings (user_id, buddy_id, var, type, value) VALUES (?, ?, ?, ?, ?) ON DUPLICATE KEY UPDATE value=?");
 
-	createStatement(&m_stmt_removeBuddySettings, "i", "DELETE FROM " + p->configuration().sqlPrefix + "buddies_settings WHERE buddy_id=?");
+	createStatement(&m_stmt_removeBuddySettings, "ii", "DELETE FROM " + p->configuration().sqlPrefix + "buddies_settings WHERE user_id=? AND buddy_id=?");
 	createStatement(&m_stmt_getSettings, "i|IISS", "SELECT user_id, type, var, value FROM " + p->configuration().sqlPrefix + "users_settings WHERE user_id=?");
 	
 	createStatement(&m_stmt_getOnlineUsers, "|S","SELECT jid FROM " + p->configuration().sqlPrefix + "users WHERE online=1");
@@ -428,6 +489,12 @@ void SQLClass::createStatements() {
 		createStatement(&m_stmt_setUserOnline, "bi", "UPDATE " + p->configuration().sqlPrefix + "users SET online=?, last_login=DATETIME('NOW')  WHERE id=?");
 	else
 		createStatement(&m_stmt_setUserOnline, "bi", "UPDATE " + p->configuration().sqlPrefix + "users SET online=?, last_login=NOW()  WHERE id=?");
+
+	createStatement(&m_stmt_getUsersByServer, "s|ISSSS", "SELECT u.id, u.jid, u.uin, u.password, u.encoding FROM " + p->configuration().sqlPrefix + "users_servers s, " + p->configuration().sqlPrefix + "users u WHERE s.jid=? AND u.id=s.user_id");
+	if (p->configuration().sqlType == "sqlite")
+		createStatement(&m_stmt_addUserServer, "iss", "INSERT OR IGNORE INTO " + p->configuration().sqlPrefix + "users_servers (user_id, jid, server) VALUES (?, ?, ?)");
+	else
+		createStatement(&m_stmt_addUserServer, "iss", "INSERT IGNORE INTO " + p->configuration().sqlPrefix + "users_servers (user_id, jid, server) VALUES (?, ?, ?)");
 }
 
 static std::string encryptMe(const std::string &password, std::string &key) {
@@ -464,6 +531,10 @@ void SQLClass::addUser(const UserRow &user) {
 
 	*m_stmt_addUser << user.jid << user.uin << encrypted << user.language << user.encoding << user.vip;
 	m_stmt_addUser->execute();
+
+	// This JID could be cached as unregistered, so forget it.
+	if (p->probeLimiter())
+		p->probeLimiter()->forget(user.jid);
 }
 
 void SQLClass::removeStatements() {
@@ -487,6 +558,8 @@ void SQLClass::removeStatements() {
 	m_stmt_getSettings->removeStatement();
 	m_stmt_getOnlineUsers->removeStatement();
 	m_stmt_setUserOnline->removeStatement();
+	m_stmt_getUsersByServer->removeStatement();
+	m_stmt_addUserServer->removeStatement();
 }
 
 bool SQLClass::reconnect() {
@@ -586,8 +659,6 @@ void SQLClass::initDb() {
 							"  PRIMARY KEY (buddy_id, var)"
 							");", now;
 
-				*m_sess << "CREATE INDEX IF NOT EXISTS user_id02 ON " + p->configuration().sqlPrefix + "buddies_settings (user_id);", now;
-
 				*m_sess << "CREATE TABLE IF NOT EXISTS " + p->configuration().sqlPrefix + "users ("
 							"  id INTEGER PRIMARY KEY NOT NULL,"
 							"  jid varchar(255) NOT NULL,"
@@ -609,13 +680,13 @@ void SQLClass::initDb() {
 							"  value varchar(255) NOT NULL,"
 							"  PRIMARY KEY (user_id, var)"
 							");", now;
-							
-				*m_sess << "CREATE INDEX IF NOT EXISTS user_id03 ON " + p->configuration().sqlPrefix + "users_settings (user_id);", now;
+
+				createSQLiteIndexes();
 
 				*m_sess << "CREATE TABLE IF NOT EXISTS " + p->configuration().sqlPrefix + "db_version ("
-					"  ver INTEGER NOT NULL DEFAULT '3'"
+					"  ver INTEGER NOT NULL DEFAULT '4'"
 					");", now;
-				*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(3)", now;
+				*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(4)", now;
 			}
 			catch (Poco::Exception e) {
 				Log("SQL ERROR", e.displayText());
@@ -730,6 +801,42 @@ void SQLClass::upgradeDatabase() {
 					*m_sess << "ALTER TABLE " + p->configuration().sqlPrefix + "buddies ADD flags int(4) NOT NULL DEFAULT '0';", now;
 					*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(3);", now;
 				}
+				else {
+					// MySQL got 'flags' column in version 2 already.
+					*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(3);", now;
+				}
+			}
+			else if (i == 3) {
+				if (p->configuration().sqlType == "sqlite") {
+					// SQLite can change schema in transaction, so interrupted upgrade
+					// leaves the DB in version 3.
+					beginTransaction();
+					*m_sess << "DROP INDEX IF EXISTS user_id02;", now;
+					*m_sess << "DROP INDEX IF EXISTS user_id03;", now;
+					createSQLiteIndexes();
+					*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(4);", now;
+					commitTransaction();
+				}
+				else {
+					// Indexes matched to prepared statements, users_servers table and
+					// buddies_settings clustered by user_id. Every ALTER TABLE is atomic
+					// and MySQL applies writes done during it, so there's no copy of the
+					// table which could miss them. Every step can be done again, so
+					// interrupted upgrade can be restarted.
+					if (!hasIndex("users", "online_jid"))
+						alterTableOnline("users", "ADD INDEX online_jid (online, jid)");
+					if (!hasIndex("buddies", "user_id_id"))
+						alterTableOnline("buddies", "ADD INDEX user_id_id (user_id, id)");
+					*m_sess << "CREATE TABLE IF NOT EXISTS `" + p->configuration().sqlPrefix + "users_servers` ("
+								"`user_id` int(10) unsigned NOT NULL,"
+								"`jid` varchar(255) collate utf8_bin NOT NULL,"
+								"`server` varchar(255) collate utf8_bin NOT NULL,"
+								"PRIMARY KEY (`user_id`),"
+								"KEY `jid` (`jid`)"
+								") ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;", now;
+					rebuildBuddiesSettings();
+					*m_sess << "REPLACE INTO " + p->configuration().sqlPrefix + "db_version (ver) values(4);", now;
+				}
 			}
 		}
 	}
@@ -741,6 +848,57 @@ void SQLClass::upgradeDatabase() {
 	Log("SQL", "Done");
 }
 
+void SQLClass::createSQLiteIndexes() {
+	const std::string &prefix = p->configuration().sqlPrefix;
+	// Same indexes as in MySQL schema. users_settings lookups (user_id=?) use
+	// its primary key.
+	// m_stmt_getBuddies: WHERE user_id=? ORDER BY id.
+	*m_sess << "CREATE INDEX IF NOT EXISTS " + prefix + "buddies_user ON " + prefix + "buddies (user_id, id);", now;
+	// m_stmt_getBuddiesSettings: WHERE user_id=? ORDER BY buddy_id.
+	*m_sess << "CREATE INDEX IF NOT EXISTS " + prefix + "buddies_settings_user ON " + prefix + "buddies_settings (user_id, buddy_id);", now;
+	// m_stmt_getOnlineUsers: WHERE online=1.
+	*m_sess << "CREATE INDEX IF NOT EXISTS " + prefix + "users_online ON " + prefix + "users (online, jid);", now;
+
+	*m_sess << "CREATE TABLE IF NOT EXISTS " + prefix + "users_servers ("
+				"  user_id INTEGER PRIMARY KEY NOT NULL,"
+				"  jid varchar(255) NOT NULL,"
+				"  server varchar(255) NOT NULL"
+				");", now;
+	// users.jid is unique already, so user_id is enough as the unique key.
+	*m_sess << "CREATE INDEX IF NOT EXISTS " + prefix + "users_servers_jid ON " + prefix + "users_servers (jid);", now;
+}
+
+void SQLClass::alterTableOnline(const std::string &table, const std::string &alter) {
+	const std::string name = p->configuration().sqlPrefix + table;
+	try {
+		// MySQL >= 5.6 can build the index without blocking writes.
+		*m_sess << "ALTER TABLE " + name + " " + alter + ", ALGORITHM=INPLACE, LOCK=NONE;", now;
+	}
+	catch (Poco::Exception e) {
+		Log("SQL", "Online ALTER TABLE is not supported, table " << name << " will be locked: " << e.displayText());
+		*m_sess << "ALTER TABLE " + name + " " + alter + ";", now;
+	}
+}
+
+void SQLClass::rebuildBuddiesSettings() {
+	// (user_id, buddy_id, var) is unique, because (buddy_id, var) is.
+	if (!hasIndex("buddies_settings", "PRIMARY", "user_id"))
+		alterTableOnline("buddies_settings", "DROP PRIMARY KEY, ADD PRIMARY KEY (user_id, buddy_id, var)");
+
+	// user_id index is the prefix of the new primary key.
+	if (hasIndex("buddies_settings", "user_id"))
+		alterTableOnline("buddies_settings", "DROP INDEX user_id");
+}
+
+bool SQLClass::hasIndex(const std::string &table, const std::string &index, const std::string &column) {
+	Poco::UInt64 count = 0;
+	std::string query = "SELECT COUNT(*) FROM information_schema.statistics WHERE table_schema=DATABASE() AND table_name='" + p->configuration().sqlPrefix + table + "' AND index_name='" + index + "'";
+	if (!column.empty())
+		query += " AND column_name='" + column + "'";
+	*m_sess << query, into(count), now;
+	return count != 0;
+}
+
 long SQLClass::getRegisteredUsersCount(){
 	Poco::UInt64 users;
 	*m_sess << "SELECT count(*) FROM " + p->configuration().sqlPrefix + "users", into(users), now;
@@ -754,6 +912,7 @@ long SQLClass::getRegisteredUsersRosterCount(){
 }
 
 void SQLClass::updateUser(const UserRow &user) {
+	FlightRecorderSQL rec(user.id, "updateUser");
 	std::string encrypted = user.password;
 	if (!p->configuration().sqlCryptKey.empty())
 		encrypted = encryptMe(user.password, p->configuration().sqlCryptKey);
@@ -763,6 +922,7 @@ void SQLClass::updateUser(const UserRow &user) {
 }
 
 void SQLClass::removeBuddy(long userId, const std::string &uin, long buddy_id) {
+	FlightRecorderSQL rec(userId, "removeBuddy");
 	if (buddy_id == 0) {
 		Poco::UInt32 id = 0;
 		try {
@@ -775,21 +935,24 @@ void SQLClass::removeBuddy(long userId, const std::string &uin, long buddy_id) {
 			buddy_id = id;
 	}
 	*m_stmt_removeBuddy << (Poco::Int32) userId << uin;
-	*m_stmt_removeBuddySettings << (Poco::Int32) buddy_id;
+	*m_stmt_removeBuddySettings << (Poco::Int32) userId << (Poco::Int32) buddy_id;
 	m_stmt_removeBuddy->execute();
 	m_stmt_removeBuddySettings->execute();
 }
 
 void SQLClass::removeUser(long userId) {
+	FlightRecorderSQL rec(userId, "removeUser");
 	*m_stmt_removeUser << (Poco::Int32) userId;
 	m_stmt_removeUser->execute();
 	Poco::Int32 id = userId;
 	*m_sess << "DELETE FROM " + p->configuration().sqlPrefix + "buddies WHERE user_id=?", use(id), now;
 	*m_sess << "DELETE FROM " + p->configuration().sqlPrefix + "buddies_settings WHERE user_id=?", use(id), now;
 	*m_sess << "DELETE FROM " + p->configuration().sqlPrefix + "users_settings WHERE user_id=?", use(id), now;
+	*m_sess << "DELETE FROM " + p->configuration().sqlPrefix + "users_servers WHERE user_id=?", use(id), now;
 }
 
 void SQLClass::removeUserBuddies(long userId) {
+	FlightRecorderSQL rec(userId, "removeUserBuddies");
 	*m_stmt_removeUserBuddies << (Poco::Int32) userId;
 	m_stmt_removeUserBuddies->execute();
 }
@@ -798,6 +961,7 @@ void SQLClass::addDownload(const std::string &filename, const std::string &vip)
 }
 
 long SQLClass::addBuddy(long userId, const std::string &uin, const std::string &subscription, const std::string &group, const std::string &nickname, int flags) {
+	FlightRecorderSQL rec(userId, "addBuddy");
 	std::string u(uin);
 	p->protocol()->prepareUsername(u);
 	*m_stmt_addBuddy << (Poco::Int32) userId << u << subscription << group << nickname << (Poco::Int32) flags;
@@ -838,12 +1002,14 @@ long SQLClass::addBuddy(long userId, const std::string &uin, const std::string &
 }
 
 void SQLClass::updateBuddySubscription(long userId, const std::string &uin, const std::string &subscription) {
+	FlightRecorderSQL rec(userId, "updateBuddySubscription");
 	*m_stmt_updateBuddySubscription << subscription << (Poco::Int32) userId << uin;
 	
 	m_stmt_updateBuddySubscription->execute();
 }
 
 UserRow SQLClass::getUserByJid(const std::string &jid){
+	FlightRecorderSQL rec(jid, "getUserByJid");
 	UserRow user;
 	user.id = -1;
 	user.vip = 0;
@@ -867,18 +1033,21 @@ UserRow SQLClass::getUserByJid(const std::string &jid){
 }
 
 std::map<std::string, UserRow> SQLClass::getUsersByJid(const std::string &jid) {
+	std::map<std::string, UserRow> users;
 	std::vector<Poco::Int32> resId; 
 	std::vector<std::string> resJid;
 	std::vector<std::string> resUin;
 	std::vector<std::string> resPassword;
 	std::vector<std::string> resEncoding;
-	*m_sess <<  "SELECT id, jid, uin, password, encoding FROM " + p->configuration().sqlPrefix + "users WHERE jid LIKE \"" + jid +"%\"",
-													into(resId),
-													into(resJid),
-													into(resUin),
-													into(resPassword),
-													into(resEncoding), now;
-	std::map<std::string, UserRow> users;
+
+	// Only users_servers is used. Rows created before schema v4 have "jid" +
+	// "server" without separator, which can't be split unambiguously
+	// ("user@example.co" + "mx.net" vs. "user@example.com" + "x.net"), so they are
+	// never matched and such users get new row on their next login.
+	*m_stmt_getUsersByServer << jid;
+	if (m_stmt_getUsersByServer->execute())
+		*m_stmt_getUsersByServer >> resId >> resJid >> resUin >> resPassword >> resEncoding;
+
 	for (int i = 0; i < (int) resId.size(); i++) {
 		std::string jid = resJid[i];
 		users[jid].id = resId[i];
@@ -890,7 +1059,14 @@ std::map<std::string, UserRow> SQLClass::getUsersByJid(const std::string &jid) {
 	return users;
 }
 
+void SQLClass::addUserServer(long userId, const std::string &jid, const std::string &server) {
+	FlightRecorderSQL rec(userId, "addUserServer");
+	*m_stmt_addUserServer << (Poco::Int32) userId << jid << server;
+	m_stmt_addUserServer->execute();
+}
+
 GHashTable *SQLClass::getBuddies(long userId, PurpleAccount *account) {
+	FlightRecorderSQL rec(userId, "getBuddies");
 	GHashTable *roster = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	std::vector <Poco::Int32> settingIds;
 	std::vector <Poco::Int32> settingTypes;
@@ -1011,6 +1187,7 @@ GHashTable *SQLClass::getBuddies(long userId, PurpleAccount *account) {
 }
 
 std::list <std::string> SQLClass::getBuddies(long userId) {
+	FlightRecorderSQL rec(userId, "getBuddies");
 	std::list <std::string> list;
 
 	std::vector <Poco::Int32> buddyIds;
@@ -1044,6 +1221,7 @@ std::list <std::string> SQLClass::getBuddies(long userId) {
 // settings
 
 void SQLClass::addSetting(long userId, const std::string &key, const std::string &value, PurpleType type) {
+	FlightRecorderSQL rec(userId, "addSetting");
 	if (userId == 0) {
 		Log("SQL ERROR", "Trying to add user setting with user_id = 0: " << key);
 		return;
@@ -1053,11 +1231,13 @@ void SQLClass::addSetting(long userId, const std::string &key, const std::string
 }
 
 void SQLClass::updateSetting(long userId, const std::string &key, const std::string &value) {
+	FlightRecorderSQL rec(userId, "updateSetting");
 	*m_stmt_updateSetting << value << (Poco::Int32) userId << key;
 	m_stmt_updateSetting->execute();
 }
 
 GHashTable * SQLClass::getSettings(long userId) {
+	FlightRecorderSQL rec(userId, "getSettings");
 	GHashTable *settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) purple_value_destroy);
 	PurpleType type;
 	PurpleValue *value;
@@ -1094,6 +1274,7 @@ GHashTable * SQLClass::getSettings(long userId) {
 }
 
 void SQLClass::addBuddySetting(long userId, long buddyId, const std::string &key, const std::string &value, PurpleType type) {
+	FlightRecorderSQL rec(userId, "addBuddySetting");
 	*m_stmt_addBuddySetting << (Poco::Int32) userId << (Poco::Int32) buddyId << key << (Poco::Int32) type << value;
 	if (p->configuration().sqlType != "sqlite")
 		*m_stmt_addBuddySetting << value;
@@ -1109,6 +1290,7 @@ std::vector<std::string> SQLClass::getOnlineUsers() {
 }
 
 void SQLClass::setUserOnline(long userId, bool online) {
+	FlightRecorderSQL rec(userId, "setUserOnline");
 	*m_stmt_setUserOnline << online << (Poco::Int32) userId;
 	m_stmt_setUserOnline->execute();
 }
@@ -50,6 +50,7 @@
 #include "spectrumtimer.h"
 
 class GlooxMessageHandler;
+class SQLiteMaintenance;
 
 using namespace Poco::Data;
 using namespace gloox;
@@ -161,6 +162,7 @@ class SQLClass : public AbstractBackend {
 
 		UserRow getUserByJid(const std::string &jid);
 		std::map<std::string, UserRow> getUsersByJid(const std::string &jid);
+		void addUserServer(long userId, const std::string &jid, const std::string &server);
 		GHashTable *getBuddies(long userId, PurpleAccount *account);
 		std::list <std::string> getBuddies(long userId);
 		bool loaded() { return m_loaded; }
@@ -168,12 +170,40 @@ class SQLClass : public AbstractBackend {
 		void setUserOnline(long userId, bool online);
 		void beginTransaction();
 		void commitTransaction();
+		void getStats(std::map <std::string, BackendStat> &stats);
 		
 	private:
 		/*
 		 * Creates tables for sqlite3 DB.
 		 */
 		void initDb();
+
+		/*
+		 * Sets WAL journal and other pragmas used by SQLite "performance" profile.
+		 */
+		void applySQLiteProfile();
+
+		/*
+		 * Changes primary key of buddies_settings to (user_id, buddy_id, var) using
+		 * online ALTER TABLE, so the table is not locked for whole migration.
+		 */
+		void rebuildBuddiesSettings();
+
+		/*
+		 * Creates schema v4 indexes and users_servers table in SQLite DB.
+		 */
+		void createSQLiteIndexes();
+
+		/*
+		 * Runs ALTER TABLE without locking the table if MySQL supports it.
+		 */
+		void alterTableOnline(const std::string &table, const std::string &alter);
+
+		/*
+		 * Returns true if MySQL table has index with given name (and containing
+		 * given column, if it's not empty).
+		 */
+		bool hasIndex(const std::string &table, const std::string &index, const std::string &column = "");
 		SpectrumSQLStatement *m_stmt_addUser;
 		SpectrumSQLStatement *m_stmt_updateUserPassword;
 		SpectrumSQLStatement *m_stmt_removeBuddy;
@@ -191,6 +221,8 @@ class SQLClass : public AbstractBackend {
 		SpectrumSQLStatement *m_stmt_addBuddySetting;
 		SpectrumSQLStatement *m_stmt_removeBuddySettings;
 		SpectrumSQLStatement *m_stmt_setUserOnline;
+		SpectrumSQLStatement *m_stmt_getUsersByServer;
+		SpectrumSQLStatement *m_stmt_addUserServer;
 		SpectrumSQLStatement *m_stmt_getOnlineUsers;
 		Poco::Data::Statement *m_version_stmt;
 
@@ -204,6 +236,7 @@ class SQLClass : public AbstractBackend {
 		SpectrumTimer *m_pingTimer;
 		int m_dbversion;
 		bool m_check;
+		SQLiteMaintenance *m_maintenance;
 };
 
 #endif
@@ -0,0 +1,213 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "sqlitemaintenance.h"
+#include "transport_config.h"
+#include <sstream>
+#include <algorithm>
+#include <vector>
+
+#ifdef WITH_SQLITE
+#include "Poco/Data/Session.h"
+#include "Poco/Data/SQLite/Connector.h"
+
+using namespace Poco::Data;
+
+// Number of pages freed by one incremental_vacuum call. Each call holds the
+// write lock only for a short time, so the main thread is not blocked.
+#define VACUUM_STEP 256
+// Busy timeout (in ms) of maintenance connection. Maintenance gives up rather
+// than making the main thread wait for it.
+#define MAINTENANCE_BUSY_TIMEOUT "100"
+
+static gpointer maintenanceThread(gpointer data) {
+	SQLiteMaintenance *maintenance = (SQLiteMaintenance *) data;
+	maintenance->loop();
+	return NULL;
+}
+
+SQLiteMaintenance::SQLiteMaintenance(const std::string &database, int checkpointInterval, int maintenanceInterval) : Thread(),
+	m_database(database), m_checkpointInterval(checkpointInterval), m_maintenanceInterval(maintenanceInterval), m_lastMaintenance(0),
+	m_checkpoints(0), m_checkpointsBusy(0), m_walFrames(0), m_maintenanceRuns(0), m_analyzedTables(0), m_analyzeSkipped(0),
+	m_vacuumedPages(0), m_errors(0) {
+	if (m_checkpointInterval <= 0)
+		m_checkpointInterval = 30;
+}
+
+SQLiteMaintenance::~SQLiteMaintenance() {
+	finish();
+}
+
+void SQLiteMaintenance::start() {
+	if (!isRunning())
+		run(maintenanceThread, this);
+}
+
+void SQLiteMaintenance::finish() {
+	if (!isRunning())
+		return;
+	stop();
+	lockMutex();
+	wakeUp();
+	unlockMutex();
+	join();
+	stopped();
+}
+
+void SQLiteMaintenance::loop() {
+	Session *sess = NULL;
+	try {
+		sess = new Session("SQLite", m_database);
+		Poco::Int32 timeout;
+		*sess << "PRAGMA busy_timeout=" MAINTENANCE_BUSY_TIMEOUT, into(timeout), now;
+	}
+	catch (Poco::Exception e) {
+		lockMutex();
+		m_errors++;
+		unlockMutex();
+		delete sess;
+		return;
+	}
+
+	m_lastMaintenance = time(NULL);
+	while (!waitForStop(m_checkpointInterval * 1000)) {
+		checkpoint(sess);
+		if (m_maintenanceInterval > 0 && time(NULL) - m_lastMaintenance >= m_maintenanceInterval) {
+			maintain(sess);
+			m_lastMaintenance = time(NULL);
+		}
+	}
+
+	sess->close();
+	delete sess;
+}
+
+void SQLiteMaintenance::checkpoint(Session *sess) {
+	// PASSIVE checkpoint never waits for readers or writers, it just copies
+	// as many frames as it can.
+	Poco::Int32 busy = 0;
+	Poco::Int32 frames = 0;
+	Poco::Int32 checkpointed = 0;
+	try {
+		*sess << "PRAGMA wal_checkpoint(PASSIVE)", into(busy), into(frames), into(checkpointed), now;
+	}
+	catch (Poco::Exception e) {
+		lockMutex();
+		m_errors++;
+		unlockMutex();
+		return;
+	}
+
+	lockMutex();
+	m_checkpoints++;
+	if (busy)
+		m_checkpointsBusy++;
+	m_walFrames = frames;
+	unlockMutex();
+}
+
+void SQLiteMaintenance::maintain(Session *sess) {
+	long vacuumed = 0;
+	long analyzed = 0;
+	long skipped = 0;
+	try {
+		// Limits the work done by ANALYZE on big tables. Older SQLite versions
+		// don't know this pragma, which is fine.
+		try {
+			Poco::Int32 limit;
+			*sess << "PRAGMA analysis_limit=1000", into(limit), now;
+		}
+		catch (Poco::Exception e) {
+		}
+
+		// ANALYZE of whole database would hold write lock until all tables
+		// are analyzed, so analyze them one by one in separate transactions.
+		std::vector <std::string> tables;
+		*sess << "SELECT name FROM sqlite_master WHERE type='table' AND name NOT LIKE 'sqlite_%'", into(tables), now;
+		for (std::vector <std::string>::iterator it = tables.begin(); it != tables.end() && !shouldStop(); it++) {
+			try {
+				*sess << "ANALYZE \"" + *it + "\"", now;
+				analyzed++;
+			}
+			catch (Poco::Exception e) {
+				// Main thread is writing, try it next time.
+				skipped++;
+			}
+			// Let the main thread write between tables.
+			if (waitForStop(50))
+				break;
+		}
+
+		// Incremental vacuum works only for databases created with
+		// auto_vacuum=INCREMENTAL (new databases in "performance" profile).
+		Poco::Int32 autoVacuum = 0;
+		*sess << "PRAGMA auto_vacuum", into(autoVacuum), now;
+		if (autoVacuum == 2) {
+			Poco::Int32 freePages = 0;
+			*sess << "PRAGMA freelist_count", into(freePages), now;
+			while (freePages > 0 && !shouldStop()) {
+				int pages = std::min((int) freePages, VACUUM_STEP);
+				std::ostringstream stmt;
+				stmt << "PRAGMA incremental_vacuum(" << pages << ")";
+				*sess << stmt.str(), now;
+				freePages -= pages;
+				vacuumed += pages;
+				// Let the main thread write between steps.
+				if (waitForStop(50))
+					break;
+			}
+		}
+	}
+	catch (Poco::Exception e) {
+		lockMutex();
+		m_errors++;
+		unlockMutex();
+	}
+
+	lockMutex();
+	m_maintenanceRuns++;
+	m_analyzedTables += analyzed;
+	m_analyzeSkipped += skipped;
+	m_vacuumedPages += vacuumed;
+	unlockMutex();
+}
+
+void SQLiteMaintenance::getStats(std::map <std::string, BackendStat> &stats) {
+	lockMutex();
+	stats["sqlite/checkpoints"].units = "checkpoints";
+	stats["sqlite/checkpoints"].value = m_checkpoints;
+	stats["sqlite/checkpoints-busy"].units = "checkpoints";
+	stats["sqlite/checkpoints-busy"].value = m_checkpointsBusy;
+	stats["sqlite/wal-frames"].units = "frames";
+	stats["sqlite/wal-frames"].value = m_walFrames;
+	stats["sqlite/maintenance-runs"].units = "runs";
+	stats["sqlite/maintenance-runs"].value = m_maintenanceRuns;
+	stats["sqlite/analyzed-tables"].units = "tables";
+	stats["sqlite/analyzed-tables"].value = m_analyzedTables;
+	stats["sqlite/analyze-skipped"].units = "tables";
+	stats["sqlite/analyze-skipped"].value = m_analyzeSkipped;
+	stats["sqlite/vacuumed-pages"].units = "pages";
+	stats["sqlite/vacuumed-pages"].value = m_vacuumedPages;
+	stats["sqlite/errors"].units = "errors";
+	stats["sqlite/errors"].value = m_errors;
+	unlockMutex();
+}
+
+#endif
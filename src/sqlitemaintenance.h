@@ -0,0 +1,80 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_SQLITE_MAINTENANCE_H
+#define SPECTRUM_SQLITE_MAINTENANCE_H
+
+#include <string>
+#include <map>
+#include <time.h>
+#include "thread.h"
+#include "abstractbackend.h"
+
+namespace Poco {
+	namespace Data {
+		class Session;
+	}
+}
+
+// Background thread used by SQLite "performance" profile. It uses its own
+// connection to the database, so it never blocks the main loop:
+//  - every `checkpointInterval` seconds it runs passive WAL checkpoint, so WAL
+//    doesn't grow and commits in main thread don't have to do it,
+//  - every `maintenanceInterval` seconds it runs ANALYZE table by table
+//    (skipping tables it can't lock quickly) and, if the database uses
+//    incremental auto_vacuum, frees unused pages in small steps.
+class SQLiteMaintenance : public Thread {
+	public:
+		SQLiteMaintenance(const std::string &database, int checkpointInterval = 30, int maintenanceInterval = 21600);
+		~SQLiteMaintenance();
+
+		// Starts the thread.
+		void start();
+
+		// Stops the thread and waits until it finishes current job.
+		void finish();
+
+		// Adds statistics of checkpoints and maintenance jobs into stats map.
+		void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Thread main loop. Called from the thread.
+		void loop();
+
+	private:
+		void checkpoint(Poco::Data::Session *session);
+		void maintain(Poco::Data::Session *session);
+
+		std::string m_database;
+		int m_checkpointInterval;
+		int m_maintenanceInterval;
+		time_t m_lastMaintenance;
+
+		// Protected by Thread's mutex.
+		long m_checkpoints;
+		long m_checkpointsBusy;
+		long m_walFrames;
+		long m_maintenanceRuns;
+		long m_analyzedTables;
+		long m_analyzeSkipped;		// tables not analyzed because database was busy
+		long m_vacuumedPages;
+		long m_errors;
+};
+
+#endif
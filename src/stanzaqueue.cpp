@@ -0,0 +1,380 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "stanzaqueue.h"
+#include "spectrumtimer.h"
+#include "stanzawriter.h"
+#include "log.h"
+#include "glib.h"
+#include "gloox/jid.h"
+
+static gboolean processQueue(void *data) {
+	StanzaQueue *queue = (StanzaQueue *) data;
+	return queue->process();
+}
+
+static gboolean resumeQueue(void *data) {
+	StanzaQueue *queue = (StanzaQueue *) data;
+	queue->resume();
+	return FALSE;
+}
+
+StanzaQueue::StanzaQueue(StanzaQueueSender sender, void *data, int budget) : m_sender(sender), m_rawSender(NULL), m_writable(NULL), m_data(data), m_budget(budget),
+	m_sent(0), m_waiting(false), m_dropped(0), m_blocked(0), m_coalesced(0), m_delayed(0), m_latency(0), m_maxLatency(0), m_maxSize(0), m_time(0) {
+	if (m_budget <= 0)
+		m_budget = 1;
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++) {
+		m_classes[i].count = 0;
+		m_classes[i].bytes = 0;
+		m_classes[i].limit = 0;
+	}
+	m_timer = new SpectrumTimer(0, &processQueue, this);
+	m_waitTimer = new SpectrumTimer(STANZA_QUEUE_WAIT, &resumeQueue, this);
+}
+
+StanzaQueue::~StanzaQueue() {
+	delete m_timer;
+	delete m_waitTimer;
+	clear();
+}
+
+long long StanzaQueue::now() {
+	if (m_time != 0)
+		return m_time;
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+StanzaPriority StanzaQueue::getPriority(Tag *tag) {
+	if (tag->name() == "presence") {
+		if (tag->findChild("x", "xmlns", "http://jabber.org/protocol/muc#user"))
+			return STANZA_PRIORITY_BULK;
+		return STANZA_PRIORITY_PRESENCE;
+	}
+	if (tag->name() == "iq" && tag->findAttribute("type") == "result" && tag->findChild("vCard"))
+		return STANZA_PRIORITY_BULK;
+	return STANZA_PRIORITY_HIGH;
+}
+
+unsigned long StanzaQueue::getSize(Tag *tag) {
+	unsigned long size = sizeof(Tag) + tag->name().size() + tag->cdata().size();
+	const Tag::AttributeList &attributes = tag->attributes();
+	for (Tag::AttributeList::const_iterator it = attributes.begin(); it != attributes.end(); it++) {
+		size += sizeof(Tag::Attribute) + (*it)->name().size() + (*it)->value().size();
+	}
+	const TagList &children = tag->children();
+	for (TagList::const_iterator it = children.begin(); it != children.end(); it++) {
+		size += getSize(*it);
+	}
+	return size;
+}
+
+void StanzaQueue::write(Tag *tag, const std::string &xml) {
+	m_sent++;
+	if (tag)
+		m_sender(tag, m_data);
+	else
+		m_rawSender(xml, m_data);
+}
+
+bool StanzaQueue::writable() {
+	return m_writable == NULL || m_writable(m_data);
+}
+
+void StanzaQueue::block() {
+	m_blocked++;
+	m_waiting = true;
+	m_waitTimer->start();
+}
+
+void StanzaQueue::send(Tag *tag) {
+	// Nothing is queued and we haven't reached the budget, so send it directly.
+	if (!m_waiting && m_sent < m_budget && size() == 0) {
+		if (writable()) {
+			write(tag, "");
+			// m_sent is reset in next main loop iteration.
+			m_timer->start();
+			return;
+		}
+		block();
+	}
+
+	std::string coalesceKey;
+	if (tag->name() == "presence") {
+		const std::string &type = tag->findAttribute("type");
+		if (type.empty() || type == "unavailable")
+			coalesceKey = tag->findAttribute("from") + "/" + tag->findAttribute("to");
+	}
+	enqueue(tag, "", getPriority(tag), JID(tag->findAttribute("to")).bare(), coalesceKey, getSize(tag));
+	if (!m_waiting)
+		m_timer->start();
+}
+
+void StanzaQueue::send(StanzaWriter &writer) {
+	const std::string &xml = writer.xml();
+	if (!m_waiting && m_sent < m_budget && size() == 0) {
+		if (writable()) {
+			write(NULL, xml);
+			m_timer->start();
+			return;
+		}
+		block();
+	}
+
+	// StanzaWriter is used only for buddies' presences, so nothing from it
+	// belongs to bulk class.
+	std::string coalesceKey;
+	StanzaPriority priority = STANZA_PRIORITY_HIGH;
+	if (writer.name() == "presence") {
+		priority = STANZA_PRIORITY_PRESENCE;
+		if (writer.type().empty() || writer.type() == "unavailable")
+			coalesceKey = writer.from() + "/" + writer.to();
+	}
+	enqueue(NULL, xml, priority, JID(writer.to()).bare(), coalesceKey, sizeof(Entry) + xml.size());
+	if (!m_waiting)
+		m_timer->start();
+}
+
+void StanzaQueue::enqueue(Tag *tag, const std::string &xml, StanzaPriority priority, const std::string &user,
+						  const std::string &coalesceKey, unsigned long bytes) {
+	Class &c = m_classes[priority];
+
+	Entry *old = NULL;
+	if (!coalesceKey.empty()) {
+		std::map <std::string, Entry *>::iterator it = m_coalesce.find(coalesceKey);
+		if (it != m_coalesce.end())
+			old = it->second;
+	}
+
+	// Check the limit before the old presence is dropped, so we don't lose
+	// both of them. Memory of the old one is freed if it's in the same class.
+	unsigned long freed = old && old->priority == priority ? old->size : 0;
+	if (c.limit != 0 && c.bytes - freed + bytes > c.limit) {
+		Log("StanzaQueue", "queue is full, dropping stanza to " << user);
+		delete tag;
+		m_dropped++;
+		return;
+	}
+
+	// Drop queued presence, the newer one is queued at the end, so it's not
+	// sent before stanzas generated after the old one.
+	if (old) {
+		Class &oldClass = m_classes[old->priority];
+		oldClass.count--;
+		oldClass.bytes -= old->size;
+		delete old->tag;
+		old->tag = NULL;
+		old->xml.clear();
+		old->dropped = true;
+		m_coalesce.erase(coalesceKey);
+		m_coalesced++;
+	}
+
+	promote(priority, user);
+
+	Entry *e = new Entry;
+	e->tag = tag;
+	e->xml = xml;
+	e->coalesceKey = coalesceKey;
+	e->size = bytes;
+	e->time = now();
+	e->priority = priority;
+	e->dropped = false;
+
+	std::list <Entry *> &entries = c.users[user];
+	if (entries.empty())
+		c.order.push_back(user);
+	entries.push_back(e);
+	if (!coalesceKey.empty())
+		m_coalesce[coalesceKey] = e;
+	c.count++;
+	c.bytes += bytes;
+
+	if (size() > m_maxSize)
+		m_maxSize = size();
+}
+
+void StanzaQueue::promote(StanzaPriority priority, const std::string &user) {
+	Class &c = m_classes[priority];
+	// Stanzas in lower classes are always newer than the ones in higher
+	// classes for the same user, so appending keeps the order.
+	for (int i = priority + 1; i < STANZA_PRIORITY_COUNT; i++) {
+		Class &lower = m_classes[i];
+		std::map <std::string, std::list <Entry *> >::iterator it = lower.users.find(user);
+		if (it == lower.users.end())
+			continue;
+
+		std::list <Entry *> &entries = c.users[user];
+		if (entries.empty())
+			c.order.push_back(user);
+		for (std::list <Entry *>::iterator e = it->second.begin(); e != it->second.end(); e++) {
+			if ((*e)->dropped) {
+				delete *e;
+				continue;
+			}
+			lower.count--;
+			lower.bytes -= (*e)->size;
+			c.count++;
+			c.bytes += (*e)->size;
+			(*e)->priority = priority;
+			entries.push_back(*e);
+		}
+		lower.users.erase(it);
+		lower.order.remove(user);
+		if (entries.empty()) {
+			c.users.erase(user);
+			c.order.remove(user);
+		}
+	}
+}
+
+StanzaQueue::Entry *StanzaQueue::pop(Class &c) {
+	while (true) {
+		std::string user = c.order.front();
+		c.order.pop_front();
+
+		std::map <std::string, std::list <Entry *> >::iterator it = c.users.find(user);
+		Entry *e = it->second.front();
+		it->second.pop_front();
+		if (it->second.empty())
+			c.users.erase(it);
+		else
+			c.order.push_back(user);
+
+		if (e->dropped) {
+			delete e;
+			continue;
+		}
+
+		if (!e->coalesceKey.empty())
+			m_coalesce.erase(e->coalesceKey);
+		c.count--;
+		c.bytes -= e->size;
+		return e;
+	}
+}
+
+bool StanzaQueue::process() {
+	m_sent = 0;
+	if (m_waiting)
+		return false;
+	long long t = now();
+	for (int i = 0; i < STANZA_PRIORITY_COUNT && m_sent < m_budget; i++) {
+		Class &c = m_classes[i];
+		while (c.count != 0 && m_sent < m_budget) {
+			if (!writable()) {
+				block();
+				return false;
+			}
+			Entry *e = pop(c);
+			long latency = (long) (t - e->time);
+			m_latency += latency;
+			m_delayed++;
+			if (latency > m_maxLatency)
+				m_maxLatency = latency;
+			write(e->tag, e->xml);
+			delete e;
+		}
+	}
+	// Keep the timer running also when we've just sent something, so m_sent
+	// is reset in next iteration.
+	return m_sent != 0;
+}
+
+void StanzaQueue::resume() {
+	if (!writable()) {
+		m_waitTimer->start();
+		return;
+	}
+	m_waiting = false;
+	if (process())
+		m_timer->start();
+}
+
+void StanzaQueue::clear() {
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++) {
+		Class &c = m_classes[i];
+		for (std::map <std::string, std::list <Entry *> >::iterator it = c.users.begin(); it != c.users.end(); it++) {
+			for (std::list <Entry *>::iterator e = it->second.begin(); e != it->second.end(); e++) {
+				delete (*e)->tag;
+				delete *e;
+			}
+		}
+		c.users.clear();
+		c.order.clear();
+		c.count = 0;
+		c.bytes = 0;
+	}
+	m_coalesce.clear();
+	m_waitTimer->stop();
+	m_waiting = false;
+}
+
+unsigned long StanzaQueue::size() {
+	unsigned long count = 0;
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++)
+		count += m_classes[i].count;
+	return count;
+}
+
+unsigned long StanzaQueue::bytes() {
+	unsigned long total = 0;
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++)
+		total += m_classes[i].bytes;
+	return total;
+}
+
+unsigned long StanzaQueue::bytes(const std::string &user) {
+	unsigned long total = 0;
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++) {
+		std::map <std::string, std::list <Entry *> >::iterator it = m_classes[i].users.find(user);
+		if (it == m_classes[i].users.end())
+			continue;
+		for (std::list <Entry *>::iterator e = (*it).second.begin(); e != (*it).second.end(); e++) {
+			if (!(*e)->dropped)
+				total += (*e)->size;
+		}
+	}
+	return total;
+}
+
+void StanzaQueue::getStats(std::map <std::string, BackendStat> &stats) {
+	const char *names[] = {"high", "presence", "bulk"};
+	for (int i = 0; i < STANZA_PRIORITY_COUNT; i++) {
+		std::string prefix = std::string("queue/") + names[i];
+		stats[prefix].units = "stanzas";
+		stats[prefix].value = m_classes[i].count;
+		stats[prefix + "-memory"].units = "KB";
+		stats[prefix + "-memory"].value = m_classes[i].bytes / 1024;
+	}
+	stats["queue/max-size"].units = "stanzas";
+	stats["queue/max-size"].value = m_maxSize;
+	stats["queue/dropped"].units = "stanzas";
+	stats["queue/dropped"].value = m_dropped;
+	stats["queue/blocked"].units = "times";
+	stats["queue/blocked"].value = m_blocked;
+	stats["queue/coalesced"].units = "stanzas";
+	stats["queue/coalesced"].value = m_coalesced;
+	stats["queue/latency-avg"].units = "ms";
+	stats["queue/latency-avg"].value = m_delayed == 0 ? 0 : (long) (m_latency / m_delayed);
+	stats["queue/latency-max"].units = "ms";
+	stats["queue/latency-max"].value = m_maxLatency;
+}
@@ -0,0 +1,193 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_STANZA_QUEUE_H
+#define SPECTRUM_STANZA_QUEUE_H
+
+#include <string>
+#include <map>
+#include <list>
+#include "gloox/tag.h"
+#include "abstractbackend.h"
+
+using namespace gloox;
+
+class SpectrumTimer;
+
+typedef enum {	STANZA_PRIORITY_HIGH = 0,	// messages and IQs
+				STANZA_PRIORITY_PRESENCE,	// presences of buddies
+				STANZA_PRIORITY_BULK,		// MUC occupants, vCards
+				STANZA_PRIORITY_COUNT
+				} StanzaPriority;
+
+class StanzaWriter;
+
+// Sends the stanza to XMPP server.
+typedef void (*StanzaQueueSender)(Tag *tag, void *data);
+
+// Sends already serialized stanza to XMPP server.
+typedef void (*StanzaQueueRawSender)(const std::string &xml, void *data);
+
+// Returns true if the connection to XMPP server can take more data without
+// blocking.
+typedef bool (*StanzaQueueWritable)(void *data);
+
+// How often (in ms) the queue checks if the connection is writable again.
+#define STANZA_QUEUE_WAIT 20
+
+// Outbound stanza scheduler used by Transport::send.
+//
+// At most `budget` stanzas are written in one main loop iteration. While it's
+// not reached, stanzas are sent immediately. Others are queued and sent in
+// next iterations in priority order (messages/IQs, presences, bulk) and
+// round-robin between users in every class, so one user with huge roster
+// doesn't delay messages of others.
+//
+// Stanzas for one recipient (bare JID) are always sent in the order they were
+// generated. When stanza is queued in higher class, stanzas for the same
+// recipient queued in lower classes are moved before it into its class, so
+// for example buddy's presence is not sent after his message.
+//
+// Queued presences of the same from/to pair are coalesced to the latest one;
+// the old one is dropped and the new one is queued at the end. Every class can
+// have memory limit; new stanza which doesn't fit into it is dropped.
+//
+// The budget only spreads sending between main loop iterations. Backpressure
+// comes from StanzaQueueWritable: when the connection can't take more data,
+// nothing is sent, new stanzas are queued and the connection is checked again
+// every STANZA_QUEUE_WAIT ms, so slow XMPP server makes the queue (and its
+// memory limits) grow instead of data buffered in the socket.
+class StanzaQueue {
+	public:
+		// `sender` - function which really sends the stanza.
+		// `budget` - maximum number of stanzas sent in one main loop iteration.
+		StanzaQueue(StanzaQueueSender sender, void *data, int budget = 100);
+		~StanzaQueue();
+
+		// Sets memory limit for given class in bytes. 0 means no limit.
+		void setLimit(StanzaPriority priority, unsigned long limit) { m_classes[priority].limit = limit; }
+
+		// Sets function used to send stanzas generated by StanzaWriter.
+		void setRawSender(StanzaQueueRawSender sender) { m_rawSender = sender; }
+
+		// Sets function which tells if the connection is writable. Without it,
+		// the connection is always considered writable.
+		void setWritable(StanzaQueueWritable writable) { m_writable = writable; }
+
+		// Sends or queues the stanza. Takes ownership of the tag.
+		void send(Tag *tag);
+
+		// Sends or queues the stanza from StanzaWriter. Queued stanza is
+		// copied, so the writer can be reused.
+		void send(StanzaWriter &writer);
+
+		// Sends queued stanzas in this main loop iteration. Returns true if there
+		// are still some queued stanzas. Called by timer.
+		bool process();
+
+		// Called by timer while the connection is not writable. Starts sending
+		// queued stanzas once it's writable again.
+		void resume();
+
+		// Removes all queued stanzas (for example when the connection is lost).
+		void clear();
+
+		// Returns number of queued stanzas.
+		unsigned long size();
+		unsigned long size(StanzaPriority priority) { return m_classes[priority].count; }
+
+		// Returns memory used by queued stanzas in given class.
+		unsigned long bytes(StanzaPriority priority) { return m_classes[priority].bytes; }
+
+		// Returns memory used by all queued stanzas.
+		unsigned long bytes();
+
+		// Returns memory used by stanzas queued for given user (bare JID).
+		unsigned long bytes(const std::string &user);
+
+		long getDropped() { return m_dropped; }
+		long getBlocked() { return m_blocked; }
+		long getCoalesced() { return m_coalesced; }
+
+		// Returns statistics for http://jabber.org/protocol/stats.
+		void getStats(std::map <std::string, BackendStat> &stats);
+
+		// Returns priority class of the stanza.
+		static StanzaPriority getPriority(Tag *tag);
+
+		// Returns approximate memory used by the tag.
+		static unsigned long getSize(Tag *tag);
+
+		// Sets current time in ms. Used only by tests, if it's 0, real time is used.
+		void setTime(long long t) { m_time = t; }
+
+	private:
+		struct Entry {
+			Tag *tag;					// NULL if the stanza is already serialized in xml
+			std::string xml;
+			std::string coalesceKey;	// from/to pair if the stanza can be coalesced
+			unsigned long size;
+			long long time;				// when the stanza was queued
+			StanzaPriority priority;	// class the stanza is queued in
+			bool dropped;				// replaced by newer presence, skipped when it's popped
+		};
+
+		struct Class {
+			std::map <std::string, std::list <Entry *> > users;	// user -> queued stanzas
+			std::list <std::string> order;						// users with queued stanzas, round-robin
+			unsigned long count;								// without dropped stanzas
+			unsigned long bytes;
+			unsigned long limit;
+		};
+
+		long long now();
+		void enqueue(Tag *tag, const std::string &xml, StanzaPriority priority, const std::string &user,
+					 const std::string &coalesceKey, unsigned long bytes);
+		void write(Tag *tag, const std::string &xml);
+		bool writable();
+		// Stops sending until the connection is writable again.
+		void block();
+		Entry *pop(Class &c);
+		// Moves stanzas for `user` queued in classes lower than `priority` to
+		// the end of the user's stanzas in `priority` class.
+		void promote(StanzaPriority priority, const std::string &user);
+
+		StanzaQueueSender m_sender;
+		StanzaQueueRawSender m_rawSender;
+		StanzaQueueWritable m_writable;
+		void *m_data;
+		int m_budget;
+		int m_sent;						// stanzas sent in current main loop iteration
+		Class m_classes[STANZA_PRIORITY_COUNT];
+		std::map <std::string, Entry *> m_coalesce;	// from/to pair -> queued presence
+		SpectrumTimer *m_timer;
+		SpectrumTimer *m_waitTimer;		// running while the connection is not writable
+		bool m_waiting;
+		long m_dropped;
+		long m_blocked;					// how many times the connection was not writable
+		long m_coalesced;
+		long m_delayed;					// number of stanzas sent from queue
+		long long m_latency;			// sum of latencies of m_delayed stanzas in ms
+		long m_maxLatency;
+		unsigned long m_maxSize;
+		long long m_time;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "stanzawriter.h"
+#include "textsanitizer.h"
+
+StanzaWriter::StanzaWriter() : m_startTagOpen(false) {
+}
+
+StanzaWriter &StanzaWriter::instance() {
+	static StanzaWriter writer;
+	return writer;
+}
+
+void StanzaWriter::start(const std::string &name) {
+	m_xml.clear();
+	m_open.clear();
+	m_name = name;
+	m_type.clear();
+	m_from.clear();
+	m_to.clear();
+	m_startTagOpen = false;
+	startChild(name);
+}
+
+void StanzaWriter::appendEscaped(const std::string &text) {
+	// Invalid characters are replaced, so the rest of the text is not lost.
+	if (!isValidXMLText(text)) {
+		std::string sanitized(text);
+		sanitizeXMLText(sanitized);
+		appendEscaped(sanitized);
+		return;
+	}
+
+	// Same characters as gloox's util::escape.
+	size_t last = 0;
+	for (size_t i = 0; i < text.size(); i++) {
+		const char *entity;
+		switch (text[i]) {
+			case '&': entity = "&amp;"; break;
+			case '<': entity = "&lt;"; break;
+			case '>': entity = "&gt;"; break;
+			case '\'': entity = "&apos;"; break;
+			case '"': entity = "&quot;"; break;
+			default: continue;
+		}
+		m_xml.append(text, last, i - last);
+		m_xml.append(entity);
+		last = i + 1;
+	}
+	m_xml.append(text, last, std::string::npos);
+}
+
+void StanzaWriter::closeStartTag() {
+	if (m_startTagOpen) {
+		m_xml += '>';
+		m_startTagOpen = false;
+	}
+}
+
+void StanzaWriter::addAttribute(const std::string &name, const std::string &value) {
+	if (!m_startTagOpen || name.empty() || value.empty())
+		return;
+	if (m_open.size() == 1) {
+		if (name == "type")
+			m_type = value;
+		else if (name == "from")
+			m_from = value;
+		else if (name == "to")
+			m_to = value;
+	}
+	m_xml += ' ';
+	m_xml += name;
+	m_xml += "='";
+	appendEscaped(value);
+	m_xml += '\'';
+}
+
+void StanzaWriter::addChild(const std::string &name, const std::string &cdata) {
+	closeStartTag();
+	m_xml += '<';
+	m_xml += name;
+	if (cdata.empty()) {
+		m_xml += "/>";
+		return;
+	}
+	m_xml += '>';
+	appendEscaped(cdata);
+	m_xml += "</";
+	m_xml += name;
+	m_xml += '>';
+}
+
+void StanzaWriter::startChild(const std::string &name) {
+	closeStartTag();
+	m_xml += '<';
+	m_xml += name;
+	m_open.push_back(name);
+	m_startTagOpen = true;
+}
+
+void StanzaWriter::endChild() {
+	if (m_open.empty())
+		return;
+	if (m_startTagOpen) {
+		m_xml += "/>";
+		m_startTagOpen = false;
+	}
+	else {
+		m_xml += "</";
+		m_xml += m_open.back();
+		m_xml += '>';
+	}
+	m_open.pop_back();
+}
+
+void StanzaWriter::addCData(const std::string &cdata) {
+	if (m_open.empty() || cdata.empty())
+		return;
+	closeStartTag();
+	appendEscaped(cdata);
+}
+
+const std::string &StanzaWriter::xml() {
+	while (!m_open.empty())
+		endChild();
+	return m_xml;
+}
@@ -0,0 +1,92 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_STANZAWRITER_H
+#define SPECTRUM_STANZAWRITER_H
+
+#include <string>
+#include <vector>
+
+// Serializes stanza directly to string, without building gloox Tag tree.
+// Output is the same as Tag::xml() of the tree built by the same sequence of
+// Tag calls:
+//
+//	StanzaWriter &writer = StanzaWriter::instance();
+//	writer.start("presence");
+//	writer.addAttribute("from", from);			// tag->addAttribute("from", from);
+//	writer.addChild("status", message);			// tag->addChild(new Tag("status", message));
+//	writer.startChild("c");						// Tag *c = new Tag("c");
+//	writer.addAttribute("xmlns", ns);			// c->addAttribute("xmlns", ns);
+//	writer.endChild();							// tag->addChild(c);
+//	Transport::instance()->send(writer);
+//
+// Attributes have to be added before children. As in gloox, attributes with
+// empty value are skipped. Unlike gloox, values and cdata which are not valid
+// XML text are not dropped, invalid characters are replaced (see
+// sanitizeXMLText).
+class StanzaWriter {
+	public:
+		StanzaWriter();
+
+		// Returns writer whose buffer is reused by all generated stanzas.
+		// Stanzas are generated only in main thread, so one is enough.
+		static StanzaWriter &instance();
+
+		// Starts new stanza with given name. Previous content is discarded,
+		// but the buffer is kept.
+		void start(const std::string &name);
+
+		// Adds attribute to the element started last.
+		void addAttribute(const std::string &name, const std::string &value);
+
+		// Adds child element with cdata (or empty element).
+		void addChild(const std::string &name, const std::string &cdata = "");
+
+		// Starts child element. Its attributes and children are added by
+		// following calls until endChild().
+		void startChild(const std::string &name);
+		void endChild();
+
+		// Adds cdata to the element started last.
+		void addCData(const std::string &cdata);
+
+		// Closes all open elements and returns the stanza.
+		const std::string &xml();
+
+		// Stanza name and its attributes used by StanzaQueue.
+		const std::string &name() { return m_name; }
+		const std::string &type() { return m_type; }
+		const std::string &from() { return m_from; }
+		const std::string &to() { return m_to; }
+
+	private:
+		void closeStartTag();
+		void appendEscaped(const std::string &text);
+
+		std::string m_xml;
+		std::vector <std::string> m_open;	// names of open elements
+		bool m_startTagOpen;				// '>' of the last element hasn't been written yet
+		std::string m_name;
+		std::string m_type;
+		std::string m_from;
+		std::string m_to;
+};
+
+#endif
@@ -28,6 +28,14 @@
 #include "log.h"
 #include "spectrum_util.h"
 #include "transport.h"
+#include "probelimiter.h"
+#include "stanzaqueue.h"
+#include "workscheduler.h"
+#include "spectrumtimer.h"
+#include "spectrummessagehandler.h"
+#include "settingsmanager.h"
+#include "rostermanager.h"
+#include "memoryaccounting.h"
 
 #include "sql.h"
 #include <sstream>
@@ -134,6 +142,57 @@ Tag* GlooxStatsHandler::handleTag (Tag *stanzaTag){
 		t = new Tag("stat");
 		t->addAttribute("name","messages/out");
 		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","probes/dropped");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","probes/suppressed");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","probes/unregistered");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","conversations/reaped");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","conversations/reclaimed-memory");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","chatstates/suppressed-in");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","chatstates/suppressed-out");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","settings/writes");
+		query->addChild(t);
+
+		t = new Tag("stat");
+		t->addAttribute("name","settings/skipped");
+		query->addChild(t);
+
+		std::map <std::string, BackendStat> backendStats;
+		p->sql()->getStats(backendStats);
+		if (p->stanzaQueue())
+			p->stanzaQueue()->getStats(backendStats);
+		if (p->workScheduler())
+			p->workScheduler()->getStats(backendStats);
+		SpectrumTimer::getStats(backendStats);
+		SpectrumRosterManager::getStats(backendStats);
+		MemoryAccounting::getStats(backendStats);
+		for (std::map <std::string, BackendStat>::iterator it = backendStats.begin(); it != backendStats.end(); it++) {
+			t = new Tag("stat");
+			t->addAttribute("name", it->first);
+			query->addChild(t);
+		}
 		
 #ifndef WIN32
 		t = new Tag("stat");
@@ -166,6 +225,16 @@ Tag* GlooxStatsHandler::handleTag (Tag *stanzaTag){
 
 		long users = p->userManager()->onlineBuddiesCount();
 
+		std::map <std::string, BackendStat> backendStats;
+		p->sql()->getStats(backendStats);
+		if (p->stanzaQueue())
+			p->stanzaQueue()->getStats(backendStats);
+		if (p->workScheduler())
+			p->workScheduler()->getStats(backendStats);
+		SpectrumTimer::getStats(backendStats);
+		SpectrumRosterManager::getStats(backendStats);
+		MemoryAccounting::getStats(backendStats);
+
 		for (std::list<Tag*>::iterator i = stats.begin(); i != stats.end(); i++) {
 			std::string name = (*i)->findAttribute("name");
 			if (name == "uptime") {
@@ -210,6 +279,66 @@ Tag* GlooxStatsHandler::handleTag (Tag *stanzaTag){
 				t->addAttribute("units","messages");
 				t->addAttribute("value",m_messagesOut);
 				query->addChild(t);
+			} else if (name == "probes/dropped") {
+				t = new Tag("stat");
+				t->addAttribute("name","probes/dropped");
+				t->addAttribute("units","stanzas");
+				t->addAttribute("value",p->probeLimiter()->getDropped());
+				query->addChild(t);
+			} else if (name == "probes/suppressed") {
+				t = new Tag("stat");
+				t->addAttribute("name","probes/suppressed");
+				t->addAttribute("units","stanzas");
+				t->addAttribute("value",p->probeLimiter()->getSuppressed());
+				query->addChild(t);
+			} else if (name == "probes/unregistered") {
+				t = new Tag("stat");
+				t->addAttribute("name","probes/unregistered");
+				t->addAttribute("units","users");
+				t->addAttribute("value",(long) p->probeLimiter()->size());
+				query->addChild(t);
+			} else if (name == "conversations/reaped") {
+				t = new Tag("stat");
+				t->addAttribute("name","conversations/reaped");
+				t->addAttribute("units","conversations");
+				t->addAttribute("value",SpectrumMessageHandler::getReapedConversations());
+				query->addChild(t);
+			} else if (name == "conversations/reclaimed-memory") {
+				t = new Tag("stat");
+				t->addAttribute("name","conversations/reclaimed-memory");
+				t->addAttribute("units","KB");
+				t->addAttribute("value",SpectrumMessageHandler::getReclaimedMemory() / 1024);
+				query->addChild(t);
+			} else if (name == "chatstates/suppressed-in") {
+				t = new Tag("stat");
+				t->addAttribute("name","chatstates/suppressed-in");
+				t->addAttribute("units","stanzas");
+				t->addAttribute("value",SpectrumMessageHandler::getSuppressedChatStatesIn());
+				query->addChild(t);
+			} else if (name == "chatstates/suppressed-out") {
+				t = new Tag("stat");
+				t->addAttribute("name","chatstates/suppressed-out");
+				t->addAttribute("units","stanzas");
+				t->addAttribute("value",SpectrumMessageHandler::getSuppressedChatStatesOut());
+				query->addChild(t);
+			} else if (name == "settings/writes") {
+				t = new Tag("stat");
+				t->addAttribute("name","settings/writes");
+				t->addAttribute("units","settings");
+				t->addAttribute("value",SettingsManager::getSettingsWrites());
+				query->addChild(t);
+			} else if (name == "settings/skipped") {
+				t = new Tag("stat");
+				t->addAttribute("name","settings/skipped");
+				t->addAttribute("units","settings");
+				t->addAttribute("value",SettingsManager::getSettingsSkipped());
+				query->addChild(t);
+			} else if (backendStats.find(name) != backendStats.end()) {
+				t = new Tag("stat");
+				t->addAttribute("name",name);
+				t->addAttribute("units",backendStats[name].units);
+				t->addAttribute("value",backendStats[name].value);
+				query->addChild(t);
 			}
 #ifndef WIN32
 			else if (name == "memory-usage") {
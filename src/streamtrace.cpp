@@ -0,0 +1,73 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "streamtrace.h"
+#include "spectrumtimer.h"
+
+static gboolean flushTrace(void *data) {
+	StreamTrace *trace = (StreamTrace *) data;
+	trace->flush();
+	return TRUE;
+}
+
+StreamTrace::StreamTrace() : m_timer(NULL) {
+}
+
+StreamTrace::~StreamTrace() {
+	if (m_timer)
+		delete m_timer;
+	m_writer.close();
+}
+
+long long StreamTrace::now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool StreamTrace::open(const std::string &file) {
+	if (!m_writer.open(file, now())) {
+		Log("StreamTrace", "Can't create trace file " << file);
+		return false;
+	}
+	Log("StreamTrace", "Recording component stream and libpurple callbacks into " << file);
+	// Flush regularly, so the trace is usable even if Spectrum crashes.
+	if (!m_timer)
+		m_timer = new SpectrumTimer(1000, &flushTrace, this);
+	m_timer->start();
+	return true;
+}
+
+void StreamTrace::flush() {
+	m_writer.flush();
+}
+
+void StreamTrace::callback(const char *name, PurpleAccount *account, PurpleConversation *conv, const char *who, const char *text, const char *extra) {
+	if (conv && !account)
+		account = purple_conversation_get_account(conv);
+	m_writer.writeCallback(now(), name, account ? purple_account_get_username(account) : NULL, conv ? purple_conversation_get_name(conv) : NULL, who, text, extra);
+}
+
+void StreamTrace::handleLog(LogLevel level, LogArea area, const std::string &message) {
+	if (area == LogAreaXmlIncoming)
+		m_writer.write(TRACE_STREAM_IN, now(), message.data(), message.size());
+	else if (area == LogAreaXmlOutgoing)
+		m_writer.write(TRACE_STREAM_OUT, now(), message.data(), message.size());
+}
@@ -0,0 +1,67 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_STREAM_TRACE_H
+#define SPECTRUM_STREAM_TRACE_H
+
+#include <string>
+#include "purple.h"
+#include "gloox/loghandler.h"
+#include "tracefile.h"
+#include "log.h"
+
+using namespace gloox;
+
+extern LogClass Log_;
+
+class SpectrumTimer;
+
+// Records component stream and libpurple callbacks into trace file (see
+// TraceFileWriter), so production load can be replayed offline by
+// tools/trace-replay.
+//
+// Stream is recorded as gloox logs it: every incoming stanza and every
+// outgoing write. Register the trace as gloox LogHandler for
+// LogAreaXmlIncoming | LogAreaXmlOutgoing.
+class StreamTrace : public LogHandler {
+	public:
+		StreamTrace();
+		~StreamTrace();
+
+		// Starts recording into `file`. Returns false if it can't be created.
+		bool open(const std::string &file);
+
+		// Records libpurple callback. `who`, `text` and `extra` are callback
+		// specific, see callers in main.cpp.
+		void callback(const char *name, PurpleAccount *account, PurpleConversation *conv, const char *who = NULL, const char *text = NULL, const char *extra = NULL);
+
+		// Writes buffered records to disk. Called periodically by timer.
+		void flush();
+
+		void handleLog(LogLevel level, LogArea area, const std::string &message);
+
+	private:
+		long long now();
+
+		TraceFileWriter m_writer;
+		SpectrumTimer *m_timer;
+};
+
+#endif
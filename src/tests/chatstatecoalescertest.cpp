@@ -0,0 +1,79 @@
+#include "chatstatecoalescertest.h"
+#include "chatstatecoalescer.h"
+
+void ChatStateCoalescerTest::up (void) {
+	// 1000ms between states, 500ms window for messages
+	m_counter = 0;
+	m_coalescer = new ChatStateCoalescer(1000, 500, &m_counter);
+	m_coalescer->setTime(100000);
+}
+
+void ChatStateCoalescerTest::down (void) {
+	delete m_coalescer;
+}
+
+void ChatStateCoalescerTest::repeatedStates() {
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == true);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == false);
+	m_coalescer->setTime(105000);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == false);
+	CPPUNIT_ASSERT (m_coalescer->getSuppressed() == 2);
+	CPPUNIT_ASSERT (m_counter == 2);
+
+	// other conversations are independent
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user2", "composing") == true);
+	CPPUNIT_ASSERT (m_coalescer->size() == 2);
+}
+
+void ChatStateCoalescerTest::rateLimit() {
+	std::list <std::pair<std::string, std::string> > states;
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == true);
+
+	// paused is deferred and replaced by composing, so nothing changes
+	m_coalescer->setTime(100100);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "paused") == false);
+	CPPUNIT_ASSERT (m_coalescer->hasPending() == true);
+	m_coalescer->setTime(100200);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == false);
+	CPPUNIT_ASSERT (m_coalescer->hasPending() == false);
+	CPPUNIT_ASSERT (m_coalescer->getSuppressed() == 2);
+
+	// paused is forwarded by flush() after the interval
+	m_coalescer->setTime(100300);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "paused") == false);
+	m_coalescer->setTime(100900);
+	m_coalescer->flush(states);
+	CPPUNIT_ASSERT (states.empty());
+	m_coalescer->setTime(101000);
+	m_coalescer->flush(states);
+	CPPUNIT_ASSERT (states.size() == 1);
+	CPPUNIT_ASSERT (states.front().first == "user");
+	CPPUNIT_ASSERT (states.front().second == "paused");
+	CPPUNIT_ASSERT (m_coalescer->hasPending() == false);
+
+	// composing after the interval is forwarded immediately
+	m_coalescer->setTime(102000);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == true);
+}
+
+void ChatStateCoalescerTest::supersededByMessage() {
+	std::list <std::pair<std::string, std::string> > states;
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == true);
+
+	m_coalescer->setTime(103000);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "active") == false);
+	m_coalescer->handleMessage("user");
+	m_coalescer->setTime(104000);
+	m_coalescer->flush(states);
+	CPPUNIT_ASSERT (states.empty());
+	CPPUNIT_ASSERT (m_coalescer->getSuppressed() == 1);
+
+	// message already ended typing
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "active") == false);
+	CPPUNIT_ASSERT (m_coalescer->handleChatState("user", "composing") == true);
+
+	// idle conversations are forgotten
+	m_coalescer->setTime(1000000);
+	m_coalescer->flush(states);
+	CPPUNIT_ASSERT (m_coalescer->size() == 0);
+}
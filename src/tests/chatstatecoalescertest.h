@@ -0,0 +1,33 @@
+#ifndef CHATSTATE_COALESCER_TEST_H
+#define CHATSTATE_COALESCER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class ChatStateCoalescer;
+
+class ChatStateCoalescerTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (ChatStateCoalescerTest);
+	CPPUNIT_TEST (repeatedStates);
+	CPPUNIT_TEST (rateLimit);
+	CPPUNIT_TEST (supersededByMessage);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void repeatedStates();
+		void rateLimit();
+		void supersededByMessage();
+
+	private:
+		ChatStateCoalescer *m_coalescer;
+		long m_counter;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ChatStateCoalescerTest);
+
+#endif
@@ -0,0 +1,71 @@
+#include "flightrecordertest.h"
+#include "flightrecorder.h"
+#include <sstream>
+
+void FlightRecorderTest::wrapAround() {
+	FlightRecorder recorder(3);
+	recorder.record(FLIGHT_STANZA_IN, "message", "chat", 1000000);
+	recorder.record(FLIGHT_CALLBACK, "conv_write_im", "", 2000000);
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 2, recorder.size());
+
+	recorder.record(FLIGHT_SQL, "getSettings", "", 3000000);
+	recorder.record(FLIGHT_STANZA_SEND, "message", "", 4000000);
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 3, recorder.size());
+	CPPUNIT_ASSERT_EQUAL ((unsigned long) 4, recorder.recorded());
+
+	// the oldest event is overwritten
+	std::string dump = recorder.dump();
+	CPPUNIT_ASSERT (dump.find("chat") == std::string::npos);
+	CPPUNIT_ASSERT (dump.find("callback conv_write_im") < dump.find("sql      getSettings"));
+	CPPUNIT_ASSERT (dump.find("sql      getSettings") < dump.find("send     message"));
+
+	recorder.clear();
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 0, recorder.size());
+	CPPUNIT_ASSERT (recorder.dump().empty());
+}
+
+void FlightRecorderTest::dump() {
+	FlightRecorder recorder;
+	recorder.record(FLIGHT_CALLBACK, "conv_write_im", "buddy@icq", 1000000);
+	recorder.record(FLIGHT_STANZA_SEND, "message", "chat", 1002500);
+	recorder.record(FLIGHT_STANZA_OUT, "message", "chat", 1012500);
+
+	std::istringstream in(recorder.dump());
+	std::string line;
+	std::getline(in, line);
+	CPPUNIT_ASSERT (line.find("   +0.000 ms callback conv_write_im buddy@icq") != std::string::npos);
+	std::getline(in, line);
+	CPPUNIT_ASSERT (line.find("   +2.500 ms send     message chat") != std::string::npos);
+	std::getline(in, line);
+	CPPUNIT_ASSERT (line.find("  +10.000 ms out      message chat") != std::string::npos);
+	CPPUNIT_ASSERT (!std::getline(in, line));
+}
+
+void FlightRecorderTest::storageId() {
+	FlightRecorderManager manager;
+
+	// User isn't registered yet, so storage calls can't be mapped to the user.
+	manager.enable("user@localhost");
+	manager.record(5, FLIGHT_SQL, "getSettings");
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 0, manager.getRecorder("user@localhost")->size());
+
+	// Storage ID is resolved at login.
+	manager.setStorageId("user@localhost/psi", 5);
+	manager.record(5, FLIGHT_SQL, "getSettings");
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 1, manager.getRecorder("user@localhost")->size());
+
+	// New ID replaces the old one.
+	manager.setStorageId("user@localhost", 6);
+	manager.record(5, FLIGHT_SQL, "getSettings");
+	manager.record(6, FLIGHT_SQL, "setUserOnline");
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 2, manager.getRecorder("user@localhost")->size());
+
+	// Users without recorder are ignored.
+	manager.setStorageId("other@localhost", 7);
+	manager.record(7, FLIGHT_SQL, "getSettings");
+	CPPUNIT_ASSERT_EQUAL ((unsigned int) 2, manager.getRecorder("user@localhost")->size());
+
+	manager.disable("user@localhost");
+	manager.record(6, FLIGHT_SQL, "getSettings");
+	CPPUNIT_ASSERT (manager.getRecorder("user@localhost") == NULL);
+}
@@ -0,0 +1,27 @@
+#ifndef FLIGHT_RECORDER_TEST_H
+#define FLIGHT_RECORDER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class FlightRecorderTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (FlightRecorderTest);
+	CPPUNIT_TEST (wrapAround);
+	CPPUNIT_TEST (dump);
+	CPPUNIT_TEST (storageId);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void) {}
+		void down (void) {}
+
+	protected:
+		void wrapAround();
+		void dump();
+		void storageId();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (FlightRecorderTest);
+
+#endif
@@ -0,0 +1,155 @@
+#include "kvstoretest.h"
+#include "kvstore.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#define KVSTORE_TEST_FILE "kvstoretest.db"
+
+void KVStoreTest::up (void) {
+	unlink(KVSTORE_TEST_FILE);
+	m_store = new KVStore(KVSTORE_TEST_FILE, false);
+	CPPUNIT_ASSERT (m_store->open());
+}
+
+void KVStoreTest::down (void) {
+	delete m_store;
+	unlink(KVSTORE_TEST_FILE);
+}
+
+void KVStoreTest::reopen() {
+	delete m_store;
+	m_store = new KVStore(KVSTORE_TEST_FILE, false);
+	CPPUNIT_ASSERT (m_store->open());
+}
+
+void KVStoreTest::putAndGet() {
+	std::string value;
+	m_store->put("user/a@example.com", "a");
+	m_store->put("user/b@example.com", "b");
+	m_store->put("id/1", "a@example.com");
+	m_store->remove("user/b@example.com");
+	CPPUNIT_ASSERT (m_store->get("user/a@example.com", value));
+	CPPUNIT_ASSERT (value == "a");
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->size() == 2);
+	CPPUNIT_ASSERT (m_store->get("user/a@example.com", value));
+	CPPUNIT_ASSERT (value == "a");
+	CPPUNIT_ASSERT (!m_store->get("user/b@example.com", value));
+	CPPUNIT_ASSERT (m_store->keys("user/").size() == 1);
+}
+
+void KVStoreTest::batch() {
+	std::string value;
+	m_store->beginBatch();
+	m_store->put("a", "1");
+	m_store->put("b", "2");
+	m_store->remove("a");
+	CPPUNIT_ASSERT (m_store->get("b", value));
+	CPPUNIT_ASSERT (m_store->getBatches() == 0);
+	CPPUNIT_ASSERT (m_store->commitBatch());
+	CPPUNIT_ASSERT (m_store->getBatches() == 1);
+
+	reopen();
+	CPPUNIT_ASSERT (!m_store->contains("a"));
+	CPPUNIT_ASSERT (m_store->get("b", value));
+	CPPUNIT_ASSERT (value == "2");
+}
+
+void KVStoreTest::brokenBatch() {
+	std::string value;
+	m_store->put("a", "1");
+
+	// Simulate crash during write.
+	int fd = open(KVSTORE_TEST_FILE, O_WRONLY | O_APPEND);
+	CPPUNIT_ASSERT (write(fd, "SPKB\1\0\0\0\xff\0\0\0broken", 18) == 18);
+	close(fd);
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->get("a", value));
+	m_store->put("b", "2");
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->get("a", value));
+	CPPUNIT_ASSERT (m_store->get("b", value));
+	CPPUNIT_ASSERT (value == "2");
+}
+
+void KVStoreTest::malformedBatch() {
+	std::string value;
+	m_store->put("a", "1");
+
+	// Checksum is right, but the only record has unknown op.
+	std::string data("\7\0\0\0\1\0\0\0\1\0\0\0b2", 14);
+	uint32_t sum = 2166136261U;
+	for (size_t i = 0; i < data.size(); i++) {
+		sum ^= (unsigned char) data[i];
+		sum *= 16777619U;
+	}
+	int32_t header[3] = {1, (int32_t) data.size(), (int32_t) sum};
+	int fd = open(KVSTORE_TEST_FILE, O_WRONLY | O_APPEND);
+	CPPUNIT_ASSERT (write(fd, "SPKB", 4) == 4);
+	CPPUNIT_ASSERT (write(fd, header, sizeof(header)) == sizeof(header));
+	CPPUNIT_ASSERT (write(fd, data.c_str(), data.size()) == (ssize_t) data.size());
+	close(fd);
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->size() == 1);
+	CPPUNIT_ASSERT (!m_store->contains("b"));
+	m_store->put("c", "3");
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->get("c", value));
+	CPPUNIT_ASSERT (value == "3");
+}
+
+void KVStoreTest::compact() {
+	std::string value;
+	m_store->put("a", "1");
+	for (int i = 0; i < 100; i++)
+		m_store->put("b", std::string(20000, 'x'));
+	CPPUNIT_ASSERT (m_store->needsCompaction());
+	CPPUNIT_ASSERT (m_store->compact());
+	CPPUNIT_ASSERT (!m_store->needsCompaction());
+	CPPUNIT_ASSERT (m_store->getDeadBytes() == 0);
+
+	reopen();
+	CPPUNIT_ASSERT (m_store->size() == 2);
+	CPPUNIT_ASSERT (m_store->get("a", value));
+	CPPUNIT_ASSERT (value == "1");
+}
+
+void KVStoreTest::userRecord() {
+	KVUserRecord record;
+	record.id = 5;
+	if (sizeof(long) > 4)
+		record.id += (long) 1 << 40;
+	record.jid = "user@example.com";
+	record.uin = "123456";
+	record.serverJid = "user@example.com";
+	record.server = "%irc.example.com";
+	record.settings["enable_avatars"].type = 1;
+	record.settings["enable_avatars"].value = "1";
+	KVBuddy &buddy = record.buddies["654321"];
+	buddy.id = 7;
+	buddy.uin = "654321";
+	buddy.flags = 1;
+	buddy.settings["alias"].type = 1;
+	buddy.settings["alias"].value = "Friend";
+
+	m_store->put(KV_USER_PREFIX + record.jid, record.serialize());
+	reopen();
+
+	std::string value;
+	KVUserRecord parsed;
+	CPPUNIT_ASSERT (m_store->get(KV_USER_PREFIX + record.jid, value));
+	CPPUNIT_ASSERT (parsed.parse(value));
+	CPPUNIT_ASSERT (parsed.id == record.id);
+	CPPUNIT_ASSERT (parsed.uin == "123456");
+	CPPUNIT_ASSERT (parsed.server == "%irc.example.com");
+	CPPUNIT_ASSERT (parsed.settings["enable_avatars"].value == "1");
+	CPPUNIT_ASSERT (parsed.findBuddy(7) != NULL);
+	CPPUNIT_ASSERT (parsed.findBuddy(7)->settings["alias"].value == "Friend");
+	CPPUNIT_ASSERT (!parsed.parse(value.substr(0, value.size() - 1)));
+}
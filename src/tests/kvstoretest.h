@@ -0,0 +1,40 @@
+#ifndef KVSTORE_TEST_H
+#define KVSTORE_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class KVStore;
+
+class KVStoreTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (KVStoreTest);
+	CPPUNIT_TEST (putAndGet);
+	CPPUNIT_TEST (batch);
+	CPPUNIT_TEST (brokenBatch);
+	CPPUNIT_TEST (malformedBatch);
+	CPPUNIT_TEST (compact);
+	CPPUNIT_TEST (userRecord);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void putAndGet();
+		void batch();
+		void brokenBatch();
+		void malformedBatch();
+		void compact();
+		void userRecord();
+
+	private:
+		void reopen();
+
+		KVStore *m_store;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (KVStoreTest);
+
+#endif
@@ -0,0 +1,105 @@
+#include "localizationtest.h"
+#include "localization.h"
+#include <unistd.h>
+
+#define MO_FILE "/tmp/spectrum-test.mo"
+
+// Header (7 words), original and translated string tables (2 words each),
+// hash table (3 words), strings.
+#define MO_HASH_SIZE 3
+#define MO_STRINGS (7 * 4 + 2 * 8 + MO_HASH_SIZE * 4)
+
+void LocalizationTest::up (void) {
+	unlink(MO_FILE);
+}
+
+void LocalizationTest::down (void) {
+	unlink(MO_FILE);
+}
+
+static void appendWord(std::string &data, guint32 word, bool bigEndian) {
+	word = bigEndian ? GUINT32_TO_BE(word) : GUINT32_TO_LE(word);
+	data.append((const char *) &word, 4);
+}
+
+std::string LocalizationTest::buildCatalog(bool bigEndian) {
+	std::string data;
+	guint32 header[7] = {0x950412DE, 0, 1, 28, 36, MO_HASH_SIZE, 44};
+	for (int i = 0; i < 7; i++)
+		appendWord(data, header[i], bigEndian);
+	// "Hello" at MO_STRINGS, "Ahoj" right after its NUL
+	appendWord(data, 5, bigEndian);
+	appendWord(data, MO_STRINGS, bigEndian);
+	appendWord(data, 4, bigEndian);
+	appendWord(data, MO_STRINGS + 6, bigEndian);
+	// every hash slot points to the only message, so the lookup finds it
+	// wherever it starts
+	for (int i = 0; i < MO_HASH_SIZE; i++)
+		appendWord(data, 1, bigEndian);
+	data.append("Hello", 6);
+	data.append("Ahoj", 5);
+	return data;
+}
+
+void LocalizationTest::writeCatalog(const std::string &data) {
+	CPPUNIT_ASSERT (g_file_set_contents(MO_FILE, data.c_str(), data.size(), NULL));
+}
+
+void LocalizationTest::littleEndian() {
+	writeCatalog(buildCatalog(false));
+	MoFile mo(MO_FILE);
+	CPPUNIT_ASSERT (mo.isLoaded());
+	CPPUNIT_ASSERT (mo.isReversed() == (G_BYTE_ORDER == G_BIG_ENDIAN));
+	CPPUNIT_ASSERT (std::string(mo.lookup("Hello")) == "Ahoj");
+	CPPUNIT_ASSERT (mo.lookup("Bye") == NULL);
+}
+
+void LocalizationTest::bigEndian() {
+	writeCatalog(buildCatalog(true));
+	MoFile mo(MO_FILE);
+	CPPUNIT_ASSERT (mo.isLoaded());
+	CPPUNIT_ASSERT (mo.isReversed() == (G_BYTE_ORDER == G_LITTLE_ENDIAN));
+	CPPUNIT_ASSERT (std::string(mo.lookup("Hello")) == "Ahoj");
+	CPPUNIT_ASSERT (mo.lookup("Bye") == NULL);
+}
+
+void LocalizationTest::truncated() {
+	std::string data = buildCatalog(false);
+
+	// hash table is not complete
+	writeCatalog(data.substr(0, 50));
+	MoFile mo(MO_FILE);
+	CPPUNIT_ASSERT (!mo.isLoaded());
+	CPPUNIT_ASSERT (mo.lookup("Hello") == NULL);
+
+	// translated string is cut off
+	writeCatalog(data.substr(0, data.size() - 2));
+	MoFile cut(MO_FILE);
+	CPPUNIT_ASSERT (cut.isLoaded());
+	CPPUNIT_ASSERT (cut.lookup("Hello") == NULL);
+}
+
+void LocalizationTest::corrupted() {
+	std::string data = buildCatalog(false);
+
+	// wrong magic
+	data[0] ^= 1;
+	writeCatalog(data);
+	MoFile magic(MO_FILE);
+	CPPUNIT_ASSERT (!magic.isLoaded());
+
+	// original string points out of the file
+	data = buildCatalog(false);
+	data.replace(32, 4, "\xff\xff\xff\x7f", 4);
+	writeCatalog(data);
+	MoFile offset(MO_FILE);
+	CPPUNIT_ASSERT (offset.isLoaded());
+	CPPUNIT_ASSERT (offset.lookup("Hello") == NULL);
+
+	// hash table size 0 would be division by zero
+	data = buildCatalog(false);
+	data.replace(20, 4, std::string(4, '\0'));
+	writeCatalog(data);
+	MoFile hash(MO_FILE);
+	CPPUNIT_ASSERT (!hash.isLoaded());
+}
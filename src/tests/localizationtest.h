@@ -0,0 +1,34 @@
+#ifndef LOCALIZATION_TEST_H
+#define LOCALIZATION_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class LocalizationTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (LocalizationTest);
+	CPPUNIT_TEST (littleEndian);
+	CPPUNIT_TEST (bigEndian);
+	CPPUNIT_TEST (truncated);
+	CPPUNIT_TEST (corrupted);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void littleEndian();
+		void bigEndian();
+		void truncated();
+		void corrupted();
+
+	private:
+		// Writes .mo catalog translating "Hello" to "Ahoj" into MO_FILE.
+		std::string buildCatalog(bool bigEndian);
+		void writeCatalog(const std::string &data);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (LocalizationTest);
+
+#endif
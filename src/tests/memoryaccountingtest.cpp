@@ -0,0 +1,71 @@
+#include "memoryaccountingtest.h"
+#include "memoryaccounting.h"
+
+void MemoryAccountingTest::up (void) {
+}
+
+void MemoryAccountingTest::down (void) {
+}
+
+static void addUser(unsigned long *totals, std::vector <MemoryAccounting::UserUsage> &users, const std::string &jid, unsigned long roster, unsigned long filetransfers) {
+	unsigned long usage[MEMORY_SUBSYSTEM_COUNT];
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+		usage[i] = 0;
+	usage[MEMORY_ROSTER] = roster;
+	usage[MEMORY_FILETRANSFERS] = filetransfers;
+	MemoryAccounting::addUser(totals, users, jid, usage);
+}
+
+void MemoryAccountingTest::totals() {
+	unsigned long totals[MEMORY_SUBSYSTEM_COUNT];
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+		totals[i] = 0;
+	std::vector <MemoryAccounting::UserUsage> users;
+
+	addUser(totals, users, "a@localhost", 100, 10);
+	addUser(totals, users, "b@localhost", 200, 0);
+
+	CPPUNIT_ASSERT(users.size() == 2);
+	CPPUNIT_ASSERT(users[0].jid == "a@localhost");
+	CPPUNIT_ASSERT(users[0].usage[MEMORY_ROSTER] == 100);
+	CPPUNIT_ASSERT(users[0].usage[MEMORY_FILETRANSFERS] == 10);
+	CPPUNIT_ASSERT(users[0].total == 110);
+	CPPUNIT_ASSERT(users[1].total == 200);
+
+	CPPUNIT_ASSERT(totals[MEMORY_ROSTER] == 300);
+	CPPUNIT_ASSERT(totals[MEMORY_FILETRANSFERS] == 10);
+	CPPUNIT_ASSERT(totals[MEMORY_MUC] == 0);
+}
+
+void MemoryAccountingTest::topUsers() {
+	unsigned long totals[MEMORY_SUBSYSTEM_COUNT];
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++)
+		totals[i] = 0;
+	std::vector <MemoryAccounting::UserUsage> users;
+
+	addUser(totals, users, "a@localhost", 100, 0);
+	addUser(totals, users, "b@localhost", 300, 0);
+	addUser(totals, users, "c@localhost", 200, 0);
+
+	// Limit keeps only the biggest users.
+	std::vector <MemoryAccounting::UserUsage> top(users);
+	MemoryAccounting::sortUsers(top, 2);
+	CPPUNIT_ASSERT(top.size() == 2);
+	CPPUNIT_ASSERT(top[0].jid == "b@localhost");
+	CPPUNIT_ASSERT(top[1].jid == "c@localhost");
+
+	// Limit 0 returns all users.
+	MemoryAccounting::sortUsers(users, 0);
+	CPPUNIT_ASSERT(users.size() == 3);
+	CPPUNIT_ASSERT(users[0].jid == "b@localhost");
+	CPPUNIT_ASSERT(users[2].jid == "a@localhost");
+
+	// Totals are not affected by the limit.
+	CPPUNIT_ASSERT(totals[MEMORY_ROSTER] == 600);
+}
+
+void MemoryAccountingTest::subsystemNames() {
+	CPPUNIT_ASSERT(std::string(MemoryAccounting::subsystemName(MEMORY_ROSTER)) == "roster");
+	CPPUNIT_ASSERT(std::string(MemoryAccounting::subsystemName(MEMORY_STANZA_QUEUE)) == "stanza-queue");
+	CPPUNIT_ASSERT(std::string(MemoryAccounting::subsystemName(MEMORY_SUBSYSTEM_COUNT)) == "unknown");
+}
@@ -0,0 +1,27 @@
+#ifndef MEMORY_ACCOUNTING_TEST_H
+#define MEMORY_ACCOUNTING_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class MemoryAccountingTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (MemoryAccountingTest);
+	CPPUNIT_TEST (totals);
+	CPPUNIT_TEST (topUsers);
+	CPPUNIT_TEST (subsystemNames);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void totals();
+		void topUsers();
+		void subsystemNames();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (MemoryAccountingTest);
+
+#endif
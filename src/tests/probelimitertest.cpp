@@ -0,0 +1,58 @@
+#include "probelimitertest.h"
+#include "probelimiter.h"
+
+void ProbeLimiterTest::up (void) {
+	// ttl 300s, 2 entries, 2 probes at once, 1 probe per 60s
+	m_limiter = new ProbeLimiter(300, 2, 2, 60);
+	m_limiter->setTime(1000);
+}
+
+void ProbeLimiterTest::down (void) {
+	delete m_limiter;
+}
+
+void ProbeLimiterTest::negativeCache() {
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user@example.com") == false);
+	m_limiter->setUnregistered("user@example.com");
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user@example.com") == true);
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user@example.com") == true);
+	// only stanzas which are really dropped are counted
+	CPPUNIT_ASSERT (m_limiter->getDropped() == 0);
+	m_limiter->countDropped();
+	CPPUNIT_ASSERT (m_limiter->getDropped() == 1);
+
+	m_limiter->setTime(1300);
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user@example.com") == false);
+
+	m_limiter->setUnregistered("user@example.com");
+	m_limiter->forget("user@example.com");
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user@example.com") == false);
+	CPPUNIT_ASSERT (m_limiter->getDropped() == 1);
+}
+
+void ProbeLimiterTest::negativeCacheLimit() {
+	m_limiter->setUnregistered("user1@example.com");
+	m_limiter->setUnregistered("user2@example.com");
+	m_limiter->setUnregistered("user3@example.com");
+	CPPUNIT_ASSERT (m_limiter->size() == 2);
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user1@example.com") == false);
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user2@example.com") == true);
+	CPPUNIT_ASSERT (m_limiter->isUnregistered("user3@example.com") == true);
+}
+
+void ProbeLimiterTest::probeRate() {
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == true);
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == true);
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == false);
+	CPPUNIT_ASSERT (m_limiter->getSuppressed() == 1);
+
+	// other JIDs have their own bucket
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user2@example.com") == true);
+
+	m_limiter->setTime(1030);
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == false);
+	m_limiter->setTime(1060);
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == true);
+	CPPUNIT_ASSERT (m_limiter->canSendProbe("user@example.com") == false);
+	CPPUNIT_ASSERT (m_limiter->getSuppressed() == 3);
+}
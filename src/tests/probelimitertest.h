@@ -0,0 +1,32 @@
+#ifndef PROBE_LIMITER_TEST_H
+#define PROBE_LIMITER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class ProbeLimiter;
+
+class ProbeLimiterTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (ProbeLimiterTest);
+	CPPUNIT_TEST (negativeCache);
+	CPPUNIT_TEST (negativeCacheLimit);
+	CPPUNIT_TEST (probeRate);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void negativeCache();
+		void negativeCacheLimit();
+		void probeRate();
+
+	private:
+		ProbeLimiter *m_limiter;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ProbeLimiterTest);
+
+#endif
@@ -1,6 +1,9 @@
 #include "rostermanagertest.h"
 #include "rostermanager.h"
 #include "transport.h"
+#include "stanzawriter.h"
+#include "testingbackend.h"
+#include "gloox/error.h"
 
 
 void RosterManagerTest::up (void) {
@@ -36,12 +39,12 @@ void RosterManagerTest::setRoster() {
 	CPPUNIT_ASSERT(m_manager->getRosterItem("something") == NULL);
 }
 
-void RosterManagerTest::generatePresenceStanza() {
+void RosterManagerTest::writePresenceStanza() {
 	setRoster();
 	m_buddy1->setStatus(PURPLE_STATUS_AVAILABLE);
 	m_buddy1->setStatusMessage("I'm here");
 	m_buddy1->setIconHash("somehash");
-	Tag *tag;
+	StanzaWriter writer;
 	
 	std::string r;
 	r =	"<presence from='user1%example.com@icq.localhost/bot'>"
@@ -51,16 +54,16 @@ void RosterManagerTest::generatePresenceStanza() {
 				"<photo>somehash</photo>"
 			"</x>"
 		"</presence>";
-	tag = m_buddy1->generatePresenceStanza(TRANSPORT_FEATURE_AVATARS);
-	compare(tag, r);
+	CPPUNIT_ASSERT (m_buddy1->writePresenceStanza(writer, "", TRANSPORT_FEATURE_AVATARS));
+	compare(Transport::instance()->parser()->getTag(writer.xml()), r);
 	clearTags();
 
 	r =	"<presence from='user1%example.com@icq.localhost/bot'>"
 			"<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://spectrum.im/transport' ver='123'/>"
 			"<status>I'm here</status>"
 		"</presence>";
-	tag = m_buddy1->generatePresenceStanza(0);
-	compare(tag, r);
+	CPPUNIT_ASSERT (m_buddy1->writePresenceStanza(writer, "", 0));
+	compare(Transport::instance()->parser()->getTag(writer.xml()), r);
 	clearTags();
 
 	r =	"<presence from='user1%example.com@icq.localhost/bot'>"
@@ -69,8 +72,8 @@ void RosterManagerTest::generatePresenceStanza() {
 			"<status>I'm here</status>"
 		"</presence>";
 	m_buddy1->setStatus(PURPLE_STATUS_AWAY);
-	tag = m_buddy1->generatePresenceStanza(0);
-	compare(tag, r);
+	CPPUNIT_ASSERT (m_buddy1->writePresenceStanza(writer, "", 0));
+	compare(Transport::instance()->parser()->getTag(writer.xml()), r);
 	clearTags();
 
 	r =	"<presence from='user1%example.com@icq.localhost/bot'>"
@@ -78,15 +81,15 @@ void RosterManagerTest::generatePresenceStanza() {
 			"<show>away</show>"
 		"</presence>";
 	m_buddy1->setStatusMessage("");
-	tag = m_buddy1->generatePresenceStanza(0);
-	compare(tag, r);
+	CPPUNIT_ASSERT (m_buddy1->writePresenceStanza(writer, "", 0));
+	compare(Transport::instance()->parser()->getTag(writer.xml()), r);
 	clearTags();
 
 	r =	"<presence from='user1%example.com@icq.localhost/bot' type='unavailable'/>";
 	m_buddy1->setStatusMessage("");
 	m_buddy1->setStatus(PURPLE_STATUS_OFFLINE);
-	tag = m_buddy1->generatePresenceStanza(TRANSPORT_FEATURE_AVATARS);
-	compare(tag, r);
+	CPPUNIT_ASSERT (m_buddy1->writePresenceStanza(writer, "", TRANSPORT_FEATURE_AVATARS));
+	compare(Transport::instance()->parser()->getTag(writer.xml()), r);
 	clearTags();
 }
 
@@ -267,16 +270,9 @@ void RosterManagerTest::handleBuddyCreatedRIE() {
 
 	m_manager->handleBuddyCreated(m_buddy1);
 	testTagCount(0);
-	m_manager->syncBuddiesCallback();
-	testTagCount(0);
-
 	m_manager->handleBuddyCreated(m_buddy2);
-
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
 	
-	m_manager->handleBuddyCreated(m_buddy2);
-	
 	m_manager->syncBuddiesCallback();
 	testTagCount(1);
 	compare(r);
@@ -297,15 +293,8 @@ void RosterManagerTest::handleBuddyCreatedRIEOneBoth() {
 
 	m_manager->handleBuddyCreated(m_buddy1);
 	testTagCount(0);
-	m_manager->syncBuddiesCallback();
-	testTagCount(0);
-
 	m_manager->handleBuddyCreated(m_buddy2);
-
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
-	
-	m_manager->handleBuddyCreated(m_buddy2);
 	// buddies with subscription both should not be sent.
 	m_buddy2->setSubscription("both");
 	
@@ -330,13 +319,8 @@ void RosterManagerTest::handleBuddyCreatedSubscribe() {
 	m_user->setResource("psi", 10, 0); // no features => it should send subscribe instead of RIE.
 	m_manager->handleBuddyCreated(m_buddy1);
 	testTagCount(0);
-	m_manager->syncBuddiesCallback();
-	testTagCount(0);
-
 	m_manager->handleBuddyCreated(m_buddy2);
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
-	m_manager->handleBuddyCreated(m_buddy2);
 	m_manager->syncBuddiesCallback();
 	testTagCount(2);
 	compare(user1);
@@ -355,13 +339,8 @@ void RosterManagerTest::handleBuddyCreatedSubscribeOneBoth() {
 	m_user->setResource("psi", 10, 0); // no features => it should send subscribe instead of RIE.
 	m_manager->handleBuddyCreated(m_buddy1);
 	testTagCount(0);
-	m_manager->syncBuddiesCallback();
-	testTagCount(0);
-
 	m_manager->handleBuddyCreated(m_buddy2);
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
-	m_manager->handleBuddyCreated(m_buddy2);
 	m_buddy2->setSubscription("both");
 	m_manager->syncBuddiesCallback();
 	testTagCount(1);
@@ -382,15 +361,10 @@ void RosterManagerTest::handleBuddyCreatedRemove() {
 		"</iq>";
 	m_manager->handleBuddyCreated(m_buddy1);
 	testTagCount(0);
-	m_manager->syncBuddiesCallback();
-	testTagCount(0);
-
 	m_manager->handleBuddyCreated(m_buddy2);
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
 	
 	m_manager->handleBuddyRemoved(m_buddy1);
-	m_manager->syncBuddiesCallback();
 	testTagCount(0);
 
 	m_manager->syncBuddiesCallback();
@@ -466,3 +440,150 @@ void RosterManagerTest::handleSubscriptionSubscribe() {
 // 	Subscription s(Subscription::Subscribe, JID("user1%example.com@icq.localhost"));
 // 	TODO
 }
+
+static const std::string push1 =
+	"<iq type='set' to='user@example.com' from='icq.localhost'>"
+		"<query xmlns='jabber:iq:roster'>"
+			"<item jid='user1%example.com@icq.localhost' subscription='both' name='Frank'><group>Buddies</group></item>"
+		"</query>"
+	"</iq>";
+static const std::string push2 =
+	"<iq type='set' to='user@example.com' from='icq.localhost'>"
+		"<query xmlns='jabber:iq:roster'>"
+			"<item jid='user2%example.com@icq.localhost' subscription='both' name='Bob'><group>Buddies</group></item>"
+		"</query>"
+	"</iq>";
+
+void RosterManagerTest::rosterPushWindow() {
+	Configuration &cfg = TestingBackend::instance()->getConfiguration();
+	cfg.rosterPushWindow = 1;
+	cfg.rosterPushBatch = 1;
+	setRoster();
+
+	m_manager->queueRosterPush("user1@example.com");
+	m_manager->queueRosterPush("user2@example.com");
+	m_manager->sendRosterPushes();
+	testTagCount(1);
+	compare(push1);
+	CPPUNIT_ASSERT(m_manager->rosterPushesInFlight() == 1);
+	clearTags();
+
+	// result frees the window for the next push and presence is sent right away
+	m_manager->handleIqID(IQ(IQ::Result, JID("user@example.com")), 1);
+	testTagCount(2);
+	compare(push2);
+	CPPUNIT_ASSERT(m_manager->rosterPushesInFlight() == 1);
+	clearTags();
+
+	m_manager->handleIqID(IQ(IQ::Result, JID("user@example.com")), 2);
+	testTagCount(1);
+	CPPUNIT_ASSERT(m_manager->rosterPushesInFlight() == 0);
+}
+
+void RosterManagerTest::rosterPushBatchFallback() {
+	Configuration &cfg = TestingBackend::instance()->getConfiguration();
+	cfg.rosterPushWindow = 1;
+	cfg.rosterPushBatch = 2;
+	setRoster();
+
+	m_manager->queueRosterPush("user1@example.com");
+	m_manager->queueRosterPush("user2@example.com");
+	m_manager->sendRosterPushes();
+	testTagCount(1);
+	compare("<iq type='set' to='user@example.com' from='icq.localhost'>"
+				"<query xmlns='jabber:iq:roster'>"
+					"<item jid='user1%example.com@icq.localhost' subscription='both' name='Frank'><group>Buddies</group></item>"
+					"<item jid='user2%example.com@icq.localhost' subscription='both' name='Bob'><group>Buddies</group></item>"
+				"</query>"
+			"</iq>");
+	clearTags();
+
+	// even permanent error of multi-item push means items are sent one by one
+	IQ error(IQ::Error, JID("user@example.com"));
+	error.addExtension(new Error(StanzaErrorTypeModify, StanzaErrorBadRequest));
+	m_manager->handleIqID(error, 1);
+	testTagCount(1);
+	compare(push1);
+	clearTags();
+
+	m_manager->handleIqID(IQ(IQ::Result, JID("user@example.com")), 2);
+	testTagCount(1);
+	compare(push2);
+}
+
+void RosterManagerTest::rosterPushRetries() {
+	Configuration &cfg = TestingBackend::instance()->getConfiguration();
+	cfg.rosterPushWindow = 1;
+	cfg.rosterPushBatch = 1;
+	setRoster();
+
+	m_manager->queueRosterPush("user1@example.com");
+	m_manager->queueRosterPush("user2@example.com");
+	m_manager->sendRosterPushes();
+	clearTags();
+
+	// temporary error is not retried right away, so the window is free for the next push
+	long long future = (long long) 1 << 62;
+	IQ error(IQ::Error, JID("user@example.com"));
+	error.addExtension(new Error(StanzaErrorTypeWait, StanzaErrorResourceConstraint));
+	m_manager->handleIqID(error, 1);
+	testTagCount(1);
+	compare(push2);
+	clearTags();
+
+	// retried push waits for backoff and for free place in the window
+	m_manager->sendRosterPushes(future);
+	testTagCount(0);
+	m_manager->handleIqID(IQ(IQ::Result, JID("user@example.com")), 2);
+	clearTags();
+	m_manager->sendRosterPushes(future);
+	testTagCount(1);
+	compare(push1);
+	clearTags();
+
+	// it's retried three times, then the push is dropped
+	int context = 3;
+	for (int i = 0; i < 2; i++) {
+		m_manager->handleIqID(error, context++);
+		testTagCount(0);
+		m_manager->sendRosterPushes(future);
+		testTagCount(1);
+		compare(push1);
+		clearTags();
+	}
+	m_manager->handleIqID(error, context++);
+	m_manager->sendRosterPushes(future);
+	testTagCount(0);
+	CPPUNIT_ASSERT(m_manager->rosterPushesInFlight() == 0);
+
+	m_manager->queueRosterPush("user2@example.com");
+	m_manager->sendRosterPushes();
+	clearTags();
+
+	// permanent error is not retried
+	IQ notAllowed(IQ::Error, JID("user@example.com"));
+	notAllowed.addExtension(new Error(StanzaErrorTypeCancel, StanzaErrorNotAllowed));
+	m_manager->handleIqID(notAllowed, context++);
+	testTagCount(0);
+	CPPUNIT_ASSERT(m_manager->rosterPushesInFlight() == 0);
+}
+
+void RosterManagerTest::scheduleSyncMaxDelay() {
+	long long maxDelay = PROTOCOL()->capabilities().rosterSyncMaxDelay;
+	long long t = 1000;
+
+	// buddies coming in the quiet period postpone synchronization...
+	CPPUNIT_ASSERT (m_manager->scheduleSync(t));
+	CPPUNIT_ASSERT (m_manager->scheduleSync(t + maxDelay / 2));
+	CPPUNIT_ASSERT (m_manager->scheduleSync(t + maxDelay - 1));
+
+	// ...but only until rosterSyncMaxDelay passes since the first one
+	CPPUNIT_ASSERT (!m_manager->scheduleSync(t + maxDelay));
+	CPPUNIT_ASSERT (!m_manager->scheduleSync(t + 2 * maxDelay));
+
+	// after synchronization, next buddy starts new period
+	m_manager->syncBuddiesCallback();
+	CPPUNIT_ASSERT (m_manager->scheduleSync(t + 2 * maxDelay));
+	CPPUNIT_ASSERT (m_manager->scheduleSync(t + 3 * maxDelay - 1));
+	CPPUNIT_ASSERT (!m_manager->scheduleSync(t + 3 * maxDelay));
+}
@@ -14,7 +14,7 @@ class SpectrumRosterManager;
 class RosterManagerTest : public AbstractTest {
 	CPPUNIT_TEST_SUITE (RosterManagerTest);
 	CPPUNIT_TEST (setRoster);
-	CPPUNIT_TEST (generatePresenceStanza);
+	CPPUNIT_TEST (writePresenceStanza);
 	CPPUNIT_TEST (sendUnavailablePresenceToAll);
 	CPPUNIT_TEST (sendPresenceToAll);
 	CPPUNIT_TEST (isInRoster);
@@ -31,6 +31,10 @@ class RosterManagerTest : public AbstractTest {
 	CPPUNIT_TEST (handlePresenceProbe);
 	CPPUNIT_TEST (handleAuthorizationRequest);
 	CPPUNIT_TEST (handleSubscriptionSubscribe);
+	CPPUNIT_TEST (rosterPushWindow);
+	CPPUNIT_TEST (rosterPushBatchFallback);
+	CPPUNIT_TEST (rosterPushRetries);
+	CPPUNIT_TEST (scheduleSyncMaxDelay);
 	CPPUNIT_TEST_SUITE_END ();
 
 	public:
@@ -39,7 +43,7 @@ class RosterManagerTest : public AbstractTest {
 
 	protected:
 		void setRoster();
-		void generatePresenceStanza();
+		void writePresenceStanza();
 		void sendUnavailablePresenceToAll();
 		void sendPresenceToAll();
 		void isInRoster();
@@ -56,6 +60,10 @@ class RosterManagerTest : public AbstractTest {
 		void handlePresenceProbe();
 		void handleAuthorizationRequest();
 		void handleSubscriptionSubscribe();
+		void rosterPushWindow();
+		void rosterPushBatchFallback();
+		void rosterPushRetries();
+		void scheduleSyncMaxDelay();
 		
 	private:
 		SpectrumBuddyTest *m_buddy1;
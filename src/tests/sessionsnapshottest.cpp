@@ -0,0 +1,115 @@
+#include "sessionsnapshottest.h"
+#include "sessionsnapshot.h"
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_FILE "/tmp/spectrum-test.snapshot"
+
+void SessionSnapshotTest::up (void) {
+	std::map <std::string, SnapshotUser> users;
+	SnapshotUser &u = users["user@example.com"];
+	u.jid = "user@example.com";
+	u.activeResource = "psi";
+
+	SnapshotResource r;
+	r.name = "psi";
+	r.priority = 5;
+	r.caps = 255;
+	r.show = 2;
+	r.status = "Away from keyboard";
+	u.resources.push_back(r);
+
+	SnapshotBuddy b;
+	b.jid = "123456@icq.localhost";
+	b.status = 2;
+	u.buddies.push_back(b);
+
+	users["user2@example.com"].jid = "user2@example.com";
+
+	m_data = SessionSnapshot::serialize(users, 1000);
+	unlink(SNAPSHOT_FILE);
+}
+
+void SessionSnapshotTest::down (void) {
+	unlink(SNAPSHOT_FILE);
+}
+
+void SessionSnapshotTest::serializeAndParse() {
+	std::map <std::string, SnapshotUser> users;
+	time_t timestamp = 0;
+	CPPUNIT_ASSERT (SessionSnapshot::parse(m_data.c_str(), m_data.size(), users, timestamp));
+	CPPUNIT_ASSERT (timestamp == 1000);
+	CPPUNIT_ASSERT (users.size() == 2);
+
+	SnapshotUser &u = users["user@example.com"];
+	CPPUNIT_ASSERT (u.activeResource == "psi");
+	CPPUNIT_ASSERT (u.resources.size() == 1);
+	CPPUNIT_ASSERT (u.resources.front().priority == 5);
+	CPPUNIT_ASSERT (u.resources.front().caps == 255);
+	CPPUNIT_ASSERT (u.resources.front().status == "Away from keyboard");
+	CPPUNIT_ASSERT (u.buddies.size() == 1);
+	CPPUNIT_ASSERT (u.buddies.front().jid == "123456@icq.localhost");
+
+	CPPUNIT_ASSERT (users["user2@example.com"].resources.empty());
+}
+
+void SessionSnapshotTest::parseBroken() {
+	std::map <std::string, SnapshotUser> users;
+	time_t timestamp = 0;
+
+	// truncated
+	CPPUNIT_ASSERT (!SessionSnapshot::parse(m_data.c_str(), m_data.size() - 1, users, timestamp));
+	CPPUNIT_ASSERT (!SessionSnapshot::parse(m_data.c_str(), 10, users, timestamp));
+
+	// damaged
+	std::string data(m_data);
+	data[data.size() - 1] ^= 1;
+	CPPUNIT_ASSERT (!SessionSnapshot::parse(data.c_str(), data.size(), users, timestamp));
+
+	// wrong magic
+	data = m_data;
+	data[0] = 'X';
+	CPPUNIT_ASSERT (!SessionSnapshot::parse(data.c_str(), data.size(), users, timestamp));
+}
+
+void SessionSnapshotTest::saveUnchanged() {
+	SessionSnapshot snapshot(SNAPSHOT_FILE, 0, 600);
+	snapshot.setTime(1000);
+	// daemonized Spectrum runs with umask 0
+	mode_t mask = umask(0);
+	CPPUNIT_ASSERT (snapshot.save());
+	umask(mask);
+	CPPUNIT_ASSERT (snapshot.getWrites() == 1);
+
+	struct stat st;
+	CPPUNIT_ASSERT (stat(SNAPSHOT_FILE, &st) == 0);
+	CPPUNIT_ASSERT ((st.st_mode & 0777) == 0600);
+	CPPUNIT_ASSERT (stat(SNAPSHOT_FILE ".tmp", &st) != 0);
+
+	// nothing has changed
+	snapshot.setTime(1060);
+	CPPUNIT_ASSERT (snapshot.save());
+	CPPUNIT_ASSERT (snapshot.getWrites() == 1);
+
+	// written again before it's too old to be loaded
+	snapshot.setTime(1300);
+	CPPUNIT_ASSERT (snapshot.save());
+	CPPUNIT_ASSERT (snapshot.getWrites() == 2);
+}
+
+void SessionSnapshotTest::maxAge() {
+	CPPUNIT_ASSERT (g_file_set_contents(SNAPSHOT_FILE, m_data.c_str(), m_data.size(), NULL));
+
+	SessionSnapshot snapshot(SNAPSHOT_FILE, 0, 600);
+	snapshot.setTime(1600);
+	CPPUNIT_ASSERT (snapshot.load());
+	CPPUNIT_ASSERT (snapshot.hasUser("user@example.com"));
+
+	snapshot.setTime(1601);
+	CPPUNIT_ASSERT (!snapshot.load());
+	CPPUNIT_ASSERT (!snapshot.hasUser("user@example.com"));
+
+	// no limit
+	SessionSnapshot unlimited(SNAPSHOT_FILE, 0, 0);
+	CPPUNIT_ASSERT (unlimited.load());
+}
@@ -0,0 +1,32 @@
+#ifndef SESSION_SNAPSHOT_TEST_H
+#define SESSION_SNAPSHOT_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class SessionSnapshotTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (SessionSnapshotTest);
+	CPPUNIT_TEST (serializeAndParse);
+	CPPUNIT_TEST (parseBroken);
+	CPPUNIT_TEST (saveUnchanged);
+	CPPUNIT_TEST (maxAge);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void serializeAndParse();
+		void parseBroken();
+		void saveUnchanged();
+		void maxAge();
+
+	private:
+		std::string m_data;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (SessionSnapshotTest);
+
+#endif
@@ -0,0 +1,93 @@
+#include "settingsmanagertest.h"
+#include "settingsmanager.h"
+#include "transport.h"
+#include "testingbackend.h"
+
+void SettingsManagerTest::up (void) {
+	TestingBackend::instance()->getConfiguration().settingsFlushInterval = 5;
+	m_user = new TestingUser("key", "user@example.com");
+	m_manager = new SettingsManager(m_user);
+
+	// settings as they are loaded from storage
+	GHashTable *settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) purple_value_destroy);
+	PurpleValue *value = purple_value_new(PURPLE_TYPE_BOOLEAN);
+	purple_value_set_boolean(value, true);
+	g_hash_table_replace(settings, g_strdup("enable_avatars"), value);
+	value = purple_value_new(PURPLE_TYPE_STRING);
+	purple_value_set_string(value, "1");
+	g_hash_table_replace(settings, g_strdup("roster_version"), value);
+	value = purple_value_new(PURPLE_TYPE_STRING);
+	purple_value_set_string(value, "Frank");
+	g_hash_table_replace(settings, g_strdup("nickname"), value);
+	m_manager->setSettings(settings);
+}
+
+void SettingsManagerTest::down (void) {
+	delete m_manager;
+	delete m_user;
+	TestingBackend::instance()->reset();
+}
+
+void SettingsManagerTest::dirtyTracking() {
+	TestingBackend *backend = TestingBackend::instance();
+	long skipped = SettingsManager::getSettingsSkipped();
+
+	// unchanged value is not written at all
+	m_manager->updateSetting<bool>("enable_avatars", true);
+	m_manager->updateSetting<std::string>("nickname", "Frank");
+	CPPUNIT_ASSERT (SettingsManager::getSettingsSkipped() == skipped + 2);
+
+	// value changed twice before flush is written once
+	m_manager->updateSetting<std::string>(SETTING_ROSTER_VERSION, "2");
+	m_manager->updateSetting<std::string>("roster_version", "3");
+	CPPUNIT_ASSERT (m_manager->getSetting<std::string>(SETTING_ROSTER_VERSION) == "3");
+	CPPUNIT_ASSERT (backend->getSettingWrites() == 0);
+
+	m_manager->flushSettings();
+	CPPUNIT_ASSERT (backend->getSettingWrites() == 1);
+	CPPUNIT_ASSERT (backend->getSettings()["roster_version"] == "3");
+
+	// nothing is dirty after flush
+	m_manager->flushSettings();
+	CPPUNIT_ASSERT (backend->getSettingWrites() == 1);
+}
+
+void SettingsManagerTest::flushOnDestroy() {
+	TestingBackend *backend = TestingBackend::instance();
+	m_manager->updateSetting<std::string>("nickname", "Bob");
+	m_manager->updateSetting<bool>(SETTING_ENABLE_AVATARS, false);
+	CPPUNIT_ASSERT (backend->getSettingWrites() == 0);
+
+	delete m_manager;
+	m_manager = NULL;
+	CPPUNIT_ASSERT (backend->getSettingWrites() == 2);
+	CPPUNIT_ASSERT (backend->getSettings()["nickname"] == "Bob");
+	CPPUNIT_ASSERT (backend->getSettings()["enable_avatars"] == "0");
+}
+
+void SettingsManagerTest::knownSettings() {
+	CPPUNIT_ASSERT (SettingsManager::findSetting("enable_transport") == SETTING_ENABLE_TRANSPORT);
+	CPPUNIT_ASSERT (SettingsManager::findSetting("roster_version") == SETTING_ROSTER_VERSION);
+	CPPUNIT_ASSERT (SettingsManager::findSetting("nickname") == SETTING_UNKNOWN);
+	CPPUNIT_ASSERT (SettingsManager::findSetting("") == SETTING_UNKNOWN);
+
+	// known settings are converted from their slots
+	PurpleValue *value = m_manager->getSettingValue("enable_avatars");
+	CPPUNIT_ASSERT (value != NULL);
+	CPPUNIT_ASSERT (purple_value_get_type(value) == PURPLE_TYPE_BOOLEAN);
+	CPPUNIT_ASSERT (purple_value_get_boolean(value));
+	m_manager->updateSetting<bool>(SETTING_ENABLE_AVATARS, false);
+	CPPUNIT_ASSERT (!purple_value_get_boolean(m_manager->getSettingValue("enable_avatars")));
+
+	value = m_manager->getSettingValue("roster_version");
+	CPPUNIT_ASSERT (value != NULL);
+	CPPUNIT_ASSERT (std::string(purple_value_get_string(value)) == "1");
+
+	// known setting which is not in storage yet
+	CPPUNIT_ASSERT (m_manager->getSettingValue("enable_transport") == NULL);
+
+	value = m_manager->getSettingValue("nickname");
+	CPPUNIT_ASSERT (value != NULL);
+	CPPUNIT_ASSERT (std::string(purple_value_get_string(value)) == "Frank");
+	CPPUNIT_ASSERT (m_manager->getSettingValue("unknown") == NULL);
+}
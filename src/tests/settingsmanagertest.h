@@ -0,0 +1,34 @@
+#ifndef SETTINGS_MANAGER_TEST_H
+#define SETTINGS_MANAGER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "testinguser.h"
+#include "abstracttest.h"
+
+class SettingsManager;
+
+class SettingsManagerTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (SettingsManagerTest);
+	CPPUNIT_TEST (dirtyTracking);
+	CPPUNIT_TEST (flushOnDestroy);
+	CPPUNIT_TEST (knownSettings);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void dirtyTracking();
+		void flushOnDestroy();
+		void knownSettings();
+
+	private:
+		SettingsManager *m_manager;
+		TestingUser *m_user;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (SettingsManagerTest);
+
+#endif
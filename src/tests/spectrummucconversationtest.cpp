@@ -2,6 +2,7 @@
 #include "spectrummucconversation.h"
 #include "transport.h"
 #include "../capabilityhandler.h"
+#include "../textsanitizer.h"
 
 void SpectrumMUCConversationTest::up (void) {
 	m_user = new TestingUser("key", "user@example.com");
@@ -75,3 +76,24 @@ void SpectrumMUCConversationTest::renameUser() {
 	m_conv->renameUser(m_user, "Frank", "Bob", "Bob the King");
 	testTagCount(2);
 }
+
+void SpectrumMUCConversationTest::sanitizeNicks() {
+	std::string r;
+	r =	"<message to='user@example.com/psi' from='#room%irc.freenode.net@icq.localhost/Fr" SANITIZER_REPLACEMENT "ank' type='groupchat'>"
+			"<body>Hi</body>"
+		"</message>";
+	m_conv->handleMessage(m_user, "Fr\x01" "ank", "Hi", PURPLE_MESSAGE_RECV, time(NULL));
+	testTagCount(1);
+	compare(r);
+	clearTags();
+
+	r =	"<presence from='#room%irc.freenode.net@icq.localhost/Bo" SANITIZER_REPLACEMENT "b' to='user@example.com/psi'>"
+			"<x xmlns='http://jabber.org/protocol/muc#user'>"
+				"<item affiliation='member' role='participant'/>"
+			"</x>"
+		"</presence>";
+	GList *cbuddies = g_list_prepend(NULL, purple_conv_chat_cb_new("Bo\xff" "b", NULL, PURPLE_CBFLAGS_NONE));
+	m_conv->addUsers(m_user, cbuddies);
+	testTagCount(1);
+	compare(r);
+}
@@ -16,6 +16,7 @@ class SpectrumMUCConversationTest : public AbstractTest
 	CPPUNIT_TEST (handleMessage);
 	CPPUNIT_TEST (addUsers);
 	CPPUNIT_TEST (renameUser);
+	CPPUNIT_TEST (sanitizeNicks);
 	CPPUNIT_TEST_SUITE_END ();
 
 	public:
@@ -26,6 +27,7 @@ class SpectrumMUCConversationTest : public AbstractTest
 		void handleMessage();
 		void addUsers();
 		void renameUser();
+		void sanitizeNicks();
 		
 	private:
 		SpectrumMUCConversation *m_conv;
@@ -0,0 +1,157 @@
+#include "spectrumtimertest.h"
+#include "spectrumtimer.h"
+
+struct TestTimer {
+	SpectrumTimer *timer;
+	int fired;
+	int repeat;
+	bool restart;
+	SpectrumTimer *other;
+};
+
+static gboolean testCallback(void *data) {
+	TestTimer *t = (TestTimer *) data;
+	t->fired++;
+	if (t->other) {
+		// deleting timer expired in the same tick
+		delete t->other;
+		t->other = NULL;
+	}
+	if (t->restart) {
+		t->timer->stop();
+		t->timer->start();
+		return FALSE;
+	}
+	return t->fired < t->repeat;
+}
+
+void SpectrumTimerTest::up (void) {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	m_time = (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	SpectrumTimerWheel::instance()->setTime(m_time);
+	// wheel is not running, so this just resets its clock
+	SpectrumTimerWheel::instance()->process();
+}
+
+void SpectrumTimerTest::down (void) {
+	SpectrumTimerWheel::instance()->setTime(0);
+}
+
+void SpectrumTimerTest::advance(long long ms) {
+	long long end = m_time + ms;
+	while (m_time < end) {
+		m_time += SpectrumTimerWheel::TICK;
+		SpectrumTimerWheel::instance()->setTime(m_time);
+		SpectrumTimerWheel::instance()->process();
+	}
+}
+
+void SpectrumTimerTest::expire() {
+	int size = SpectrumTimerWheel::instance()->size();
+	TestTimer t = {NULL, 0, 1, false, NULL};
+	t.timer = new SpectrumTimer(1000, &testCallback, &t);
+	t.timer->start();
+	t.timer->start();
+	CPPUNIT_ASSERT (SpectrumTimerWheel::instance()->size() == size + 1);
+
+	advance(950);
+	CPPUNIT_ASSERT (t.fired == 0);
+	advance(100);
+	CPPUNIT_ASSERT (t.fired == 1);
+	CPPUNIT_ASSERT (t.timer->isRunning() == false);
+	CPPUNIT_ASSERT (SpectrumTimerWheel::instance()->size() == size);
+	delete t.timer;
+}
+
+void SpectrumTimerTest::repeat() {
+	TestTimer t = {NULL, 0, 3, false, NULL};
+	t.timer = new SpectrumTimer(250, &testCallback, &t);
+	t.timer->start();
+	advance(1000);
+	CPPUNIT_ASSERT (t.fired == 3);
+	CPPUNIT_ASSERT (t.timer->isRunning() == false);
+	delete t.timer;
+}
+
+void SpectrumTimerTest::stopInCallback() {
+	TestTimer t = {NULL, 0, 1, true, NULL};
+	TestTimer victim = {NULL, 0, 1, false, NULL};
+	t.timer = new SpectrumTimer(500, &testCallback, &t);
+	victim.timer = new SpectrumTimer(500, &testCallback, &victim);
+	t.other = victim.timer;
+	// short timers expired in the same tick are called in the order they were started
+	t.timer->start();
+	victim.timer->start();
+
+	advance(550);
+	CPPUNIT_ASSERT (t.fired == 1);
+	CPPUNIT_ASSERT (victim.fired == 0);
+	// stopped and started again in callback
+	CPPUNIT_ASSERT (t.timer->isRunning());
+	advance(550);
+	CPPUNIT_ASSERT (t.fired == 2);
+	t.timer->stop();
+	delete t.timer;
+}
+
+void SpectrumTimerTest::longTimer() {
+	TestTimer t = {NULL, 0, 1, false, NULL};
+	t.timer = new SpectrumTimer(3600 * 1000, &testCallback, &t);
+	t.timer->start();
+	advance(3600 * 1000 - 100);
+	CPPUNIT_ASSERT (t.fired == 0);
+	advance(150);
+	CPPUNIT_ASSERT (t.fired == 1);
+	delete t.timer;
+}
+
+void SpectrumTimerTest::restart() {
+	int size = SpectrumTimerWheel::instance()->size();
+	TestTimer t = {NULL, 0, 1, false, NULL};
+	t.timer = new SpectrumTimer(500, &testCallback, &t);
+	t.timer->restart();
+	advance(400);
+	// postponed by another 500 ms
+	t.timer->restart();
+	CPPUNIT_ASSERT (SpectrumTimerWheel::instance()->size() == size + 1);
+	advance(400);
+	CPPUNIT_ASSERT (t.fired == 0);
+	advance(150);
+	CPPUNIT_ASSERT (t.fired == 1);
+	CPPUNIT_ASSERT (t.timer->isRunning() == false);
+	delete t.timer;
+}
+
+void SpectrumTimerTest::wakeUp() {
+	SpectrumTimerWheel *wheel = SpectrumTimerWheel::instance();
+	CPPUNIT_ASSERT (wheel->size() == 0);
+	CPPUNIT_ASSERT (wheel->nextTimeout() == -1);
+
+	TestTimer t = {NULL, 0, 1, false, NULL};
+	t.timer = new SpectrumTimer(1000, &testCallback, &t);
+	t.timer->start();
+	CPPUNIT_ASSERT (wheel->nextTimeout() >= 1000);
+	CPPUNIT_ASSERT (wheel->nextTimeout() <= 1000 + SpectrumTimerWheel::TICK);
+
+	// shorter timer moves the wake up
+	TestTimer s = {NULL, 0, 1, false, NULL};
+	s.timer = new SpectrumTimer(200, &testCallback, &s);
+	s.timer->start();
+	CPPUNIT_ASSERT (wheel->nextTimeout() <= 200 + SpectrumTimerWheel::TICK);
+	advance(250);
+	CPPUNIT_ASSERT (s.fired == 1);
+	CPPUNIT_ASSERT (wheel->nextTimeout() <= 750 + SpectrumTimerWheel::TICK);
+
+	// nothing is due after the last timer is stopped
+	t.timer->stop();
+	CPPUNIT_ASSERT (wheel->nextTimeout() == -1);
+
+	// long timer wakes the wheel only to cascade it
+	delete s.timer;
+	s.timer = new SpectrumTimer(3600 * 1000, &testCallback, &s);
+	s.timer->start();
+	CPPUNIT_ASSERT (wheel->nextTimeout() <= 256 * SpectrumTimerWheel::TICK);
+	delete s.timer;
+	delete t.timer;
+}
@@ -0,0 +1,39 @@
+#ifndef SPECTRUM_TIMER_TEST_H
+#define SPECTRUM_TIMER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class SpectrumTimerTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (SpectrumTimerTest);
+	CPPUNIT_TEST (expire);
+	CPPUNIT_TEST (repeat);
+	CPPUNIT_TEST (stopInCallback);
+	CPPUNIT_TEST (longTimer);
+	CPPUNIT_TEST (restart);
+	CPPUNIT_TEST (wakeUp);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void expire();
+		void repeat();
+		void stopInCallback();
+		void longTimer();
+		void restart();
+		void wakeUp();
+
+	private:
+		// Moves wheel time by `ms` and runs expired timers.
+		void advance(long long ms);
+
+		long long m_time;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (SpectrumTimerTest);
+
+#endif
@@ -0,0 +1,263 @@
+#include "stanzaqueuetest.h"
+#include "stanzaqueue.h"
+
+static std::list <Tag *> sent;
+static bool connectionWritable;
+
+static void sendTag(Tag *tag, void *data) {
+	sent.push_back(tag);
+}
+
+static bool isWritable(void *data) {
+	return connectionWritable;
+}
+
+static Tag *createTag(const std::string &name, const std::string &from, const std::string &to, const std::string &type = "") {
+	Tag *tag = new Tag(name);
+	tag->addAttribute("from", from);
+	tag->addAttribute("to", to);
+	if (!type.empty())
+		tag->addAttribute("type", type);
+	return tag;
+}
+
+static void clearSent() {
+	for (std::list <Tag *>::iterator it = sent.begin(); it != sent.end(); it++)
+		delete *it;
+	sent.clear();
+}
+
+void StanzaQueueTest::up (void) {
+	m_queue = new StanzaQueue(&sendTag, NULL, 2);
+	m_queue->setWritable(&isWritable);
+	m_queue->setTime(1000);
+	connectionWritable = true;
+}
+
+void StanzaQueueTest::down (void) {
+	delete m_queue;
+	clearSent();
+}
+
+// Uses the budget, so next stanzas are queued.
+void StanzaQueueTest::fill() {
+	m_queue->send(createTag("message", "a@icq.localhost", "user@localhost"));
+	m_queue->send(createTag("message", "b@icq.localhost", "user@localhost"));
+	clearSent();
+}
+
+void StanzaQueueTest::priorities() {
+	// Every stanza goes to different user, so they are not reordered because
+	// of the same recipient.
+	Tag *tag = createTag("presence", "#room%irc.freenode.org@irc.localhost/nick", "user1@localhost");
+	Tag *x = new Tag("x");
+	x->addAttribute("xmlns", "http://jabber.org/protocol/muc#user");
+	tag->addChild(x);
+	CPPUNIT_ASSERT (StanzaQueue::getPriority(tag) == STANZA_PRIORITY_BULK);
+
+	Tag *vcard = createTag("iq", "a@icq.localhost", "user4@localhost", "result");
+	vcard->addChild(new Tag("vCard"));
+	CPPUNIT_ASSERT (StanzaQueue::getPriority(vcard) == STANZA_PRIORITY_BULK);
+
+	fill();
+	m_queue->send(tag);
+	m_queue->send(createTag("presence", "a@icq.localhost", "user2@localhost"));
+	m_queue->send(createTag("message", "a@icq.localhost", "user3@localhost"));
+	m_queue->send(vcard);
+	CPPUNIT_ASSERT (m_queue->size() == 4);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_BULK) == 2);
+
+	m_queue->setTime(1100);
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.size() == 2);
+	CPPUNIT_ASSERT (sent.front()->name() == "message");
+	CPPUNIT_ASSERT (sent.back()->name() == "presence");
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.size() == 4);
+	CPPUNIT_ASSERT (sent.back() == vcard);
+	CPPUNIT_ASSERT (m_queue->size() == 0);
+
+	std::map <std::string, BackendStat> stats;
+	m_queue->getStats(stats);
+	CPPUNIT_ASSERT (stats["queue/latency-max"].value == 100);
+}
+
+void StanzaQueueTest::budget() {
+	m_queue->send(createTag("message", "a@icq.localhost", "user@localhost"));
+	m_queue->send(createTag("message", "b@icq.localhost", "user@localhost"));
+	m_queue->send(createTag("message", "c@icq.localhost", "user@localhost"));
+	CPPUNIT_ASSERT (sent.size() == 2);
+	CPPUNIT_ASSERT (m_queue->size() == 1);
+
+	CPPUNIT_ASSERT (m_queue->process() == true);
+	CPPUNIT_ASSERT (sent.size() == 3);
+	CPPUNIT_ASSERT (m_queue->process() == false);
+
+	// new iteration, so stanza is sent directly
+	m_queue->send(createTag("message", "d@icq.localhost", "user@localhost"));
+	CPPUNIT_ASSERT (sent.size() == 4);
+}
+
+void StanzaQueueTest::recipientOrder() {
+	Tag *join = createTag("presence", "#room%irc.freenode.org@irc.localhost/nick", "user@localhost/psi");
+	Tag *x = new Tag("x");
+	x->addAttribute("xmlns", "http://jabber.org/protocol/muc#user");
+	join->addChild(x);
+	Tag *presence = createTag("presence", "a@icq.localhost", "user@localhost");
+	Tag *other = createTag("presence", "b@icq.localhost", "user2@localhost");
+	Tag *message = createTag("message", "a@icq.localhost", "user@localhost");
+
+	fill();
+	m_queue->send(join);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_BULK) == 1);
+	m_queue->send(presence);
+	m_queue->send(other);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_BULK) == 0);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_PRESENCE) == 3);
+
+	// message moves older stanzas for the same user before it
+	m_queue->send(message);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_HIGH) == 3);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_PRESENCE) == 1);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_BULK) == 0);
+
+	m_queue->process();
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.size() == 4);
+	std::list <Tag *>::iterator it = sent.begin();
+	CPPUNIT_ASSERT (*it++ == join);
+	CPPUNIT_ASSERT (*it++ == presence);
+	CPPUNIT_ASSERT (*it++ == message);
+	CPPUNIT_ASSERT (*it++ == other);
+}
+
+void StanzaQueueTest::coalescing() {
+	fill();
+	m_queue->send(createTag("presence", "a@icq.localhost", "user@localhost"));
+	Tag *last = createTag("presence", "a@icq.localhost", "user@localhost", "unavailable");
+	m_queue->send(last);
+	// subscription requests are never coalesced
+	m_queue->send(createTag("presence", "a@icq.localhost", "user@localhost", "subscribe"));
+	m_queue->send(createTag("presence", "a@icq.localhost", "user@localhost", "subscribe"));
+	CPPUNIT_ASSERT (m_queue->size() == 3);
+	CPPUNIT_ASSERT (m_queue->getCoalesced() == 1);
+
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.front() == last);
+}
+
+void StanzaQueueTest::fairness() {
+	fill();
+	m_queue->send(createTag("presence", "a@icq.localhost", "user1@localhost"));
+	m_queue->send(createTag("presence", "b@icq.localhost", "user1@localhost"));
+	m_queue->send(createTag("presence", "c@icq.localhost", "user1@localhost"));
+	m_queue->send(createTag("presence", "a@icq.localhost", "user2@localhost"));
+
+	m_queue->process();
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.size() == 4);
+	std::list <Tag *>::iterator it = sent.begin();
+	CPPUNIT_ASSERT ((*it++)->findAttribute("to") == "user1@localhost");
+	CPPUNIT_ASSERT ((*it++)->findAttribute("to") == "user2@localhost");
+	CPPUNIT_ASSERT ((*it++)->findAttribute("to") == "user1@localhost");
+	CPPUNIT_ASSERT ((*it++)->findAttribute("to") == "user1@localhost");
+}
+
+void StanzaQueueTest::limit() {
+	Tag *tag = createTag("presence", "a@icq.localhost", "user@localhost");
+	m_queue->setLimit(STANZA_PRIORITY_PRESENCE, StanzaQueue::getSize(tag) + 1);
+	fill();
+	m_queue->send(tag);
+	m_queue->send(createTag("presence", "b@icq.localhost", "user@localhost"));
+	CPPUNIT_ASSERT (m_queue->size() == 1);
+	CPPUNIT_ASSERT (m_queue->getDropped() == 1);
+
+	// messages have their own limit
+	Tag *message = createTag("message", "a@icq.localhost", "user@localhost");
+	m_queue->setLimit(STANZA_PRIORITY_HIGH, StanzaQueue::getSize(message) + 1);
+	m_queue->send(message);
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_HIGH) == 2);
+	m_queue->send(createTag("message", "b@icq.localhost", "user2@localhost"));
+	CPPUNIT_ASSERT (m_queue->size(STANZA_PRIORITY_HIGH) == 2);
+	CPPUNIT_ASSERT (m_queue->getDropped() == 2);
+}
+
+void StanzaQueueTest::coalescingLimit() {
+	Tag *old = createTag("presence", "a@icq.localhost", "user@localhost");
+	Tag *big = createTag("presence", "a@icq.localhost", "user@localhost");
+	big->addChild(new Tag("status", std::string(100, 'x')));
+	m_queue->setLimit(STANZA_PRIORITY_PRESENCE, StanzaQueue::getSize(old) + 1);
+	fill();
+
+	// new presence doesn't fit even when the old one is freed, so the old one
+	// is kept
+	m_queue->send(old);
+	m_queue->send(big);
+	CPPUNIT_ASSERT (m_queue->size() == 1);
+	CPPUNIT_ASSERT (m_queue->getDropped() == 1);
+	CPPUNIT_ASSERT (m_queue->getCoalesced() == 0);
+
+	// the same size fits into memory freed by the old one
+	Tag *last = createTag("presence", "a@icq.localhost", "user@localhost", "unavailable");
+	m_queue->setLimit(STANZA_PRIORITY_PRESENCE, StanzaQueue::getSize(last));
+	m_queue->send(last);
+	CPPUNIT_ASSERT (m_queue->size() == 1);
+	CPPUNIT_ASSERT (m_queue->getCoalesced() == 1);
+
+	m_queue->process();
+	CPPUNIT_ASSERT (sent.front() == last);
+}
+
+void StanzaQueueTest::backpressure() {
+	connectionWritable = false;
+	m_queue->send(createTag("message", "a@icq.localhost", "user@localhost"));
+	CPPUNIT_ASSERT (sent.size() == 0);
+	CPPUNIT_ASSERT (m_queue->size() == 1);
+	CPPUNIT_ASSERT (m_queue->getBlocked() == 1);
+
+	// nothing is sent until the connection is writable, even in new iteration
+	m_queue->send(createTag("message", "b@icq.localhost", "user@localhost"));
+	CPPUNIT_ASSERT (m_queue->process() == false);
+	m_queue->resume();
+	CPPUNIT_ASSERT (sent.size() == 0);
+	CPPUNIT_ASSERT (m_queue->size() == 2);
+
+	connectionWritable = true;
+	m_queue->resume();
+	CPPUNIT_ASSERT (sent.size() == 2);
+	CPPUNIT_ASSERT (m_queue->size() == 0);
+
+	// connection is full when queued stanzas are processed
+	m_queue->process();
+	fill();
+	m_queue->send(createTag("message", "c@icq.localhost", "user@localhost"));
+	m_queue->send(createTag("message", "d@icq.localhost", "user@localhost"));
+	connectionWritable = false;
+	CPPUNIT_ASSERT (m_queue->process() == false);
+	CPPUNIT_ASSERT (m_queue->size() == 2);
+	connectionWritable = true;
+	m_queue->resume();
+	CPPUNIT_ASSERT (m_queue->size() == 0);
+}
+
+void StanzaQueueTest::userBytes() {
+	fill();
+	Tag *tag1 = createTag("presence", "a@icq.localhost", "user1@localhost/psi");
+	Tag *tag2 = createTag("message", "a@icq.localhost", "user1@localhost");
+	Tag *tag3 = createTag("presence", "a@icq.localhost", "user2@localhost");
+	unsigned long size1 = StanzaQueue::getSize(tag1) + StanzaQueue::getSize(tag2);
+	unsigned long size2 = StanzaQueue::getSize(tag3);
+	m_queue->send(tag1);
+	m_queue->send(tag2);
+	m_queue->send(tag3);
+
+	CPPUNIT_ASSERT (m_queue->bytes("user1@localhost") == size1);
+	CPPUNIT_ASSERT (m_queue->bytes("user2@localhost") == size2);
+	CPPUNIT_ASSERT (m_queue->bytes("user3@localhost") == 0);
+	CPPUNIT_ASSERT (m_queue->bytes() == size1 + size2);
+
+	// budget is 2, so the message and the presence of user1 are sent
+	m_queue->process();
+	CPPUNIT_ASSERT (m_queue->bytes("user1@localhost") == 0);
+	CPPUNIT_ASSERT (m_queue->bytes() == size2);
+}
@@ -0,0 +1,45 @@
+#ifndef STANZA_QUEUE_TEST_H
+#define STANZA_QUEUE_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class StanzaQueue;
+
+class StanzaQueueTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (StanzaQueueTest);
+	CPPUNIT_TEST (priorities);
+	CPPUNIT_TEST (budget);
+	CPPUNIT_TEST (recipientOrder);
+	CPPUNIT_TEST (coalescing);
+	CPPUNIT_TEST (fairness);
+	CPPUNIT_TEST (limit);
+	CPPUNIT_TEST (userBytes);
+	CPPUNIT_TEST (coalescingLimit);
+	CPPUNIT_TEST (backpressure);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void priorities();
+		void budget();
+		void recipientOrder();
+		void coalescing();
+		void fairness();
+		void limit();
+		void userBytes();
+		void coalescingLimit();
+		void backpressure();
+
+	private:
+		void fill();
+		StanzaQueue *m_queue;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (StanzaQueueTest);
+
+#endif
@@ -0,0 +1,126 @@
+#include "stanzawritertest.h"
+#include "stanzawriter.h"
+#include "textsanitizer.h"
+#include "gloox/tag.h"
+
+using namespace gloox;
+
+// Every test builds the same stanza using gloox Tag and StanzaWriter and
+// checks that the serialized output is identical.
+
+void StanzaWriterTest::presence() {
+	Tag *tag = new Tag("presence");
+	tag->addAttribute("from", "user1%example.com@icq.localhost/bot");
+	tag->addChild( new Tag("status", "I'm here") );
+	tag->addChild( new Tag("show", "away") );
+	Tag *c = new Tag("c");
+	c->addAttribute("xmlns", "http://jabber.org/protocol/caps");
+	c->addAttribute("hash", "sha-1");
+	c->addAttribute("ver", "123");
+	tag->addChild(c);
+	Tag *x = new Tag("x");
+	x->addAttribute("xmlns", "vcard-temp:x:update");
+	x->addChild( new Tag("photo", "somehash") );
+	tag->addChild(x);
+	tag->addAttribute("to", "user@example.com/psi");
+
+	StanzaWriter writer;
+	writer.start("presence");
+	writer.addAttribute("from", "user1%example.com@icq.localhost/bot");
+	writer.addAttribute("to", "user@example.com/psi");
+	writer.addChild("status", "I'm here");
+	writer.addChild("show", "away");
+	writer.startChild("c");
+	writer.addAttribute("xmlns", "http://jabber.org/protocol/caps");
+	writer.addAttribute("hash", "sha-1");
+	writer.addAttribute("ver", "123");
+	writer.endChild();
+	writer.startChild("x");
+	writer.addAttribute("xmlns", "vcard-temp:x:update");
+	writer.addChild("photo", "somehash");
+
+	CPPUNIT_ASSERT_EQUAL (tag->xml(), writer.xml());
+	CPPUNIT_ASSERT (writer.name() == "presence");
+	CPPUNIT_ASSERT (writer.from() == "user1%example.com@icq.localhost/bot");
+	CPPUNIT_ASSERT (writer.to() == "user@example.com/psi");
+	CPPUNIT_ASSERT (writer.type().empty());
+	delete tag;
+}
+
+void StanzaWriterTest::escaping() {
+	std::string text("<b>Tom & \"Jerry\"</b> isn't here > \xc5\x99");
+	Tag *tag = new Tag("presence");
+	tag->addAttribute("from", text);
+	Tag *n = new Tag("nick", text);
+	n->addAttribute("xmlns", "http://jabber.org/protocol/nick");
+	tag->addChild(n);
+
+	StanzaWriter writer;
+	writer.start("presence");
+	writer.addAttribute("from", text);
+	writer.startChild("nick");
+	writer.addAttribute("xmlns", "http://jabber.org/protocol/nick");
+	writer.addCData(text);
+	writer.endChild();
+
+	CPPUNIT_ASSERT_EQUAL (tag->xml(), writer.xml());
+	delete tag;
+}
+
+void StanzaWriterTest::emptyValues() {
+	Tag *tag = new Tag("presence");
+	tag->addAttribute("from", "");
+	tag->addAttribute("type", "unavailable");
+	tag->addChild( new Tag("status", "") );
+	tag->addChild( new Tag("x") );
+
+	StanzaWriter writer;
+	writer.start("presence");
+	writer.addAttribute("from", "");
+	writer.addAttribute("type", "unavailable");
+	writer.addChild("status", "");
+	writer.startChild("x");
+	writer.endChild();
+
+	CPPUNIT_ASSERT_EQUAL (tag->xml(), writer.xml());
+	CPPUNIT_ASSERT (writer.type() == "unavailable");
+	delete tag;
+
+	tag = new Tag("presence");
+	writer.start("presence");
+	CPPUNIT_ASSERT_EQUAL (tag->xml(), writer.xml());
+	delete tag;
+}
+
+void StanzaWriterTest::invalidText() {
+	StanzaWriter writer;
+	writer.start("presence");
+	writer.addAttribute("from", "user1%example.com@icq.localhost");
+	writer.startChild("nick");
+	writer.addAttribute("xmlns", "http://jabber.org/protocol/nick");
+	writer.addCData("Tom\x01 & \xff");
+	writer.endChild();
+	writer.addChild("status", "\x01");
+	writer.startChild("x");
+	writer.addAttribute("name", "a\x02" "b");
+
+	CPPUNIT_ASSERT_EQUAL (std::string("<presence from='user1%example.com@icq.localhost'>"
+			"<nick xmlns='http://jabber.org/protocol/nick'>Tom" SANITIZER_REPLACEMENT " &amp; " SANITIZER_REPLACEMENT "</nick>"
+			"<status>" SANITIZER_REPLACEMENT "</status>"
+			"<x name='a" SANITIZER_REPLACEMENT "b'/>"
+		"</presence>"), writer.xml());
+}
+
+void StanzaWriterTest::reuse() {
+	StanzaWriter writer;
+	writer.start("presence");
+	writer.addAttribute("to", "user@example.com");
+	writer.addChild("status", "first");
+	writer.xml();
+
+	writer.start("message");
+	writer.addAttribute("type", "chat");
+	writer.addChild("body", "second");
+	CPPUNIT_ASSERT_EQUAL (std::string("<message type='chat'><body>second</body></message>"), writer.xml());
+	CPPUNIT_ASSERT (writer.to().empty());
+}
@@ -0,0 +1,31 @@
+#ifndef STANZA_WRITER_TEST_H
+#define STANZA_WRITER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class StanzaWriterTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (StanzaWriterTest);
+	CPPUNIT_TEST (presence);
+	CPPUNIT_TEST (escaping);
+	CPPUNIT_TEST (emptyValues);
+	CPPUNIT_TEST (invalidText);
+	CPPUNIT_TEST (reuse);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void) {}
+		void down (void) {}
+
+	protected:
+		void presence();
+		void escaping();
+		void emptyValues();
+		void invalidText();
+		void reuse();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (StanzaWriterTest);
+
+#endif
@@ -58,6 +58,8 @@ class TestingBackend : public AbstractBackend {
 		void reset() {
 			m_buddies.clear();
 			m_users.clear();
+			m_settings.clear();
+			m_settingWrites = 0;
 			Configuration cfg;
 			cfg.jid_escaping = 1;
 			cfg.enable_public_registration = 1;
@@ -91,12 +93,23 @@ class TestingBackend : public AbstractBackend {
 		Configuration &getConfiguration() { return m_configuration; }
 		void setConfiguration(const Configuration &conf) { m_configuration = conf; }
 		std::map<std::string, UserRow> getUsersByJid(const std::string &jid) { std::map<std::string, UserRow> test; return test; }
-		void updateSetting(long userId, const std::string &key, const std::string &value) {}
+		void updateSetting(long userId, const std::string &key, const std::string &value) {
+			m_settings[key] = value;
+			m_settingWrites++;
+		}
+		void addSetting(long userId, const std::string &key, const std::string &value, PurpleType type) {
+			m_settings[key] = value;
+		}
+		GHashTable *getSettings(long userId) { return NULL; }
+		std::map <std::string, std::string> &getSettings() { return m_settings; }
+		int getSettingWrites() { return m_settingWrites; }
 
 	private:
 		Configuration m_configuration;
 		std::map <std::string, UserRow> m_users;
 		std::map <std::string, Buddy> m_buddies;
+		std::map <std::string, std::string> m_settings;
+		int m_settingWrites;
 		std::vector<std::string> m_onlineUsers;
 		static TestingBackend *m_pInstance;
 		GlooxParser *m_parser;
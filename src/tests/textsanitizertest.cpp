@@ -0,0 +1,91 @@
+#include "textsanitizertest.h"
+#include "textsanitizer.h"
+#include <stdlib.h>
+
+// Straightforward check of XML 1.0 Char production used to verify the
+// vectorized one.
+static bool isValidReference(const std::string &text) {
+	static const unsigned int minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+	size_t i = 0;
+	while (i < text.size()) {
+		unsigned char c = text[i];
+		unsigned int cp;
+		int n;
+		if (c < 0x80) { cp = c; n = 1; }
+		else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; n = 2; }
+		else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; n = 3; }
+		else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; n = 4; }
+		else return false;
+		if (i + n > text.size())
+			return false;
+		for (int k = 1; k < n; k++) {
+			unsigned char d = text[i + k];
+			if ((d & 0xC0) != 0x80)
+				return false;
+			cp = (cp << 6) | (d & 0x3F);
+		}
+		if (cp < minimum[n])
+			return false;
+		if (!(cp == 0x09 || cp == 0x0A || cp == 0x0D || (cp >= 0x20 && cp <= 0xD7FF)
+			|| (cp >= 0xE000 && cp <= 0xFFFD) || (cp >= 0x10000 && cp <= 0x10FFFF)))
+			return false;
+		i += n;
+	}
+	return true;
+}
+
+void TextSanitizerTest::validText() {
+	std::string text("Hello,\tworld!\r\nP\xc5\x99\xc3\xad\xc5\xa1t\xc4\x9b \xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80");
+	const char *data = text.data();
+	CPPUNIT_ASSERT (isValidXMLText(text));
+	CPPUNIT_ASSERT (sanitizeXMLText(text) == false);
+	// valid text is not copied
+	CPPUNIT_ASSERT (text.data() == data);
+}
+
+void TextSanitizerTest::invalidUTF8() {
+	std::string text("a\xff" "b\xc3");
+	CPPUNIT_ASSERT (findInvalidXMLText(text.data(), text.size()) == 1);
+	CPPUNIT_ASSERT (sanitizeXMLText(text) == true);
+	CPPUNIT_ASSERT (text == "a" SANITIZER_REPLACEMENT "b" SANITIZER_REPLACEMENT);
+
+	// overlong '/' and surrogate
+	text = "\xc0\xaf\xed\xa0\x80";
+	CPPUNIT_ASSERT (!isValidXMLText(text));
+	sanitizeXMLText(text, "_");
+	CPPUNIT_ASSERT (text == "_____");
+}
+
+void TextSanitizerTest::illegalCharacters() {
+	std::string text("typing\x1b[0m and \x01 U+FFFF \xef\xbf\xbf");
+	text += std::string(1, '\0');
+	CPPUNIT_ASSERT (findInvalidXMLText(text.data(), text.size()) == 6);
+	CPPUNIT_ASSERT (sanitizeXMLText(text, "?") == true);
+	CPPUNIT_ASSERT (text == "typing?[0m and ? U+FFFF ??");
+}
+
+void TextSanitizerTest::fuzz() {
+	const char *pieces[] = {"a", "long ascii text without any special characters ", "\t", "\x01",
+		"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xef\xbf\xbe", "\xed\xa0\x80", "\xc0\xaf",
+		"\xf4\x90\x80\x80", "\xff", "\x80", "\xc3", "\xe2\x82"};
+	int count = sizeof(pieces) / sizeof(pieces[0]);
+	srand(1);
+	for (int i = 0; i < 20000; i++) {
+		std::string text;
+		int n = rand() % 30;
+		for (int k = 0; k < n; k++) {
+			if (rand() % 3 == 0)
+				text += (char) (rand() % 256);
+			else
+				text += pieces[rand() % count];
+		}
+		bool valid = isValidReference(text);
+		CPPUNIT_ASSERT (isValidXMLText(text) == valid);
+
+		std::string sanitized(text);
+		CPPUNIT_ASSERT (sanitizeXMLText(sanitized) == !valid);
+		CPPUNIT_ASSERT (isValidReference(sanitized));
+		if (valid)
+			CPPUNIT_ASSERT (sanitized == text);
+	}
+}
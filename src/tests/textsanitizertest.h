@@ -0,0 +1,29 @@
+#ifndef TEXT_SANITIZER_TEST_H
+#define TEXT_SANITIZER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class TextSanitizerTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (TextSanitizerTest);
+	CPPUNIT_TEST (validText);
+	CPPUNIT_TEST (invalidUTF8);
+	CPPUNIT_TEST (illegalCharacters);
+	CPPUNIT_TEST (fuzz);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void) {}
+		void down (void) {}
+
+	protected:
+		void validText();
+		void invalidUTF8();
+		void illegalCharacters();
+		void fuzz();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (TextSanitizerTest);
+
+#endif
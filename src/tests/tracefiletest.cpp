@@ -0,0 +1,92 @@
+#include "tracefiletest.h"
+#include "tracefile.h"
+#include <unistd.h>
+
+#define TRACE_FILE "/tmp/spectrum-test.trace"
+
+void TraceFileTest::up() {
+	unlink(TRACE_FILE);
+}
+
+void TraceFileTest::down() {
+	unlink(TRACE_FILE);
+}
+
+void TraceFileTest::writeAndRead() {
+	TraceFileWriter writer;
+	CPPUNIT_ASSERT (writer.open(TRACE_FILE, 1000000));
+	writer.write(TRACE_STREAM_IN, 1000500, "<iq id='1'/>", 12);
+	writer.write(TRACE_STREAM_OUT, 1300000, "<iq id='1' type='result'/>", 26);
+	// time going backwards is stored as zero delta
+	writer.write(TRACE_STREAM_IN, 1200000, "", 0);
+	writer.close();
+
+	TraceFileReader reader;
+	TraceRecord record;
+	CPPUNIT_ASSERT (reader.open(TRACE_FILE));
+	CPPUNIT_ASSERT_EQUAL (1000000LL, reader.startTime());
+
+	CPPUNIT_ASSERT (reader.read(record));
+	CPPUNIT_ASSERT_EQUAL (TRACE_STREAM_IN, record.type);
+	CPPUNIT_ASSERT_EQUAL (500LL, record.time);
+	CPPUNIT_ASSERT_EQUAL (std::string("<iq id='1'/>"), record.data);
+
+	CPPUNIT_ASSERT (reader.read(record));
+	CPPUNIT_ASSERT_EQUAL (TRACE_STREAM_OUT, record.type);
+	CPPUNIT_ASSERT_EQUAL (300000LL, record.time);
+	CPPUNIT_ASSERT_EQUAL (std::string("<iq id='1' type='result'/>"), record.data);
+
+	CPPUNIT_ASSERT (reader.read(record));
+	CPPUNIT_ASSERT_EQUAL (300000LL, record.time);
+	CPPUNIT_ASSERT_EQUAL (std::string(""), record.data);
+
+	CPPUNIT_ASSERT (!reader.read(record));
+}
+
+void TraceFileTest::callbackFields() {
+	TraceFileWriter writer;
+	CPPUNIT_ASSERT (writer.open(TRACE_FILE, 0));
+	writer.writeCallback(10, "conv_write_im", "user@example.com", "buddy", "buddy", "Hi!", "2");
+	writer.writeCallback(20, "signed_on", "user@example.com", NULL, NULL, NULL, NULL);
+	writer.close();
+
+	TraceFileReader reader;
+	TraceRecord record;
+	CPPUNIT_ASSERT (reader.open(TRACE_FILE));
+
+	CPPUNIT_ASSERT (reader.read(record));
+	CPPUNIT_ASSERT_EQUAL (TRACE_CALLBACK, record.type);
+	std::vector <std::string> fields = TraceFileReader::fields(record);
+	CPPUNIT_ASSERT_EQUAL (6, (int) fields.size());
+	CPPUNIT_ASSERT_EQUAL (std::string("conv_write_im"), fields[0]);
+	CPPUNIT_ASSERT_EQUAL (std::string("user@example.com"), fields[1]);
+	CPPUNIT_ASSERT_EQUAL (std::string("Hi!"), fields[4]);
+	CPPUNIT_ASSERT_EQUAL (std::string("2"), fields[5]);
+
+	CPPUNIT_ASSERT (reader.read(record));
+	fields = TraceFileReader::fields(record);
+	CPPUNIT_ASSERT_EQUAL (6, (int) fields.size());
+	CPPUNIT_ASSERT_EQUAL (std::string("signed_on"), fields[0]);
+	CPPUNIT_ASSERT_EQUAL (std::string(""), fields[2]);
+}
+
+void TraceFileTest::truncated() {
+	TraceFileWriter writer;
+	CPPUNIT_ASSERT (writer.open(TRACE_FILE, 0));
+	writer.write(TRACE_STREAM_IN, 10, "<presence/>", 11);
+	writer.write(TRACE_STREAM_IN, 20, "<message><body>Hi</body></message>", 34);
+	unsigned long long size = writer.size();
+	writer.close();
+	CPPUNIT_ASSERT_EQUAL (0, truncate(TRACE_FILE, size - 5));
+
+	TraceFileReader reader;
+	TraceRecord record;
+	CPPUNIT_ASSERT (reader.open(TRACE_FILE));
+	CPPUNIT_ASSERT (reader.read(record));
+	CPPUNIT_ASSERT_EQUAL (std::string("<presence/>"), record.data);
+	CPPUNIT_ASSERT (!reader.read(record));
+
+	// not a trace at all
+	CPPUNIT_ASSERT_EQUAL (0, truncate(TRACE_FILE, 3));
+	CPPUNIT_ASSERT (!reader.open(TRACE_FILE));
+}
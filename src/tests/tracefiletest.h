@@ -0,0 +1,27 @@
+#ifndef TRACE_FILE_TEST_H
+#define TRACE_FILE_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class TraceFileTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (TraceFileTest);
+	CPPUNIT_TEST (writeAndRead);
+	CPPUNIT_TEST (callbackFields);
+	CPPUNIT_TEST (truncated);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void writeAndRead();
+		void callbackFields();
+		void truncated();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (TraceFileTest);
+
+#endif
@@ -4,6 +4,7 @@
 #include "../abstractbackend.h"
 #include "testingbackend.h"
 #include "testingprotocol.h"
+#include "../stanzawriter.h"
 
 Configuration configuration;
 
@@ -22,6 +23,24 @@ void Transport::send(Tag *tag) {
 	m_tags.push_back(tag);
 }
 
+void Transport::send(StanzaWriter &writer) {
+	m_tags.push_back(parser()->getTag(writer.xml()));
+}
+
+void Transport::send(IQ &iq, IqHandler *ih, int context, bool del) {
+	m_tags.push_back(iq.tag());
+}
+
+void Transport::removeIDHandler(IqHandler *ih) {
+}
+
+void Transport::addJob(const std::string &user, const std::string &name, WorkSchedulerStep step, void *data) {
+	while (step(data)) {}
+}
+
+void Transport::removeJobs(void *data) {
+}
+
 UserManager *Transport::userManager() {
 	return m_userManager;
 }
@@ -46,6 +65,10 @@ AbstractProtocol *Transport::protocol() {
 	return (AbstractProtocol *) TestingProtocol::instance();
 }
 
+PurplePlugin *Transport::prpl() {
+	return NULL;
+}
+
 Configuration &Transport::getConfiguration() {
 	return TestingBackend::instance()->getConfiguration();
 }
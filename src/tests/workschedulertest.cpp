@@ -0,0 +1,86 @@
+#include "workschedulertest.h"
+#include "workscheduler.h"
+
+struct TestJob {
+	std::string name;
+	int steps;
+	std::list <std::string> *log;
+	WorkScheduler *scheduler;
+};
+
+static bool testStep(void *data) {
+	TestJob *job = (TestJob *) data;
+	job->log->push_back(job->name);
+	return --job->steps > 0;
+}
+
+static bool removingStep(void *data) {
+	TestJob *job = (TestJob *) data;
+	job->log->push_back(job->name);
+	job->scheduler->removeJobs(data);
+	return true;
+}
+
+void WorkSchedulerTest::up (void) {
+	// big budget, so all steps are run in one process() call
+	m_scheduler = new WorkScheduler(100000);
+}
+
+void WorkSchedulerTest::down (void) {
+	delete m_scheduler;
+}
+
+void WorkSchedulerTest::runJobs() {
+	std::list <std::string> log;
+	TestJob a = {"a", 3, &log, m_scheduler};
+	TestJob b = {"b", 1, &log, m_scheduler};
+
+	CPPUNIT_ASSERT (m_scheduler->addJob("user@localhost", "test", &testStep, &a));
+	CPPUNIT_ASSERT (m_scheduler->addJob("user@localhost", "test", &testStep, &a) == false);
+	CPPUNIT_ASSERT (m_scheduler->addJob("user@localhost", "test", &testStep, &b));
+	CPPUNIT_ASSERT (m_scheduler->hasJob("test", &a));
+	CPPUNIT_ASSERT (m_scheduler->size() == 2);
+
+	CPPUNIT_ASSERT (m_scheduler->process() == false);
+	CPPUNIT_ASSERT (m_scheduler->size() == 0);
+
+	// jobs of one user are run in order
+	std::string order;
+	for (std::list <std::string>::iterator it = log.begin(); it != log.end(); it++)
+		order += *it;
+	CPPUNIT_ASSERT (order == "aaab");
+
+	std::map <std::string, BackendStat> stats;
+	m_scheduler->getStats(stats);
+	CPPUNIT_ASSERT (stats["jobs/test/finished"].value == 2);
+	CPPUNIT_ASSERT (stats["jobs/test/steps"].value == 4);
+}
+
+void WorkSchedulerTest::roundRobin() {
+	std::list <std::string> log;
+	TestJob a = {"a", 3, &log, m_scheduler};
+	TestJob b = {"b", 2, &log, m_scheduler};
+	m_scheduler->addJob("user1@localhost", "test", &testStep, &a);
+	m_scheduler->addJob("user2@localhost", "test", &testStep, &b);
+	m_scheduler->process();
+
+	std::string order;
+	for (std::list <std::string>::iterator it = log.begin(); it != log.end(); it++)
+		order += *it;
+	CPPUNIT_ASSERT (order == "ababa");
+}
+
+void WorkSchedulerTest::removeJobs() {
+	std::list <std::string> log;
+	TestJob a = {"a", 3, &log, m_scheduler};
+	TestJob b = {"b", 3, &log, m_scheduler};
+	m_scheduler->addJob("user1@localhost", "test", &testStep, &a);
+	m_scheduler->removeJobs(&a);
+	CPPUNIT_ASSERT (m_scheduler->size() == 0);
+
+	// job which removes itself
+	m_scheduler->addJob("user1@localhost", "test", &removingStep, &b);
+	CPPUNIT_ASSERT (m_scheduler->process() == false);
+	CPPUNIT_ASSERT (log.size() == 1);
+	CPPUNIT_ASSERT (m_scheduler->size() == 0);
+}
@@ -0,0 +1,32 @@
+#ifndef WORK_SCHEDULER_TEST_H
+#define WORK_SCHEDULER_TEST_H
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include "abstracttest.h"
+
+class WorkScheduler;
+
+class WorkSchedulerTest : public AbstractTest
+{
+	CPPUNIT_TEST_SUITE (WorkSchedulerTest);
+	CPPUNIT_TEST (runJobs);
+	CPPUNIT_TEST (roundRobin);
+	CPPUNIT_TEST (removeJobs);
+	CPPUNIT_TEST_SUITE_END ();
+
+	public:
+		void up (void);
+		void down (void);
+
+	protected:
+		void runJobs();
+		void roundRobin();
+		void removeJobs();
+
+	private:
+		WorkScheduler *m_scheduler;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (WorkSchedulerTest);
+
+#endif
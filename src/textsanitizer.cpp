@@ -0,0 +1,166 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "textsanitizer.h"
+#include <string.h>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Returns length of valid character at `p`, or minus number of bytes which
+// have to be replaced. Character has to be valid UTF-8 (no overlong forms, no
+// surrogates) and allowed by XML 1.0 Char production.
+static int checkChar(const unsigned char *p, const unsigned char *end) {
+	unsigned char c = p[0];
+	if (c < 0x80)
+		return (c >= 0x20 || c == 0x09 || c == 0x0A || c == 0x0D) ? 1 : -1;
+
+	uint32_t cp;
+	if (c < 0xC2)
+		return -1;
+	else if (c < 0xE0) {
+		if (end - p < 2 || (p[1] & 0xC0) != 0x80)
+			return -1;
+		return 2;
+	}
+	else if (c < 0xF0) {
+		if (end - p < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80)
+			return -1;
+		cp = ((c & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		// Overlong forms and surrogates.
+		if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))
+			return -1;
+		// Noncharacters U+FFFE and U+FFFF are not XML characters.
+		if (cp >= 0xFFFE)
+			return -3;
+		return 3;
+	}
+	else if (c < 0xF5) {
+		if (end - p < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+			return -1;
+		cp = ((c & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+		// Overlong forms and code points above U+10FFFF.
+		if (cp < 0x10000 || cp > 0x10FFFF)
+			return -1;
+		return 4;
+	}
+	return -1;
+}
+
+// Returns offset of the first byte in [from, len) which is not printable
+// ASCII, so it has to be checked by checkChar.
+static size_t skipPrintableASCII(const unsigned char *p, size_t from, size_t len) {
+	size_t i = from;
+	// Latin scripts have only few ASCII characters between accented ones,
+	// so short runs are not worth vector loads.
+	for (size_t shortEnd = i + 8 < len ? i + 8 : len; i < shortEnd; i++) {
+		if (p[i] < 0x20 || p[i] >= 0x80)
+			return i;
+	}
+#if defined(__AVX2__)
+	// Bytes >= 0x80 are negative as signed chars, so one signed comparison
+	// finds both control characters and non-ASCII bytes.
+	const __m256i limit32 = _mm256_set1_epi8(0x20);
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit32, v));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i limit = _mm_set1_epi8(0x20);
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	// Sets high bit of every byte which is >= 0x80 or < 0x20. It can mark
+	// bytes after such byte too, but those are checked by checkChar anyway.
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		if ((w | ((w - ones * 0x20) & ~w)) & highs)
+			break;
+	}
+#endif
+	for (; i < len; i++) {
+		if (p[i] < 0x20 || p[i] >= 0x80)
+			break;
+	}
+	return i;
+}
+
+size_t findInvalidXMLText(const char *text, size_t len) {
+	const unsigned char *p = (const unsigned char *) text;
+	const unsigned char *end = p + len;
+	size_t i = 0;
+	while (i < len) {
+		// Vector scan pays off only for runs of ASCII, text in non-latin
+		// scripts is checked character after character.
+		if (p[i] >= 0x20 && p[i] < 0x80) {
+			i = skipPrintableASCII(p, i, len);
+			continue;
+		}
+		int n = checkChar(p + i, end);
+		if (n < 0)
+			return i;
+		i += n;
+	}
+	return len;
+}
+
+bool sanitizeXMLText(std::string &text, const char *replacement) {
+	size_t len = text.size();
+	size_t i = findInvalidXMLText(text.data(), len);
+	if (i == len)
+		return false;
+
+	const unsigned char *p = (const unsigned char *) text.data();
+	const unsigned char *end = p + len;
+	std::string result;
+	result.reserve(len + 8);
+	result.append(text, 0, i);
+	while (i < len) {
+		if (p[i] >= 0x20 && p[i] < 0x80) {
+			size_t valid = skipPrintableASCII(p, i, len);
+			result.append((const char *) p + i, valid - i);
+			i = valid;
+			continue;
+		}
+		int n = checkChar(p + i, end);
+		if (n > 0)
+			result.append((const char *) p + i, n);
+		else {
+			result.append(replacement);
+			n = -n;
+		}
+		i += n;
+	}
+	text.swap(result);
+	return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_TEXTSANITIZER_H
+#define SPECTRUM_TEXTSANITIZER_H
+
+#include <string>
+
+// UTF-8 encoded U+FFFD REPLACEMENT CHARACTER.
+#define SANITIZER_REPLACEMENT "\xEF\xBF\xBD"
+
+// Returns offset of the first byte which is not part of valid UTF-8 character
+// allowed in XML 1.0, or `len` if the whole text is valid. Runs of ASCII
+// characters are checked 16 (or 32 with AVX2) bytes at once.
+size_t findInvalidXMLText(const char *text, size_t len);
+
+// Returns true if text can be sent in XML stanza as it is.
+inline bool isValidXMLText(const std::string &text) {
+	return findInvalidXMLText(text.data(), text.size()) == text.size();
+}
+
+// Replaces invalid UTF-8 sequences and characters illegal in XML 1.0 (control
+// characters, U+FFFE, U+FFFF) by `replacement`. Valid text is not copied.
+// Returns true if text has been changed.
+//
+// Every text coming from legacy network has to pass through this before it is
+// added to stanza, because XMPP server closes the component stream when it
+// receives illegal character, which disconnects all users.
+bool sanitizeXMLText(std::string &text, const char *replacement = SANITIZER_REPLACEMENT);
+
+#endif
@@ -74,6 +74,19 @@ bool Thread::shouldStop() {
 	return stop;
 }
 
+bool Thread::waitForStop(int timeout) {
+	GTimeVal until;
+	g_get_current_time(&until);
+	g_time_val_add(&until, (glong) timeout * 1000);
+
+	g_mutex_lock(m_mutex);
+	if (!m_stop)
+		g_cond_timed_wait(m_cond, m_mutex, &until);
+	bool stop = m_stop;
+	g_mutex_unlock(m_mutex);
+	return stop;
+}
+
 bool Thread::isRunning() {
 	return m_thread != NULL;
 }
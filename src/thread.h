@@ -42,6 +42,10 @@ class Thread {
 		void stopped();
 		bool shouldStop();
 
+		// Waits until stop() and wakeUp() are called or until timeout (in
+		// milliseconds) expires. Returns true if the thread should stop.
+		bool waitForStop(int timeout);
+
 		bool isRunning();
 
 	private:
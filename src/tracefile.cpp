@@ -0,0 +1,182 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "tracefile.h"
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TraceFileWriter::TraceFileWriter() : m_file(NULL), m_last(0), m_size(0) {
+}
+
+TraceFileWriter::~TraceFileWriter() {
+	close();
+}
+
+bool TraceFileWriter::open(const std::string &file, long long start) {
+	close();
+	// Trace contains raw stanzas including passwords, so it must not be
+	// readable by others regardless of umask.
+	int fd = ::open(file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd == -1)
+		return false;
+	// open() doesn't change mode of already existing file.
+	fchmod(fd, 0600);
+	m_file = fdopen(fd, "wb");
+	if (!m_file) {
+		::close(fd);
+		return false;
+	}
+	// Records are written from main loop, don't let stdio flush every few kB.
+	setvbuf(m_file, NULL, _IOFBF, 256 * 1024);
+	m_buffer.assign("SPTR");
+	m_buffer += (char) TRACE_FILE_VERSION;
+	writeVarint(start);
+	fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+	m_size = m_buffer.size();
+	m_last = start;
+	return true;
+}
+
+void TraceFileWriter::close() {
+	if (m_file) {
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+void TraceFileWriter::flush() {
+	if (m_file)
+		fflush(m_file);
+}
+
+void TraceFileWriter::writeVarint(unsigned long long value) {
+	while (value >= 0x80) {
+		m_buffer += (char) ((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	m_buffer += (char) value;
+}
+
+void TraceFileWriter::write(TraceRecordType type, long long time, const char *data, size_t len) {
+	if (!m_file)
+		return;
+	// Wall clock can go backwards, but deltas are unsigned.
+	if (time < m_last)
+		time = m_last;
+	m_buffer.clear();
+	m_buffer += (char) type;
+	writeVarint(time - m_last);
+	writeVarint(len);
+	m_last = time;
+	fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+	fwrite(data, 1, len, m_file);
+	m_size += m_buffer.size() + len;
+}
+
+void TraceFileWriter::writeCallback(long long time, const char *name, const char *account, const char *conversation, const char *who, const char *text, const char *extra) {
+	const char *fields[] = { name, account, conversation, who, text, extra };
+	std::string data;
+	for (int i = 0; i < 6; i++) {
+		if (i != 0)
+			data += '\0';
+		if (fields[i])
+			data += fields[i];
+	}
+	write(TRACE_CALLBACK, time, data.data(), data.size());
+}
+
+TraceFileReader::TraceFileReader() : m_file(NULL), m_start(0), m_time(0) {
+}
+
+TraceFileReader::~TraceFileReader() {
+	close();
+}
+
+bool TraceFileReader::open(const std::string &file) {
+	close();
+	m_file = fopen(file.c_str(), "rb");
+	if (!m_file)
+		return false;
+	char header[5];
+	unsigned long long start;
+	if (fread(header, 1, 5, m_file) != 5 || memcmp(header, "SPTR", 4) != 0 || header[4] != TRACE_FILE_VERSION || !readVarint(start)) {
+		close();
+		return false;
+	}
+	m_start = start;
+	m_time = 0;
+	return true;
+}
+
+void TraceFileReader::close() {
+	if (m_file) {
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+bool TraceFileReader::readVarint(unsigned long long &value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(m_file);
+		if (c == EOF)
+			return false;
+		value |= (unsigned long long) (c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool TraceFileReader::read(TraceRecord &record) {
+	if (!m_file)
+		return false;
+	int type = fgetc(m_file);
+	unsigned long long delta, len;
+	if (type == EOF || !readVarint(delta) || !readVarint(len))
+		return false;
+	// Stanzas are limited by server anyway, larger length means broken file.
+	if (type < TRACE_STREAM_IN || type > TRACE_CALLBACK || len > 64 * 1024 * 1024)
+		return false;
+	record.type = (TraceRecordType) type;
+	m_time += delta;
+	record.time = m_time;
+	record.data.resize(len);
+	if (len && fread(&record.data[0], 1, len, m_file) != len)
+		return false;
+	return true;
+}
+
+std::vector <std::string> TraceFileReader::fields(const TraceRecord &record) {
+	std::vector <std::string> ret;
+	size_t start = 0;
+	while (true) {
+		size_t end = record.data.find('\0', start);
+		if (end == std::string::npos) {
+			ret.push_back(record.data.substr(start));
+			break;
+		}
+		ret.push_back(record.data.substr(start, end - start));
+		start = end + 1;
+	}
+	return ret;
+}
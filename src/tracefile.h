@@ -0,0 +1,107 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_TRACE_FILE_H
+#define SPECTRUM_TRACE_FILE_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#define TRACE_FILE_VERSION 1
+
+typedef enum {	TRACE_STREAM_IN = 1,	// stanza received from XMPP server
+				TRACE_STREAM_OUT = 2,	// data sent to XMPP server
+				TRACE_CALLBACK = 3		// libpurple UI-op or signal callback
+				} TraceRecordType;
+
+struct TraceRecord {
+	TraceRecordType type;
+	long long time;			// microseconds since the start of the trace
+	std::string data;		// stanza or NUL-separated callback fields
+};
+
+// Compact binary trace of component stream and libpurple callbacks. Written
+// by StreamTrace, read by tools/trace-replay.
+//
+// File format (integers are unsigned LEB128 varints):
+//   "SPTR" | version byte | start time in us since epoch | records
+// Every record is:
+//   type byte | us since previous record | data length | data
+// Callback records have data in form
+//   "name\0account\0conversation\0who\0text\0extra".
+class TraceFileWriter {
+	public:
+		TraceFileWriter();
+		~TraceFileWriter();
+
+		// Creates the file and writes header. `start` is wall-clock time in us.
+		bool open(const std::string &file, long long start);
+		void close();
+		bool isOpen() { return m_file != NULL; }
+
+		// Appends record. `time` is wall-clock time in us.
+		void write(TraceRecordType type, long long time, const char *data, size_t len);
+
+		// Appends callback record, NULL fields are stored as empty strings.
+		void writeCallback(long long time, const char *name, const char *account, const char *conversation, const char *who, const char *text, const char *extra);
+
+		void flush();
+
+		// Returns number of written bytes.
+		unsigned long long size() { return m_size; }
+
+	private:
+		void writeVarint(unsigned long long value);
+
+		FILE *m_file;
+		long long m_last;
+		unsigned long long m_size;
+		std::string m_buffer;
+};
+
+class TraceFileReader {
+	public:
+		TraceFileReader();
+		~TraceFileReader();
+
+		// Opens the file and checks header. Returns false if it's not a trace.
+		bool open(const std::string &file);
+		void close();
+
+		// Reads next record. Returns false at the end of file or when the rest
+		// of the file is truncated.
+		bool read(TraceRecord &record);
+
+		// Returns wall-clock time in us when the trace was started.
+		long long startTime() { return m_start; }
+
+		// Splits data of callback record into fields.
+		static std::vector <std::string> fields(const TraceRecord &record);
+
+	private:
+		bool readVarint(unsigned long long &value);
+
+		FILE *m_file;
+		long long m_start;
+		long long m_time;
+};
+
+#endif
@@ -2,6 +2,9 @@
 #include "main.h"
 #include "usermanager.h"
 #include "filetransfermanager.h"
+#include "stanzaqueue.h"
+#include "stanzawriter.h"
+#include "flightrecorder.h"
 
 Transport* Transport::m_pInstance = NULL;
 
@@ -10,11 +13,59 @@ Transport::Transport(const std::string jid) { m_jid = jid; m_pInstance = this; }
 Transport::~Transport() {}
 
 void Transport::send(Tag *tag) {
-	GlooxMessageHandler::instance()->j->send(tag);
+	if (FlightRecorderManager::active())
+		FlightRecorderManager::instance()->recordSend(tag);
+	StanzaQueue *queue = GlooxMessageHandler::instance()->stanzaQueue();
+	if (queue)
+		queue->send(tag);
+	else
+		GlooxMessageHandler::instance()->j->send(tag);
+}
+
+void Transport::send(StanzaWriter &writer) {
+	if (FlightRecorderManager::active())
+		FlightRecorderManager::instance()->recordSend(writer);
+	StanzaQueue *queue = GlooxMessageHandler::instance()->stanzaQueue();
+	if (queue)
+		queue->send(writer);
+	else
+		GlooxMessageHandler::instance()->sendRaw(writer.xml());
+}
+
+void Transport::addJob(const std::string &user, const std::string &name, WorkSchedulerStep step, void *data) {
+	WorkScheduler *scheduler = GlooxMessageHandler::instance()->workScheduler();
+	if (scheduler)
+		scheduler->addJob(user, name, step, data);
+	else
+		while (step(data)) {}
+}
+
+void Transport::removeJobs(void *data) {
+	WorkScheduler *scheduler = GlooxMessageHandler::instance()->workScheduler();
+	if (scheduler)
+		scheduler->removeJobs(data);
 }
 
 void Transport::send(IQ &iq, IqHandler *ih, int context, bool del) {
-	GlooxMessageHandler::instance()->j->send(iq, ih, context, del);
+	StanzaQueue *queue = GlooxMessageHandler::instance()->stanzaQueue();
+	// gloox deletes the handler only when it sends the IQ itself.
+	if (!queue || del) {
+		GlooxMessageHandler::instance()->j->send(iq, ih, context, del);
+		return;
+	}
+
+	// Register the handler now and let the IQ wait in the queue, so it's not
+	// sent before stanzas generated earlier.
+	Tag *tag = iq.tag();
+	if (ih && (iq.subtype() == IQ::Get || iq.subtype() == IQ::Set)) {
+		std::string id = tag->findAttribute("id");
+		if (id.empty()) {
+			id = getId();
+			tag->addAttribute("id", id);
+		}
+		GlooxMessageHandler::instance()->j->trackID(ih, id, context);
+	}
+	send(tag);
 }
 
 UserManager *Transport::userManager() {
@@ -45,6 +96,10 @@ AbstractProtocol *Transport::protocol() {
 	return GlooxMessageHandler::instance()->protocol();
 }
 
+PurplePlugin *Transport::prpl() {
+	return GlooxMessageHandler::instance()->prpl();
+}
+
 Configuration &Transport::getConfiguration() {
 	return GlooxMessageHandler::instance()->configuration();
 }
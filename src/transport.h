@@ -31,9 +31,11 @@
 #include "capabilitymanager.h"
 #include "configfile.h"
 #include "accountcollector.h"
+#include "workscheduler.h"
 
 using namespace gloox;
 class UserManager;
+class StanzaWriter;
 
 #define PROTOCOL() Transport::instance()->protocol()
 #define CONFIG() Transport::instance()->getConfiguration()
@@ -56,6 +58,7 @@ class Transport : public CapabilityManager {
 		~Transport();
 		static Transport *instance() { return m_pInstance; }
 		static void send(Tag *tag);
+		static void send(StanzaWriter &writer);
 		static void send(IQ &iq, IqHandler *ih, int context, bool del=false);
 		static void removeIDHandler(IqHandler *ih);
 		static UserManager *userManager();
@@ -67,6 +70,7 @@ class Transport : public CapabilityManager {
 		void clearTags() { m_tags.clear(); }
 		static GlooxParser *parser();
 		static AbstractProtocol *protocol();
+		static PurplePlugin *prpl();
 		static Configuration &getConfiguration();
 		static void registerStanzaExtension(StanzaExtension *extension);
 		static bool canSendFile(PurpleAccount *account, const std::string &uname);
@@ -79,6 +83,11 @@ class Transport : public CapabilityManager {
 		static void fetchVCard(const std::string &jid);
 		static bool isAdmin(const std::string &barejid);
 
+		// Adds job to WorkScheduler. If there is no scheduler, job is finished immediately.
+		static void addJob(const std::string &user, const std::string &name, WorkSchedulerStep step, void *data);
+		// Removes all jobs with this data.
+		static void removeJobs(void *data);
+
 
 		
 	private:
@@ -36,6 +36,9 @@
 #include "transport.h"
 #include "gloox/sha.h"
 #include "spectrumtimer.h"
+#include "memoryaccounting.h"
+#include "stanzaqueue.h"
+#include "flightrecorder.h"
 
 #ifdef WITH_IMAGEMAGICK
 #include "Magick++.h"
@@ -54,6 +57,8 @@ User::User(JID jid, const std::string &username, const std::string &password, co
 	setActiveResource(jid.resource());
 
 	m_userID = id;
+	if (FlightRecorderManager::active())
+		FlightRecorderManager::instance()->setStorageId(m_jid, m_userID);
 	m_userKey = userKey;
 	m_account = NULL;
 	m_vip = vip;
@@ -64,6 +69,7 @@ User::User(JID jid, const std::string &username, const std::string &password, co
 
 	m_encoding = encoding;
 	m_lang = g_strdup(language.c_str());
+	m_translation = localization.getTranslation(m_lang);
 	m_features = 0;
 	m_loadingBuddiesFromDB = false;
 	m_photoHash.clear();
@@ -81,13 +87,7 @@ User::User(JID jid, const std::string &username, const std::string &password, co
 	setSettings(Transport::instance()->sql()->getSettings(m_userID));
 
 	// Add default settings
-	addSetting("enable_transport", true);
-	addSetting("enable_notify_email", false);
-	addSetting("enable_avatars", true);
-	addSetting("enable_chatstate", true);
-	addSetting("save_files_on_server", false);
-	addSetting("reject_authorizations", false);
-	addSetting("first_synchronization_done", false);
+	addKnownSettings();
 
 	Transport::instance()->sql()->setUserOnline(m_userID, true);
 	Transport::instance()->protocol()->onUserCreated(this);
@@ -98,8 +98,12 @@ User::User(JID jid, const std::string &username, const std::string &password, co
 	reply->addAttribute( "type", "subscribe" );
 	Transport::instance()->send( reply );
 
-	// Ask for user's roster
-	sendRosterGet(m_jid);
+	// Ask for user's roster. First synchronization needs the whole roster,
+	// later only changes since the last synchronized version are sent.
+	if (getSetting<bool>(SETTING_FIRST_SYNCHRONIZATION_DONE))
+		sendRosterGet(m_jid, getSetting<std::string>(SETTING_ROSTER_VERSION));
+	else
+		sendRosterGet(m_jid);
 }
 
 /*
@@ -112,31 +116,36 @@ bool User::hasTransportFeature(int feature) {
 	return false;
 }
 
+/*
+ * Changes user's language and resolves its translations.
+ */
+void User::setLang(const char *lang) {
+	g_free(m_lang);
+	m_lang = g_strdup(lang);
+	m_translation = localization.getTranslation(m_lang);
+}
+
+void User::getMemoryUsage(unsigned long *usage) {
+	SpectrumRosterManager::getMemoryUsage(usage);
+	SpectrumMessageHandler::getMemoryUsage(usage);
+	usage[MEMORY_CAPS] += ResourceManager::getMemoryUsage();
+
+	StanzaQueue *queue = GlooxMessageHandler::instance()->stanzaQueue();
+	if (queue)
+		usage[MEMORY_STANZA_QUEUE] += queue->bytes(m_jid);
+}
+
 /*
  * Called when legacy network user stops typing.
  */
 void User::purpleBuddyTypingStopped(const std::string &uin){
 	if (!hasFeature(GLOOX_FEATURE_CHATSTATES) || !hasTransportFeature(TRANSPORT_FEATURE_TYPING_NOTIFY))
 		return;
-	if (!getSetting<bool>("enable_chatstate"))
+	if (!getSetting<bool>(SETTING_ENABLE_CHATSTATE))
 		return;
 
 	Log(m_jid, uin << " stopped typing");
-
-	std::string username(uin);
-	// Remove resource if it's XMPP JID
-	if (Transport::instance()->getConfiguration().protocol == "xmpp") {
-		size_t pos = username.find("/");
-		if (pos != std::string::npos)
-			username.erase((int) pos, username.length() - (int) pos);
-	}
-	AbstractSpectrumBuddy *s_buddy = getRosterItem(uin);
-	if (s_buddy && s_buddy->getFlags() & SPECTRUM_BUDDY_JID_ESCAPING)
-		username = JID::escapeNode(username);
-	else
-		std::for_each( username.begin(), username.end(), replaceBadJidCharacters() ); // OK
-
-	SpectrumMessageHandler::sendChatstate(username + "@" + Transport::instance()->jid() + "/bot", m_jid, "active");
+	handleBuddyChatState(uin, "active");
 }
 
 /*
@@ -145,26 +154,11 @@ void User::purpleBuddyTypingStopped(const std::string &uin){
 void User::purpleBuddyTyping(const std::string &uin){
 	if (!hasFeature(GLOOX_FEATURE_CHATSTATES) || !hasTransportFeature(TRANSPORT_FEATURE_TYPING_NOTIFY))
 		return;
-	if (!getSetting<bool>("enable_chatstate"))
+	if (!getSetting<bool>(SETTING_ENABLE_CHATSTATE))
 		return;
 
 	Log(m_jid, uin << " is typing");
-
-	std::string username(uin);
-	// Remove resource if it's XMPP JID
-	if (Transport::instance()->getConfiguration().protocol == "xmpp") {
-		size_t pos = username.find("/");
-		if (pos != std::string::npos)
-			username.erase((int) pos, username.length() - (int) pos);
-	}
-
-	AbstractSpectrumBuddy *s_buddy = getRosterItem(uin);
-	if (s_buddy && s_buddy->getFlags() & SPECTRUM_BUDDY_JID_ESCAPING)
-		username = JID::escapeNode(username);
-	else
-		std::for_each( username.begin(), username.end(), replaceBadJidCharacters() ); // OK
-
-	SpectrumMessageHandler::sendChatstate(username + "@" + Transport::instance()->jid() + "/bot", m_jid, "composing");
+	handleBuddyChatState(uin, "composing");
 }
 
 /*
@@ -173,26 +167,11 @@ void User::purpleBuddyTyping(const std::string &uin){
 void User::purpleBuddyTypingPaused(const std::string &uin){
 	if (!hasFeature(GLOOX_FEATURE_CHATSTATES) || !hasTransportFeature(TRANSPORT_FEATURE_TYPING_NOTIFY))
 		return;
-	if (!getSetting<bool>("enable_chatstate"))
+	if (!getSetting<bool>(SETTING_ENABLE_CHATSTATE))
 		return;
 
 	Log(m_jid, uin << " paused typing");
-
-	std::string username(uin);
-	// Remove resource if it's XMPP JID
-	if (Transport::instance()->getConfiguration().protocol == "xmpp") {
-		size_t pos = username.find("/");
-		if (pos != std::string::npos)
-			username.erase((int) pos, username.length() - (int) pos);
-	}
-
-	AbstractSpectrumBuddy *s_buddy = getRosterItem(uin);
-	if (s_buddy && s_buddy->getFlags() & SPECTRUM_BUDDY_JID_ESCAPING)
-		username = JID::escapeNode(username);
-	else
-		std::for_each( username.begin(), username.end(), replaceBadJidCharacters() ); // OK
-
-	SpectrumMessageHandler::sendChatstate(username + "@" + Transport::instance()->jid() + "/bot", m_jid, "paused");
+	handleBuddyChatState(uin, "paused");
 }
 
 /*
@@ -236,7 +215,7 @@ void User::connect() {
 	}
 	Transport::instance()->collector()->stopCollecting(m_account);
 
-	PurplePlugin *plugin = purple_find_prpl(Transport::instance()->protocol()->protocol().c_str());
+	PurplePlugin *plugin = Transport::instance()->prpl();
 	PurplePluginProtocolInfo *prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(plugin);
 	for (GList *l = prpl_info->protocol_options; l != NULL; l = l->next) {
 		PurpleAccountOption *option = (PurpleAccountOption *) l->data;
@@ -274,7 +253,7 @@ void User::connect() {
 	purple_account_set_bool(m_account, "require_tls",  Transport::instance()->getConfiguration().require_tls);
 	purple_account_set_bool(m_account, "use_ssl",  Transport::instance()->getConfiguration().require_tls);
 	purple_account_set_bool(m_account, "direct_connect", false);
-	purple_account_set_bool(m_account, "check-mail", getSetting<bool>("enable_notify_email"));
+	purple_account_set_bool(m_account, "check-mail", getSetting<bool>(SETTING_ENABLE_NOTIFY_EMAIL));
 
 	m_account->ui_data = this;
 	
@@ -296,7 +275,7 @@ void User::connect() {
 		purple_account_set_proxy_info(m_account, info);
 	}
 
-	if (valid && getSetting<bool>("enable_transport")) {
+	if (valid && getSetting<bool>(SETTING_ENABLE_TRANSPORT)) {
 // 		purple_account_connect(m_account);
 		const PurpleStatusType *statusType = purple_account_get_status_type_with_primitive(m_account, (PurpleStatusPrimitive) m_presenceType);
 		if (statusType) {
@@ -311,7 +290,7 @@ void User::connect() {
 		purple_account_set_enabled(m_account, PURPLE_UI, TRUE);
 	}
 
-	SpectrumRosterManager::sendPresence(Transport::instance()->jid(), m_jid, "unavailable", tr(getLang(), _("Connecting")));
+	SpectrumRosterManager::sendPresence(Transport::instance()->jid(), m_jid, "unavailable", tr(m_translation, _("Connecting")));
 }
 
 /*
@@ -467,6 +446,15 @@ void User::receivedPresence(const Presence &stanza) {
 						removeConversationResource(stanza.from().resource());
 						GlooxAdhocHandler::instance()->unregisterSession(stanza.from().full());
 					}
+					else if (stanza.from().resource().empty()) {
+						// Unavailable presence from bare JID (for example answer to probe
+						// for user restored from session snapshot) => all resources are gone.
+						std::map <std::string, Resource> resources = getResources();
+						for (std::map <std::string, Resource>::iterator it = resources.begin(); it != resources.end(); it++) {
+							removeResource((*it).first);
+							removeConversationResource((*it).first);
+						}
+					}
 					sendUnavailablePresenceToAll(stanza.from().resource());
 // 				}
 			}
@@ -546,7 +534,7 @@ void User::receivedPresence(const Presence &stanza) {
 			}
 		}
 
-		if (getSetting<bool>("enable_transport") == false) {
+		if (getSetting<bool>(SETTING_ENABLE_TRANSPORT) == false) {
 			SpectrumRosterManager::sendPresence(Transport::instance()->jid(), stanza.from().bare(),
 												"unavailable");
 		}
@@ -640,7 +628,7 @@ void User::handleVCard(const VCard* vcard) {
 
 #ifdef WITH_IMAGEMAGICK
 	if (size != 0) {
-		PurplePlugin *plugin = purple_find_prpl(Transport::instance()->protocol()->protocol().c_str());
+		PurplePlugin *plugin = Transport::instance()->prpl();
 		PurplePluginProtocolInfo *prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(plugin);
 		if (prpl_info->icon_spec.format == NULL) {
 			g_free(photo);
@@ -675,9 +663,10 @@ void User::handleVCard(const VCard* vcard) {
 			img.magick(format);
 
 			int width, height;
-			if (CONFIG().protocol == "icq") {
-				width = 48;
-				height = 48;
+			const ProtocolCapabilities &caps = Transport::instance()->protocol()->capabilities();
+			if (caps.avatarWidth && caps.avatarHeight) {
+				width = caps.avatarWidth;
+				height = caps.avatarHeight;
 			}
 			else {
 				purple_buddy_icon_get_scale_size(&prpl_info->icon_spec, &width, &height);
@@ -685,7 +674,7 @@ void User::handleVCard(const VCard* vcard) {
 
 			if (img.size().width() != width || img.size().height() != height) {
 				Magick::Geometry g = Magick::Geometry(width,height);
-				g.aspect(CONFIG().protocol == "icq");
+				g.aspect(caps.avatarExactSize);
 				img.scale(g);
 			}
 
@@ -716,6 +705,7 @@ void User::handleVCard(const VCard* vcard) {
 User::~User(){
 	Log("User Destructor", m_jid << " " << m_account << " " << (m_account ? purple_account_get_username(m_account) : "") );
 	Transport::instance()->protocol()->onDestroy(this);
+	flushSettings();
 	g_free(m_lang);
 	delete m_reconnectTimer;
 
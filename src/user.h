@@ -38,6 +38,7 @@ class FiletransferRepeater;
 
 class RosterRow;
 class SpectrumTimer;
+class Translation;
 
 using namespace gloox;
 
@@ -81,7 +82,9 @@ class User : public AbstractUser, public SpectrumRosterManager, public SpectrumM
 		const std::string & jid() { return m_jid; }
 
 		const char *getLang() { return m_lang; }
-		void setLang(const char *lang) { g_free(m_lang); m_lang = g_strdup(lang); }
+		void setLang(const char *lang);
+		// Returns handle of user's language for tr().
+		Translation *getTranslation() { return m_translation; }
 
 		const std::string & userKey() { return m_userKey; }
 		void setFeatures(int f) { m_features = f; }
@@ -89,6 +92,10 @@ class User : public AbstractUser, public SpectrumRosterManager, public SpectrumM
 		long storageId() { return m_userID; }
 		bool loadingBuddiesFromDB() { return m_loadingBuddiesFromDB; }
 
+		// Adds approximate memory used by this user to `usage` (indexed by
+		// MemorySubsystem). Filetransfers are added by MemoryAccounting::collect().
+		void getMemoryUsage(unsigned long *usage);
+
 	private:
 		std::string m_jid;			// Jabber ID of this user
 		long m_userID;				// userID for Database
@@ -102,6 +109,7 @@ class User : public AbstractUser, public SpectrumRosterManager, public SpectrumM
 		std::string m_username;		// legacy network user name
 		std::string m_encoding;
 		char *m_lang;			// xml:lang
+		Translation *m_translation;	// translations for m_lang
 		int m_features;
 		bool m_loadingBuddiesFromDB;
 		std::string m_photoHash;
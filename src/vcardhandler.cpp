@@ -25,6 +25,8 @@
 #include "gloox/vcard.h"
 #include "protocols/abstractprotocol.h"
 #include "transport.h"
+#include "memoryaccounting.h"
+#include "textsanitizer.h"
 
 static void base64encode(const unsigned char * input, int len, std::string & out)
 {
@@ -143,6 +145,17 @@ bool GlooxVCardHandler::hasVCardRequest(const std::string &name){
 	return false;
 }
 
+// Replaces characters illegal in XML in all fields of vCard built from user
+// info received from legacy network.
+static void sanitizeVCard(Tag *tag) {
+	std::string cdata = tag->cdata();
+	if (sanitizeXMLText(cdata))
+		tag->setCData(cdata);
+	const TagList &children = tag->children();
+	for (TagList::const_iterator it = children.begin(); it != children.end(); it++)
+		sanitizeVCard(*it);
+}
+
 void GlooxVCardHandler::userInfoArrived(PurpleConnection *gc, const std::string &who, PurpleNotifyUserInfo *user_info){
 	GList *vcardEntries = purple_notify_user_info_get_entries(user_info);
 	User *user = (User *) p->userManager()->getUserByAccount(purple_connection_get_account(gc));
@@ -166,8 +179,9 @@ void GlooxVCardHandler::userInfoArrived(PurpleConnection *gc, const std::string
 			vcard = new Tag( "vCard" );
 			vcard->addAttribute( "xmlns", "vcard-temp" );
 		}
+		sanitizeVCard(vcard);
 
-		if (user->getSetting<bool>("enable_avatars"))
+		if (user->getSetting<bool>(SETTING_ENABLE_AVATARS))
 			Log("VCard", "AVATARS ENABLED IN USER SETTINGS");
 		
 		if (user->hasTransportFeature(TRANSPORT_FEATURE_AVATARS))
@@ -185,7 +199,7 @@ void GlooxVCardHandler::userInfoArrived(PurpleConnection *gc, const std::string
 			reply->addAttribute( "from", JID::escapeNode(who) + "@" + p->jid() );
 		}
 
-		if (user->getSetting<bool>("enable_avatars") && user->hasTransportFeature(TRANSPORT_FEATURE_AVATARS)) {
+		if (user->getSetting<bool>(SETTING_ENABLE_AVATARS) && user->hasTransportFeature(TRANSPORT_FEATURE_AVATARS)) {
 			Tag *photo = new Tag("PHOTO");
 
 			Log("VCard", "Trying to find out " << name);
@@ -241,3 +255,13 @@ void GlooxVCardHandler::userInfoArrived(PurpleConnection *gc, const std::string
 
 void GlooxVCardHandler::handleIqID (const IQ &iq, int context){
 }
+
+unsigned long GlooxVCardHandler::getMemoryUsage() {
+	unsigned long size = 0;
+	for (std::map<std::string,std::list<std::string> >::iterator it = vcardRequests.begin(); it != vcardRequests.end(); it++) {
+		size += MEMORY_MAP_NODE + MemoryAccounting::stringSize((*it).first) + sizeof(std::list<std::string>);
+		for (std::list<std::string>::iterator l = (*it).second.begin(); l != (*it).second.end(); l++)
+			size += MEMORY_LIST_NODE + MemoryAccounting::stringSize(*l);
+	}
+	return size;
+}
@@ -72,6 +72,8 @@ public:
 	void handleIqID (const IQ &iq, int context);
 	bool hasVCardRequest (const std::string &name);
 	void userInfoArrived(PurpleConnection *gc, const std::string &who, PurpleNotifyUserInfo *user_info);
+	// Returns approximate memory used by pending vCard requests.
+	unsigned long getMemoryUsage();
 	GlooxMessageHandler *p;
 	std::map<std::string,std::list<std::string> > vcardRequests;
 };
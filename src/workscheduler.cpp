@@ -0,0 +1,175 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "workscheduler.h"
+#include "spectrumtimer.h"
+#include "log.h"
+#include "glib.h"
+
+static gboolean processJobs(void *data) {
+	WorkScheduler *scheduler = (WorkScheduler *) data;
+	return scheduler->process();
+}
+
+WorkScheduler::WorkScheduler(int budget) : m_running(NULL), m_count(0), m_budget(budget), m_overruns(0) {
+	if (m_budget <= 0)
+		m_budget = 1;
+	m_timer = new SpectrumTimer(0, &processJobs, this);
+}
+
+WorkScheduler::~WorkScheduler() {
+	delete m_timer;
+	for (std::map <std::string, std::list <Job *> >::iterator it = m_jobs.begin(); it != m_jobs.end(); it++) {
+		for (std::list <Job *>::iterator j = it->second.begin(); j != it->second.end(); j++)
+			delete *j;
+	}
+}
+
+long long WorkScheduler::now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool WorkScheduler::hasJob(const std::string &name, void *data) {
+	for (std::map <std::string, std::list <Job *> >::iterator it = m_jobs.begin(); it != m_jobs.end(); it++) {
+		for (std::list <Job *>::iterator j = it->second.begin(); j != it->second.end(); j++) {
+			if ((*j)->data == data && (*j)->name == name && !(*j)->removed)
+				return true;
+		}
+	}
+	return false;
+}
+
+bool WorkScheduler::addJob(const std::string &user, const std::string &name, WorkSchedulerStep step, void *data) {
+	std::list <Job *> &jobs = m_jobs[user];
+	for (std::list <Job *>::iterator j = jobs.begin(); j != jobs.end(); j++) {
+		if ((*j)->data == data && (*j)->name == name && !(*j)->removed)
+			return false;
+	}
+
+	Job *job = new Job;
+	job->name = name;
+	job->step = step;
+	job->data = data;
+	job->removed = false;
+	if (jobs.empty())
+		m_order.push_back(user);
+	jobs.push_back(job);
+	m_count++;
+	m_timer->start();
+	return true;
+}
+
+void WorkScheduler::removeJobs(void *data) {
+	for (std::map <std::string, std::list <Job *> >::iterator it = m_jobs.begin(); it != m_jobs.end(); ) {
+		std::list <Job *> &jobs = it->second;
+		for (std::list <Job *>::iterator j = jobs.begin(); j != jobs.end(); ) {
+			if ((*j)->data != data) {
+				j++;
+			}
+			else if (*j == m_running) {
+				// Removed by process() when the step returns.
+				(*j)->removed = true;
+				j++;
+			}
+			else {
+				delete *j;
+				jobs.erase(j++);
+				m_count--;
+			}
+		}
+
+		if (jobs.empty()) {
+			m_order.remove(it->first);
+			m_jobs.erase(it++);
+		}
+		else
+			it++;
+	}
+}
+
+bool WorkScheduler::process() {
+	long long start = now();
+	long long deadline = start + (long long) m_budget * 1000;
+
+	while (!m_order.empty()) {
+		std::string user = m_order.front();
+		m_order.pop_front();
+
+		std::map <std::string, std::list <Job *> >::iterator it = m_jobs.find(user);
+		Job *job = it->second.front();
+
+		long long t = now();
+		m_running = job;
+		bool again = job->step(job->data);
+		m_running = NULL;
+		long step = (long) (now() - t);
+
+		JobStats &s = m_stats[job->name];
+		s.steps++;
+		s.time += step;
+		if (step > s.maxStep)
+			s.maxStep = step;
+
+		// Step could add or remove jobs, so find them again.
+		it = m_jobs.find(user);
+		if (!again || job->removed) {
+			if (!again)
+				s.jobs++;
+			it->second.remove(job);
+			delete job;
+			m_count--;
+		}
+
+		if (it->second.empty())
+			m_jobs.erase(it);
+		else
+			m_order.push_back(user);
+
+		if (now() >= deadline)
+			break;
+	}
+
+	if (now() - start > (long long) m_budget * 1000) {
+		m_overruns++;
+		Log("WorkScheduler", "jobs took " << (now() - start) / 1000 << " ms in one iteration");
+	}
+
+	return !m_order.empty();
+}
+
+void WorkScheduler::getStats(std::map <std::string, BackendStat> &stats) {
+	stats["jobs/pending"].units = "jobs";
+	stats["jobs/pending"].value = m_count;
+	stats["jobs/overruns"].units = "iterations";
+	stats["jobs/overruns"].value = m_overruns;
+	for (std::map <std::string, JobStats>::iterator it = m_stats.begin(); it != m_stats.end(); it++) {
+		std::string prefix = "jobs/" + it->first;
+		stats[prefix + "/finished"].units = "jobs";
+		stats[prefix + "/finished"].value = it->second.jobs;
+		stats[prefix + "/steps"].units = "steps";
+		stats[prefix + "/steps"].value = it->second.steps;
+		stats[prefix + "/time"].units = "ms";
+		stats[prefix + "/time"].value = (long) (it->second.time / 1000);
+		stats[prefix + "/max-step"].units = "ms";
+		stats[prefix + "/max-step"].value = it->second.maxStep / 1000;
+	}
+}
@@ -0,0 +1,94 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef SPECTRUM_WORK_SCHEDULER_H
+#define SPECTRUM_WORK_SCHEDULER_H
+
+#include <string>
+#include <map>
+#include <list>
+#include "abstractbackend.h"
+
+class SpectrumTimer;
+
+// Does one step of the job. Returns true if the job has more work to do.
+typedef bool (*WorkSchedulerStep)(void *data);
+
+// Runs long per-user jobs (storing or merging big rosters and so on) in small
+// steps, so one user with huge roster doesn't block the main loop for others.
+//
+// In every main loop iteration, steps of jobs are run for `budget` ms at most.
+// Users are served round-robin; jobs of one user are run in the order they
+// were added, so job can rely on data prepared by previous job of that user.
+class WorkScheduler {
+	public:
+		// `budget` - time in ms used for jobs in one main loop iteration.
+		WorkScheduler(int budget = 20);
+		~WorkScheduler();
+
+		// Adds new job. `user` is used for round-robin, `name` for statistics.
+		// `step` is called with `data` until it returns false. If the job with the
+		// same name and data is already scheduled, nothing happens and false is returned.
+		bool addJob(const std::string &user, const std::string &name, WorkSchedulerStep step, void *data);
+
+		// Returns true if the job with this name and data is scheduled.
+		bool hasJob(const std::string &name, void *data);
+
+		// Removes all jobs with this data. Has to be called when `data` is destroyed.
+		void removeJobs(void *data);
+
+		// Runs steps of scheduled jobs for `budget` ms. Returns true if there are
+		// still some jobs. Called by timer.
+		bool process();
+
+		// Returns number of scheduled jobs.
+		unsigned long size() { return m_count; }
+
+		// Returns statistics for http://jabber.org/protocol/stats.
+		void getStats(std::map <std::string, BackendStat> &stats);
+
+	private:
+		struct Job {
+			std::string name;
+			WorkSchedulerStep step;
+			void *data;
+			bool removed;
+		};
+
+		struct JobStats {
+			long jobs;			// finished jobs
+			long steps;
+			long long time;		// in microseconds
+			long maxStep;		// in microseconds
+		};
+
+		long long now();
+
+		std::map <std::string, std::list <Job *> > m_jobs;	// user -> jobs
+		std::list <std::string> m_order;					// users with jobs, round-robin
+		std::map <std::string, JobStats> m_stats;			// job name -> statistics
+		Job *m_running;
+		unsigned long m_count;
+		int m_budget;
+		long m_overruns;				// iterations which took longer than budget
+		SpectrumTimer *m_timer;
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+// Compares libpurple eventloop backends from geventloop.cpp. Registers
+// `fds` idle sockets and measures how long it takes to register them and
+// how long one loop iteration takes while only one socket is active.
+//
+// Usage: eventloopbench [fds] [iterations]
+
+#include "geventloop.h"
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+struct BenchData {
+	int fd;
+	int left;
+	GMainLoop *gloop;
+#ifdef WITH_LIBEVENT
+	struct ev_loop *evloop;
+#endif
+};
+
+static long long now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void idleRead(gpointer data, gint fd, PurpleInputCondition cond) {
+	std::cerr << "idle socket " << fd << " became readable\n";
+}
+
+// Reads one byte and writes it back, so every loop iteration wakes up once.
+static void pingPong(gpointer data, gint fd, PurpleInputCondition cond) {
+	BenchData *d = (BenchData *) data;
+	char c;
+	if (read(fd, &c, 1) != 1)
+		return;
+	if (--d->left > 0) {
+		if (write(d->fd, &c, 1) != 1)
+			std::cerr << "write failed\n";
+		return;
+	}
+	if (d->gloop)
+		g_main_loop_quit(d->gloop);
+#ifdef WITH_LIBEVENT
+	else
+		ev_unloop(d->evloop, EVUNLOOP_ALL);
+#endif
+}
+
+static int raiseFdLimit(int fds) {
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return fds;
+	rlim_t needed = (rlim_t) fds * 2 + 64;
+	if (rl.rlim_cur < needed) {
+		rl.rlim_cur = needed < rl.rlim_max ? needed : rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (rl.rlim_cur < needed) {
+		fds = (int) (rl.rlim_cur - 64) / 2;
+		std::cerr << "RLIMIT_NOFILE too low, using " << fds << " idle sockets\n";
+	}
+	return fds;
+}
+
+static void bench(const std::string &name, int fds, int iterations) {
+	PurpleEventLoopUiOps *ops = getEventLoopUiOps(name);
+	BenchData d;
+	d.left = iterations;
+	d.gloop = NULL;
+#ifdef WITH_LIBEVENT
+	d.evloop = NULL;
+	if (name != "glib")
+		d.evloop = ev_default_loop(0);
+	else
+#endif
+	d.gloop = g_main_loop_new(NULL, FALSE);
+
+	std::vector <int> sockets;
+	std::vector <guint> handles;
+	long long start = now();
+	for (int i = 0; i < fds; i++) {
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+			std::cerr << "socketpair failed after " << i << " sockets\n";
+			break;
+		}
+		sockets.push_back(sv[0]);
+		sockets.push_back(sv[1]);
+		handles.push_back(ops->input_add(sv[0], PURPLE_INPUT_READ, idleRead, NULL));
+	}
+	long long added = now() - start;
+
+	int active[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, active);
+	d.fd = active[1];
+	guint activeHandle = ops->input_add(active[0], PURPLE_INPUT_READ, pingPong, &d);
+
+	start = now();
+	if (write(active[1], "x", 1) == 1) {
+		if (d.gloop)
+			g_main_loop_run(d.gloop);
+#ifdef WITH_LIBEVENT
+		else
+			ev_loop(d.evloop, 0);
+#endif
+	}
+	long long run = now() - start;
+
+	start = now();
+	for (std::vector <guint>::iterator it = handles.begin(); it != handles.end(); it++)
+		ops->input_remove(*it);
+	long long removed = now() - start;
+	ops->input_remove(activeHandle);
+
+	for (std::vector <int>::iterator it = sockets.begin(); it != sockets.end(); it++)
+		close(*it);
+	close(active[0]);
+	close(active[1]);
+	if (d.gloop)
+		g_main_loop_unref(d.gloop);
+
+	std::cout << name << ": " << handles.size() << " idle fds"
+			  << ", add " << added / 1000 << " ms"
+			  << ", remove " << removed / 1000 << " ms"
+			  << ", " << (double) run / iterations << " us per iteration\n";
+}
+
+int main(int argc, char **argv) {
+	int fds = argc > 1 ? atoi(argv[1]) : 10000;
+	int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+	if (fds < 0 || iterations <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [fds] [iterations]\n";
+		return 1;
+	}
+
+	g_thread_init(NULL);
+	fds = raiseFdLimit(fds);
+
+	bench("glib", fds, iterations);
+#ifdef WITH_LIBEVENT
+	struct ev_loop *loop = createEventLoop("epoll");
+	setLoop(loop);
+	bench(getEventLoopBackend(loop), fds, iterations);
+#else
+	std::cout << "libev: not compiled in\n";
+#endif
+	return 0;
+}
@@ -20,21 +20,36 @@
 
 #include "main.h"
 #include <iostream>
+#include <algorithm>
+#include <stdio.h>
+
+#define MIGRATE_BATCH_SIZE 1000
 
 SQLClass::SQLClass(const std::string &config) {
 	m_sess = NULL;
 	
 	loadConfigFile(config);
-	
+}
+
+bool SQLClass::connect() {
 	try {
-		MySQL::Connector::registerConnector(); 
-		m_sess = new Session("MySQL", "user=" + m_configuration.sqlUser + ";password=" + m_configuration.sqlPassword + ";host=" + m_configuration.sqlHost + ";db=" + m_configuration.sqlDb + ";auto-reconnect=true");
+		if (m_configuration.sqlType == "sqlite") {
+			SQLite::Connector::registerConnector();
+			m_sess = new Session("SQLite", m_configuration.sqlDb);
+		}
+		else {
+			MySQL::Connector::registerConnector(); 
+			m_sess = new Session("MySQL", "user=" + m_configuration.sqlUser + ";password=" + m_configuration.sqlPassword + ";host=" + m_configuration.sqlHost + ";db=" + m_configuration.sqlDb + ";auto-reconnect=true");
+		}
 	}
 	catch (Poco::Exception e) {
 		std::cout << e.displayText() << "\n";
-		return;
+		return false;
 	}
-	
+	return m_sess != NULL;
+}
+
+void SQLClass::migrate() {
 	if (!m_sess)
 		return;
 	try {
@@ -87,13 +102,13 @@ SQLClass::SQLClass(const std::string &config) {
 		") ENGINE=InnoDB DEFAULT CHARSET=utf8 COLLATE=utf8_bin;", now;
 		
 		std::cout << "Migrating data from `" + m_configuration.sqlPrefix + "users` table to `migrated_" + m_configuration.sqlPrefix + "users` temporary table\n";
-		*m_sess << std::string("INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "users (`id`, `jid`, `uin`, `password`, `language`) SELECT `id`, `jid`, `uin`, `password`, `language` FROM " + m_configuration.sqlPrefix + "users;"), now;
+		copyInBatches("INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "users (`id`, `jid`, `uin`, `password`, `language`) SELECT `id`, `jid`, `uin`, `password`, `language` FROM " + m_configuration.sqlPrefix + "users WHERE", "`id`");
 	
 		std::cout << "Migrating data from `" + m_configuration.sqlPrefix + "rosters` table to `migrated_" + m_configuration.sqlPrefix + "buddies` temporary table\n";
-		*m_sess << "INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "buddies (`id`,  `user_id`,  `uin`,  `subscription`,  `nickname`,  `groups`) SELECT AA.`id`,  AB.`id`,  AA.`uin`,  AA.`subscription`,  AA.`nickname`,  AA.`g` FROM " + m_configuration.sqlPrefix + "rosters AA, " + m_configuration.sqlPrefix + "users AB WHERE AA.`jid`=AB.`jid`", now;
+		copyInBatches("INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "buddies (`id`,  `user_id`,  `uin`,  `subscription`,  `nickname`,  `groups`) SELECT AA.`id`,  AB.`id`,  AA.`uin`,  AA.`subscription`,  AA.`nickname`,  AA.`g` FROM " + m_configuration.sqlPrefix + "rosters AA, " + m_configuration.sqlPrefix + "users AB WHERE AA.`jid`=AB.`jid` AND", "AB.`id`");
 
 		std::cout << "Migrating data from `" + m_configuration.sqlPrefix + "settings` table to `migrated_users_settings` temporary table\n";
-		*m_sess << "INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "users_settings (`user_id`,  `var`,  `type`,  `value`) SELECT AB.`id`,  AA.`var`,  AA.`type`,  AA.`value` FROM " + m_configuration.sqlPrefix + "settings AA, " + m_configuration.sqlPrefix + "users AB WHERE AA.`jid`=AB.`jid`", now;
+		copyInBatches("INSERT IGNORE INTO migrated_" + m_configuration.sqlPrefix + "users_settings (`user_id`,  `var`,  `type`,  `value`) SELECT AB.`id`,  AA.`var`,  AA.`type`,  AA.`value` FROM " + m_configuration.sqlPrefix + "settings AA, " + m_configuration.sqlPrefix + "users AB WHERE AA.`jid`=AB.`jid` AND", "AB.`id`");
 		std::cout << "All data are now migrated in `migrated_" + m_configuration.sqlPrefix + "users`, `migrated_" + m_configuration.sqlPrefix + "buddies` and `migrated_" + m_configuration.sqlPrefix + "users_settings` tables.\n";
 		std::cout << "PLEASE verify if data are migrated sucessfully by changing prefix in your config file to \"migrated_" <<  m_configuration.sqlPrefix  <<"\" and run new version of transport.\n";
 		std::cout << "You can of course drop tables from previous version, but be sure data are migrated sucessfully!\n";
@@ -106,6 +121,236 @@ SQLClass::SQLClass(const std::string &config) {
 }
 
 
+void SQLClass::copyInBatches(const std::string &statement, const std::string &idColumn) {
+	Poco::UInt64 maxId = 0;
+	*m_sess << "SELECT CAST(COALESCE(MAX(`id`), 0) AS UNSIGNED) FROM " + m_configuration.sqlPrefix + "users", into(maxId), now;
+
+	// Copy data of MIGRATE_BATCH_SIZE users at once, so tables are not locked
+	// for whole migration.
+	for (Poco::UInt64 from = 0; from < maxId; from += MIGRATE_BATCH_SIZE) {
+		Poco::Int32 first = from;
+		Poco::Int32 last = from + MIGRATE_BATCH_SIZE;
+		*m_sess << statement + " " + idColumn + " > ? AND " + idColumn + " <= ?", use(first), use(last), now;
+		std::cout << "  users " << first + 1 << " - " << std::min((Poco::UInt64) last, maxId) << " of " << maxId << "\n";
+	}
+}
+
+void SQLClass::loadRoster(KVUserRecord &record) {
+	Poco::Int32 userId = record.id;
+	std::vector <Poco::Int32> ids;
+	std::vector <std::string> uins;
+	std::vector <std::string> subscriptions;
+	std::vector <std::string> nicknames;
+	std::vector <std::string> groups;
+	std::vector <Poco::Int32> flags;
+	*m_sess << "SELECT id, uin, subscription, nickname, groups, flags FROM " + m_configuration.sqlPrefix + "buddies WHERE user_id=?",
+		use(userId), into(ids), into(uins), into(subscriptions), into(nicknames), into(groups), into(flags), now;
+
+	std::map <long, KVBuddy *> buddies;
+	for (unsigned int i = 0; i < ids.size(); i++) {
+		KVBuddy &buddy = record.buddies[uins[i]];
+		buddy.id = ids[i];
+		buddy.uin = uins[i];
+		buddy.subscription = subscriptions[i];
+		buddy.nickname = nicknames[i];
+		buddy.group = groups[i];
+		buddy.flags = flags[i];
+		buddies[buddy.id] = &buddy;
+	}
+
+	std::vector <Poco::Int32> buddyIds;
+	std::vector <Poco::Int32> types;
+	std::vector <std::string> vars;
+	std::vector <std::string> values;
+	*m_sess << "SELECT buddy_id, type, var, value FROM " + m_configuration.sqlPrefix + "buddies_settings WHERE user_id=?",
+		use(userId), into(buddyIds), into(types), into(vars), into(values), now;
+	for (unsigned int i = 0; i < buddyIds.size(); i++) {
+		if (buddies.find(buddyIds[i]) == buddies.end())
+			continue;
+		KVSetting &setting = buddies[buddyIds[i]]->settings[vars[i]];
+		setting.type = types[i];
+		setting.value = values[i];
+	}
+
+	types.clear();
+	vars.clear();
+	values.clear();
+	*m_sess << "SELECT type, var, value FROM " + m_configuration.sqlPrefix + "users_settings WHERE user_id=?",
+		use(userId), into(types), into(vars), into(values), now;
+	for (unsigned int i = 0; i < vars.size(); i++) {
+		KVSetting &setting = record.settings[vars[i]];
+		setting.type = types[i];
+		setting.value = values[i];
+	}
+
+	std::vector <std::string> serverJids;
+	std::vector <std::string> servers;
+	*m_sess << "SELECT jid, server FROM " + m_configuration.sqlPrefix + "users_servers WHERE user_id=?",
+		use(userId), into(serverJids), into(servers), now;
+	if (!serverJids.empty()) {
+		record.serverJid = serverJids[0];
+		record.server = servers[0];
+	}
+}
+
+bool SQLClass::exportKV(const std::string &file) {
+	KVStore store(file, false);
+	if (!store.open()) {
+		std::cout << store.getLastError() << "\n";
+		return false;
+	}
+	if (store.size() != 0) {
+		std::cout << file << " is not empty, remove it first.\n";
+		return false;
+	}
+
+	try {
+		Poco::UInt64 usersCount = 0;
+		*m_sess << "SELECT CAST(COUNT(*) AS UNSIGNED) FROM " + m_configuration.sqlPrefix + "users", into(usersCount), now;
+		std::cout << "Exporting " << usersCount << " users to " << file << "\n";
+
+		long nextUserId = 1;
+		long nextBuddyId = 1;
+		long buddiesCount = 0;
+		unsigned long exported = 0;
+		Poco::Int32 lastId = 0;
+		Poco::Int32 limit = MIGRATE_BATCH_SIZE;
+		// Users are read and written in batches of MIGRATE_BATCH_SIZE users,
+		// so we don't keep everything in memory.
+		while (true) {
+			std::vector <Poco::Int32> ids;
+			std::vector <std::string> jids;
+			std::vector <std::string> uins;
+			std::vector <std::string> passwords;
+			std::vector <std::string> languages;
+			std::vector <std::string> encodings;
+			std::vector <bool> vips;
+			*m_sess << "SELECT id, jid, uin, password, language, encoding, vip FROM " + m_configuration.sqlPrefix + "users WHERE id > ? ORDER BY id LIMIT ?",
+				use(lastId), use(limit), into(ids), into(jids), into(uins), into(passwords), into(languages), into(encodings), into(vips), now;
+			if (ids.empty())
+				break;
+
+			store.beginBatch();
+			for (unsigned int i = 0; i < ids.size(); i++) {
+				KVUserRecord record;
+				record.id = ids[i];
+				record.jid = jids[i];
+				record.uin = uins[i];
+				record.password = passwords[i];
+				record.language = languages[i];
+				record.encoding = encodings[i];
+				record.vip = vips[i];
+				loadRoster(record);
+
+				for (std::map <std::string, KVBuddy>::iterator it = record.buddies.begin(); it != record.buddies.end(); it++)
+					nextBuddyId = std::max(nextBuddyId, it->second.id + 1);
+				nextUserId = std::max(nextUserId, record.id + 1);
+				buddiesCount += record.buddies.size();
+
+				char id[32];
+				snprintf(id, sizeof(id), "%ld", record.id);
+				store.put(KV_USER_PREFIX + record.jid, record.serialize());
+				store.put(KV_ID_PREFIX + std::string(id), record.jid);
+			}
+			if (!store.commitBatch()) {
+				std::cout << store.getLastError() << "\n";
+				return false;
+			}
+			exported += ids.size();
+			lastId = ids.back();
+			std::cout << exported << " users exported\n";
+		}
+
+		store.beginBatch();
+		char value[32];
+		snprintf(value, sizeof(value), "%ld", nextUserId);
+		store.put(KV_NEXT_USER_ID, value);
+		snprintf(value, sizeof(value), "%ld", nextBuddyId);
+		store.put(KV_NEXT_BUDDY_ID, value);
+		snprintf(value, sizeof(value), "%ld", buddiesCount);
+		store.put(KV_BUDDIES_COUNT, value);
+		if (!store.commitBatch()) {
+			std::cout << store.getLastError() << "\n";
+			return false;
+		}
+		std::cout << "Exported " << exported << " users and " << buddiesCount << " buddies.\n";
+	}
+	catch (Poco::Exception e) {
+		std::cout << "\n" << e.displayText() << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool SQLClass::importKV(const std::string &file) {
+	KVStore store(file, false);
+	if (!store.open()) {
+		std::cout << store.getLastError() << "\n";
+		return false;
+	}
+
+	std::vector <std::string> keys = store.keys(KV_USER_PREFIX);
+	std::cout << "Importing " << keys.size() << " users from " << file << "\n";
+	long buddiesCount = 0;
+	try {
+		m_sess->begin();
+		for (unsigned int i = 0; i < keys.size(); i++) {
+			std::string data;
+			KVUserRecord record;
+			if (!store.get(keys[i], data) || !record.parse(data)) {
+				std::cout << "Skipping broken record " << keys[i] << "\n";
+				continue;
+			}
+
+			Poco::Int32 userId = record.id;
+			bool vip = record.vip;
+			*m_sess << "INSERT INTO " + m_configuration.sqlPrefix + "users (id, jid, uin, password, language, encoding, vip) VALUES (?, ?, ?, ?, ?, ?, ?)",
+				use(userId), use(record.jid), use(record.uin), use(record.password), use(record.language), use(record.encoding), use(vip), now;
+
+			if (!record.serverJid.empty()) {
+				*m_sess << "INSERT INTO " + m_configuration.sqlPrefix + "users_servers (user_id, jid, server) VALUES (?, ?, ?)",
+					use(userId), use(record.serverJid), use(record.server), now;
+			}
+
+			for (std::map <std::string, KVSetting>::iterator it = record.settings.begin(); it != record.settings.end(); it++) {
+				std::string var = it->first;
+				Poco::Int32 type = it->second.type;
+				*m_sess << "INSERT INTO " + m_configuration.sqlPrefix + "users_settings (user_id, var, type, value) VALUES (?, ?, ?, ?)",
+					use(userId), use(var), use(type), use(it->second.value), now;
+			}
+
+			for (std::map <std::string, KVBuddy>::iterator it = record.buddies.begin(); it != record.buddies.end(); it++) {
+				KVBuddy &buddy = it->second;
+				Poco::Int32 buddyId = buddy.id;
+				Poco::Int32 flags = buddy.flags;
+				*m_sess << "INSERT INTO " + m_configuration.sqlPrefix + "buddies (id, user_id, uin, subscription, nickname, groups, flags) VALUES (?, ?, ?, ?, ?, ?, ?)",
+					use(buddyId), use(userId), use(buddy.uin), use(buddy.subscription), use(buddy.nickname), use(buddy.group), use(flags), now;
+
+				for (std::map <std::string, KVSetting>::iterator s = buddy.settings.begin(); s != buddy.settings.end(); s++) {
+					std::string var = s->first;
+					Poco::Int32 type = s->second.type;
+					*m_sess << "INSERT INTO " + m_configuration.sqlPrefix + "buddies_settings (user_id, buddy_id, var, type, value) VALUES (?, ?, ?, ?, ?)",
+						use(userId), use(buddyId), use(var), use(type), use(s->second.value), now;
+				}
+				buddiesCount++;
+			}
+
+			if (i % 1000 == 999) {
+				m_sess->commit();
+				std::cout << i + 1 << " users imported\n";
+				m_sess->begin();
+			}
+		}
+		m_sess->commit();
+	}
+	catch (Poco::Exception e) {
+		std::cout << "\n" << e.displayText() << "\n";
+		return false;
+	}
+	std::cout << "Imported " << keys.size() << " users and " << buddiesCount << " buddies.\n";
+	return true;
+}
+
 bool SQLClass::loadConfigFile(const std::string &config) {
 	GKeyFile *keyfile;
 	int flags;
@@ -128,53 +373,53 @@ bool SQLClass::loadConfigFile(const std::string &config) {
 	}
 
 	value = g_key_file_get_string(keyfile, "service","protocol", NULL);
-	m_configuration.protocol = std::string(value);
+	m_configuration.protocol = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "service","name", NULL);
-	m_configuration.discoName = std::string(value);
+	m_configuration.discoName = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "service","server", NULL);
-	m_configuration.server = std::string(value);
+	m_configuration.server = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "service","password", NULL);
-	m_configuration.password = std::string(value);
+	m_configuration.password = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "service","jid", NULL);
-	m_configuration.jid = std::string(value);
+	m_configuration.jid = value ? std::string(value) : "";
 	g_free(value);
 	
 	m_configuration.port = (int)g_key_file_get_integer(keyfile, "service","port", NULL);
 	
 	value = g_key_file_get_string(keyfile, "service","filetransfer_cache", NULL);
-	m_configuration.filetransferCache = std::string(value);
+	m_configuration.filetransferCache = value ? std::string(value) : "";
 	g_free(value);
 
 	value = g_key_file_get_string(keyfile, "database","type", NULL);
-	m_configuration.sqlType = std::string(value);
+	m_configuration.sqlType = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "database","host", NULL);
-	m_configuration.sqlHost = std::string(value);
+	m_configuration.sqlHost = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "database","password", NULL);
-	m_configuration.sqlPassword = std::string(value);
+	m_configuration.sqlPassword = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "database","user", NULL);
-	m_configuration.sqlUser = std::string(value);
+	m_configuration.sqlUser = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "database","database", NULL);
-	m_configuration.sqlDb = std::string(value);
+	m_configuration.sqlDb = value ? std::string(value) : "";
 	g_free(value);
 	
 	value = g_key_file_get_string(keyfile, "database","prefix", NULL);
-	m_configuration.sqlPrefix = std::string(value);
+	m_configuration.sqlPrefix = value ? std::string(value) : "";
 	g_free(value);
 
 	g_key_file_free(keyfile);
@@ -182,12 +427,26 @@ bool SQLClass::loadConfigFile(const std::string &config) {
 }
 
 int main( int argc, char* argv[] ) {
-	if (argc != 2) {
+	if (argc == 4 && (std::string(argv[2]) == "--export-kv" || std::string(argv[2]) == "--import-kv")) {
+		SQLClass sql(argv[1]);
+		if (!sql.connect())
+			return 1;
+		if (std::string(argv[2]) == "--export-kv")
+			return sql.exportKV(argv[3]) ? 0 : 1;
+		return sql.importKV(argv[3]) ? 0 : 1;
+	}
+	else if (argc != 2) {
 		std::cout << "Converts mysql database from old pre-release model to new model.\n";
 		std::cout << "Usage: migratedb spectrum_config_file.cfg.\n";
+		std::cout << "\n";
+		std::cout << "Copies data between SQL database and key-value storage (type=kv).\n";
+		std::cout << "Usage: migratedb spectrum_config_file.cfg --export-kv store_file.\n";
+		std::cout << "       migratedb spectrum_config_file.cfg --import-kv store_file.\n";
 	}
 	else {
 		std::string config(argv[1]);
 		SQLClass MigrateClass(config);
+		if (MigrateClass.connect())
+			MigrateClass.migrate();
 	}
-}
\ No newline at end of file
+}
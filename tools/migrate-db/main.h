@@ -24,6 +24,7 @@
 #include "Poco/Data/SQLite/Connector.h" 
 #include "Poco/Data/MySQL/Connector.h"
 #include "glib.h"
+#include "kvstore.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -67,9 +68,30 @@ class SQLClass {
 	public:
 		SQLClass(const std::string &config);
 		~SQLClass() { delete m_sess; }
+
+		// Connects to database configured in config file.
+		bool connect();
+
+		// Converts mysql database from old pre-release model to new model.
+		void migrate();
+
+		// Copies all users with their rosters and settings from SQL database
+		// to key-value store used by "type=kv" storage backend.
+		bool exportKV(const std::string &file);
+
+		// Copies all users from key-value store to SQL database. Tables have to
+		// exist and they should be empty.
+		bool importKV(const std::string &file);
 		
 	private:
 		bool loadConfigFile(const std::string &config);
+
+		// Runs INSERT ... SELECT statement for batches of users. Statement has to
+		// end with "WHERE" or "AND", condition for idColumn is appended to it.
+		void copyInBatches(const std::string &statement, const std::string &idColumn);
+		// Loads roster, buddies settings, settings and users_servers row of the
+		// user from SQL database.
+		void loadRoster(KVUserRecord &record);
 		
 		Poco::Data::Session *m_sess;
 		Configuration m_configuration;				// configuration struct
@@ -0,0 +1,108 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+// Measures throughput of findInvalidXMLText and sanitizeXMLText from
+// textsanitizer.cpp on typical legacy texts and compares it with checking
+// them byte after byte.
+//
+// Usage: sanitizerbench [megabytes]
+
+#include "textsanitizer.h"
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static long long now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Validates text one character at a time, as g_utf8_validate does.
+static size_t bytewise(const char *text, size_t len) {
+	const unsigned char *p = (const unsigned char *) text;
+	size_t i = 0;
+	while (i < len) {
+		unsigned char c = p[i];
+		int n = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+		if (c < 0x20 && c != 0x09 && c != 0x0A && c != 0x0D)
+			return i;
+		if (i + n > len)
+			return i;
+		for (int k = 1; k < n; k++) {
+			if ((p[i + k] & 0xC0) != 0x80)
+				return i;
+		}
+		i += n;
+	}
+	return len;
+}
+
+static void run(const std::string &name, const std::string &sample, int megabytes) {
+	// Messages and statuses are short, so the sample is checked many times
+	// instead of once as one big buffer.
+	long iterations = (long) megabytes * 1024 * 1024 / sample.size();
+	size_t sum = 0;
+
+	long long start = now();
+	for (long i = 0; i < iterations; i++)
+		sum += bytewise(sample.data(), sample.size());
+	long long bytewiseTime = now() - start;
+
+	start = now();
+	for (long i = 0; i < iterations; i++)
+		sum += findInvalidXMLText(sample.data(), sample.size());
+	long long findTime = now() - start;
+
+	start = now();
+	for (long i = 0; i < iterations; i++) {
+		std::string copy(sample);
+		sum += sanitizeXMLText(copy);
+	}
+	long long sanitizeTime = now() - start;
+
+	std::cout << name << ": bytewise " << megabytes * 1000000LL / (bytewiseTime + 1) << " MB/s"
+		<< ", findInvalidXMLText " << megabytes * 1000000LL / (findTime + 1) << " MB/s"
+		<< ", sanitizeXMLText (with copy) " << megabytes * 1000000LL / (sanitizeTime + 1) << " MB/s"
+		<< " (" << sum % 10 << ")\n";
+}
+
+int main(int argc, char **argv) {
+	int megabytes = argc > 1 ? atoi(argv[1]) : 256;
+
+	std::string ascii;
+	while (ascii.size() < 200)
+		ascii += "Hi, are you coming to the meeting tomorrow? ";
+	std::string latin;
+	while (latin.size() < 200)
+		latin += "P\xc5\x99\xc3\xad\xc5\xa1t\xc4\x9b p\xc5\x99ijdu pozd\xc4\x9bji, ";
+	std::string cjk;
+	while (cjk.size() < 200)
+		cjk += "\xe4\xbd\xa0\xe5\xa5\xbd\xef\xbc\x8c\xe6\x98\x8e\xe5\xa4\xa9\xe8\xa7\x81 ";
+	std::string control = ascii;
+	control[100] = '\x1b';
+
+	run("ascii", ascii, megabytes);
+	run("latin2", latin, megabytes);
+	run("cjk", cjk, megabytes);
+	run("control", control, megabytes);
+	return 0;
+}
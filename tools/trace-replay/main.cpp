@@ -0,0 +1,488 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+// Stand-in XMPP server for performance regression tests. Accepts component
+// connection from Spectrum and feeds it with stanzas recorded by
+// `spectrum --trace` at recorded or accelerated speed. Spectrum should use
+// protocol=replay with prpl-spectrum-replay (replayprpl.cpp) loaded with
+// the same trace, so the legacy network side is replayed too.
+//
+// Reports throughput of replayed and received stanzas and latency of
+// requests (stanzas with id) answered by Spectrum.
+//
+// Spectrum generates different IQ ids in every run, so replies to requests
+// sent by Spectrum (roster pushes, disco, ...) can't be replayed with recorded
+// ids. Recorded requests are matched with live ones by recipient, type and
+// payload in order of sending and replies are rewritten to live ids. Reply
+// which would be replayed before its request is sent by Spectrum waits for it.
+//
+// Usage: tracereplay trace [port] [speed]
+//   speed - multiplier of recorded timing, 0 means as fast as possible
+
+#include "tracefile.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <set>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Spectrum has finished when it doesn't send anything for this time.
+#define IDLE_TIMEOUT 5000000
+
+struct Stanza {
+	long long time;		// us since the first replayed stanza
+	std::string xml;
+};
+
+static long long now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Returns value of attribute of the top-level element.
+static std::string getAttribute(const std::string &xml, const std::string &name) {
+	size_t end = xml.find('>');
+	for (size_t pos = xml.find(" " + name + "="); pos < end; pos = xml.find(" " + name + "=", pos + 1)) {
+		size_t start = pos + name.size() + 2;
+		char quote = xml[start];
+		if (quote != '\'' && quote != '"')
+			continue;
+		size_t close = xml.find(quote, start + 1);
+		if (close == std::string::npos)
+			break;
+		return xml.substr(start + 1, close - start - 1);
+	}
+	return "";
+}
+
+static std::string getName(const std::string &xml) {
+	size_t end = xml.find_first_of(" />", 1);
+	return xml.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+}
+
+// Replaces value of attribute of the top-level element.
+static std::string setAttribute(const std::string &xml, const std::string &name, const std::string &value) {
+	size_t end = xml.find('>');
+	for (size_t pos = xml.find(" " + name + "="); pos < end; pos = xml.find(" " + name + "=", pos + 1)) {
+		size_t start = pos + name.size() + 2;
+		char quote = xml[start];
+		if (quote != '\'' && quote != '"')
+			continue;
+		size_t close = xml.find(quote, start + 1);
+		if (close == std::string::npos)
+			break;
+		return xml.substr(0, start + 1) + value + xml.substr(close);
+	}
+	return xml;
+}
+
+// Returns true if the stanza is IQ request.
+static bool isRequest(const std::string &xml) {
+	std::string type = getAttribute(xml, "type");
+	return getName(xml) == "iq" && (type == "get" || type == "set");
+}
+
+// Returns true if the stanza is IQ reply.
+static bool isReply(const std::string &xml) {
+	std::string type = getAttribute(xml, "type");
+	return getName(xml) == "iq" && (type == "result" || type == "error");
+}
+
+// Returns key identifying IQ request independently of its id: recipient,
+// type and name and namespace of the payload.
+static std::string requestKey(const std::string &xml) {
+	std::string key = getAttribute(xml, "to") + "|" + getAttribute(xml, "type");
+	size_t end = xml.find('>');
+	if (end == std::string::npos || xml[end - 1] == '/')
+		return key;
+	size_t child = xml.find('<', end);
+	if (child == std::string::npos || xml[child + 1] == '/')
+		return key;
+	std::string payload = xml.substr(child);
+	return key + "|" + getName(payload) + "|" + getAttribute(payload, "xmlns");
+}
+
+// Splits outgoing component stream into top-level stanzas.
+class StreamSplitter {
+	public:
+		StreamSplitter() : m_depth(0), m_state(TEXT), m_quote(0), m_closing(false), m_last(0), m_streamStarted(false), m_streamClosed(false) {}
+
+		// Appends data and moves complete stanzas into `stanzas`.
+		void feed(const char *data, size_t len, std::vector <std::string> &stanzas) {
+			for (size_t i = 0; i < len; i++) {
+				char c = data[i];
+				m_stanza += c;
+				switch (m_state) {
+					case TEXT:
+						if (c == '<') {
+							if (m_depth == 1)
+								m_stanza.assign("<");
+							m_state = TAG_START;
+						}
+						break;
+					case TAG_START:
+						if (c == '?' || c == '!')
+							m_state = SKIP;
+						else {
+							m_closing = (c == '/');
+							m_state = TAG;
+						}
+						break;
+					case SKIP:
+						if (c == '>')
+							m_state = TEXT;
+						break;
+					case TAG:
+						if (m_quote) {
+							if (c == m_quote)
+								m_quote = 0;
+						}
+						else if (c == '\'' || c == '"')
+							m_quote = c;
+						else if (c == '>') {
+							m_state = TEXT;
+							if (m_closing) {
+								m_depth--;
+								if (m_depth == 1)
+									stanzas.push_back(m_stanza);
+								else if (m_depth == 0)
+									m_streamClosed = true;
+							}
+							else if (m_last == '/') {
+								if (m_depth == 1)
+									stanzas.push_back(m_stanza);
+							}
+							else if (++m_depth == 1)
+								m_streamStarted = true;
+							if (m_depth <= 1)
+								m_stanza.clear();
+						}
+						break;
+				}
+				m_last = c;
+			}
+		}
+
+		bool streamStarted() { return m_streamStarted; }
+		bool streamClosed() { return m_streamClosed; }
+
+	private:
+		enum { TEXT, TAG_START, TAG, SKIP };
+		int m_depth;
+		int m_state;
+		char m_quote;
+		bool m_closing;
+		char m_last;
+		bool m_streamStarted;
+		bool m_streamClosed;
+		std::string m_stanza;
+};
+
+class Connection {
+	public:
+		Connection(int fd) : m_fd(fd), m_bytes(0) {
+			fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+		}
+
+		~Connection() { close(m_fd); }
+
+		void send(const std::string &data) { m_out += data; }
+		bool hasOutput() { return !m_out.empty(); }
+		unsigned long long bytes() { return m_bytes; }
+
+		// Waits at most `timeout` us for socket events, writes pending data and
+		// reads complete stanzas. Returns false when connection is closed.
+		bool process(long long timeout, std::vector <std::string> &stanzas) {
+			struct pollfd pfd;
+			pfd.fd = m_fd;
+			pfd.events = POLLIN | (m_out.empty() ? 0 : POLLOUT);
+			int ret = poll(&pfd, 1, timeout < 0 ? 0 : (int) ((timeout + 999) / 1000));
+			if (ret < 0)
+				return errno == EINTR;
+			if (pfd.revents & POLLOUT) {
+				ssize_t written = write(m_fd, m_out.data(), m_out.size());
+				if (written < 0 && errno != EAGAIN)
+					return false;
+				if (written > 0)
+					m_out.erase(0, written);
+			}
+			if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+				char buffer[65536];
+				ssize_t len = read(m_fd, buffer, sizeof(buffer));
+				if (len == 0 || (len < 0 && errno != EAGAIN))
+					return false;
+				if (len > 0) {
+					m_bytes += len;
+					m_splitter.feed(buffer, len, stanzas);
+				}
+			}
+			return !m_splitter.streamClosed();
+		}
+
+		StreamSplitter &splitter() { return m_splitter; }
+
+	private:
+		int m_fd;
+		std::string m_out;
+		unsigned long long m_bytes;
+		StreamSplitter m_splitter;
+};
+
+static long long percentile(std::vector <long long> &values, double p) {
+	if (values.empty())
+		return 0;
+	size_t index = (size_t) (p * (values.size() - 1));
+	return values[index];
+}
+
+static int listenOn(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " trace [port] [speed]\n";
+		return 1;
+	}
+	int port = argc > 2 ? atoi(argv[2]) : 5347;
+	double speed = argc > 3 ? atof(argv[3]) : 1;
+	signal(SIGPIPE, SIG_IGN);
+
+	TraceFileReader reader;
+	if (!reader.open(argv[1])) {
+		std::cerr << argv[1] << " is not Spectrum trace file\n";
+		return 1;
+	}
+
+	// Stream header, handshake and end of stream are generated by this server.
+	std::vector <Stanza> stanzas;
+	unsigned long recordedOut = 0;
+	unsigned long callbacks = 0;
+	long long first = -1;
+	long long recordedEnd = 0;
+	// Ids of recorded requests sent by Spectrum in order of sending by key.
+	std::map <std::string, std::list <std::string> > recordedRequests;
+	std::set <std::string> recordedIds;
+	StreamSplitter recordedSplitter;
+	std::vector <std::string> recordedStanzas;
+	TraceRecord record;
+	while (reader.read(record)) {
+		recordedEnd = record.time;
+		if (record.type == TRACE_STREAM_OUT) {
+			recordedOut++;
+			recordedSplitter.feed(record.data.data(), record.data.size(), recordedStanzas);
+			for (size_t i = 0; i < recordedStanzas.size(); i++) {
+				std::string id = getAttribute(recordedStanzas[i], "id");
+				if (!id.empty() && isRequest(recordedStanzas[i])) {
+					recordedRequests[requestKey(recordedStanzas[i])].push_back(id);
+					recordedIds.insert(id);
+				}
+			}
+			recordedStanzas.clear();
+		}
+		else if (record.type == TRACE_CALLBACK)
+			callbacks++;
+		else if (record.data.compare(0, 14, "<stream:stream") != 0 && record.data.compare(0, 10, "<handshake") != 0
+				 && record.data.compare(0, 16, "</stream:stream>") != 0) {
+			if (first == -1)
+				first = record.time;
+			Stanza stanza;
+			stanza.time = record.time - first;
+			stanza.xml.swap(record.data);
+			stanzas.push_back(stanza);
+		}
+	}
+	std::cout << "Loaded " << stanzas.size() << " incoming stanzas, " << recordedOut << " outgoing writes and "
+			  << callbacks << " callbacks (" << (recordedEnd - (first == -1 ? 0 : first)) / 1000000.0 << " s)\n";
+
+	int server = listenOn(port);
+	if (server < 0) {
+		std::cerr << "Can't listen on port " << port << "\n";
+		return 1;
+	}
+	std::cout << "Waiting for Spectrum on port " << port << "\n";
+	int fd = accept(server, NULL, NULL);
+	close(server);
+	if (fd < 0) {
+		std::cerr << "accept() failed\n";
+		return 1;
+	}
+	Connection conn(fd);
+
+	// Component handshake, password is not checked.
+	std::vector <std::string> received;
+	while (!conn.splitter().streamStarted()) {
+		if (!conn.process(IDLE_TIMEOUT, received))
+			return 1;
+	}
+	conn.send("<?xml version='1.0'?><stream:stream xmlns:stream='http://etherx.jabber.org/streams' xmlns='jabber:component:accept' id='replay'>");
+	bool authenticated = false;
+	while (!authenticated) {
+		if (!conn.process(IDLE_TIMEOUT, received))
+			return 1;
+		for (size_t i = 0; i < received.size(); i++) {
+			if (getName(received[i]) == "handshake")
+				authenticated = true;
+		}
+		received.clear();
+	}
+	conn.send("<handshake/>");
+
+	std::map <std::string, long long> pending;		// id -> time when the request was sent
+	std::map <std::string, std::string> liveIds;		// recorded id -> id of the same request in this run
+	std::list <std::string> waiting;				// replies to requests not sent by Spectrum yet
+	unsigned long rewritten = 0;
+	std::map <std::string, unsigned long> names;		// received stanzas by element name
+	std::vector <long long> latencies;
+	unsigned long receivedCount = 0;
+	unsigned long long startBytes = conn.bytes();
+	long long start = now();
+	long long lastReceived = start;
+	long long lastSent = start;
+	size_t next = 0;
+	bool connected = true;
+
+	while (connected) {
+		long long t = now();
+		while (next < stanzas.size() && (speed <= 0 || stanzas[next].time / speed <= t - start)) {
+			const std::string &xml = stanzas[next].xml;
+			// Only IQ requests are always answered.
+			if (isRequest(xml))
+				pending[getAttribute(xml, "id")] = t;
+			if (isReply(xml) && recordedIds.count(getAttribute(xml, "id"))) {
+				std::map <std::string, std::string>::iterator it = liveIds.find(getAttribute(xml, "id"));
+				if (it == liveIds.end())
+					waiting.push_back(xml);
+				else {
+					conn.send(setAttribute(xml, "id", it->second));
+					rewritten++;
+				}
+			}
+			else
+				conn.send(xml);
+			next++;
+			lastSent = t;
+			// Don't build huge output buffer when replaying as fast as possible.
+			if (speed <= 0 && next % 100 == 0)
+				break;
+		}
+
+		long long timeout;
+		if (next < stanzas.size())
+			timeout = speed > 0 ? (long long) (stanzas[next].time / speed) - (t - start) : 0;
+		else {
+			long long idle = t - std::max(lastReceived, lastSent);
+			if (idle >= IDLE_TIMEOUT && !conn.hasOutput())
+				break;
+			timeout = IDLE_TIMEOUT - idle;
+		}
+
+		connected = conn.process(timeout, received);
+		t = now();
+		for (size_t i = 0; i < received.size(); i++) {
+			receivedCount++;
+			names[getName(received[i])]++;
+			std::string id = getAttribute(received[i], "id");
+			if (!id.empty() && isRequest(received[i])) {
+				std::list <std::string> &ids = recordedRequests[requestKey(received[i])];
+				if (!ids.empty()) {
+					liveIds[ids.front()] = id;
+					ids.pop_front();
+				}
+			}
+			std::map <std::string, long long>::iterator it = pending.find(id);
+			if (!id.empty() && it != pending.end()) {
+				latencies.push_back(t - it->second);
+				pending.erase(it);
+			}
+		}
+		if (!received.empty()) {
+			lastReceived = t;
+			for (std::list <std::string>::iterator it = waiting.begin(); it != waiting.end(); ) {
+				std::map <std::string, std::string>::iterator live = liveIds.find(getAttribute(*it, "id"));
+				if (live == liveIds.end()) {
+					it++;
+					continue;
+				}
+				conn.send(setAttribute(*it, "id", live->second));
+				rewritten++;
+				it = waiting.erase(it);
+			}
+		}
+		received.clear();
+	}
+
+	if (!connected)
+		std::cout << "Spectrum closed the connection\n";
+
+	double duration = (std::max(lastReceived, lastSent) - start) / 1000000.0;
+	if (duration <= 0)
+		duration = 1e-6;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Replayed " << next << " stanzas in " << duration << " s (" << next / duration << " stanzas/s)\n";
+	std::cout << "Received " << receivedCount << " stanzas, " << (conn.bytes() - startBytes) / 1024 << " kB ("
+			  << receivedCount / duration << " stanzas/s)\n";
+	for (std::map <std::string, unsigned long>::iterator it = names.begin(); it != names.end(); it++)
+		std::cout << "  " << it->first << ": " << it->second << "\n";
+	std::cout << "Rewrote ids of " << rewritten << " replies, " << waiting.size() << " replies had no matching request\n";
+
+	std::sort(latencies.begin(), latencies.end());
+	long long sum = 0;
+	for (size_t i = 0; i < latencies.size(); i++)
+		sum += latencies[i];
+	std::cout << std::setprecision(2);
+	std::cout << "Answered " << latencies.size() << " of " << latencies.size() + pending.size() << " requests";
+	if (!latencies.empty()) {
+		std::cout << ", latency avg " << sum / latencies.size() / 1000.0 << " ms"
+				  << ", p50 " << percentile(latencies, 0.5) / 1000.0 << " ms"
+				  << ", p95 " << percentile(latencies, 0.95) / 1000.0 << " ms"
+				  << ", p99 " << percentile(latencies, 0.99) / 1000.0 << " ms"
+				  << ", max " << latencies.back() / 1000.0 << " ms";
+	}
+	std::cout << "\n";
+	return 0;
+}
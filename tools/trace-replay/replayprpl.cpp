@@ -0,0 +1,358 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+// prpl-spectrum-replay: fake libpurple protocol which replays callbacks
+// recorded by `spectrum --trace`. When account logs in, it loads callback
+// records of the account with the same username from the trace and
+// generates the same libpurple events (incoming messages, buddy statuses,
+// typing notifications, MUC events) with recorded timing.
+//
+// Environment:
+//   SPECTRUM_REPLAY_TRACE - path to the trace file
+//   SPECTRUM_REPLAY_SPEED - speed multiplier, 0 means as fast as possible
+//                           (default 1)
+//
+// Install libreplayprpl.so into "plugins" directory in Spectrum's userDir and
+// use protocol=replay in Spectrum config file.
+
+#define PURPLE_PLUGINS
+
+#include "purple.h"
+#include "tracefile.h"
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+// Number of records delivered in one main loop iteration when replaying as
+// fast as possible, so Spectrum still handles its socket in between.
+#define REPLAY_BATCH 100
+
+struct ReplayEvent {
+	long long time;
+	std::vector <std::string> fields;	// see TraceFileWriter::writeCallback
+};
+
+struct ReplayAccount {
+	PurpleConnection *gc;
+	std::vector <ReplayEvent> events;
+	size_t next;
+	long long start;		// local time when the replay started
+	guint timer;
+	int chatId;
+};
+
+static double replaySpeed = 1;
+
+static long long now() {
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Loads callback records of `username`. Time of events is relative to the
+// first "signed_on" of the account.
+static void loadEvents(ReplayAccount *acc, const std::string &username) {
+	const char *file = g_getenv("SPECTRUM_REPLAY_TRACE");
+	TraceFileReader reader;
+	if (!file || !reader.open(file)) {
+		purple_debug_error("replay", "Can't open trace file %s\n", file ? file : "(SPECTRUM_REPLAY_TRACE not set)");
+		return;
+	}
+
+	long long base = -1;
+	TraceRecord record;
+	while (reader.read(record)) {
+		if (record.type != TRACE_CALLBACK)
+			continue;
+		std::vector <std::string> fields = TraceFileReader::fields(record);
+		if (fields.size() != 6 || fields[1] != username)
+			continue;
+		if (base == -1) {
+			if (fields[0] != "signed_on")
+				continue;
+			base = record.time;
+			continue;
+		}
+		ReplayEvent event;
+		event.time = record.time - base;
+		event.fields.swap(fields);
+		acc->events.push_back(event);
+	}
+	purple_debug_info("replay", "Loaded %d events for %s\n", (int) acc->events.size(), username.c_str());
+}
+
+static PurpleConversation *findChat(PurpleAccount *account, const std::string &name) {
+	PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT, name.c_str(), account);
+	if (conv && purple_conv_chat_has_left(PURPLE_CONV_CHAT(conv)))
+		return NULL;
+	return conv;
+}
+
+static void setBuddyStatus(PurpleAccount *account, const std::string &who, const char *status, const std::string &message) {
+	if (!purple_find_buddy(account, who.c_str()))
+		purple_blist_add_buddy(purple_buddy_new(account, who.c_str(), NULL), NULL, NULL, NULL);
+	if (message.empty())
+		purple_prpl_got_user_status(account, who.c_str(), status, NULL);
+	else
+		purple_prpl_got_user_status(account, who.c_str(), status, "message", message.c_str(), NULL);
+}
+
+static bool isBuddyOnline(PurpleAccount *account, const std::string &who) {
+	PurpleBuddy *buddy = purple_find_buddy(account, who.c_str());
+	return buddy && PURPLE_BUDDY_IS_ONLINE(buddy);
+}
+
+// Generates libpurple event from recorded callback. Returns false if the
+// account was disconnected.
+static bool dispatch(ReplayAccount *acc, const ReplayEvent &event) {
+	PurpleAccount *account = purple_connection_get_account(acc->gc);
+	const std::string &name = event.fields[0];
+	const std::string &conversation = event.fields[2];
+	const std::string &who = event.fields[3];
+	const std::string &text = event.fields[4];
+	const std::string &extra = event.fields[5];
+
+	if (name == "conv_write_im") {
+		int flags = atoi(extra.c_str());
+		// Messages sent by our user are generated by replayed stream.
+		if (flags & PURPLE_MESSAGE_RECV)
+			serv_got_im(acc->gc, who.c_str(), text.c_str(), (PurpleMessageFlags) flags, time(NULL));
+	}
+	else if (name == "conv_write_chat") {
+		int flags = atoi(extra.c_str());
+		PurpleConversation *conv = findChat(account, conversation);
+		if (conv && (flags & PURPLE_MESSAGE_RECV))
+			serv_got_chat_in(acc->gc, purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)), who.c_str(), (PurpleMessageFlags) flags, text.c_str(), time(NULL));
+	}
+	else if (name == "conv_chat_topic_changed") {
+		PurpleConversation *conv = findChat(account, conversation);
+		if (conv)
+			purple_conv_chat_set_topic(PURPLE_CONV_CHAT(conv), who.c_str(), text.c_str());
+	}
+	else if (name == "conv_chat_add_users") {
+		PurpleConversation *conv = findChat(account, conversation);
+		if (conv && !purple_conv_chat_find_user(PURPLE_CONV_CHAT(conv), who.c_str()))
+			purple_conv_chat_add_user(PURPLE_CONV_CHAT(conv), who.c_str(), NULL, (PurpleConvChatBuddyFlags) atoi(extra.c_str()), FALSE);
+	}
+	else if (name == "conv_chat_remove_users") {
+		PurpleConversation *conv = findChat(account, conversation);
+		if (conv && purple_conv_chat_find_user(PURPLE_CONV_CHAT(conv), who.c_str()))
+			purple_conv_chat_remove_user(PURPLE_CONV_CHAT(conv), who.c_str(), NULL);
+	}
+	else if (name == "conv_chat_rename_user") {
+		PurpleConversation *conv = findChat(account, conversation);
+		if (conv && purple_conv_chat_find_user(PURPLE_CONV_CHAT(conv), who.c_str()))
+			purple_conv_chat_rename_user(PURPLE_CONV_CHAT(conv), who.c_str(), text.c_str());
+	}
+	else if (name == "buddyTyping")
+		serv_got_typing(acc->gc, who.c_str(), 0, PURPLE_TYPING);
+	else if (name == "buddyTyped")
+		serv_got_typing(acc->gc, who.c_str(), 0, PURPLE_TYPED);
+	else if (name == "buddyTypingStopped")
+		serv_got_typing_stopped(acc->gc, who.c_str());
+	else if (name == "buddyStatusChanged")
+		setBuddyStatus(account, who, extra.c_str(), text);
+	else if (name == "buddySignedOn") {
+		if (!isBuddyOnline(account, who))
+			setBuddyStatus(account, who, "available", "");
+	}
+	else if (name == "buddySignedOff") {
+		if (isBuddyOnline(account, who))
+			setBuddyStatus(account, who, "offline", "");
+	}
+	else if (name == "buddyRemoved") {
+		PurpleBuddy *buddy = purple_find_buddy(account, who.c_str());
+		if (buddy)
+			purple_blist_remove_buddy(buddy);
+	}
+	else if (name == "connection_report_disconnect") {
+		purple_connection_error_reason(acc->gc, (PurpleConnectionError) atoi(extra.c_str()), text.c_str());
+		return false;
+	}
+	return true;
+}
+
+static gboolean replayNext(gpointer data) {
+	ReplayAccount *acc = (ReplayAccount *) data;
+	acc->timer = 0;
+	long long elapsed = now() - acc->start;
+	int delivered = 0;
+	while (acc->next < acc->events.size()) {
+		const ReplayEvent &event = acc->events[acc->next];
+		long long due = replaySpeed > 0 ? (long long) (event.time / replaySpeed) : 0;
+		if (replaySpeed > 0 && due > elapsed) {
+			acc->timer = purple_timeout_add((due - elapsed) / 1000, replayNext, acc);
+			return FALSE;
+		}
+		if (replaySpeed <= 0 && delivered == REPLAY_BATCH) {
+			acc->timer = purple_timeout_add(0, replayNext, acc);
+			return FALSE;
+		}
+		acc->next++;
+		delivered++;
+		// Connection and `acc` are destroyed by connection error.
+		if (!dispatch(acc, event))
+			return FALSE;
+	}
+	purple_debug_info("replay", "Replay of %s finished\n", purple_account_get_username(purple_connection_get_account(acc->gc)));
+	return FALSE;
+}
+
+static const char *replay_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
+	return "replay";
+}
+
+static GList *replay_status_types(PurpleAccount *account) {
+	// Recorded statuses are stored as primitive IDs, so there is one status
+	// type per primitive.
+	const PurpleStatusPrimitive primitives[] = { PURPLE_STATUS_AVAILABLE, PURPLE_STATUS_AWAY,
+		PURPLE_STATUS_UNAVAILABLE, PURPLE_STATUS_EXTENDED_AWAY, PURPLE_STATUS_INVISIBLE,
+		PURPLE_STATUS_MOBILE, PURPLE_STATUS_TUNE };
+	GList *types = NULL;
+	for (unsigned int i = 0; i < G_N_ELEMENTS(primitives); i++) {
+		types = g_list_append(types, purple_status_type_new_with_attrs(primitives[i], NULL, NULL, TRUE, TRUE, FALSE,
+			"message", "Message", purple_value_new(PURPLE_TYPE_STRING), NULL));
+	}
+	types = g_list_append(types, purple_status_type_new(PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE));
+	return types;
+}
+
+static void replay_login(PurpleAccount *account) {
+	PurpleConnection *gc = purple_account_get_connection(account);
+	ReplayAccount *acc = new ReplayAccount;
+	acc->gc = gc;
+	acc->next = 0;
+	acc->timer = 0;
+	acc->chatId = 0;
+	gc->proto_data = acc;
+
+	loadEvents(acc, purple_account_get_username(account));
+	purple_connection_set_state(gc, PURPLE_CONNECTED);
+
+	acc->start = now();
+	acc->timer = purple_timeout_add(0, replayNext, acc);
+}
+
+static void replay_close(PurpleConnection *gc) {
+	ReplayAccount *acc = (ReplayAccount *) gc->proto_data;
+	if (!acc)
+		return;
+	if (acc->timer)
+		purple_timeout_remove(acc->timer);
+	delete acc;
+	gc->proto_data = NULL;
+}
+
+static int replay_send_im(PurpleConnection *gc, const char *who, const char *message, PurpleMessageFlags flags) {
+	return 1;
+}
+
+static unsigned int replay_send_typing(PurpleConnection *gc, const char *name, PurpleTypingState state) {
+	return 0;
+}
+
+static GList *replay_chat_info(PurpleConnection *gc) {
+	struct proto_chat_entry *pce = g_new0(struct proto_chat_entry, 1);
+	pce->label = "Room:";
+	pce->identifier = "room";
+	pce->required = TRUE;
+	return g_list_append(NULL, pce);
+}
+
+static GHashTable *replay_chat_info_defaults(PurpleConnection *gc, const char *room) {
+	GHashTable *defaults = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+	if (room)
+		g_hash_table_insert(defaults, (gpointer) "room", g_strdup(room));
+	return defaults;
+}
+
+static char *replay_get_chat_name(GHashTable *components) {
+	return g_strdup((const char *) g_hash_table_lookup(components, "room"));
+}
+
+static void replay_join_chat(PurpleConnection *gc, GHashTable *components) {
+	ReplayAccount *acc = (ReplayAccount *) gc->proto_data;
+	const char *room = (const char *) g_hash_table_lookup(components, "room");
+	if (room)
+		serv_got_joined_chat(gc, ++acc->chatId, room);
+}
+
+static void replay_chat_leave(PurpleConnection *gc, int id) {
+}
+
+static int replay_chat_send(PurpleConnection *gc, int id, const char *message, PurpleMessageFlags flags) {
+	PurpleConversation *conv = purple_find_chat(gc, id);
+	if (conv)
+		serv_got_chat_in(gc, id, purple_conv_chat_get_nick(PURPLE_CONV_CHAT(conv)), flags, message, time(NULL));
+	return 0;
+}
+
+static void replay_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group) {
+}
+
+static void replay_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group) {
+}
+
+static void replay_set_status(PurpleAccount *account, PurpleStatus *status) {
+}
+
+static PurplePluginProtocolInfo prpl_info;
+static PurplePluginInfo info;
+
+static void init_plugin(PurplePlugin *plugin) {
+	const char *speed = g_getenv("SPECTRUM_REPLAY_SPEED");
+	if (speed)
+		replaySpeed = g_ascii_strtod(speed, NULL);
+
+	prpl_info.options = OPT_PROTO_CHAT_TOPIC;
+	prpl_info.list_icon = replay_list_icon;
+	prpl_info.status_types = replay_status_types;
+	prpl_info.chat_info = replay_chat_info;
+	prpl_info.chat_info_defaults = replay_chat_info_defaults;
+	prpl_info.login = replay_login;
+	prpl_info.close = replay_close;
+	prpl_info.send_im = replay_send_im;
+	prpl_info.send_typing = replay_send_typing;
+	prpl_info.set_status = replay_set_status;
+	prpl_info.add_buddy = replay_add_buddy;
+	prpl_info.remove_buddy = replay_remove_buddy;
+	prpl_info.join_chat = replay_join_chat;
+	prpl_info.get_chat_name = replay_get_chat_name;
+	prpl_info.chat_leave = replay_chat_leave;
+	prpl_info.chat_send = replay_chat_send;
+	prpl_info.struct_size = sizeof(PurplePluginProtocolInfo);
+
+	info.magic = PURPLE_PLUGIN_MAGIC;
+	info.major_version = PURPLE_MAJOR_VERSION;
+	info.minor_version = PURPLE_MINOR_VERSION;
+	info.type = PURPLE_PLUGIN_PROTOCOL;
+	info.priority = PURPLE_PRIORITY_DEFAULT;
+	info.id = (char *) "prpl-spectrum-replay";
+	info.name = (char *) "Spectrum replay";
+	info.version = (char *) "1.0";
+	info.summary = (char *) "Replays libpurple callbacks recorded by Spectrum";
+	info.description = (char *) "Replays libpurple callbacks recorded by Spectrum";
+	info.homepage = (char *) "http://spectrum.im";
+	info.extra_info = &prpl_info;
+}
+
+extern "C" {
+PURPLE_INIT_PLUGIN(spectrum_replay, init_plugin, info)
+}